@@ -0,0 +1,137 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: admit.c 225 2012-05-31 08:22:47Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Admission control.
+ *
+ * Connections wait in the listen queue while every server is busy. Once all
+ * servers have been busy longer than OverloadShedDelay, queued connections
+ * are old enough that the clients are better off retrying later, so the
+ * daemon starts taking them off the queue and answering 503 with
+ * Retry-After. Like CoDel, the shedding rate grows with the square root of
+ * the number shed while the overload lasts, and it stops as soon as a server
+ * becomes idle.
+ *
+ * The daemon never blocks here. The listening socket is non-blocking, the
+ * response is pre-rendered and sent with MSG_DONTWAIT, and draining the
+ * client is left to the lingering close helper.
+ */
+
+#include "qhttpd.h"
+
+static struct timeval m_tvSaturated;    // time all servers became busy
+static struct timeval m_tvLastShed;     // time the last connection was shed
+static int m_nShedInterval = 0;         // ms to wait before next shedding
+static int m_nShedCount = 0;            // shed count in current overload
+static bool m_bSaturated = false;
+
+static bool _shedConnection(int nBindSockFd);
+static int _isqrt(int n);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Update overload state and shed a queued connection if it's due. Called by
+ * the daemon in every loop.
+ *
+ * @param nBindSockFd   listening socket
+ * @param bSaturated    true if no server is idle and no more can be launched
+ * @return true if a connection was shed, otherwise returns false
+ */
+bool admitControl(int nBindSockFd, bool bSaturated)
+{
+    if (bSaturated == false) {
+        if (m_bSaturated == true && m_nShedCount > 0) {
+            LOG_INFO("Overload is over. %d connections were shed.", m_nShedCount);
+        }
+        m_bSaturated = false;
+        m_nShedCount = 0;
+        return false;
+    }
+
+    struct timeval tvNow;
+    gettimeofday(&tvNow, NULL);
+
+    if (m_bSaturated == false) {
+        m_bSaturated = true;
+        m_tvSaturated = tvNow;
+        m_nShedCount = 0;
+        return false;
+    }
+
+    // queued connections are not old enough yet
+    float nSaturatedMs = getDiffTimeval(&tvNow, &m_tvSaturated) * 1000;
+    if (nSaturatedMs < g_conf.nOverloadShedDelay) return false;
+    if (m_nShedCount > 0 && getDiffTimeval(&tvNow, &m_tvLastShed) * 1000 < m_nShedInterval) return false;
+
+    if (_shedConnection(nBindSockFd) == false) return false;
+    m_nShedCount++;
+    m_tvLastShed = tvNow;
+
+    // control law, shed faster while overload lasts
+    m_nShedInterval = OVERLOAD_SHED_INTERVAL / _isqrt(m_nShedCount);
+
+    if (m_nShedCount == 1) {
+        LOG_WARN("Maximum connection reached for %.0f ms. Shedding connections.", nSaturatedMs);
+    }
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static bool _shedConnection(int nBindSockFd)
+{
+    int nNewSockFd = accept(nBindSockFd, NULL, NULL);
+    if (nNewSockFd < 0) return false;  // nothing queued
+
+    httpCannedSend(nNewSockFd, HTTP_CODE_SERVICE_UNAVAILABLE);
+
+    // let the helper drain request, so the client reads 503 instead of RST
+    shutdown(nNewSockFd, SHUT_WR);
+    lingerHandOver(nNewSockFd);
+    close(nNewSockFd);
+
+    poolCountShedConnection();
+    DEBUG("Connection shed.");
+
+    return true;
+}
+
+static int _isqrt(int n)
+{
+    int nRoot = 1;
+    while ((nRoot + 1) * (nRoot + 1) <= n) nRoot++;
+    return nRoot;
+}
@@ -0,0 +1,292 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: cache.c 222 2012-05-24 11:02:37Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Disk cache for generated contents.
+ *
+ * Entries are plain files in CacheDir named by MD5 hash of the key. They are
+ * written to a temporary file and renamed into place, so readers never see a
+ * partial entry and children need no locking. The daemon trims the directory
+ * down to CacheMaxSize periodically, removing least recently used entries
+ * first. It's done in a short-lived helper process, so scanning a large
+ * directory never holds up child management. A hit touches the entry's
+ * modification time.
+ */
+
+#include "qhttpd.h"
+
+#define CACHE_TMP_PREFIX    ".tmp."
+#define CACHE_TMP_EXPIRE    (60 * 60)   // stale temporary files are removed
+                                        // after this seconds
+
+struct CacheEntry {
+    char    szName[NAME_MAX + 1];
+    off_t   nSize;
+    time_t  nMtime;
+};
+
+static pid_t m_nCleanupPid = 0;
+
+static char *_getEntryPath(char *pszBuf, size_t nBufSize, const char *pszKey);
+static int _cmpEntry(const void *p1, const void *p2);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Prepare cache directory.
+ *
+ * @return true if cache is available, otherwise returns false
+ */
+bool cacheInit(void)
+{
+    if (IS_EMPTY_STRING(g_conf.szCacheDir) == true) return false;
+
+    struct stat dirstat;
+    if (sysStat(g_conf.szCacheDir, &dirstat) == 0 && S_ISDIR(dirstat.st_mode)) return true;
+
+    if (qfile_mkdir(g_conf.szCacheDir, DEF_DIR_MODE, true) == false) {
+        LOG_WARN("Can't create cache directory %s. Cache is disabled.", g_conf.szCacheDir);
+        g_conf.szCacheDir[0] = '\0';
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Open cached entry for reading.
+ *
+ * @param pszKey    cache key
+ * @param pStat     stat of the entry will be stored. can be NULL.
+ * @return file descriptor if found, otherwise returns -1
+ */
+int cacheOpen(const char *pszKey, struct stat *pStat)
+{
+    if (IS_EMPTY_STRING(g_conf.szCacheDir) == true) return -1;
+
+    char szPath[PATH_MAX];
+    _getEntryPath(szPath, sizeof(szPath), pszKey);
+
+    int nFd = sysOpen(szPath, O_RDONLY, 0);
+    if (nFd < 0) return -1;
+
+    if (pStat != NULL && sysFstat(nFd, pStat) < 0) {
+        sysClose(nFd);
+        return -1;
+    }
+
+    // mark as recently used
+    futimens(nFd, NULL);
+
+    return nFd;
+}
+
+/**
+ * Create temporary file for a new entry.
+ *
+ * @param pszTmpPath    temporary file path will be stored
+ * @param nBufSize      size of pszTmpPath buffer
+ * @return file descriptor if successful, otherwise returns -1
+ */
+int cacheCreate(char *pszTmpPath, size_t nBufSize)
+{
+    if (IS_EMPTY_STRING(g_conf.szCacheDir) == true) return -1;
+
+    snprintf(pszTmpPath, nBufSize, "%s/" CACHE_TMP_PREFIX "%d.XXXXXX", g_conf.szCacheDir, getpid());
+    int nFd = mkstemp(pszTmpPath);
+    if (nFd < 0) {
+        LOG_WARN("Can't create temporary cache file in %s. (errno: %d)", g_conf.szCacheDir, errno);
+        return -1;
+    }
+    fchmod(nFd, DEF_FILE_MODE);
+
+    return nFd;
+}
+
+/**
+ * Publish temporary file as an entry.
+ */
+bool cacheCommit(const char *pszKey, const char *pszTmpPath)
+{
+    char szPath[PATH_MAX];
+    _getEntryPath(szPath, sizeof(szPath), pszKey);
+
+    if (sysRename(pszTmpPath, szPath) != 0) {
+        sysUnlink(pszTmpPath);
+        return false;
+    }
+
+    DEBUG("Cache stored. (%s)", pszKey);
+    return true;
+}
+
+/**
+ * Discard temporary file.
+ */
+bool cacheAbort(const char *pszTmpPath)
+{
+    return (sysUnlink(pszTmpPath) == 0) ? true : false;
+}
+
+/**
+ * Launch a helper process which trims the cache directory. Called by the
+ * daemon periodically. Nothing is done while the last helper is running.
+ *
+ * @param nBindSockFd   listening socket, closed in the helper
+ * @param nMaxSize      the maximum size of cache directory in bytes
+ * @return true if launched, otherwise returns false
+ */
+bool cacheCleanupStart(int nBindSockFd, off_t nMaxSize)
+{
+    if (IS_EMPTY_STRING(g_conf.szCacheDir) == true) return false;
+
+    // still running, or reaped already by the daemon
+    if (m_nCleanupPid > 0) {
+        if (waitpid(m_nCleanupPid, NULL, WNOHANG) == 0) return false;
+        m_nCleanupPid = 0;
+    }
+
+    pid_t nPid = fork();
+    if (nPid < 0) {
+        LOG_WARN("Can't launch cache cleanup helper. (errno: %d)", errno);
+        return false;
+    } else if (nPid == 0) {
+        if (nBindSockFd >= 0) close(nBindSockFd);
+        cacheCleanup(nMaxSize);
+        exit(EXIT_SUCCESS);
+    }
+
+    m_nCleanupPid = nPid;
+    return true;
+}
+
+/**
+ * Remove entries until the cache directory fits in the size limit. Called by
+ * the cleanup helper.
+ *
+ * @param nMaxSize  the maximum size of cache directory in bytes
+ * @return the number of entries removed
+ */
+int cacheCleanup(off_t nMaxSize)
+{
+    if (IS_EMPTY_STRING(g_conf.szCacheDir) == true) return 0;
+
+    DIR *pDir = sysOpendir(g_conf.szCacheDir);
+    if (pDir == NULL) return 0;
+
+    int nRemoved = 0;
+    time_t nNow = time(NULL);
+    off_t nTotalSize = 0;
+    struct CacheEntry *pEntries = NULL;
+    size_t nEntries = 0, nAlloced = 0;
+
+    struct dirent *pFile;
+    while ((pFile = sysReaddir(pDir)) != NULL) {
+        if (pFile->d_name[0] == '.' && strncmp(pFile->d_name, CACHE_TMP_PREFIX, CONST_STRLEN(CACHE_TMP_PREFIX))) continue;
+
+        char szPath[sizeof(g_conf.szCacheDir) + 1 + NAME_MAX];
+        snprintf(szPath, sizeof(szPath), "%s/%s", g_conf.szCacheDir, pFile->d_name);
+
+        struct stat filestat;
+        if (sysStat(szPath, &filestat) < 0 || !S_ISREG(filestat.st_mode)) continue;
+
+        // abandoned temporary file
+        if (pFile->d_name[0] == '.') {
+            if (nNow - filestat.st_mtime > CACHE_TMP_EXPIRE && sysUnlink(szPath) == 0) nRemoved++;
+            continue;
+        }
+
+        if (nEntries == nAlloced) {
+            size_t nNewAlloc = (nAlloced == 0) ? 256 : nAlloced * 2;
+            struct CacheEntry *pNew = (struct CacheEntry *)realloc(pEntries, nNewAlloc * sizeof(struct CacheEntry));
+            if (pNew == NULL) break;
+            pEntries = pNew;
+            nAlloced = nNewAlloc;
+        }
+
+        qstrcpy(pEntries[nEntries].szName, sizeof(pEntries[nEntries].szName), pFile->d_name);
+        pEntries[nEntries].nSize = filestat.st_size;
+        pEntries[nEntries].nMtime = filestat.st_mtime;
+        nEntries++;
+        nTotalSize += filestat.st_size;
+    }
+    sysClosedir(pDir);
+
+    // remove least recently used ones
+    if (nTotalSize > nMaxSize && nEntries > 0) {
+        qsort(pEntries, nEntries, sizeof(struct CacheEntry), _cmpEntry);
+
+        size_t i;
+        for (i = 0; i < nEntries && nTotalSize > nMaxSize; i++) {
+            char szPath[sizeof(g_conf.szCacheDir) + 1 + NAME_MAX];
+            snprintf(szPath, sizeof(szPath), "%s/%s", g_conf.szCacheDir, pEntries[i].szName);
+            if (sysUnlink(szPath) == 0) {
+                nTotalSize -= pEntries[i].nSize;
+                nRemoved++;
+            }
+        }
+    }
+
+    if (pEntries != NULL) free(pEntries);
+
+    if (nRemoved > 0) DEBUG("%d cache entries removed.", nRemoved);
+    return nRemoved;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static char *_getEntryPath(char *pszBuf, size_t nBufSize, const char *pszKey)
+{
+    unsigned char szDigest[16];
+    qhashmd5((const void *)pszKey, strlen(pszKey), szDigest);
+
+    char szName[sizeof(szDigest) * 2 + 1];
+    int i;
+    for (i = 0; i < sizeof(szDigest); i++) {
+        snprintf(szName + (i * 2), 3, "%02x", szDigest[i]);
+    }
+
+    snprintf(pszBuf, nBufSize, "%s/%s", g_conf.szCacheDir, szName);
+    return pszBuf;
+}
+
+static int _cmpEntry(const void *p1, const void *p2)
+{
+    const struct CacheEntry *pEntry1 = (const struct CacheEntry *)p1;
+    const struct CacheEntry *pEntry2 = (const struct CacheEntry *)p2;
+
+    if (pEntry1->nMtime < pEntry2->nMtime) return -1;
+    if (pEntry1->nMtime > pEntry2->nMtime) return 1;
+    return 0;
+}
@@ -69,6 +69,14 @@ void childStart(int nSockFd)
     }
 #endif
 
+#ifdef ENABLE_IOURING
+    if (g_conf.bEnableIoUring == true) {
+        if (iouringInit() == false) {
+            LOG_WARN("Can't initialize io_uring. Using default I/O.");
+        }
+    }
+#endif
+
     // init random
     srand((unsigned)(time(NULL) + getpid() + nSockFd));
 
@@ -142,8 +150,12 @@ void childStart(int nSockFd)
 #endif
             // register client information
             if (poolSetConnInfo(nNewSockFd) == true) {
-                // launch main logic
-                httpMain(nNewSockFd);
+                if (limitAdmit(true) == true) {
+                    // launch main logic
+                    httpMain(nNewSockFd);
+                } else {
+                    httpCannedSend(nNewSockFd, HTTP_CODE_TOO_MANY_REQUESTS);
+                }
             }
 #ifdef ENABLE_HOOK
         } else {
@@ -175,6 +187,11 @@ static void childEnd(int nStatus)
     if (g_conf.bEnableLua == true) luaFree();
 #endif
 
+#ifdef ENABLE_IOURING
+    // release io_uring
+    if (iouringIsReady() == true) iouringFree();
+#endif
+
 #ifdef ENABLE_HOOK
     // hook
     if (hookBeforeChildEnd() == false) {
@@ -103,7 +103,17 @@ bool loadConfig(struct ServerConfig *pConf, char *pszFilePath)
     fetch2Int(conflist, pConf->nMaxKeepAliveRequests, "MaxKeepAliveRequests");
 
     fetch2Int(conflist, pConf->nConnectionTimeout, "ConnectionTimeout");
+    fetch2Int(conflist, pConf->nKeepAliveTimeout, "KeepAliveTimeout");
+    fetch2Int(conflist, pConf->nHeaderReadTimeout, "HeaderReadTimeout");
+    fetch2Int(conflist, pConf->nMinBodyRate, "MinBodyRate");
     fetch2Bool(conflist, pConf->bIgnoreOverConnection, "IgnoreOverConnection");
+    fetch2Int(conflist, pConf->nListenBacklog, "ListenBacklog");
+    fetch2Int(conflist, pConf->nOverloadShedDelay, "OverloadShedDelay");
+    fetch2Int(conflist, pConf->nOverloadRetryAfter, "OverloadRetryAfter");
+    fetch2Int(conflist, pConf->nClientPrefixLength, "ClientPrefixLength");
+    fetch2Int(conflist, pConf->nClientMaxConnections, "ClientMaxConnections");
+    fetch2Int(conflist, pConf->nClientRequestRate, "ClientRequestRate");
+    fetch2Int(conflist, pConf->nClientRequestBurst, "ClientRequestBurst");
     fetch2Int(conflist, pConf->nResponseExpires, "ResponseExpires");
 
     fetch2Str(conflist, pConf->szDocumentRoot, "DocumentRoot");
@@ -112,12 +122,48 @@ bool loadConfig(struct ServerConfig *pConf, char *pszFilePath)
 
     fetch2Str(conflist, pConf->szDirectoryIndex, "DirectoryIndex");
 
+    fetch2Bool(conflist, pConf->bEnableAutoindex, "EnableAutoindex");
+    fetch2Int(conflist, pConf->nAutoindexPageSize, "AutoindexPageSize");
+    fetch2Int(conflist, pConf->nAutoindexCacheTime, "AutoindexCacheTime");
+
     fetch2Bool(conflist, pConf->bEnableLua, "EnableLua");
     fetch2Str(conflist, pConf->szLuaScript, "LuaScript");
 
     fetch2Bool(conflist, pConf->bEnableStatus, "EnableStatus");
     fetch2Str(conflist, pConf->szStatusUrl, "StatusUrl");
 
+    fetch2Str(conflist, pConf->szErrorPageDir, "ErrorPageDir");
+
+    fetch2Bool(conflist, pConf->bEnablePrecompressed, "EnablePrecompressed");
+
+    fetch2Bool(conflist, pConf->bEnableCompression, "EnableCompression");
+    fetch2Int(conflist, pConf->nCompressLevel, "CompressLevel");
+    fetch2Int(conflist, pConf->nCompressMinSize, "CompressMinSize");
+    fetch2Str(conflist, pConf->szCompressTypes, "CompressTypes");
+
+    fetch2Str(conflist, pConf->szCacheDir, "CacheDir");
+    fetch2Int(conflist, pConf->nCacheMaxSize, "CacheMaxSize");
+
+    fetch2Int(conflist, pConf->nIoHintMinSize, "IoHintMinSize");
+    fetch2Int(conflist, pConf->nIoDropCacheMinSize, "IoDropCacheMinSize");
+
+    fetch2Int(conflist, pConf->nSendRateLimit, "SendRateLimit");
+    fetch2Str(conflist, pConf->szSendRateLocations, "SendRateLocations");
+    fetch2Int(conflist, pConf->nSendRateFreeSize, "SendRateFreeSize");
+
+    fetch2Bool(conflist, pConf->bAllowPropfindInfinity, "AllowPropfindInfinity");
+    fetch2Int(conflist, pConf->nPropfindMaxEntries, "PropfindMaxEntries");
+    fetch2Int(conflist, pConf->nPropfindCacheTime, "PropfindCacheTime");
+
+    fetch2Int(conflist, pConf->nLockMaxTimeout, "LockMaxTimeout");
+
+    fetch2Bool(conflist, pConf->bPutSync, "PutSync");
+    fetch2Str(conflist, pConf->szContentStore, "ContentStore");
+
+    fetch2Bool(conflist, pConf->bEnableStrongEtag, "EnableStrongEtag");
+
+    fetch2Bool(conflist, pConf->bEnableIoUring, "EnableIoUring");
+
     fetch2Str(conflist, pConf->szErrorLog, "ErrorLog");
     fetch2Str(conflist, pConf->szAccessLog, "AccessLog");
     fetch2Int(conflist, pConf->nLogRotate, "LogRotate");
@@ -142,7 +188,7 @@ bool checkConfig(struct ServerConfig *pConf)
         qstrcpy(pConf->szAllowedMethods, sizeof(pConf->szAllowedMethods),
                 "OPTIONS,HEAD,GET,PUT"
                 ","
-                "PROPFIND,PROPPATCH,MKCOL,MOVE,DELETE,LOCK,UNLOCK");
+                "PROPFIND,PROPPATCH,MKCOL,MOVE,COPY,DELETE,LOCK,UNLOCK");
     }
 
     if (strstr(pConf->szAllowedMethods, "OPTIONS") != NULL) pConf->methods.bOptions = true;
@@ -154,9 +200,16 @@ bool checkConfig(struct ServerConfig *pConf)
     if (strstr(pConf->szAllowedMethods, "PROPPATCH") != NULL) pConf->methods.bProppatch = true;
     if (strstr(pConf->szAllowedMethods, "MKCOL") != NULL) pConf->methods.bMkcol = true;
     if (strstr(pConf->szAllowedMethods, "MOVE") != NULL) pConf->methods.bMove = true;
+    if (strstr(pConf->szAllowedMethods, "COPY") != NULL) pConf->methods.bCopy = true;
     if (strstr(pConf->szAllowedMethods, "DELETE") != NULL) pConf->methods.bDelete = true;
     if (strstr(pConf->szAllowedMethods, "LOCK") != NULL) pConf->methods.bLock = true;
     if (strstr(pConf->szAllowedMethods, "UNLOCK") != NULL) pConf->methods.bUnlock = true;
 
+    // at least one request must pass
+    if (pConf->nClientRequestBurst < 1) pConf->nClientRequestBurst = 1;
+
+    // locks must live at least a second
+    if (pConf->nLockMaxTimeout < 1) pConf->nLockMaxTimeout = 1;
+
     return true;
 }
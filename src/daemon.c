@@ -39,7 +39,6 @@ static void daemonEnd(int nStatus);
 static void daemonSignalInit(void *func);
 static void daemonSignal(int signo);
 static void daemonSignalHandler(void);
-static bool ignoreConnection(int nSockFd, long int nTimeoutMs);
 
 /////////////////////////////////////////////////////////////////////////
 // PUBLIC FUNCTIONS
@@ -91,6 +90,18 @@ void daemonStart(bool nDaemonize)
     }
     LOG_INFO("Child management pool created.");
 
+    // init client limits
+    if (limitInit() == false) {
+        LOG_ERR("Can't initialize client limits.");
+        daemonEnd(EXIT_FAILURE);
+    }
+
+    // init lock table
+    if (lockInit() == false) {
+        LOG_ERR("Can't initialize lock table.");
+        daemonEnd(EXIT_FAILURE);
+    }
+
     // load mime
     if (IS_EMPTY_STRING(g_conf.szMimeFile) == false) {
         if (mimeInit(g_conf.szMimeFile) == true) {
@@ -102,6 +113,28 @@ void daemonStart(bool nDaemonize)
         LOG_INFO("No mimetype configuration file set.");
     }
 
+    // build canned responses
+    if (httpCannedInit(g_conf.szErrorPageDir) == false) {
+        LOG_ERR("Can't build canned responses.");
+        daemonEnd(EXIT_FAILURE);
+    }
+    LOG_INFO("Canned responses built.");
+
+    // prepare cache directory
+    if (cacheInit() == true) {
+        LOG_INFO("Cache directory %s is ready.", g_conf.szCacheDir);
+    }
+
+    // prepare content store
+    if (storeInit() == true) {
+        LOG_INFO("Content store %s is ready.", g_conf.szContentStore);
+    }
+
+    // launch lingering close helper
+    if (lingerStart(-1) == true) {
+        LOG_INFO("Lingering close helper launched.");
+    }
+
     // init socket
     int nSockFd;
     if ((nSockFd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
@@ -142,7 +175,7 @@ void daemonStart(bool nDaemonize)
     LOG_INFO("Binding port %d succeed.", g_conf.nPort);
 
     // listen
-    if (listen(nSockFd, MAX_LISTEN_BACKLOG) == -1) {
+    if (listen(nSockFd, g_conf.nListenBacklog) == -1) {
         LOG_ERR("Can't listen port %d.", g_conf.nPort);
         daemonEnd(EXIT_FAILURE);
     }
@@ -164,7 +197,6 @@ void daemonStart(bool nDaemonize)
     LOG_SYS("%s %s is ready on the port %d.", g_prgname, g_prgversion, g_conf.nPort);
 
     // prefork management
-    int nIgnoredConn = 0;
     int nChildFlag = 0; // n : number of spares required, -n : number of times reqched over max idle, 0 : no action
     while (true) {
         // signal handling
@@ -195,14 +227,6 @@ void daemonStart(bool nDaemonize)
                 } else if (nIdleChilds <= 0) {
                     // max connection reached
                     nChildFlag = 0;
-
-                    // ignore connectin
-                    if (g_conf.bIgnoreOverConnection == true) {
-                        while (ignoreConnection(nSockFd, 0) == true) {
-                            nIgnoredConn++;
-                            LOG_WARN("Maximum connection reached. Connection ignored. (%d)", nIgnoredConn);
-                        }
-                    }
                 }
             } else if (nIdleChilds > g_conf.nMaxSpareServers) {
                 // too much idle childs
@@ -217,6 +241,11 @@ void daemonStart(bool nDaemonize)
             }
         }
 
+        // shed queued connections under overload
+        if (g_conf.bIgnoreOverConnection == true) {
+            admitControl(nSockFd, (nRunningChilds >= g_conf.nMaxClients && nIdleChilds <= 0) ? true : false);
+        }
+
         //
         // SECTION: prefork control
         //
@@ -308,6 +337,26 @@ void daemonStart(bool nDaemonize)
                 LOG_WARN("Child count mismatch. fixed.");
             }
 
+            // check lingering close helper
+            lingerCheck(nSockFd);
+
+            // clear expired locks
+            lockReap();
+
+            // trim cache
+            static time_t nLastCacheCleanup = 0;
+            if (time(NULL) - nLastCacheCleanup >= CACHE_CLEANUP_INTERVAL) {
+                cacheCleanupStart(nSockFd, (off_t)g_conf.nCacheMaxSize * 1024 * 1024);
+                nLastCacheCleanup = time(NULL);
+            }
+
+            // remove abandoned uploads
+            static time_t nLastUploadReap = 0;
+            if (time(NULL) - nLastUploadReap >= UPLOAD_REAP_INTERVAL) {
+                httpUploadReapStart(nSockFd);
+                nLastUploadReap = time(NULL);
+            }
+
 #ifdef ENABLE_HOOK
             if (hookWhileDaemonIdle() < 0) {
                 LOG_ERR("Hook failed.");
@@ -348,6 +397,9 @@ static void daemonEnd(int nStatus)
         while (waitpid(-1, NULL, WNOHANG) > 0);
     }
 
+    // stop lingering close helper
+    lingerStop();
+
 #ifdef ENABLE_HOOK
     if (hookBeforeDaemonEnd() == false) {
         LOG_ERR("Hook failed.");
@@ -365,6 +417,15 @@ static void daemonEnd(int nStatus)
         LOG_WARN("Can't destroy mime types.");
     }
 
+    // destroy canned responses
+    httpCannedFree();
+
+    // destroy client limits
+    limitFree();
+
+    // destroy lock table
+    lockFree();
+
     // destroy shared memory
     if (poolFree() == false) {
         LOG_WARN("Can't destroy child management pool .");
@@ -475,6 +536,12 @@ static void daemonSignalHandler(void)
                 LOG_WARN("Failed to load mimetypes from %s", g_conf.szMimeFile);
             }
 
+            // rebuild canned responses
+            httpCannedFree();
+            if (httpCannedInit(g_conf.szErrorPageDir) == false) {
+                LOG_WARN("Failed to build canned responses.");
+            }
+
 #ifdef ENABLE_HOOK
             // hup hook
             if (hookAfterDaemonSIGHUP() == false) {
@@ -515,57 +582,3 @@ static void daemonSignalHandler(void)
         LOG_SYS("Decreasing log-level to %d.", g_loglevel);
     }
 }
-
-static bool ignoreConnection(int nSockFd, long int nTimeoutMs)
-{
-    struct sockaddr_in connAddr;
-    socklen_t nConnLen = sizeof(connAddr);
-    int nNewSockFd;
-
-    // wait connection
-    if (qio_wait_readable(nSockFd, nTimeoutMs) <= 0) return false;
-
-    // accept connection
-    if ((nNewSockFd = accept(nSockFd, (struct sockaddr *)&connAddr, &nConnLen)) == -1) return false;
-
-    //
-    // caughted connection
-    //
-
-    // parse request
-    struct HttpRequest *pReq = httpRequestParse(nSockFd, g_conf.nConnectionTimeout);
-    if (pReq == NULL) {
-        LOG_ERR("Can't parse request.");
-        closeSocket(nNewSockFd);
-        return false;
-    }
-
-    // create response
-    struct HttpResponse *pRes = httpResponseCreate(pReq);
-    if (pRes == NULL) {
-        LOG_ERR("Can't create response.");
-        httpRequestFree(pReq);
-        closeSocket(nNewSockFd);
-        return false;
-    }
-
-    // set response
-    pRes->pszHttpVersion = strdup(HTTP_PROTOCOL_11);
-    pRes->nResponseCode = HTTP_CODE_SERVICE_UNAVAILABLE;
-    httpHeaderSetStr(pRes->pHeaders, "Connection", "close");
-
-    // serialize & stream out
-    httpResponseOut(pRes);
-
-    // logging
-    httpAccessLog(pReq, pRes);
-
-    // close connection immediately
-    closeSocket(nNewSockFd);
-
-    // free resources
-    if (pRes != NULL) httpResponseFree(pRes);
-    if (pReq != NULL) httpRequestFree(pReq);
-
-    return true;
-}
@@ -0,0 +1,251 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: etag.c 234 2012-06-21 09:12:05Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Entity tags.
+ *
+ * By default an ETag is made of the request path, size and mtime, so it
+ * changes when a file is renamed or copied with its mtime. With
+ * EnableStrongEtag, the SHA-256 hash of the contents is used instead. It's
+ * computed once, when the file is uploaded or on the first GET, and kept
+ * in an extended attribute of the file together with the size and mtime it
+ * was computed for. So the tag follows the inode through renames and
+ * restarts, and it's dropped once the file is modified. Listings don't read
+ * files, so a file not hashed yet has no tag there rather than one which
+ * changes on the first GET.
+ *
+ * Each server also remembers the recent tags by inode, so most requests
+ * make no system call for it.
+ */
+
+#include "qhttpd.h"
+#include <sys/xattr.h>
+
+#define ETAG_XATTR_MAX  (SHA256_DIGEST_SIZE * 2 + 64)  // xattr value length
+
+struct EtagCache {
+    dev_t   nDev;
+    ino_t   nIno;
+    off_t   nSize;
+    struct  timespec mtime;
+    bool    bHash;              // flag for known hash, false for no hash
+    char    szHash[SHA256_DIGEST_SIZE * 2 + 1];
+};
+
+static struct EtagCache m_aCache[ETAG_CACHE_SIZE];
+
+static char *_getHash(const char *pszSysPath, struct stat *pStat, char *pszBuf, size_t nBufSize, bool bCompute);
+static bool _computeHash(const char *pszSysPath, struct stat *pStat, char *pszBuf, size_t nBufSize);
+static void _makeXattr(char *pszBuf, size_t nBufSize, const char *pszHash, struct stat *pStat);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Get entity tag of a file.
+ *
+ * @param pszBuf        etag is stored without quotes
+ * @param nBufSize      size of pszBuf, ETAG_MAX
+ * @param pszPath       request path of the file
+ * @param pszSysPath    system path of the file. NULL to use weak one.
+ * @param pStat         stat of the file
+ * @param bCompute      hash the file now if it's not hashed yet and strong
+ *                      etags are enabled. false for listing many files.
+ * @return pszBuf, or NULL if bCompute is false and the file is not hashed
+ *         yet, so its tag is not known
+ */
+char *etagGet(char *pszBuf, size_t nBufSize, const char *pszPath, const char *pszSysPath, struct stat *pStat,
+              bool bCompute)
+{
+    if (pszSysPath != NULL && S_ISREG(pStat->st_mode)) {
+        if (_getHash(pszSysPath, pStat, pszBuf, nBufSize, bCompute) != NULL) return pszBuf;
+
+        // the path one would be replaced by the hash on the first GET
+        if (bCompute == false && g_conf.bEnableStrongEtag == true && pStat->st_size <= ETAG_HASH_MAX_SIZE) {
+            pszBuf[0] = '\0';
+            return NULL;
+        }
+    }
+
+    unsigned int nFilepathHash = qhashfnv1_32((const void *)pszPath, strlen(pszPath));
+    snprintf(pszBuf, nBufSize, "%08x-%08x-%08x", nFilepathHash, (unsigned int)pStat->st_size, (unsigned int)pStat->st_mtime);
+    pszBuf[nBufSize - 1] = '\0';
+    return pszBuf;
+}
+
+/**
+ * Keep content hash of a file, which is written already.
+ *
+ * @param nFd       file descriptor
+ * @param pDigest   SHA-256 digest of the contents
+ * @return true if successful, otherwise returns false
+ */
+bool etagSetHash(int nFd, const unsigned char *pDigest)
+{
+    struct stat filestat;
+    if (sysFstat(nFd, &filestat) != 0) return false;
+
+    char *pszHash = qhex_encode(pDigest, SHA256_DIGEST_SIZE);
+    if (pszHash == NULL) return false;
+
+    char szValue[ETAG_XATTR_MAX];
+    _makeXattr(szValue, sizeof(szValue), pszHash, &filestat);
+    free(pszHash);
+
+    return (fsetxattr(nFd, ETAG_XATTR_NAME, szValue, strlen(szValue), 0) == 0) ? true : false;
+}
+
+/**
+ * Check whether the kept content hash of a file is still valid, which is
+ * false once the file is modified after it's hashed.
+ *
+ * @param pszSysPath    system path of the file
+ * @param pStat         stat of the file
+ * @param pszHash       expected hash in hex
+ * @return true if the file is hashed with pszHash and not modified since
+ */
+bool etagCheckHash(const char *pszSysPath, struct stat *pStat, const char *pszHash)
+{
+    char szValue[ETAG_XATTR_MAX];
+    ssize_t nLen = getxattr(pszSysPath, ETAG_XATTR_NAME, szValue, sizeof(szValue) - 1);
+    if (nLen <= 0) return false;
+    szValue[nLen] = '\0';
+
+    char szExpect[ETAG_XATTR_MAX];
+    _makeXattr(szExpect, sizeof(szExpect), pszHash, pStat);
+    return (!strcmp(szValue, szExpect)) ? true : false;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static char *_getHash(const char *pszSysPath, struct stat *pStat, char *pszBuf, size_t nBufSize, bool bCompute)
+{
+    if (g_conf.bEnableStrongEtag == false && IS_EMPTY_STRING(g_conf.szContentStore) == true) return NULL;
+    if (g_conf.bEnableStrongEtag == false) bCompute = false;
+    if (nBufSize < SHA256_DIGEST_SIZE * 2 + 1) return NULL;
+
+    // remembered one
+    struct EtagCache *pCache = &m_aCache[(pStat->st_ino ^ pStat->st_dev) % ETAG_CACHE_SIZE];
+    if (pCache->nIno == pStat->st_ino && pCache->nDev == pStat->st_dev && pCache->nSize == pStat->st_size
+        && pCache->mtime.tv_sec == pStat->st_mtim.tv_sec && pCache->mtime.tv_nsec == pStat->st_mtim.tv_nsec) {
+        if (pCache->bHash == true) {
+            qstrcpy(pszBuf, nBufSize, pCache->szHash);
+            return pszBuf;
+        }
+        // other servers may have hashed it since
+        if (g_conf.bEnableStrongEtag == false) return NULL;
+    }
+
+    // kept in the file
+    bool bFound = false;
+    char szValue[ETAG_XATTR_MAX];
+    ssize_t nLen = getxattr(pszSysPath, ETAG_XATTR_NAME, szValue, sizeof(szValue) - 1);
+    if (nLen > 0) {
+        szValue[nLen] = '\0';
+        char szExpect[ETAG_XATTR_MAX];
+        _makeXattr(szExpect, sizeof(szExpect), szValue, pStat);
+        if (!strcmp(szValue, szExpect) && strlen(szValue) > SHA256_DIGEST_SIZE * 2
+            && szValue[SHA256_DIGEST_SIZE * 2] == ' ') {
+            qstrncpy(pszBuf, nBufSize, szValue, SHA256_DIGEST_SIZE * 2);
+            bFound = true;
+        }
+    }
+
+    if (bFound == false && bCompute == true && pStat->st_size <= ETAG_HASH_MAX_SIZE) {
+        bFound = _computeHash(pszSysPath, pStat, pszBuf, nBufSize);
+    }
+
+    pCache->nDev = pStat->st_dev;
+    pCache->nIno = pStat->st_ino;
+    pCache->nSize = pStat->st_size;
+    pCache->mtime = pStat->st_mtim;
+    pCache->bHash = bFound;
+    if (bFound == true) qstrcpy(pCache->szHash, sizeof(pCache->szHash), pszBuf);
+
+    return (bFound == true) ? pszBuf : NULL;
+}
+
+static bool _computeHash(const char *pszSysPath, struct stat *pStat, char *pszBuf, size_t nBufSize)
+{
+    int nFd = sysOpen(pszSysPath, O_RDONLY, 0);
+    if (nFd < 0) return false;
+
+    struct Sha256 hash;
+    sha256Init(&hash);
+    sysFadvise(nFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char szBuf[64 * 1024];
+    ssize_t nRead;
+    while ((nRead = read(nFd, szBuf, sizeof(szBuf))) > 0) {
+        sha256Update(&hash, szBuf, nRead);
+    }
+
+    // the file must not be changed while it's hashed
+    struct stat filestat;
+    if (nRead < 0 || sysFstat(nFd, &filestat) != 0 || filestat.st_ino != pStat->st_ino
+        || filestat.st_size != pStat->st_size || filestat.st_mtim.tv_sec != pStat->st_mtim.tv_sec
+        || filestat.st_mtim.tv_nsec != pStat->st_mtim.tv_nsec) {
+        sysClose(nFd);
+        return false;
+    }
+
+    unsigned char szDigest[SHA256_DIGEST_SIZE];
+    sha256Final(&hash, szDigest);
+    char *pszHash = qhex_encode(szDigest, SHA256_DIGEST_SIZE);
+    if (pszHash == NULL) {
+        sysClose(nFd);
+        return false;
+    }
+    qstrcpy(pszBuf, nBufSize, pszHash);
+
+    // keep it, it's still remembered if the file is read-only to us
+    char szValue[ETAG_XATTR_MAX];
+    _makeXattr(szValue, sizeof(szValue), pszHash, &filestat);
+    if (fsetxattr(nFd, ETAG_XATTR_NAME, szValue, strlen(szValue), 0) != 0) {
+        DEBUG("Can't keep content hash of %s. (errno: %d)", pszSysPath, errno);
+    }
+    free(pszHash);
+    sysClose(nFd);
+
+    DEBUG("Content hash of %s computed.", pszSysPath);
+    return true;
+}
+
+/*
+ * Value of the extended attribute, "<hash> <size> <mtime>".
+ */
+static void _makeXattr(char *pszBuf, size_t nBufSize, const char *pszHash, struct stat *pStat)
+{
+    snprintf(pszBuf, nBufSize, "%.*s %jd %jd.%09ld", SHA256_DIGEST_SIZE * 2, pszHash, (intmax_t)pStat->st_size,
+             (intmax_t)pStat->st_mtim.tv_sec, pStat->st_mtim.tv_nsec);
+}
@@ -0,0 +1,512 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: http_autoindex.c 235 2012-06-22 14:30:18Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Directory listings for GET of a directory without DirectoryIndex file.
+ *
+ * Entries are read by walkTree() like PROPFIND, sorted and split into pages
+ * of AutoindexPageSize, and rendered as HTML or JSON(?format=json). Other
+ * query parameters are sort=name|size|mtime, order=asc|desc and page=N.
+ * Hidden entries, which include property and upload temporary files, are
+ * not listed.
+ *
+ * Rendered pages are kept in CacheDir under the generation of the
+ * directory, which is bumped by every change made by this server, so a
+ * listing is read from the disk once until the directory changes. The
+ * cache key doubles as ETag, and revalidation gets 304 without reading
+ * the directory.
+ */
+
+#include "qhttpd.h"
+
+#define AUTOINDEX_SORT_NAME     (0)
+#define AUTOINDEX_SORT_SIZE     (1)
+#define AUTOINDEX_SORT_MTIME    (2)
+
+struct AutoindexEntry {
+    char    *pszName;
+    off_t   nSize;
+    time_t  nMtime;
+    bool    bDir;
+};
+
+struct AutoindexList {
+    struct AutoindexEntry *pEntries;
+    int     nEntries;
+    int     nAlloc;
+    bool    bTruncated;         // flag for AUTOINDEX_MAX_ENTRIES reached
+};
+
+struct AutoindexQuery {
+    bool    bJson;              // JSON or HTML
+    int     nSort;              // AUTOINDEX_SORT_*
+    bool    bDesc;              // descending order
+    int     nPage;              // page number, 1 for the first
+};
+
+static int m_nSort;             // sort order for _cmpEntry()
+static bool m_bDesc;
+
+static bool _parseQuery(const char *pszQuery, struct AutoindexQuery *pQuery);
+static bool _getQueryValue(const char *pszQuery, const char *pszName, char *pszBuf, size_t nBufSize);
+static bool _readList(const char *pszSysPath, struct AutoindexQuery *pQuery, struct AutoindexList *pList);
+static void _freeList(struct AutoindexList *pList);
+static int _scanWalk(struct WalkEntry *pEntry, void *pArg);
+static int _cmpEntry(const void *p1, const void *p2);
+static int _getPages(struct AutoindexList *pList);
+static bool _render(struct Writer *pOut, const char *pszBasePath, struct AutoindexList *pList, struct AutoindexQuery *pQuery);
+static bool _renderHtml(struct Writer *pHtml, const char *pszBasePath, struct AutoindexList *pList,
+                        struct AutoindexQuery *pQuery, int nFirst, int nLast, int nPages);
+static bool _renderJson(struct Writer *pJson, const char *pszBasePath, struct AutoindexList *pList,
+                        struct AutoindexQuery *pQuery, int nFirst, int nLast, int nPages);
+static bool _putQueryUrl(struct Writer *pHtml, struct AutoindexQuery *pQuery, int nSort, bool bDesc, int nPage);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Respond listing of the directory.
+ *
+ * @param pszSysPath    system path of the directory
+ * @param pStat         stat of the directory
+ * @return response code
+ */
+int httpAutoindex(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszSysPath, struct stat *pStat)
+{
+    struct AutoindexQuery query;
+    if (_parseQuery(pReq->pszQueryString, &query) == false) return response400(pRes);
+    const char *pszContentType = (query.bJson == true) ? "application/json" : "text/html; charset=\"utf-8\"";
+
+    // directory path with a trailing slash, which links are made from
+    char szBasePath[PATH_MAX];
+    qstrcpy(szBasePath, sizeof(szBasePath) - 1, pReq->pszRequestPath);
+    size_t nLen = strlen(szBasePath);
+    if (nLen == 0 || szBasePath[nLen - 1] != '/') strcat(szBasePath, "/");
+
+    // the key changes with every change of the directory made by this server
+    char *pszKey = NULL;
+    char szEtag[16+1];
+    if (g_conf.nAutoindexCacheTime > 0 && IS_EMPTY_STRING(g_conf.szCacheDir) == false) {
+        char szDirKey[PATH_MAX];
+        qstrcpy(szDirKey, sizeof(szDirKey), pszSysPath);
+        size_t nKeyLen = strlen(szDirKey);
+        while (nKeyLen > 1 && szDirKey[nKeyLen - 1] == '/') szDirKey[--nKeyLen] = '\0';
+
+        pszKey = qstrdupf("autoindex:%s:%s:%u:%jd.%09ld:%ld:%c%d%c%d", szBasePath, szDirKey,
+                          poolGetGeneration(szDirKey),
+                          (intmax_t)pStat->st_mtim.tv_sec, pStat->st_mtim.tv_nsec,
+                          (long)(time(NULL) / g_conf.nAutoindexCacheTime),
+                          (query.bJson == true) ? 'j' : 'h', query.nSort, (query.bDesc == true) ? 'd' : 'a', query.nPage);
+    }
+
+    struct stat cachestat;
+    int nFd = -1;
+    if (pszKey != NULL) {
+        snprintf(szEtag, sizeof(szEtag), "%016" PRIx64, qhashfnv1_64(pszKey, strlen(pszKey)));
+
+        // the client has the same listing
+        int nCondCode = httpHeaderCheckConditions(pReq->pHeaders, true, szEtag, pStat);
+        if (nCondCode != 0) {
+            free(pszKey);
+            if (nCondCode != HTTP_CODE_NOT_MODIFIED) {
+                return httpResponseSetSimple(pRes, nCondCode, true, httpResponseGetMsg(nCondCode));
+            }
+            httpHeaderSetStrf(pRes->pHeaders, "ETag", "\"%s\"", szEtag);
+            return httpResponseSetSimple(pRes, HTTP_CODE_NOT_MODIFIED, true, NULL);
+        }
+
+        nFd = cacheOpen(pszKey, &cachestat);
+        if (nFd >= 0) DEBUG("Autoindex cache hit. (%s)", pReq->pszRequestPath);
+    }
+
+    if (nFd < 0) {
+        struct AutoindexList list;
+        if (_readList(pszSysPath, &query, &list) == false) {
+            if (pszKey != NULL) free(pszKey);
+            return response403(pRes);
+        }
+        if (query.nPage > _getPages(&list)) {
+            _freeList(&list);
+            if (pszKey != NULL) free(pszKey);
+            return response404(pRes);
+        }
+
+        // render into the cache
+        char szTmpPath[PATH_MAX];
+        int nTmpFd = (pszKey != NULL) ? cacheCreate(szTmpPath, sizeof(szTmpPath)) : -1;
+        if (nTmpFd >= 0) {
+            struct Writer *pOut = writerCreate(writerFileOut, (void *)&nTmpFd);
+            bool bRendered = false;
+            if (pOut != NULL) {
+                bRendered = (_render(pOut, szBasePath, &list, &query) == true && writerFlush(pOut) == true) ? true : false;
+                writerFree(pOut);
+            }
+            sysClose(nTmpFd);
+
+            if (bRendered == true) {
+                cacheCommit(pszKey, szTmpPath);
+                nFd = cacheOpen(pszKey, &cachestat);
+            } else {
+                cacheAbort(szTmpPath);
+            }
+        }
+
+        // or on the fly
+        if (nFd < 0) {
+            if (pszKey != NULL) free(pszKey);
+
+            struct Writer *pOut = writerCreate(writerChunkOut, (void *)pRes);
+            if (pOut == NULL) {
+                _freeList(&list);
+                return response500(pRes);
+            }
+
+            httpResponseSetCode(pRes, HTTP_CODE_OK, true);
+            httpResponseSetContent(pRes, pszContentType, NULL, 0);
+            httpResponseSetContentChunked(pRes, true);
+            httpResponseOut(pRes);
+
+            if (_render(pOut, szBasePath, &list, &query) == true && writerFlush(pOut) == true) {
+                // end of chunk
+                httpResponseOutChunk(pRes, NULL, 0);
+            }
+            writerFree(pOut);
+            _freeList(&list);
+
+            return HTTP_CODE_OK;
+        }
+        _freeList(&list);
+    }
+    free(pszKey);
+
+    httpResponseSetCode(pRes, HTTP_CODE_OK, true);
+    httpResponseSetContent(pRes, pszContentType, NULL, cachestat.st_size);
+    httpHeaderSetStrf(pRes->pHeaders, "ETag", "\"%s\"", szEtag);
+    httpResponseOut(pRes);
+    if (pRes->bHeadOnly == false) {
+        streamSend(pReq->nSockFd, nFd, cachestat.st_size, pReq->nTimeout * 1000);
+    }
+    sysClose(nFd);
+
+    return HTTP_CODE_OK;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static bool _parseQuery(const char *pszQuery, struct AutoindexQuery *pQuery)
+{
+    memset((void *)pQuery, 0, sizeof(struct AutoindexQuery));
+    pQuery->nSort = AUTOINDEX_SORT_NAME;
+    pQuery->nPage = 1;
+
+    char szValue[32];
+    if (_getQueryValue(pszQuery, "format", szValue, sizeof(szValue)) == true) {
+        if (!strcmp(szValue, "json")) pQuery->bJson = true;
+        else if (strcmp(szValue, "html")) return false;
+    }
+    if (_getQueryValue(pszQuery, "sort", szValue, sizeof(szValue)) == true) {
+        if (!strcmp(szValue, "size")) pQuery->nSort = AUTOINDEX_SORT_SIZE;
+        else if (!strcmp(szValue, "mtime")) pQuery->nSort = AUTOINDEX_SORT_MTIME;
+        else if (strcmp(szValue, "name")) return false;
+    }
+    if (_getQueryValue(pszQuery, "order", szValue, sizeof(szValue)) == true) {
+        if (!strcmp(szValue, "desc")) pQuery->bDesc = true;
+        else if (strcmp(szValue, "asc")) return false;
+    }
+    if (_getQueryValue(pszQuery, "page", szValue, sizeof(szValue)) == true) {
+        char *pszEnd;
+        long nPage = strtol(szValue, &pszEnd, 10);
+        if (*pszEnd != '\0' || nPage < 1 || nPage > INT_MAX) return false;
+        pQuery->nPage = (int)nPage;
+    }
+
+    return true;
+}
+
+/*
+ * Find value of name=value pair in the query string. Values are taken as
+ * they are, without URL decoding.
+ */
+static bool _getQueryValue(const char *pszQuery, const char *pszName, char *pszBuf, size_t nBufSize)
+{
+    if (pszQuery == NULL) return false;
+
+    size_t nNameLen = strlen(pszName);
+    const char *p = pszQuery;
+    while (p != NULL && *p != '\0') {
+        const char *pszEnd = strchr(p, '&');
+        size_t nLen = (pszEnd != NULL) ? (size_t)(pszEnd - p) : strlen(p);
+        if (nLen > nNameLen && p[nNameLen] == '=' && !strncmp(p, pszName, nNameLen)) {
+            qstrncpy(pszBuf, nBufSize, p + nNameLen + 1, nLen - nNameLen - 1);
+            return true;
+        }
+        p = (pszEnd != NULL) ? pszEnd + 1 : NULL;
+    }
+
+    return false;
+}
+
+/*
+ * Read and sort entries of the directory.
+ */
+static bool _readList(const char *pszSysPath, struct AutoindexQuery *pQuery, struct AutoindexList *pList)
+{
+    memset((void *)pList, 0, sizeof(struct AutoindexList));
+    if (walkTree(pszSysPath, 1, false, _scanWalk, (void *)pList) < 0) {
+        _freeList(pList);
+        return false;
+    }
+
+    m_nSort = pQuery->nSort;
+    m_bDesc = pQuery->bDesc;
+    if (pList->nEntries > 1) qsort(pList->pEntries, pList->nEntries, sizeof(struct AutoindexEntry), _cmpEntry);
+
+    return true;
+}
+
+static void _freeList(struct AutoindexList *pList)
+{
+    int i;
+    for (i = 0; i < pList->nEntries; i++) free(pList->pEntries[i].pszName);
+    if (pList->pEntries != NULL) free(pList->pEntries);
+    memset((void *)pList, 0, sizeof(struct AutoindexList));
+}
+
+static int _scanWalk(struct WalkEntry *pEntry, void *pArg)
+{
+    struct AutoindexList *pList = (struct AutoindexList *)pArg;
+
+    // hidden ones
+    if (pEntry->pszName[0] == '.') return WALK_CONTINUE;
+
+    if (pList->nEntries >= AUTOINDEX_MAX_ENTRIES) {
+        pList->bTruncated = true;
+        return WALK_STOP;
+    }
+
+    if (pList->nEntries >= pList->nAlloc) {
+        int nAlloc = (pList->nAlloc > 0) ? pList->nAlloc * 2 : 256;
+        struct AutoindexEntry *pEntries = (struct AutoindexEntry *)realloc(pList->pEntries, sizeof(struct AutoindexEntry) * nAlloc);
+        if (pEntries == NULL) return WALK_STOP;
+        pList->pEntries = pEntries;
+        pList->nAlloc = nAlloc;
+    }
+
+    struct AutoindexEntry *pNew = &pList->pEntries[pList->nEntries];
+    pNew->pszName = strdup(pEntry->pszName);
+    if (pNew->pszName == NULL) return WALK_STOP;
+    pNew->bDir = S_ISDIR(pEntry->st.st_mode) ? true : false;
+    pNew->nSize = (pNew->bDir == true) ? 0 : pEntry->st.st_size;
+    pNew->nMtime = pEntry->st.st_mtime;
+    pList->nEntries++;
+
+    return WALK_CONTINUE;
+}
+
+/*
+ * Directories come first in any order, names break ties.
+ */
+static int _cmpEntry(const void *p1, const void *p2)
+{
+    const struct AutoindexEntry *pEntry1 = (const struct AutoindexEntry *)p1;
+    const struct AutoindexEntry *pEntry2 = (const struct AutoindexEntry *)p2;
+
+    if (pEntry1->bDir != pEntry2->bDir) return (pEntry1->bDir == true) ? -1 : 1;
+
+    int nCmp = 0;
+    if (m_nSort == AUTOINDEX_SORT_SIZE && pEntry1->nSize != pEntry2->nSize) {
+        nCmp = (pEntry1->nSize < pEntry2->nSize) ? -1 : 1;
+    } else if (m_nSort == AUTOINDEX_SORT_MTIME && pEntry1->nMtime != pEntry2->nMtime) {
+        nCmp = (pEntry1->nMtime < pEntry2->nMtime) ? -1 : 1;
+    } else {
+        nCmp = strcmp(pEntry1->pszName, pEntry2->pszName);
+    }
+
+    return (m_bDesc == true) ? -nCmp : nCmp;
+}
+
+static int _getPages(struct AutoindexList *pList)
+{
+    if (g_conf.nAutoindexPageSize <= 0 || pList->nEntries == 0) return 1;
+    return (pList->nEntries + g_conf.nAutoindexPageSize - 1) / g_conf.nAutoindexPageSize;
+}
+
+static bool _render(struct Writer *pOut, const char *pszBasePath, struct AutoindexList *pList, struct AutoindexQuery *pQuery)
+{
+    int nPages = _getPages(pList);
+    int nFirst = 0, nLast = pList->nEntries;
+    if (g_conf.nAutoindexPageSize > 0) {
+        nFirst = (pQuery->nPage - 1) * g_conf.nAutoindexPageSize;
+        if (nLast > nFirst + g_conf.nAutoindexPageSize) nLast = nFirst + g_conf.nAutoindexPageSize;
+    }
+
+    if (pQuery->bJson == true) return _renderJson(pOut, pszBasePath, pList, pQuery, nFirst, nLast, nPages);
+    return _renderHtml(pOut, pszBasePath, pList, pQuery, nFirst, nLast, nPages);
+}
+
+static bool _renderHtml(struct Writer *pHtml, const char *pszBasePath, struct AutoindexList *pList,
+                        struct AutoindexQuery *pQuery, int nFirst, int nLast, int nPages)
+{
+    writerPutLit(pHtml, "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 3.2 Final//EN\">" CRLF
+                        "<html>" CRLF
+                        "<head>" CRLF
+                        "  <title>Index of ");
+    writerPutHtml(pHtml, pszBasePath);
+    writerPutLit(pHtml, "</title>" CRLF
+                        "  <meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />" CRLF
+                        "  <style type=\"text/css\">" CRLF
+                        "    body,td,th { font-size:14px; }" CRLF
+                        "    th,td { padding-right:2em; text-align:left; }" CRLF
+                        "  </style>" CRLF
+                        "</head>" CRLF
+                        "<body>" CRLF
+                        "<h1>Index of ");
+    writerPutHtml(pHtml, pszBasePath);
+    writerPutLit(pHtml, "</h1>" CRLF "<table>" CRLF);
+
+    // column headers sort by the column, twice for descending order
+    static const char *aszColumns[] = { "Name", "Size", "Last Modified" };
+    int i;
+    writerPutLit(pHtml, "  <tr>");
+    for (i = 0; i < 3; i++) {
+        writerPutLit(pHtml, "<th><a href=\"");
+        _putQueryUrl(pHtml, pQuery, i, (pQuery->nSort == i && pQuery->bDesc == false) ? true : false, 1);
+        writerPutLit(pHtml, "\">");
+        writerPuts(pHtml, aszColumns[i]);
+        writerPutLit(pHtml, "</a></th>");
+    }
+    writerPutLit(pHtml, "</tr>" CRLF);
+
+    // parent directory
+    size_t nBaseLen = strlen(pszBasePath);
+    if (nBaseLen > 1) {
+        const char *pszParentEnd = pszBasePath + nBaseLen - 1;
+        while (pszParentEnd > pszBasePath && *(pszParentEnd - 1) != '/') pszParentEnd--;
+        char szParent[PATH_MAX];
+        qstrncpy(szParent, sizeof(szParent), pszBasePath, pszParentEnd - pszBasePath);
+        writerPutLit(pHtml, "  <tr><td><a href=\"");
+        writerPutUrl(pHtml, szParent);
+        writerPutLit(pHtml, "\">../</a></td><td>-</td><td></td></tr>" CRLF);
+    }
+
+    for (i = nFirst; i < nLast; i++) {
+        struct AutoindexEntry *pEntry = &pList->pEntries[i];
+        writerPutLit(pHtml, "  <tr><td><a href=\"");
+        writerPutUrl(pHtml, pszBasePath);
+        writerPutUrl(pHtml, pEntry->pszName);
+        if (pEntry->bDir == true) writerPutLit(pHtml, "/");
+        writerPutLit(pHtml, "\">");
+        writerPutHtml(pHtml, pEntry->pszName);
+        if (pEntry->bDir == true) writerPutLit(pHtml, "/");
+        writerPutLit(pHtml, "</a></td><td>");
+        if (pEntry->bDir == true) writerPutLit(pHtml, "-");
+        else writerPutInt(pHtml, pEntry->nSize);
+        writerPutLit(pHtml, "</td><td>");
+        writerPutIsoDate(pHtml, pEntry->nMtime);
+        writerPutLit(pHtml, "</td></tr>" CRLF);
+    }
+    writerPutLit(pHtml, "</table>" CRLF);
+
+    // pages
+    if (nPages > 1 || pList->bTruncated == true) {
+        writerPutLit(pHtml, "<p>");
+        if (pQuery->nPage > 1) {
+            writerPutLit(pHtml, "<a href=\"");
+            _putQueryUrl(pHtml, pQuery, pQuery->nSort, pQuery->bDesc, pQuery->nPage - 1);
+            writerPutLit(pHtml, "\">Previous</a> ");
+        }
+        writerPutLit(pHtml, "Page ");
+        writerPutInt(pHtml, pQuery->nPage);
+        writerPutLit(pHtml, " of ");
+        writerPutInt(pHtml, nPages);
+        if (pQuery->nPage < nPages) {
+            writerPutLit(pHtml, " <a href=\"");
+            _putQueryUrl(pHtml, pQuery, pQuery->nSort, pQuery->bDesc, pQuery->nPage + 1);
+            writerPutLit(pHtml, "\">Next</a>");
+        }
+        if (pList->bTruncated == true) writerPutLit(pHtml, " (listing is truncated)");
+        writerPutLit(pHtml, "</p>" CRLF);
+    }
+
+    return writerPutLit(pHtml, "</body>" CRLF "</html>" CRLF);
+}
+
+static bool _renderJson(struct Writer *pJson, const char *pszBasePath, struct AutoindexList *pList,
+                        struct AutoindexQuery *pQuery, int nFirst, int nLast, int nPages)
+{
+    writerPutLit(pJson, "{\"path\":\"");
+    writerPutJson(pJson, pszBasePath);
+    writerPutLit(pJson, "\",\"total\":");
+    writerPutInt(pJson, pList->nEntries);
+    writerPutLit(pJson, ",\"truncated\":");
+    if (pList->bTruncated == true) writerPutLit(pJson, "true");
+    else writerPutLit(pJson, "false");
+    writerPutLit(pJson, ",\"page\":");
+    writerPutInt(pJson, pQuery->nPage);
+    writerPutLit(pJson, ",\"pages\":");
+    writerPutInt(pJson, nPages);
+    writerPutLit(pJson, ",\"entries\":[");
+
+    int i;
+    for (i = nFirst; i < nLast; i++) {
+        struct AutoindexEntry *pEntry = &pList->pEntries[i];
+        if (i > nFirst) writerPutLit(pJson, ",");
+        writerPutLit(pJson, CRLF "{\"name\":\"");
+        writerPutJson(pJson, pEntry->pszName);
+        if (pEntry->bDir == true) writerPutLit(pJson, "\",\"type\":\"directory\"");
+        else writerPutLit(pJson, "\",\"type\":\"file\"");
+        writerPutLit(pJson, ",\"size\":");
+        writerPutInt(pJson, pEntry->nSize);
+        writerPutLit(pJson, ",\"mtime\":\"");
+        writerPutIsoDate(pJson, pEntry->nMtime);
+        writerPutLit(pJson, "\"}");
+    }
+
+    return writerPutLit(pJson, "]}" CRLF);
+}
+
+/*
+ * Relative URL of another listing such like "?sort=size&amp;order=desc",
+ * escaped for an attribute value.
+ */
+static bool _putQueryUrl(struct Writer *pHtml, struct AutoindexQuery *pQuery, int nSort, bool bDesc, int nPage)
+{
+    static const char *aszSorts[] = { "name", "size", "mtime" };
+    writerPutLit(pHtml, "?sort=");
+    writerPuts(pHtml, aszSorts[nSort]);
+    if (bDesc == true) writerPutLit(pHtml, "&amp;order=desc");
+    if (pQuery->bJson == true) writerPutLit(pHtml, "&amp;format=json");
+    if (nPage <= 1) return true;
+    writerPutLit(pHtml, "&amp;page=");
+    return writerPutInt(pHtml, nPage);
+}
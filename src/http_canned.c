@@ -0,0 +1,340 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: http_canned.c 220 2012-05-20 10:12:41Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Canned responses.
+ *
+ * Status lines and HTML error bodies are rendered once by the daemon at
+ * startup and on SIGHUP, then shared by every child through fork(). Error
+ * responses are served by reference without any formatting or allocation.
+ */
+
+#include "qhttpd.h"
+
+#define CANNED_PROTOCOLS    (3)     // HTTP/0.9, HTTP/1.0, HTTP/1.1
+
+struct CannedEntry {
+    char   *pszStatusLine[CANNED_PROTOCOLS];  // "HTTP/1.1 404 Not Found\r\n"
+    size_t nStatusLineSize[CANNED_PROTOCOLS];
+    char   *pBody;          // pre-rendered html body
+    size_t nBodySize;       // size of body
+    bool   bCustom;         // flag for operator supplied error page
+    char   *pResponse;      // pre-rendered whole response, errors only
+    size_t nResponseSize;   // size of whole response
+};
+
+static const char *m_aszResMsg[HTTP_CODE_MAX] = {
+    [HTTP_CODE_CONTINUE]                = "Continue",
+    [HTTP_CODE_OK]                      = "OK",
+    [HTTP_CODE_CREATED]                 = "Created",
+    [HTTP_CODE_ACCEPTED]                = "Accepted",
+    [HTTP_CODE_NO_CONTENT]              = "No content",
+    [HTTP_CODE_PARTIAL_CONTENT]         = "Partial Content",
+    [HTTP_CODE_MULTI_STATUS]            = "Multi Status",
+    [HTTP_CODE_MOVED_TEMPORARILY]       = "Moved Temporarily",
+    [HTTP_CODE_NOT_MODIFIED]            = "Not Modified",
+    [HTTP_CODE_BAD_REQUEST]             = "Bad Request",
+    [HTTP_CODE_UNAUTHORIZED]            = "Authorization Required",
+    [HTTP_CODE_FORBIDDEN]               = "Forbidden",
+    [HTTP_CODE_NOT_FOUND]               = "Not Found",
+    [HTTP_CODE_METHOD_NOT_ALLOWED]      = "Method Not Allowed",
+    [HTTP_CODE_REQUEST_TIME_OUT]        = "Request Time Out",
+    [HTTP_CODE_CONFLICT]                = "Conflict",
+    [HTTP_CODE_GONE]                    = "Gone",
+    [HTTP_CODE_PRECONDITION_FAILED]     = "Precondition Failed",
+    [HTTP_CODE_REQUEST_URI_TOO_LONG]    = "Request URI Too Long",
+    [HTTP_CODE_REQUESTED_RANGE_NOT_SATISFIABLE] = "Requested Range Not Satisfiable",
+    [HTTP_CODE_LOCKED]                  = "Locked",
+    [HTTP_CODE_FAILED_DEPENDENCY]       = "Failed Dependency",
+    [HTTP_CODE_TOO_MANY_REQUESTS]       = "Too Many Requests",
+    [HTTP_CODE_INTERNAL_SERVER_ERROR]   = "Internal Server Error",
+    [HTTP_CODE_NOT_IMPLEMENTED]         = "Not Implemented",
+    [HTTP_CODE_SERVICE_UNAVAILABLE]     = "Service Unavailable",
+    [HTTP_CODE_INSUFFICIENT_STORAGE]    = "Insufficient Storage",
+};
+
+static const char *m_aszProtocols[CANNED_PROTOCOLS] = {
+    HTTP_PROTOCOL_09, HTTP_PROTOCOL_10, HTTP_PROTOCOL_11
+};
+
+static struct CannedEntry *m_pCanned = NULL;
+static char m_szServer[128] = "";
+
+static int _getProtocolIndex(const char *pszHttpVer);
+static bool _renderResponse(int nResCode, struct CannedEntry *pEntry);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Build canned responses.
+ *
+ * @param pszErrorPageDir   directory which has custom error pages named by
+ *                          response code such like 404.html. can be NULL.
+ * @return true if successful otherwise returns false
+ */
+bool httpCannedInit(const char *pszErrorPageDir)
+{
+    if (m_pCanned != NULL) return false;
+
+    m_pCanned = (struct CannedEntry *)calloc(HTTP_CODE_MAX, sizeof(struct CannedEntry));
+    if (m_pCanned == NULL) return false;
+
+    snprintf(m_szServer, sizeof(m_szServer), "%s/%s (%s)", g_prgname, g_prgversion, g_prginfo);
+
+    int nResCode, nCustoms = 0;
+    for (nResCode = 0; nResCode < HTTP_CODE_MAX; nResCode++) {
+        const char *pszMsg = m_aszResMsg[nResCode];
+        if (pszMsg == NULL) continue;
+
+        struct CannedEntry *pEntry = &m_pCanned[nResCode];
+
+        // status lines
+        int i;
+        for (i = 0; i < CANNED_PROTOCOLS; i++) {
+            pEntry->pszStatusLine[i] = qstrdupf("%s %d %s" CRLF, m_aszProtocols[i], nResCode, pszMsg);
+            if (pEntry->pszStatusLine[i] == NULL) {
+                httpCannedFree();
+                return false;
+            }
+            pEntry->nStatusLineSize[i] = strlen(pEntry->pszStatusLine[i]);
+        }
+
+        // custom error page
+        if (IS_EMPTY_STRING(pszErrorPageDir) == false) {
+            char szPagePath[PATH_MAX];
+            snprintf(szPagePath, sizeof(szPagePath), "%s/%d.html", pszErrorPageDir, nResCode);
+            size_t nSize = 0;
+            pEntry->pBody = (char *)qfile_load(szPagePath, &nSize);
+            if (pEntry->pBody != NULL) {
+                pEntry->nBodySize = nSize;
+                pEntry->bCustom = true;
+                nCustoms++;
+            }
+        }
+
+        // built-in error page
+        if (pEntry->pBody == NULL) {
+            pEntry->pBody = httpCannedRenderBody(nResCode, pszMsg);
+            if (pEntry->pBody == NULL) {
+                httpCannedFree();
+                return false;
+            }
+            pEntry->nBodySize = strlen(pEntry->pBody);
+        }
+
+        // whole response for the fast path
+        if (nResCode >= 400 && _renderResponse(nResCode, pEntry) == false) {
+            httpCannedFree();
+            return false;
+        }
+    }
+
+    if (nCustoms > 0) LOG_INFO("%d custom error pages loaded.", nCustoms);
+
+    return true;
+}
+
+bool httpCannedFree(void)
+{
+    if (m_pCanned == NULL) return false;
+
+    int nResCode;
+    for (nResCode = 0; nResCode < HTTP_CODE_MAX; nResCode++) {
+        int i;
+        for (i = 0; i < CANNED_PROTOCOLS; i++) {
+            if (m_pCanned[nResCode].pszStatusLine[i] != NULL) free(m_pCanned[nResCode].pszStatusLine[i]);
+        }
+        if (m_pCanned[nResCode].pBody != NULL) free(m_pCanned[nResCode].pBody);
+        if (m_pCanned[nResCode].pResponse != NULL) free(m_pCanned[nResCode].pResponse);
+    }
+    free(m_pCanned);
+    m_pCanned = NULL;
+
+    return true;
+}
+
+/**
+ * Get pre-rendered html body.
+ *
+ * @param nResCode  response code
+ * @param pszMsg    message to display. the built-in page is returned only
+ *                  when it's the default message of the response code.
+ *                  custom error pages are always returned.
+ * @param pnSize    size of body will be stored
+ * @return static body if available, otherwise NULL
+ */
+const char *httpCannedGetBody(int nResCode, const char *pszMsg, size_t *pnSize)
+{
+    if (m_pCanned == NULL || nResCode < 0 || nResCode >= HTTP_CODE_MAX) return NULL;
+
+    struct CannedEntry *pEntry = &m_pCanned[nResCode];
+    if (pEntry->pBody == NULL) return NULL;
+    if (pEntry->bCustom == false
+        && (pszMsg == NULL || strcmp(pszMsg, m_aszResMsg[nResCode]))) {
+        return NULL;
+    }
+
+    if (pnSize != NULL) *pnSize = pEntry->nBodySize;
+    return pEntry->pBody;
+}
+
+/**
+ * Get pre-rendered status line including tailing CRLF.
+ *
+ * @return static status line if available, otherwise NULL
+ */
+const char *httpCannedGetStatusLine(const char *pszHttpVer, int nResCode, size_t *pnSize)
+{
+    if (m_pCanned == NULL || nResCode < 0 || nResCode >= HTTP_CODE_MAX) return NULL;
+
+    int nIdx = _getProtocolIndex(pszHttpVer);
+    if (nIdx < 0 || m_pCanned[nResCode].pszStatusLine[nIdx] == NULL) return NULL;
+
+    if (pnSize != NULL) *pnSize = m_pCanned[nResCode].nStatusLineSize[nIdx];
+    return m_pCanned[nResCode].pszStatusLine[nIdx];
+}
+
+/**
+ * Send pre-rendered error response and give up the connection. This never
+ * blocks, so it's safe to be used by the daemon. The response is dropped if
+ * it doesn't fit in the socket buffer at once.
+ *
+ * @param nSockFd   socket
+ * @param nResCode  error response code
+ * @return true if whole response is queued to the socket, otherwise false
+ */
+bool httpCannedSend(int nSockFd, int nResCode)
+{
+    if (m_pCanned == NULL || nResCode < 0 || nResCode >= HTTP_CODE_MAX) return false;
+
+    struct CannedEntry *pEntry = &m_pCanned[nResCode];
+    if (pEntry->pResponse == NULL) return false;
+
+    ssize_t nSent = send(nSockFd, pEntry->pResponse, pEntry->nResponseSize, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return (nSent == (ssize_t)pEntry->nResponseSize) ? true : false;
+}
+
+/**
+ * Get the value of Server header.
+ */
+const char *httpCannedGetServer(void)
+{
+    if (m_szServer[0] == '\0') {
+        snprintf(m_szServer, sizeof(m_szServer), "%s/%s (%s)", g_prgname, g_prgversion, g_prginfo);
+    }
+    return m_szServer;
+}
+
+/**
+ * Render html body. This is used for the messages which are not canned.
+ *
+ * @return malloced html body
+ */
+char *httpCannedRenderBody(int nResCode, const char *pszMsg)
+{
+    return qstrdupf(
+               "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">" CRLF
+               "<html>" CRLF
+               "<head><title>%d %s</title></head>" CRLF
+               "<body>" CRLF
+               "<h1>%d %s</h1>" CRLF
+               "<p>%s</p>" CRLF
+               "<hr>" CRLF
+               "<address>%s %s/%s</address>" CRLF
+               "</body></html>",
+               nResCode, httpResponseGetMsg(nResCode),
+               nResCode, httpResponseGetMsg(nResCode),
+               pszMsg,
+               g_prginfo, g_prgname, g_prgversion
+           );
+}
+
+const char *httpResponseGetMsg(int nResCode)
+{
+    if (nResCode >= 0 && nResCode < HTTP_CODE_MAX && m_aszResMsg[nResCode] != NULL) {
+        return m_aszResMsg[nResCode];
+    }
+
+    LOG_WARN("PLEASE DEFINE THE MESSAGE FOR %d RESPONSE", nResCode);
+    return "";
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static int _getProtocolIndex(const char *pszHttpVer)
+{
+    if (pszHttpVer == NULL) return -1;
+
+    int i;
+    for (i = CANNED_PROTOCOLS - 1; i >= 0; i--) {
+        if (!strcmp(pszHttpVer, m_aszProtocols[i])) return i;
+    }
+    return -1;
+}
+
+static bool _renderResponse(int nResCode, struct CannedEntry *pEntry)
+{
+    char szRetryAfter[CONST_STRLEN("Retry-After: ") + 10 + CONST_STRLEN(CRLF) + 1] = "";
+    if (nResCode == HTTP_CODE_SERVICE_UNAVAILABLE && g_conf.nOverloadRetryAfter > 0) {
+        snprintf(szRetryAfter, sizeof(szRetryAfter), "Retry-After: %d" CRLF, g_conf.nOverloadRetryAfter);
+    } else if (nResCode == HTTP_CODE_TOO_MANY_REQUESTS) {
+        snprintf(szRetryAfter, sizeof(szRetryAfter), "Retry-After: %d" CRLF, LIMIT_RETRY_AFTER);
+    }
+
+    char *pszHead = qstrdupf("%s"
+                             "Server: %s" CRLF
+                             "Content-Type: text/html" CRLF
+                             "Content-Length: %zu" CRLF
+                             "%s"
+                             "Connection: close" CRLF
+                             CRLF,
+                             pEntry->pszStatusLine[CANNED_PROTOCOLS - 1],
+                             httpCannedGetServer(),
+                             pEntry->nBodySize,
+                             szRetryAfter);
+    if (pszHead == NULL) return false;
+
+    size_t nHeadSize = strlen(pszHead);
+    pEntry->pResponse = (char *)malloc(nHeadSize + pEntry->nBodySize);
+    if (pEntry->pResponse == NULL) {
+        free(pszHead);
+        return false;
+    }
+    memcpy(pEntry->pResponse, pszHead, nHeadSize);
+    memcpy(pEntry->pResponse + nHeadSize, pEntry->pBody, pEntry->nBodySize);
+    pEntry->nResponseSize = nHeadSize + pEntry->nBodySize;
+    free(pszHead);
+
+    return true;
+}
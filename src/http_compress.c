@@ -0,0 +1,528 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: http_compress.c 222 2012-05-24 11:02:37Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * On-the-fly response compression.
+ *
+ * httpResponseOut() passes every response through httpCompressFilter().
+ * Buffered contents are compressed in place and chunked contents get an
+ * encoder which httpResponseOutChunk() streams through. Static files are
+ * compressed once into the disk cache, keyed by path and ETag, and served
+ * from there with sendfile afterwards.
+ *
+ * Encoders are available depending on configure options:
+ *   --enable-zlib   : gzip, deflate
+ *   --enable-brotli : br
+ *   --enable-zstd   : zstd
+ */
+
+#include "qhttpd.h"
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef ENABLE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+#define ENCODER_OUTBUF_SIZE     (16 * 1024) // initial and incremental size
+                                            // of encoder output buffer
+
+struct HttpEncoder {
+    int    nEncoding;
+
+#ifdef ENABLE_ZLIB
+    z_stream zs;
+#endif
+#ifdef ENABLE_BROTLI
+    BrotliEncoderState *pBrotli;
+#endif
+#ifdef ENABLE_ZSTD
+    ZSTD_CCtx *pZstd;
+#endif
+
+    char   *pOutBuf;        // output buffer
+    size_t nOutBufSize;     // allocated size of output buffer
+    size_t nOutSize;        // used size of output buffer
+};
+
+// encodings in order of preference
+static const int m_anEncodings[] = {
+#ifdef ENABLE_BROTLI
+    HTTP_ENCODING_BR,
+#endif
+#ifdef ENABLE_ZSTD
+    HTTP_ENCODING_ZSTD,
+#endif
+#ifdef ENABLE_ZLIB
+    HTTP_ENCODING_GZIP,
+    HTTP_ENCODING_DEFLATE,
+#endif
+    HTTP_ENCODING_IDENTITY
+};
+
+static bool _isCompressibleType(const char *pszContentType);
+static bool _reserveOutBuf(struct HttpEncoder *pEnc, size_t nSize);
+static bool _adjustEtag(struct HttpResponse *pRes);
+static int _compressFile(int nFd, int nEncoding, const char *pszKey);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Decide encoding for the response.
+ *
+ * @param pReq              request
+ * @param pszContentType    content type of the response
+ * @param nContentsLength   size of the contents. -1 if unknown.
+ * @return selected encoding, HTTP_ENCODING_IDENTITY if not compressible
+ */
+int httpCompressSelect(struct HttpRequest *pReq, const char *pszContentType, off_t nContentsLength)
+{
+    if (pReq == NULL || httpCompressIsEligible(pszContentType, nContentsLength) == false) return HTTP_ENCODING_IDENTITY;
+
+    int nAccepted = httpEncodingParse(httpHeaderGetStr(pReq->pHeaders, "ACCEPT-ENCODING"));
+    int i;
+    for (i = 0; m_anEncodings[i] != HTTP_ENCODING_IDENTITY; i++) {
+        if (nAccepted & m_anEncodings[i]) return m_anEncodings[i];
+    }
+
+    return HTTP_ENCODING_IDENTITY;
+}
+
+/**
+ * Check whether the response would be compressed for a client which accepts
+ * it, so the response varies on Accept-Encoding.
+ *
+ * @param pszContentType    content type of the response
+ * @param nContentsLength   size of the contents. -1 if unknown.
+ * @return true if it's compressible, otherwise returns false
+ */
+bool httpCompressIsEligible(const char *pszContentType, off_t nContentsLength)
+{
+    if (g_conf.bEnableCompression == false || m_anEncodings[0] == HTTP_ENCODING_IDENTITY) return false;
+    if (nContentsLength >= 0 && nContentsLength < g_conf.nCompressMinSize) return false;
+    return _isCompressibleType(pszContentType);
+}
+
+/**
+ * Compression filter stage. Called by httpResponseOut() right before
+ * serializing headers.
+ *
+ * @return true if the response is going to be compressed
+ */
+bool httpCompressFilter(struct HttpResponse *pRes)
+{
+    struct HttpRequest *pReq = pRes->pReq;
+
+    if (g_conf.bEnableCompression == false || pReq == NULL || pRes->pEncoder != NULL) return false;
+    if (httpHeaderGetStr(pRes->pHeaders, "Content-Encoding") != NULL) return false;
+    if (pRes->nResponseCode < HTTP_CODE_OK
+        || pRes->nResponseCode == HTTP_CODE_NO_CONTENT
+        || pRes->nResponseCode == HTTP_CODE_PARTIAL_CONTENT
+        || pRes->nResponseCode == HTTP_CODE_NOT_MODIFIED) return false;
+
+    bool bChunked = (pRes->bChunked == true && pRes->pContent == NULL) ? true : false;
+    if (bChunked == false && (pRes->pContent == NULL || pRes->nContentsLength <= 0)) return false;
+
+    if (_isCompressibleType(pRes->pszContentType) == false) return false;
+    httpHeaderSetStr(pRes->pHeaders, "Vary", "Accept-Encoding");
+
+    int nEncoding = httpCompressSelect(pReq, pRes->pszContentType, (bChunked == true) ? -1 : pRes->nContentsLength);
+    if (nEncoding == HTTP_ENCODING_IDENTITY) return false;
+
+    struct HttpEncoder *pEnc = httpEncoderCreate(nEncoding, g_conf.nCompressLevel);
+    if (pEnc == NULL) return false;
+
+    if (bChunked == true) {
+        // httpResponseOutChunk() streams through the encoder
+        pRes->pEncoder = pEnc;
+    } else {
+        size_t nEncSize;
+        const void *pEncData = httpEncoderUpdate(pEnc, pRes->pContent, pRes->nContentsLength, true, &nEncSize);
+
+        // no gain
+        if (pEncData == NULL || nEncSize >= pRes->nContentsLength) {
+            httpEncoderFree(pEnc);
+            return false;
+        }
+
+        // take over the output buffer
+        if (pRes->bContentStatic == false) free(pRes->pContent);
+        pRes->pContent = pEnc->pOutBuf;
+        pRes->nContentsLength = nEncSize;
+        pRes->bContentStatic = false;
+        pEnc->pOutBuf = NULL;
+        httpEncoderFree(pEnc);
+    }
+
+    httpHeaderSetStr(pRes->pHeaders, "Content-Encoding", httpEncodingGetName(nEncoding));
+    _adjustEtag(pRes);
+
+    return true;
+}
+
+/**
+ * Open compressed representation of the static file from the cache,
+ * compressing it into the cache at first.
+ *
+ * @param pReq              request
+ * @param pszFilePath       system path of the file
+ * @param pStat             stat of the file. st_size is replaced by the
+ *                          compressed size if successful.
+ * @param pszContentType    content type of the file
+ * @param pnEncoding        selected encoding will be stored
+ * @return file descriptor of compressed file, otherwise returns -1
+ */
+int httpCompressOpenFile(struct HttpRequest *pReq, const char *pszFilePath, struct stat *pStat,
+                         const char *pszContentType, int *pnEncoding)
+{
+    if (IS_EMPTY_STRING(g_conf.szCacheDir) == true || pStat->st_size > MAX_COMPRESS_FILE_SIZE) return -1;
+
+    int nEncoding = httpCompressSelect(pReq, pszContentType, pStat->st_size);
+    if (nEncoding == HTTP_ENCODING_IDENTITY) return -1;
+
+    // cache key
+    char szEtag[ETAG_MAX];
+    if (etagGet(szEtag, sizeof(szEtag), pReq->pszRequestPath, pszFilePath, pStat, false) == NULL) return -1;
+    char *pszKey = qstrdupf("compress:%s:%s:%s:%d", pszFilePath, szEtag, httpEncodingGetName(nEncoding), g_conf.nCompressLevel);
+    if (pszKey == NULL) return -1;
+
+    struct stat cachestat;
+    int nFd = cacheOpen(pszKey, &cachestat);
+    if (nFd < 0) {
+        // compress once
+        int nOrgFd = sysOpen(pszFilePath, O_RDONLY, 0);
+        if (nOrgFd >= 0) {
+            _compressFile(nOrgFd, nEncoding, pszKey);
+            sysClose(nOrgFd);
+            nFd = cacheOpen(pszKey, &cachestat);
+        }
+    }
+    free(pszKey);
+
+    if (nFd < 0) return -1;
+
+    // no gain
+    if (cachestat.st_size >= pStat->st_size) {
+        sysClose(nFd);
+        return -1;
+    }
+
+    pStat->st_size = cachestat.st_size;
+    *pnEncoding = nEncoding;
+    return nFd;
+}
+
+/**
+ * Create encoder.
+ *
+ * @param nEncoding encoding
+ * @param nLevel    compression level, 1 to 9. mapped for each encoder.
+ * @return encoder if successful, otherwise returns NULL
+ */
+struct HttpEncoder *httpEncoderCreate(int nEncoding, int nLevel)
+{
+    struct HttpEncoder *pEnc = (struct HttpEncoder *)calloc(1, sizeof(struct HttpEncoder));
+    if (pEnc == NULL) return NULL;
+    pEnc->nEncoding = nEncoding;
+
+    if (nLevel < 1) nLevel = 1;
+    else if (nLevel > 9) nLevel = 9;
+
+    bool bInit = false;
+    switch (nEncoding) {
+#ifdef ENABLE_ZLIB
+        case HTTP_ENCODING_GZIP :
+        case HTTP_ENCODING_DEFLATE : {
+            int nWindowBits = (nEncoding == HTTP_ENCODING_GZIP) ? (15 + 16) : 15;
+            if (deflateInit2(&pEnc->zs, nLevel, Z_DEFLATED, nWindowBits, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+                bInit = true;
+            }
+            break;
+        }
+#endif
+#ifdef ENABLE_BROTLI
+        case HTTP_ENCODING_BR : {
+            pEnc->pBrotli = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+            if (pEnc->pBrotli != NULL) {
+                BrotliEncoderSetParameter(pEnc->pBrotli, BROTLI_PARAM_QUALITY, nLevel);
+                BrotliEncoderSetParameter(pEnc->pBrotli, BROTLI_PARAM_LGWIN, 19);
+                bInit = true;
+            }
+            break;
+        }
+#endif
+#ifdef ENABLE_ZSTD
+        case HTTP_ENCODING_ZSTD : {
+            pEnc->pZstd = ZSTD_createCCtx();
+            if (pEnc->pZstd != NULL) {
+                ZSTD_CCtx_setParameter(pEnc->pZstd, ZSTD_c_compressionLevel, nLevel);
+                bInit = true;
+            }
+            break;
+        }
+#endif
+        default :
+            break;
+    }
+
+    if (bInit == false) {
+        LOG_WARN("Can't initialize encoder %d.", nEncoding);
+        free(pEnc);
+        return NULL;
+    }
+
+    // allocate output buffer
+    if (_reserveOutBuf(pEnc, ENCODER_OUTBUF_SIZE) == false) {
+        httpEncoderFree(pEnc);
+        return NULL;
+    }
+
+    return pEnc;
+}
+
+/**
+ * Feed data to encoder.
+ *
+ * @param pEnc      encoder
+ * @param pIn       input data. can be NULL if nInSize is 0.
+ * @param nInSize   size of input data
+ * @param bFinish   true for the last call
+ * @param pnOutSize size of compressed data will be stored. can be 0.
+ * @return pointer of compressed data which is valid until next call,
+ *         otherwise returns NULL on error
+ */
+const void *httpEncoderUpdate(struct HttpEncoder *pEnc, const void *pIn, size_t nInSize, bool bFinish, size_t *pnOutSize)
+{
+    pEnc->nOutSize = 0;
+    *pnOutSize = 0;
+
+    switch (pEnc->nEncoding) {
+#ifdef ENABLE_ZLIB
+        case HTTP_ENCODING_GZIP :
+        case HTTP_ENCODING_DEFLATE : {
+            z_stream *zs = &pEnc->zs;
+            zs->next_in = (Bytef *)pIn;
+            zs->avail_in = nInSize;
+            while (true) {
+                if (_reserveOutBuf(pEnc, ENCODER_OUTBUF_SIZE / 4) == false) return NULL;
+                zs->next_out = (Bytef *)(pEnc->pOutBuf + pEnc->nOutSize);
+                zs->avail_out = pEnc->nOutBufSize - pEnc->nOutSize;
+
+                size_t nAvail = zs->avail_out;
+                int nRet = deflate(zs, (bFinish == true) ? Z_FINISH : Z_NO_FLUSH);
+                pEnc->nOutSize += nAvail - zs->avail_out;
+
+                if (nRet == Z_STREAM_END) break;
+                if (nRet != Z_OK && nRet != Z_BUF_ERROR) return NULL;
+                if (bFinish == false && zs->avail_in == 0 && zs->avail_out > 0) break;
+            }
+            break;
+        }
+#endif
+#ifdef ENABLE_BROTLI
+        case HTTP_ENCODING_BR : {
+            const uint8_t *pNextIn = (const uint8_t *)pIn;
+            size_t nAvailIn = nInSize;
+            BrotliEncoderOperation nOp = (bFinish == true) ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+            while (true) {
+                if (_reserveOutBuf(pEnc, ENCODER_OUTBUF_SIZE / 4) == false) return NULL;
+                uint8_t *pNextOut = (uint8_t *)(pEnc->pOutBuf + pEnc->nOutSize);
+                size_t nAvailOut = pEnc->nOutBufSize - pEnc->nOutSize;
+
+                size_t nAvail = nAvailOut;
+                if (BrotliEncoderCompressStream(pEnc->pBrotli, nOp, &nAvailIn, &pNextIn, &nAvailOut, &pNextOut, NULL) == BROTLI_FALSE) {
+                    return NULL;
+                }
+                pEnc->nOutSize += nAvail - nAvailOut;
+
+                if (nAvailIn > 0 || BrotliEncoderHasMoreOutput(pEnc->pBrotli) == BROTLI_TRUE) continue;
+                if (bFinish == true && BrotliEncoderIsFinished(pEnc->pBrotli) == BROTLI_FALSE) continue;
+                break;
+            }
+            break;
+        }
+#endif
+#ifdef ENABLE_ZSTD
+        case HTTP_ENCODING_ZSTD : {
+            ZSTD_inBuffer in = { pIn, nInSize, 0 };
+            while (true) {
+                if (_reserveOutBuf(pEnc, ENCODER_OUTBUF_SIZE / 4) == false) return NULL;
+                ZSTD_outBuffer out = { pEnc->pOutBuf + pEnc->nOutSize, pEnc->nOutBufSize - pEnc->nOutSize, 0 };
+
+                size_t nRemains = ZSTD_compressStream2(pEnc->pZstd, &out, &in, (bFinish == true) ? ZSTD_e_end : ZSTD_e_continue);
+                if (ZSTD_isError(nRemains)) return NULL;
+                pEnc->nOutSize += out.pos;
+
+                if (bFinish == true) {
+                    if (nRemains == 0) break;
+                } else if (in.pos == in.size) {
+                    break;
+                }
+            }
+            break;
+        }
+#endif
+        default :
+            return NULL;
+    }
+
+    *pnOutSize = pEnc->nOutSize;
+    return pEnc->pOutBuf;
+}
+
+void httpEncoderFree(struct HttpEncoder *pEnc)
+{
+    if (pEnc == NULL) return;
+
+#ifdef ENABLE_ZLIB
+    if (pEnc->nEncoding == HTTP_ENCODING_GZIP || pEnc->nEncoding == HTTP_ENCODING_DEFLATE) deflateEnd(&pEnc->zs);
+#endif
+#ifdef ENABLE_BROTLI
+    if (pEnc->pBrotli != NULL) BrotliEncoderDestroyInstance(pEnc->pBrotli);
+#endif
+#ifdef ENABLE_ZSTD
+    if (pEnc->pZstd != NULL) ZSTD_freeCCtx(pEnc->pZstd);
+#endif
+
+    if (pEnc->pOutBuf != NULL) free(pEnc->pOutBuf);
+    free(pEnc);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/*
+ * CompressTypes is a comma separated list of mime types. The subtype can be
+ * a wildcard such like text/\*. Parameters of the content type are ignored.
+ */
+static bool _isCompressibleType(const char *pszContentType)
+{
+    if (IS_EMPTY_STRING(pszContentType) == true) return false;
+
+    size_t nTypeLen = strcspn(pszContentType, "; \t");
+    const char *p = g_conf.szCompressTypes;
+    while (*p != '\0') {
+        while (*p == ',' || *p == ' ' || *p == '\t') p++;
+        if (*p == '\0') break;
+
+        const char *pszRule = p;
+        size_t nRuleLen = strcspn(p, ", \t");
+        p += nRuleLen;
+
+        if (nRuleLen >= 2 && pszRule[nRuleLen - 2] == '/' && pszRule[nRuleLen - 1] == '*') {
+            // wildcard subtype
+            if (nTypeLen > nRuleLen - 1 && !strncasecmp(pszContentType, pszRule, nRuleLen - 1)) return true;
+        } else if (nRuleLen == nTypeLen && !strncasecmp(pszContentType, pszRule, nRuleLen)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool _reserveOutBuf(struct HttpEncoder *pEnc, size_t nSize)
+{
+    if (pEnc->nOutBufSize - pEnc->nOutSize >= nSize) return true;
+
+    size_t nNewSize = pEnc->nOutBufSize + ENCODER_OUTBUF_SIZE;
+    if (nNewSize < pEnc->nOutSize + nSize) nNewSize = pEnc->nOutSize + nSize;
+
+    char *pNew = (char *)realloc(pEnc->pOutBuf, nNewSize);
+    if (pNew == NULL) return false;
+
+    pEnc->pOutBuf = pNew;
+    pEnc->nOutBufSize = nNewSize;
+    return true;
+}
+
+/*
+ * ETag which was set by handler belongs to the identity representation.
+ */
+static bool _adjustEtag(struct HttpResponse *pRes)
+{
+    const char *pszEtag = httpHeaderGetStr(pRes->pHeaders, "ETag");
+    if (pszEtag == NULL) return false;
+
+    char szEtag[ETAG_MAX];
+    qstrcpy(szEtag, sizeof(szEtag), pszEtag);
+    qstrunchar(szEtag, '"', '"');
+    httpEncodingAppendEtag(szEtag, sizeof(szEtag), pRes);
+    httpHeaderSetStrf(pRes->pHeaders, "ETag", "\"%s\"", szEtag);
+
+    return true;
+}
+
+static int _compressFile(int nFd, int nEncoding, const char *pszKey)
+{
+    char szTmpPath[PATH_MAX];
+    int nTmpFd = cacheCreate(szTmpPath, sizeof(szTmpPath));
+    if (nTmpFd < 0) return -1;
+
+    struct HttpEncoder *pEnc = httpEncoderCreate(nEncoding, g_conf.nCompressLevel);
+    if (pEnc == NULL) {
+        sysClose(nTmpFd);
+        cacheAbort(szTmpPath);
+        return -1;
+    }
+
+    bool bOk = true;
+    char szBuf[ENCODER_OUTBUF_SIZE];
+    while (bOk == true) {
+        ssize_t nRead = read(nFd, szBuf, sizeof(szBuf));
+        if (nRead < 0) {
+            if (errno == EINTR) continue;
+            bOk = false;
+            break;
+        }
+
+        size_t nEncSize;
+        const void *pEncData = httpEncoderUpdate(pEnc, szBuf, nRead, (nRead == 0), &nEncSize);
+        if (pEncData == NULL) bOk = false;
+        else if (nEncSize > 0 && qio_write(nTmpFd, pEncData, nEncSize, -1) != nEncSize) bOk = false;
+
+        if (nRead == 0) break;
+    }
+
+    httpEncoderFree(pEnc);
+    sysClose(nTmpFd);
+
+    if (bOk == false) {
+        cacheAbort(szTmpPath);
+        return -1;
+    }
+
+    return (cacheCommit(pszKey, szTmpPath) == true) ? 0 : -1;
+}
@@ -0,0 +1,216 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: http_encoding.c 221 2012-05-22 08:30:12Z seungyoung.kim $
+ ******************************************************************************/
+
+#include "qhttpd.h"
+
+// encodings in order of preference
+static const struct {
+    int nEncoding;
+    const char *pszName;    // content-coding token
+    const char *pszExt;     // pre-compressed file extension
+} m_aEncodings[] = {
+    { HTTP_ENCODING_BR,   "br",   ".br"  },
+    { HTTP_ENCODING_ZSTD, "zstd", ".zst" },
+    { HTTP_ENCODING_GZIP, "gzip", ".gz"  },
+    { HTTP_ENCODING_DEFLATE, "deflate", NULL },
+};
+#define NUM_ENCODINGS   (sizeof(m_aEncodings) / sizeof(m_aEncodings[0]))
+
+static int _getEncodingByName(const char *pszName, size_t nLen);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/*
+ * Parse Accept-Encoding header.
+ *
+ * @return bit flags of acceptable encodings
+ */
+int httpEncodingParse(const char *pszAcceptEncoding)
+{
+    if (pszAcceptEncoding == NULL) return HTTP_ENCODING_IDENTITY;
+
+    int nAccepted = 0, nRejected = 0;
+    bool bWildcard = false;
+    const char *p = pszAcceptEncoding;
+    while (*p != '\0') {
+        // skip separators
+        while (*p == ',' || *p == ' ' || *p == '\t') p++;
+        if (*p == '\0') break;
+
+        // coding token
+        const char *pszName = p;
+        while (*p != '\0' && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+        size_t nNameLen = p - pszName;
+
+        // parameters, only q is interested in
+        bool bZeroQ = false;
+        while (*p != '\0' && *p != ',') {
+            if (*p == ';') {
+                p++;
+                while (*p == ' ' || *p == '\t') p++;
+                if ((*p == 'q' || *p == 'Q') && p[1] == '=') {
+                    bZeroQ = (strtod(p + 2, NULL) <= 0) ? true : false;
+                    p += 2;
+                }
+                continue;
+            }
+            p++;
+        }
+
+        if (nNameLen == 1 && *pszName == '*') {
+            bWildcard = (bZeroQ == false) ? true : false;
+            continue;
+        }
+
+        int nEncoding = _getEncodingByName(pszName, nNameLen);
+        if (bZeroQ == true) nRejected |= nEncoding;
+        else nAccepted |= nEncoding;
+    }
+
+    if (bWildcard == true) nAccepted |= HTTP_ENCODING_ALL;
+    return (nAccepted & ~nRejected);
+}
+
+/*
+ * Get content-coding token of encoding.
+ */
+const char *httpEncodingGetName(int nEncoding)
+{
+    int i;
+    for (i = 0; i < NUM_ENCODINGS; i++) {
+        if (m_aEncodings[i].nEncoding == nEncoding) return m_aEncodings[i].pszName;
+    }
+    return NULL;
+}
+
+/*
+ * Select pre-compressed representation of the file.
+ *
+ * Looks up the file which has an encoding extension next to the original
+ * file such like foo.js.br, foo.js.zst and foo.js.gz. The sidecar file is
+ * used only when it's not older than the original file.
+ *
+ * @param pReq          request
+ * @param pszFilePath   system path of the original file. replaced by the
+ *                      sidecar file path if selected.
+ * @param nBufSize      size of pszFilePath buffer
+ * @param pStat         stat of the original file. replaced by the sidecar
+ *                      file stat if selected.
+ * @return selected encoding, HTTP_ENCODING_IDENTITY if not selected
+ */
+int httpEncodingSelectFile(struct HttpRequest *pReq, char *pszFilePath, size_t nBufSize, struct stat *pStat)
+{
+    if (g_conf.bEnablePrecompressed == false || !S_ISREG(pStat->st_mode)) return HTTP_ENCODING_IDENTITY;
+
+    int nAccepted = httpEncodingParse(httpHeaderGetStr(pReq->pHeaders, "ACCEPT-ENCODING"));
+    if (nAccepted == HTTP_ENCODING_IDENTITY) return HTTP_ENCODING_IDENTITY;
+
+    size_t nPathLen = strlen(pszFilePath);
+    int i;
+    for (i = 0; i < NUM_ENCODINGS; i++) {
+        if (!(nAccepted & m_aEncodings[i].nEncoding) || m_aEncodings[i].pszExt == NULL) continue;
+
+        char szSidePath[PATH_MAX];
+        if (nPathLen + strlen(m_aEncodings[i].pszExt) >= sizeof(szSidePath)
+            || nPathLen + strlen(m_aEncodings[i].pszExt) >= nBufSize) continue;
+        snprintf(szSidePath, sizeof(szSidePath), "%s%s", pszFilePath, m_aEncodings[i].pszExt);
+
+        struct stat sidestat;
+        if (sysStat(szSidePath, &sidestat) < 0 || !S_ISREG(sidestat.st_mode)) continue;
+        if (sidestat.st_mtime < pStat->st_mtime) {
+            DEBUG("Stale pre-compressed file %s", szSidePath);
+            continue;
+        }
+
+        qstrcpy(pszFilePath, nBufSize, szSidePath);
+        *pStat = sidestat;
+        return m_aEncodings[i].nEncoding;
+    }
+
+    return HTTP_ENCODING_IDENTITY;
+}
+
+/*
+ * Set Content-Encoding and Vary headers of a static file. The type and size
+ * of the original file tell whether other clients may get it compressed.
+ */
+bool httpEncodingSetHeaders(struct HttpResponse *pRes, int nEncoding, const char *pszContentType, off_t nContentsLength)
+{
+    if (nEncoding == HTTP_ENCODING_IDENTITY && g_conf.bEnablePrecompressed == false
+        && httpCompressIsEligible(pszContentType, nContentsLength) == false) return false;
+
+    // the response varies on Accept-Encoding whether it's encoded or not
+    httpHeaderSetStr(pRes->pHeaders, "Vary", "Accept-Encoding");
+
+    const char *pszName = httpEncodingGetName(nEncoding);
+    if (pszName != NULL) {
+        httpHeaderSetStr(pRes->pHeaders, "Content-Encoding", pszName);
+    }
+
+    return true;
+}
+
+/*
+ * Append content-coding to the ETag so encoded representations of the same
+ * file never share a validator with the identity one.
+ */
+char *httpEncodingAppendEtag(char *pszEtag, size_t nBufSize, struct HttpResponse *pRes)
+{
+    const char *pszEncoding = httpHeaderGetStr(pRes->pHeaders, "Content-Encoding");
+    if (pszEncoding != NULL) {
+        size_t nLen = strlen(pszEtag);
+        if (nLen < nBufSize) snprintf(pszEtag + nLen, nBufSize - nLen, "-%s", pszEncoding);
+    }
+    return pszEtag;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static int _getEncodingByName(const char *pszName, size_t nLen)
+{
+    int i;
+    for (i = 0; i < NUM_ENCODINGS; i++) {
+        if (strlen(m_aEncodings[i].pszName) == nLen
+            && !strncasecmp(pszName, m_aEncodings[i].pszName, nLen)) {
+            return m_aEncodings[i].nEncoding;
+        }
+    }
+
+    // alias
+    if (nLen == CONST_STRLEN("x-gzip") && !strncasecmp(pszName, "x-gzip", nLen)) {
+        return HTTP_ENCODING_GZIP;
+    }
+
+    return HTTP_ENCODING_IDENTITY;
+}
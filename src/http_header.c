@@ -30,6 +30,10 @@
 
 #include "qhttpd.h"
 
+static const char *_parseRangePos(const char *p, off_t *pnPos);
+static int _cmpRange(const void *p1, const void *p2);
+static bool _matchEtagList(const char *pszList, const char *pszEtag, bool bWeak);
+
 const char *httpHeaderGetStr(qlisttbl_t *entries, const char *pszName)
 {
     return entries->getstr(entries, pszName, false);
@@ -75,45 +79,165 @@ bool httpHeaderHasCasestr(qlisttbl_t *entries, const char *pszName, const char *
     return false;
 }
 
-bool httpHeaderParseRange(const char *pszRangeHeader, off_t nFilesize, off_t *pnRangeOffset1, off_t *pnRangeOffset2, off_t *pnRangeSize)
+/**
+ * Parse Range header into a range set.
+ *
+ * Ranges are validated against the file size, sorted and coalesced when
+ * they overlap or are separated by a gap smaller than the overhead of
+ * another multipart part.
+ *
+ * @param pszRangeHeader    value of Range header
+ * @param nFilesize         size of the representation
+ * @param pRanges           array which satisfiable ranges are stored in
+ * @param nMaxRanges        the maximum number of ranges to accept
+ * @return the number of satisfiable ranges. 0 if none of them is
+ *         satisfiable. -1 if the header has to be ignored for syntax error,
+ *         unsupported unit or too many ranges.
+ */
+int httpHeaderParseRanges(const char *pszRangeHeader, off_t nFilesize, struct HttpRange *pRanges, int nMaxRanges)
 {
-    if (pszRangeHeader == NULL) return false;
+    if (pszRangeHeader == NULL) return -1;
+
+    // unit
+    const char *p = pszRangeHeader;
+    while (*p == ' ' || *p == '\t') p++;
+    if (strncasecmp(p, "bytes", CONST_STRLEN("bytes"))) return -1;
+    p += CONST_STRLEN("bytes");
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p++ != '=') return -1;
+
+    int nSpecs = 0, nRanges = 0;
+    while (true) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '\0') break;
+
+        // first-byte-pos "-" last-byte-pos, or "-" suffix-length
+        off_t nFirst = -1, nLast = -1;
+        if (isdigit((int)*p)) {
+            if ((p = _parseRangePos(p, &nFirst)) == NULL) return -1;
+        }
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p++ != '-') return -1;
+        while (*p == ' ' || *p == '\t') p++;
+        if (isdigit((int)*p)) {
+            if ((p = _parseRangePos(p, &nLast)) == NULL) return -1;
+        }
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != ',' && *p != '\0') return -1;
 
-    char *pszRange = strdup(pszRangeHeader);
-    char *p1, *p2, *p3;
+        if (nFirst < 0 && nLast < 0) return -1;
+        if (nFirst >= 0 && nLast >= 0 && nLast < nFirst) return -1;
+        if (++nSpecs > nMaxRanges) return -1;
 
-    p1 = strstr(pszRange, "=");
-    p2 = strstr(pszRange, "-");
-    p3 = strstr(pszRange, ",");
+        // resolve against the file size, skipping unsatisfiable one
+        off_t nOffset1, nOffset2;
+        if (nFirst < 0) {
+            if (nLast == 0 || nFilesize == 0) continue;
+            nOffset1 = (nLast >= nFilesize) ? 0 : nFilesize - nLast;
+            nOffset2 = nFilesize - 1;
+        } else {
+            if (nFirst >= nFilesize) continue;
+            nOffset1 = nFirst;
+            nOffset2 = (nLast < 0 || nLast >= nFilesize) ? nFilesize - 1 : nLast;
+        }
 
-    // grammer check
-    if (p1 == NULL || p2 == NULL || p2 < p1) {
-        free(pszRange);
+        pRanges[nRanges].nOffset1 = nOffset1;
+        pRanges[nRanges].nOffset2 = nOffset2;
+        nRanges++;
+    }
+
+    if (nSpecs == 0) return -1;
+    if (nRanges <= 1) return nRanges;
+
+    // sort and coalesce
+    qsort(pRanges, nRanges, sizeof(struct HttpRange), _cmpRange);
+    int i, nLastIdx = 0;
+    for (i = 1; i < nRanges; i++) {
+        if (pRanges[i].nOffset1 <= pRanges[nLastIdx].nOffset2 + 1 + RANGE_COALESCE_GAP) {
+            if (pRanges[i].nOffset2 > pRanges[nLastIdx].nOffset2) {
+                pRanges[nLastIdx].nOffset2 = pRanges[i].nOffset2;
+            }
+        } else {
+            pRanges[++nLastIdx] = pRanges[i];
+        }
+    }
+
+    return nLastIdx + 1;
+}
+
+/**
+ * Evaluate If-Range header.
+ *
+ * @param entries   request headers
+ * @param pszEtag   current entity tag without quotes
+ * @param nMtime    current modification time
+ * @return true if Range header should be honored, false if the full
+ *         representation has to be sent
+ */
+bool httpHeaderCheckIfRange(qlisttbl_t *entries, const char *pszEtag, time_t nMtime)
+{
+    const char *pszIfRange = httpHeaderGetStr(entries, "IF-RANGE");
+    if (pszIfRange == NULL) return true;
+
+    while (*pszIfRange == ' ' || *pszIfRange == '\t') pszIfRange++;
+
+    // weak entity tags never match
+    if (!strncmp(pszIfRange, "W/", 2)) return false;
+
+    // strong entity tag
+    if (*pszIfRange == '"') {
+        size_t nLen = strlen(pszEtag);
+        if (!strncmp(pszIfRange + 1, pszEtag, nLen) && pszIfRange[nLen + 1] == '"') return true;
         return false;
     }
 
-    // multi-range is not supported
-    if (p3 == NULL) p3 = pszRange + strlen(pszRange);
-    else *p3 = '\0';
+    // HTTP-date which must be exactly same with Last-Modified
+    time_t nDate = qtime_parse_gmtstr(pszIfRange);
+    if (nDate >= 0 && nDate == nMtime) return true;
 
-    // parse
-    p1 += 1;
-    *p2 = '\0';
+    return false;
+}
 
-    // start
-    if (p1 == p2) *pnRangeOffset1 = 0;
-    else *pnRangeOffset1 = (off_t)atoll(p1);
+/**
+ * Evaluate preconditions in the order of RFC 7232 section 6. If-Range is
+ * evaluated later by httpHeaderCheckIfRange().
+ *
+ * @param entries   request headers
+ * @param bSafe     true for GET and HEAD, which get 304 instead of 412
+ *                  and honor If-Modified-Since
+ * @param pszEtag   current entity tag without quotes
+ * @param pStat     stat of the current representation, NULL if it doesn't
+ *                  exist
+ * @return 0 to perform the method, otherwise HTTP_CODE_NOT_MODIFIED or
+ *         HTTP_CODE_PRECONDITION_FAILED
+ */
+int httpHeaderCheckConditions(qlisttbl_t *entries, bool bSafe, const char *pszEtag, struct stat *pStat)
+{
+    if (pStat == NULL) pszEtag = NULL;
 
-    // end
-    p2 += 1;
-    if (p2 == p3) *pnRangeOffset2 = nFilesize - 1;
-    else *pnRangeOffset2 = (off_t)atoll(p2);
+    // If-Match, or If-Unmodified-Since without it
+    const char *pszIfMatch = httpHeaderGetStr(entries, "IF-MATCH");
+    const char *pszIfUnmodifiedSince = httpHeaderGetStr(entries, "IF-UNMODIFIED-SINCE");
+    if (pszIfMatch != NULL) {
+        if (_matchEtagList(pszIfMatch, pszEtag, false) == false) return HTTP_CODE_PRECONDITION_FAILED;
+    } else if (pszIfUnmodifiedSince != NULL && pStat != NULL) {
+        time_t nDate = qtime_parse_gmtstr(pszIfUnmodifiedSince);
+        if (nDate >= 0 && pStat->st_mtime > nDate) return HTTP_CODE_PRECONDITION_FAILED;
+    }
 
-    *pnRangeSize = (*pnRangeOffset2 - *pnRangeOffset1) + 1;
-    free(pszRange);
+    // If-None-Match, or If-Modified-Since without it
+    const char *pszIfNoneMatch = httpHeaderGetStr(entries, "IF-NONE-MATCH");
+    const char *pszIfModifiedSince = httpHeaderGetStr(entries, "IF-MODIFIED-SINCE");
+    if (pszIfNoneMatch != NULL) {
+        if (_matchEtagList(pszIfNoneMatch, pszEtag, true) == true) {
+            return (bSafe == true) ? HTTP_CODE_NOT_MODIFIED : HTTP_CODE_PRECONDITION_FAILED;
+        }
+    } else if (pszIfModifiedSince != NULL && bSafe == true && pStat != NULL) {
+        time_t nDate = qtime_parse_gmtstr(pszIfModifiedSince);
+        if (nDate >= 0 && pStat->st_mtime <= nDate) return HTTP_CODE_NOT_MODIFIED;
+    }
 
-    if (*pnRangeOffset1 > *pnRangeOffset2) return false;
-    return true;
+    return 0;
 }
 
 bool httpHeaderSetExpire(qlisttbl_t *entries, int nExpire)
@@ -127,3 +251,67 @@ bool httpHeaderSetExpire(qlisttbl_t *entries, int nExpire)
 
     return false;
 }
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static const char *_parseRangePos(const char *p, off_t *pnPos)
+{
+    off_t nPos = 0;
+    int nDigits;
+    for (nDigits = 0; isdigit((int)*p); p++, nDigits++) {
+        if (nDigits >= 18) return NULL; // overflow
+        nPos = (nPos * 10) + (*p - '0');
+    }
+
+    *pnPos = nPos;
+    return p;
+}
+
+static int _cmpRange(const void *p1, const void *p2)
+{
+    const struct HttpRange *pRange1 = (const struct HttpRange *)p1;
+    const struct HttpRange *pRange2 = (const struct HttpRange *)p2;
+
+    if (pRange1->nOffset1 < pRange2->nOffset1) return -1;
+    if (pRange1->nOffset1 > pRange2->nOffset1) return 1;
+    return 0;
+}
+
+/*
+ * Match entity tag against a list such like "*" or W/"a", "b".
+ *
+ * @param pszEtag   current entity tag, NULL if there is no representation
+ * @param bWeak     weak comparison which ignores W/ prefix, otherwise weak
+ *                  tags never match
+ */
+static bool _matchEtagList(const char *pszList, const char *pszEtag, bool bWeak)
+{
+    size_t nEtagLen = (pszEtag != NULL) ? strlen(pszEtag) : 0;
+    const char *p = pszList;
+    while (true) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '\0') break;
+
+        // any current representation
+        if (*p == '*') return (pszEtag != NULL) ? true : false;
+
+        bool bWeakTag = false;
+        if (p[0] == 'W' && p[1] == '/') {
+            bWeakTag = true;
+            p += 2;
+        }
+        if (*p != '"') break;  // malformed
+
+        const char *pszTag = ++p;
+        const char *pszTagEnd = strchr(pszTag, '"');
+        if (pszTagEnd == NULL) break;
+        p = pszTagEnd + 1;
+
+        if (pszEtag == NULL || (bWeakTag == true && bWeak == false)) continue;
+        if ((size_t)(pszTagEnd - pszTag) == nEtagLen && !strncmp(pszTag, pszEtag, nEtagLen)) return true;
+    }
+
+    return false;
+}
@@ -65,6 +65,9 @@ int httpMain(int nSockFd)
             break;
         }
 
+        // lift send rate limit of the last response
+        streamSetSendRate(nSockFd, 0, 0);
+
         if (pReq->nReqStatus >= 0) { // normal request
             // set request information
             poolSetConnRequest(pReq);
@@ -80,8 +83,14 @@ int httpMain(int nSockFd)
             if (pReq->nReqStatus > 0) {
                 int nResCode = 0;
 
+                // the first request was checked when the connection was accepted
+                if (poolGetChildKeepaliveRequests() > 1 && limitAdmit(false) == false) {
+                    httpHeaderSetStrf(pRes->pHeaders, "Retry-After", "%d", LIMIT_RETRY_AFTER);
+                    nResCode = httpResponseSetSimple(pRes, HTTP_CODE_TOO_MANY_REQUESTS, false, httpResponseGetMsg(HTTP_CODE_TOO_MANY_REQUESTS));
+                }
+
                 // check if the request is for server status page
-                nResCode = httpSpecialRequestHandler(pReq, pRes);
+                if (nResCode == 0) nResCode = httpSpecialRequestHandler(pReq, pRes);
 
 #ifdef ENABLE_LUA
                 if (nResCode == 0 && g_conf.bEnableLua == true) { // if response does not set
@@ -150,7 +159,7 @@ int httpRequestHandler(struct HttpRequest *pReq, struct HttpResponse *pRes)
     } else if (!strcmp(pReq->pszRequestMethod, "PUT")) {
         nResCode = httpMethodPut(pReq, pRes);
     }
-    // HTTP extension - WebDAV methods : PROPFIND,PROPPATCH,MKCOL,MOVE,DELETE,LOCK,UNLOCK
+    // HTTP extension - WebDAV methods : PROPFIND,PROPPATCH,MKCOL,MOVE,COPY,DELETE,LOCK,UNLOCK
     else if (!strcmp(pReq->pszRequestMethod, "PROPFIND")) {
         nResCode = httpMethodPropfind(pReq, pRes);
     } else if (!strcmp(pReq->pszRequestMethod, "PROPPATCH")) {
@@ -159,6 +168,8 @@ int httpRequestHandler(struct HttpRequest *pReq, struct HttpResponse *pRes)
         nResCode = httpMethodMkcol(pReq, pRes);
     } else if (!strcmp(pReq->pszRequestMethod, "MOVE")) {
         nResCode = httpMethodMove(pReq, pRes);
+    } else if (!strcmp(pReq->pszRequestMethod, "COPY")) {
+        nResCode = httpMethodCopy(pReq, pRes);
     } else if (!strcmp(pReq->pszRequestMethod, "DELETE")) {
         nResCode = httpMethodDelete(pReq, pRes);
     } else if (!strcmp(pReq->pszRequestMethod, "LOCK")) {
@@ -187,5 +198,10 @@ int httpSpecialRequestHandler(struct HttpRequest *pReq, struct HttpResponse *pRe
         nResCode = httpStatusResponse(pReq, pRes);
     }
 
+    // dead property files are not resources
+    if (isInternalPathname(pReq->pszRequestPath) == true) {
+        nResCode = response404(pRes);
+    }
+
     return nResCode;
 }
@@ -30,6 +30,22 @@
 
 #include "qhttpd.h"
 
+static bool _sendRange(struct HttpRequest *pReq, int nFd, off_t nFilesize, off_t nOffset, off_t nSize);
+static void _readAhead(int nFd, off_t nOffset, off_t nSize);
+static int _getSendRate(const char *pszPath);
+static int _getResource(struct HttpRequest *pReq, struct HttpResponse *pRes);
+static bool _sendByteRanges(struct HttpRequest *pReq, struct HttpResponse *pRes, int nFd, off_t nFilesize,
+                            const char *pszContentType, struct HttpRange *pRanges, int nRanges);
+static int _openUpload(const char *pszFilePath, char *pszTmpPath, size_t nTmpPathSize, mode_t nMode);
+static bool _commitUpload(int nFd, const char *pszTmpPath, const char *pszFilePath);
+static char *_getUploadTmpPath(char *pszBuf, size_t nBufSize, const char *pszFilePath, const char *pszPrefix, const char *pszSuffix);
+static int _putRange(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszContentRange,
+                     const char *pszFilePath, const char *pszDstPath, mode_t nMode);
+static bool _parseContentRange(const char *pszContentRange, off_t *pnStart, off_t *pnEnd, off_t *pnTotal);
+static int _reapUploadWalk(struct WalkEntry *pEntry, void *pArg);
+
+static pid_t m_nReapPid = 0;
+
 /*
  * http method - OPTIONS
  */
@@ -55,35 +71,19 @@ int httpMethodHead(struct HttpRequest *pReq, struct HttpResponse *pRes)
     char szFilePath[PATH_MAX];
     httpRequestGetSysPath(pReq, szFilePath, sizeof(szFilePath), pReq->pszRequestPath);
 
-    // get file stat
-    struct stat filestat;
-    if (sysStat(szFilePath, &filestat) < 0) {
-        return response404(pRes);
+    // offset of unfinished resumable upload, staged next to the file a
+    // symbolic link points as PUT does
+    char szDstPath[PATH_MAX], szPartPath[PATH_MAX];
+    struct stat partstat;
+    if (realpath(szFilePath, szDstPath) == NULL) qstrcpy(szDstPath, sizeof(szDstPath), szFilePath);
+    if (_getUploadTmpPath(szPartPath, sizeof(szPartPath), szDstPath, UPLOAD_PART_PREFIX, "") != NULL
+        && sysStat(szPartPath, &partstat) == 0) {
+        httpHeaderSetStrf(pRes->pHeaders, "Upload-Offset", "%jd", (intmax_t)partstat.st_size);
     }
 
-    // do action
-    int nResCode = HTTP_CODE_FORBIDDEN;
-    const char *pszHtmlMsg = NULL;
-
-    if (S_ISREG(filestat.st_mode)) {
-        nResCode = HTTP_CODE_OK;
-
-        // get Etag
-        char szEtag[ETAG_MAX];
-        getEtag(szEtag, sizeof(szEtag), pReq->pszRequestPath, &filestat);
-
-        // set headers
-        httpHeaderSetStr(pRes->pHeaders, "Accept-Ranges", "bytes");
-        httpHeaderSetStrf(pRes->pHeaders, "Last-Modified", "%s", qtime_gmt_staticstr(filestat.st_mtime));
-        httpHeaderSetStrf(pRes->pHeaders, "ETag", "\"%s\"", szEtag);
-        httpHeaderSetExpire(pRes->pHeaders, g_conf.nResponseExpires);
-    } else {
-        pszHtmlMsg = httpResponseGetMsg(nResCode);
-    }
-
-    // set response
-    httpResponseSetSimple(pRes, nResCode, true, pszHtmlMsg);
-    return nResCode;
+    // same headers as GET without contents
+    pRes->bHeadOnly = true;
+    return _getResource(pReq, pRes);
 }
 
 /*
@@ -93,6 +93,14 @@ int httpMethodGet(struct HttpRequest *pReq, struct HttpResponse *pRes)
 {
     if (g_conf.methods.bGet == false) return response405(pRes);
 
+    return _getResource(pReq, pRes);
+}
+
+/*
+ * Serve a file or a directory for GET and HEAD.
+ */
+static int _getResource(struct HttpRequest *pReq, struct HttpResponse *pRes)
+{
     // generate abs path
     char szFilePath[PATH_MAX];
     httpRequestGetSysPath(pReq, szFilePath, sizeof(szFilePath), pReq->pszRequestPath);
@@ -104,9 +112,22 @@ int httpMethodGet(struct HttpRequest *pReq, struct HttpResponse *pRes)
     }
 
     // is directory?
-    if (S_ISDIR(filestat.st_mode) && pReq->pszDirectoryIndex != NULL) {
-        qstrcatf(szFilePath, "/%s", pReq->pszDirectoryIndex);
-        if (sysStat(szFilePath, &filestat) < 0) {
+    if (S_ISDIR(filestat.st_mode)) {
+        char szIndexPath[PATH_MAX];
+        struct stat indexstat;
+        bool bIndex = false;
+        if (pReq->pszDirectoryIndex != NULL) {
+            qstrcpy(szIndexPath, sizeof(szIndexPath), szFilePath);
+            qstrcatf(szIndexPath, "/%s", pReq->pszDirectoryIndex);
+            bIndex = (sysStat(szIndexPath, &indexstat) == 0) ? true : false;
+        }
+
+        if (bIndex == true) {
+            qstrcpy(szFilePath, sizeof(szFilePath), szIndexPath);
+            filestat = indexstat;
+        } else if (g_conf.bEnableAutoindex == true) {
+            return httpAutoindex(pReq, pRes, szFilePath, &filestat);
+        } else if (pReq->pszDirectoryIndex != NULL) {
             return response404(pRes);
         }
     }
@@ -114,12 +135,29 @@ int httpMethodGet(struct HttpRequest *pReq, struct HttpResponse *pRes)
     // do action
     int nResCode = HTTP_CODE_FORBIDDEN;
     if (S_ISREG(filestat.st_mode)) {
+        // content type follows the original file name
+        const char *pszContentType = mimeDetect(szFilePath);
+
+        // select pre-compressed file
+        int nEncoding = httpEncodingSelectFile(pReq, szFilePath, sizeof(szFilePath), &filestat);
+
+        // get Etag of the file being sent
+        char szEtag[ETAG_MAX];
+        etagGet(szEtag, sizeof(szEtag), pReq->pszRequestPath, szFilePath, &filestat, true);
+
+        // or compressed one from the cache
+        int nFd = -1;
+        if (nEncoding == HTTP_ENCODING_IDENTITY) {
+            nFd = httpCompressOpenFile(pReq, szFilePath, &filestat, pszContentType, &nEncoding);
+        }
+
         // open file
-        int nFd = sysOpen(szFilePath, O_RDONLY , 0);
+        if (nFd < 0) nFd = sysOpen(szFilePath, O_RDONLY , 0);
         if (nFd < 0) return response404(pRes);
+        httpEncodingSetHeaders(pRes, nEncoding, pszContentType, filestat.st_size);
 
         // send file
-        nResCode = httpRealGet(pReq, pRes, nFd, &filestat, mimeDetect(szFilePath));
+        nResCode = httpRealGet(pReq, pRes, nFd, &filestat, pszContentType, szEtag);
 
         // close file
         sysClose(nFd);
@@ -136,75 +174,74 @@ int httpMethodGet(struct HttpRequest *pReq, struct HttpResponse *pRes)
 /*
  * returns expected response code. it do not send response except of HTTP_CODE_OK and HTTP_CODE_NOT_MODIFIED.
  */
-int httpRealGet(struct HttpRequest *pReq, struct HttpResponse *pRes, int nFd, struct stat *pStat, const char *pszContentType)
+int httpRealGet(struct HttpRequest *pReq, struct HttpResponse *pRes, int nFd, struct stat *pStat, const char *pszContentType,
+                const char *pszEtag)
 {
     // get size
     off_t nFilesize = pStat->st_size;
 
     // get Etag
     char szEtag[ETAG_MAX];
-    getEtag(szEtag, sizeof(szEtag), pReq->pszRequestPath, pStat);
+    qstrcpy(szEtag, sizeof(szEtag), pszEtag);
+    httpEncodingAppendEtag(szEtag, sizeof(szEtag), pRes);
 
     //
     // header handling section
     //
 
-    // check If-Modified-Since header
-    const char *pszIfModifiedSince = httpHeaderGetStr(pReq->pHeaders, "IF-MODIFIED-SINCE");
-    if (pszIfModifiedSince != NULL) {
-        time_t nUnivTime = qtime_parse_gmtstr(pszIfModifiedSince);
-
-        // if succeed to parsing header && file does not modified
-        if (nUnivTime >= 0 && nUnivTime > pStat->st_mtime) {
-            httpHeaderSetStrf(pRes->pHeaders, "ETag", "\"%s\"", szEtag);
-            httpHeaderSetExpire(pRes->pHeaders, g_conf.nResponseExpires);
-            return httpResponseSetSimple(pRes, HTTP_CODE_NOT_MODIFIED, true, NULL);
-        }
-    }
-
-    // check If-None-Match header
-    const char *pszIfNoneMatch = httpHeaderGetStr(pReq->pHeaders, "IF-NONE-MATCH");
-    if (pszIfNoneMatch != NULL) {
-        char *pszMatchEtag = strdup(pszIfNoneMatch);
-        qstrunchar(pszMatchEtag, '"', '"');
-
-        // if ETag is same
-        if (!strcmp(pszMatchEtag, szEtag)) {
-            httpHeaderSetStrf(pRes->pHeaders, "ETag", "\"%s\"", szEtag);
-            httpHeaderSetExpire(pRes->pHeaders, g_conf.nResponseExpires);
-            return httpResponseSetSimple(pRes, HTTP_CODE_NOT_MODIFIED, true, NULL);
-        }
-        free(pszMatchEtag);
+    // check preconditions
+    int nCondCode = httpHeaderCheckConditions(pReq->pHeaders, true, szEtag, pStat);
+    if (nCondCode == HTTP_CODE_NOT_MODIFIED) {
+        httpHeaderSetStrf(pRes->pHeaders, "ETag", "\"%s\"", szEtag);
+        httpHeaderSetExpire(pRes->pHeaders, g_conf.nResponseExpires);
+        return httpResponseSetSimple(pRes, HTTP_CODE_NOT_MODIFIED, true, NULL);
+    } else if (nCondCode != 0) {
+        return httpResponseSetSimple(pRes, nCondCode, true, httpResponseGetMsg(nCondCode));
     }
 
     // check Range header
-    off_t nRangeOffset1, nRangeOffset2, nRangeSize;
-    bool bRangeRequest = false;
+    struct HttpRange aRanges[MAX_HTTP_RANGES];
+    int nRanges = -1;
     const char *pszRange = httpHeaderGetStr(pReq->pHeaders, "RANGE");
-    if (pszRange != NULL) {
-        bRangeRequest = httpHeaderParseRange(pszRange, nFilesize, &nRangeOffset1, &nRangeOffset2, &nRangeSize);
-    }
-
-    // in case of no Range header or parsing failure
-    if (bRangeRequest == false) {
-        nRangeOffset1 = 0;
-        nRangeOffset2 = nFilesize - 1;
-        nRangeSize = nFilesize;
+    if (pszRange != NULL && httpHeaderCheckIfRange(pReq->pHeaders, szEtag, pStat->st_mtime) == true) {
+        nRanges = httpHeaderParseRanges(pszRange, nFilesize, aRanges, MAX_HTTP_RANGES);
     }
 
     //
     // set response headers
     //
-    httpResponseSetCode(pRes, (bRangeRequest == false) ? HTTP_CODE_OK : HTTP_CODE_PARTIAL_CONTENT, true);
-    httpResponseSetContent(pRes, pszContentType, NULL, nRangeSize);
-
     httpHeaderSetStr(pRes->pHeaders, "Accept-Ranges", "bytes");
     httpHeaderSetStrf(pRes->pHeaders, "Last-Modified", "%s", qtime_gmt_staticstr(pStat->st_mtime));
     httpHeaderSetStrf(pRes->pHeaders, "ETag", "\"%s\"", szEtag);
     httpHeaderSetExpire(pRes->pHeaders, g_conf.nResponseExpires);
 
-    if (bRangeRequest == true) {
-        httpHeaderSetStrf(pRes->pHeaders, "Content-Range", "bytes %jd-%jd/%jd", nRangeOffset1, nRangeOffset2, nFilesize);
+    // none of ranges is satisfiable
+    if (nRanges == 0) {
+        httpHeaderSetStrf(pRes->pHeaders, "Content-Range", "bytes */%jd", nFilesize);
+        return httpResponseSetSimple(pRes, HTTP_CODE_REQUESTED_RANGE_NOT_SATISFIABLE, true,
+                                     httpResponseGetMsg(HTTP_CODE_REQUESTED_RANGE_NOT_SATISFIABLE));
+    }
+
+    // limit sending rate of the body
+    streamSetSendRate(pReq->nSockFd, _getSendRate(pReq->pszRequestPath), g_conf.nSendRateFreeSize);
+
+    // multiple ranges
+    if (nRanges > 1) {
+        _sendByteRanges(pReq, pRes, nFd, nFilesize, pszContentType, aRanges, nRanges);
+        return HTTP_CODE_OK;
+    }
+
+    // in case of no Range header or parsing failure
+    if (nRanges < 0) {
+        aRanges[0].nOffset1 = 0;
+        aRanges[0].nOffset2 = nFilesize - 1;
+    }
+    off_t nRangeSize = aRanges[0].nOffset2 - aRanges[0].nOffset1 + 1;
+
+    httpResponseSetCode(pRes, (nRanges < 0) ? HTTP_CODE_OK : HTTP_CODE_PARTIAL_CONTENT, true);
+    httpResponseSetContent(pRes, pszContentType, NULL, nRangeSize);
+    if (nRanges == 1) {
+        httpHeaderSetStrf(pRes->pHeaders, "Content-Range", "bytes %jd-%jd/%jd", aRanges[0].nOffset1, aRanges[0].nOffset2, nFilesize);
     }
 
     // print out headers
@@ -213,15 +250,8 @@ int httpRealGet(struct HttpRequest *pReq, struct HttpResponse *pRes, int nFd, st
     //
     // print out data
     //
-    if (nFilesize > 0) {
-        if (nRangeOffset1 > 0) {
-            lseek(nFd, nRangeOffset1, SEEK_SET);
-        }
-
-        off_t nSent = streamSend(pReq->nSockFd, nFd, nRangeSize, pReq->nTimeout*1000);
-        if (nSent != nRangeSize) {
-            LOG_INFO("Connection closed by foreign host. (%s/%jd/%jd/%jd)", pReq->pszRequestPath, nSent, nRangeOffset1, nRangeSize);
-        }
+    if (nRangeSize > 0 && pRes->bHeadOnly == false) {
+        _sendRange(pReq, nFd, nFilesize, aRanges[0].nOffset1, nRangeSize);
     }
 
     return HTTP_CODE_OK;
@@ -244,17 +274,75 @@ int httpMethodPut(struct HttpRequest *pReq, struct HttpResponse *pRes)
     char szFilePath[PATH_MAX];
     httpRequestGetSysPath(pReq, szFilePath, sizeof(szFilePath), pReq->pszRequestPath);
 
-    // open file for writing
-    int nFd = sysOpen(szFilePath, O_WRONLY|O_CREAT|O_TRUNC, DEF_FILE_MODE);
+    // check preconditions
+    int nCondCode = httpConditionCheck(pReq, pRes, szFilePath);
+    if (nCondCode != 0) return nCondCode;
+
+    // check locks, creating a file adds a member to the collection
+    struct stat filestat;
+    bool bExists = (sysStat(szFilePath, &filestat) == 0) ? true : false;
+    int nLockCode = httpLockCheck(pReq, pRes, szFilePath, false, (bExists == false) ? true : false);
+    if (nLockCode != 0) return nLockCode;
+
+    // replace the file a symbolic link points, keeping its mode
+    char szDstPath[PATH_MAX];
+    qstrcpy(szDstPath, sizeof(szDstPath), szFilePath);
+    mode_t nMode = DEF_FILE_MODE;
+    if (bExists == true) {
+        if (S_ISDIR(filestat.st_mode)) return response403(pRes);
+        nMode = filestat.st_mode & 07777;
+        if (realpath(szFilePath, szDstPath) == NULL) qstrcpy(szDstPath, sizeof(szDstPath), szFilePath);
+    }
+
+    // a part of resumable upload
+    const char *pszContentRange = httpHeaderGetStr(pReq->pHeaders, "CONTENT-RANGE");
+    if (pszContentRange != NULL) {
+        return _putRange(pReq, pRes, pszContentRange, szFilePath, szDstPath, nMode);
+    }
+
+    // receive into a temporary file, so readers never see a partial file
+    char szTmpPath[PATH_MAX];
+    int nFd = _openUpload(szDstPath, szTmpPath, sizeof(szTmpPath), nMode);
     if (nFd < 0) {
         return response403(pRes); // forbidden - can't open file
     }
-
-    // receive file
+    bool bStore = (IS_EMPTY_STRING(g_conf.szContentStore) == false) ? true : false;
+#ifdef FALLOC_FL_KEEP_SIZE
+    // not for the store, the received file may be thrown away
+    if (bStore == false && pReq->nContentsLength > 0) fallocate(nFd, FALLOC_FL_KEEP_SIZE, 0, pReq->nContentsLength);
+#endif
+
+    // receive file, hashing it for the content store or strong etag
+    bool bHash = (bStore == true || g_conf.bEnableStrongEtag == true) ? true : false;
+    struct Sha256 hash;
+    if (bHash == true) {
+        sha256Init(&hash);
+        streamSetSaveHash(&hash);
+    }
     int nResCode = httpRealPut(pReq, pRes, nFd);
-
-    // close file
+    streamSetSaveHash(NULL);
+
+    // replace the file
+    bool bStored = false;
+    if (nResCode == HTTP_CODE_CREATED && bHash == true) {
+        unsigned char szDigest[SHA256_DIGEST_SIZE];
+        sha256Final(&hash, szDigest);
+        if (bStore == true) bStored = storeCommit(nFd, szDigest, szDstPath);
+        if (bStored == false) etagSetHash(nFd, szDigest);
+    }
+    if (nResCode == HTTP_CODE_CREATED && bStored == false && _commitUpload(nFd, szTmpPath, szDstPath) == false) {
+        LOG_WARN("Can't save uploaded file %s. (errno: %d)", szDstPath, errno);
+        nResCode = HTTP_CODE_INTERNAL_SERVER_ERROR;
+    }
     sysClose(nFd);
+    if ((nResCode != HTTP_CODE_CREATED || bStored == true) && szTmpPath[0] != '\0') sysUnlink(szTmpPath);
+    httpPropfindInvalidate(szFilePath);
+
+    // unfinished resumable upload is superseded
+    char szPartPath[PATH_MAX];
+    if (nResCode == HTTP_CODE_CREATED && _getUploadTmpPath(szPartPath, sizeof(szPartPath), szDstPath, UPLOAD_PART_PREFIX, "") != NULL) {
+        sysUnlink(szPartPath);
+    }
 
     // response
     bool bKeepAlive = false;
@@ -328,6 +416,68 @@ int httpRealPut(struct HttpRequest *pReq, struct HttpResponse *pRes, int nFd)
     return HTTP_CODE_CREATED;
 }
 
+/**
+ * Evaluate preconditions of a method which changes the resource.
+ *
+ * @param pszSysPath    system path of the target resource
+ * @return 0 if the method can be performed, otherwise response code which
+ *         is set already
+ */
+int httpConditionCheck(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszSysPath)
+{
+    // most requests have none
+    if (httpHeaderGetStr(pReq->pHeaders, "IF-MATCH") == NULL
+        && httpHeaderGetStr(pReq->pHeaders, "IF-NONE-MATCH") == NULL
+        && httpHeaderGetStr(pReq->pHeaders, "IF-UNMODIFIED-SINCE") == NULL) {
+        return 0;
+    }
+
+    struct stat filestat;
+    char szEtag[ETAG_MAX];
+    bool bExists = (sysStat(pszSysPath, &filestat) == 0) ? true : false;
+    if (bExists == true) etagGet(szEtag, sizeof(szEtag), pReq->pszRequestPath, pszSysPath, &filestat, true);
+
+    int nCondCode = httpHeaderCheckConditions(pReq->pHeaders, false, (bExists == true) ? szEtag : NULL,
+                                              (bExists == true) ? &filestat : NULL);
+    if (nCondCode == 0) return 0;
+
+    // request body, if any, is not read
+    return httpResponseSetSimple(pRes, nCondCode, false, httpResponseGetMsg(nCondCode));
+}
+
+/**
+ * Launch a helper process which removes staging and temporary files of
+ * uploads left untouched for UPLOAD_EXPIRE seconds. Called by the daemon
+ * periodically. Nothing is done while the last helper is running.
+ *
+ * @param nBindSockFd   listening socket, closed in the helper
+ * @return true if launched, otherwise returns false
+ */
+bool httpUploadReapStart(int nBindSockFd)
+{
+    if (g_conf.methods.bPut == false) return false;
+
+    // still running, or reaped already by the daemon
+    if (m_nReapPid > 0) {
+        if (waitpid(m_nReapPid, NULL, WNOHANG) == 0) return false;
+        m_nReapPid = 0;
+    }
+
+    pid_t nPid = fork();
+    if (nPid < 0) {
+        LOG_WARN("Can't launch upload reaping helper. (errno: %d)", errno);
+        return false;
+    } else if (nPid == 0) {
+        if (nBindSockFd >= 0) close(nBindSockFd);
+        time_t nExpire = time(NULL) - UPLOAD_EXPIRE;
+        walkTree(g_conf.szDocumentRoot, -1, false, _reapUploadWalk, (void *)&nExpire);
+        exit(EXIT_SUCCESS);
+    }
+
+    m_nReapPid = nPid;
+    return true;
+}
+
 /*
  * method not implemented
  */
@@ -335,3 +485,368 @@ int httpMethodNotImplemented(struct HttpRequest *pReq, struct HttpResponse *pRes
 {
     return response501(pRes);
 }
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/*
+ * Send a range of the file with page cache hints depending on its size class.
+ */
+static bool _sendRange(struct HttpRequest *pReq, int nFd, off_t nFilesize, off_t nOffset, off_t nSize)
+{
+    if (lseek(nFd, nOffset, SEEK_SET) != nOffset) {
+        LOG_WARN("Can't seek file. (%s/%jd)", pReq->pszRequestPath, nOffset);
+        return false;
+    }
+
+    // access pattern hints
+    bool bHint = (g_conf.nIoHintMinSize > 0 && nFilesize >= g_conf.nIoHintMinSize) ? true : false;
+    if (bHint == true) {
+        if (nSize >= g_conf.nIoHintMinSize) {
+            // sequential read of a large window, read ahead aggressively
+            sysFadvise(nFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            _readAhead(nFd, nOffset, (nSize > IO_WILLNEED_WINDOW) ? IO_WILLNEED_WINDOW : nSize);
+        } else {
+            // random access, prefetch exactly the requested window
+            sysFadvise(nFd, 0, 0, POSIX_FADV_RANDOM);
+            _readAhead(nFd, nOffset, nSize);
+        }
+    }
+
+    // send window by window. the next window is read ahead while the current
+    // one is on the wire, so the disk and the network work at the same time.
+    off_t nSent = 0;
+    while (nSent < nSize) {
+        off_t nWindow = (nSize - nSent > IO_WILLNEED_WINDOW) ? IO_WILLNEED_WINDOW : (nSize - nSent);
+        off_t nNext = nSent + nWindow;
+        if (bHint == true && nNext < nSize) {
+            _readAhead(nFd, nOffset + nNext, (nSize - nNext > IO_WILLNEED_WINDOW) ? IO_WILLNEED_WINDOW : (nSize - nNext));
+        }
+
+        off_t nRet = streamSend(pReq->nSockFd, nFd, nWindow, pReq->nTimeout*1000);
+        if (nRet > 0) nSent += nRet;
+        if (nRet != nWindow) break;
+    }
+
+    // drop cold pages
+    if (g_conf.nIoDropCacheMinSize > 0 && nFilesize >= g_conf.nIoDropCacheMinSize && nSent > 0) {
+        sysFadvise(nFd, nOffset, nSent, POSIX_FADV_DONTNEED);
+    }
+
+    if (nSent != nSize) {
+        LOG_INFO("Connection closed by foreign host. (%s/%jd/%jd/%jd)", pReq->pszRequestPath, nSent, nOffset, nSize);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Start asynchronous read of the window unless it's already in the page
+ * cache. Cached windows cost a single non-blocking probe.
+ */
+static void _readAhead(int nFd, off_t nOffset, off_t nSize)
+{
+    int nCached = sysIsCached(nFd, nOffset);
+    if (nCached >= 0) poolCountPageCache((nCached == 1) ? true : false);
+    if (nCached == 1) return;
+
+    sysFadvise(nFd, nOffset, nSize, POSIX_FADV_WILLNEED);
+}
+
+/*
+ * Find the sending rate for the path. SendRateLocations is a comma separated
+ * list of path=rate pairs and the longest matching path wins.
+ */
+static int _getSendRate(const char *pszPath)
+{
+    int nRate = g_conf.nSendRateLimit;
+    size_t nBestLen = 0;
+
+    const char *p = g_conf.szSendRateLocations;
+    while (*p != '\0') {
+        while (*p == ',' || *p == ' ' || *p == '\t') p++;
+        if (*p == '\0') break;
+
+        const char *pszRule = p;
+        size_t nRuleLen = strcspn(p, ", \t");
+        p += nRuleLen;
+
+        const char *pszRate = memchr(pszRule, '=', nRuleLen);
+        if (pszRate == NULL) continue;
+        size_t nPathLen = pszRate - pszRule;
+
+        // "/dl" covers "/dl" and "/dl/a" but not "/dlx"
+        if (nPathLen <= nBestLen || strncmp(pszPath, pszRule, nPathLen)) continue;
+        if (pszRule[nPathLen - 1] == '/' || pszPath[nPathLen] == '\0' || pszPath[nPathLen] == '/') {
+            nRate = atoi(pszRate + 1);
+            nBestLen = nPathLen;
+        }
+    }
+
+    return nRate;
+}
+
+/*
+ * Send multipart/byteranges response. Each part is sent with sendfile
+ * right after its own part header.
+ */
+static bool _sendByteRanges(struct HttpRequest *pReq, struct HttpResponse *pRes, int nFd, off_t nFilesize,
+                            const char *pszContentType, struct HttpRange *pRanges, int nRanges)
+{
+    char *pszBoundary = qstrunique(pReq->pszRequestPath);
+    if (pszBoundary == NULL) return false;
+
+    // build part headers to calculate Content-Length in advance
+    char *apszPartHeads[MAX_HTTP_RANGES];
+    char szTail[CONST_STRLEN(CRLF "--" "--" CRLF) + 32 + 1];
+    snprintf(szTail, sizeof(szTail), CRLF "--%s--" CRLF, pszBoundary);
+
+    off_t nContentsLength = strlen(szTail);
+    int i;
+    for (i = 0; i < nRanges; i++) {
+        apszPartHeads[i] = qstrdupf(CRLF "--%s" CRLF
+                                    "Content-Type: %s" CRLF
+                                    "Content-Range: bytes %jd-%jd/%jd" CRLF
+                                    CRLF,
+                                    pszBoundary, pszContentType,
+                                    pRanges[i].nOffset1, pRanges[i].nOffset2, nFilesize);
+        if (apszPartHeads[i] == NULL) break;
+        nContentsLength += strlen(apszPartHeads[i]) + (pRanges[i].nOffset2 - pRanges[i].nOffset1 + 1);
+    }
+
+    bool bRet = false;
+    if (i == nRanges) {
+        char szContentType[CONST_STRLEN("multipart/byteranges; boundary=") + 32 + 1];
+        snprintf(szContentType, sizeof(szContentType), "multipart/byteranges; boundary=%s", pszBoundary);
+
+        httpResponseSetCode(pRes, HTTP_CODE_PARTIAL_CONTENT, true);
+        httpResponseSetContent(pRes, szContentType, NULL, nContentsLength);
+        httpResponseOut(pRes);
+
+        for (i = 0; i < nRanges && pRes->bHeadOnly == false; i++) {
+            size_t nHeadSize = strlen(apszPartHeads[i]);
+            if (streamWrite(pReq->nSockFd, apszPartHeads[i], nHeadSize, pReq->nTimeout*1000) != nHeadSize) break;
+            if (_sendRange(pReq, nFd, nFilesize, pRanges[i].nOffset1, pRanges[i].nOffset2 - pRanges[i].nOffset1 + 1) == false) break;
+        }
+        if (pRes->bHeadOnly == true) {
+            bRet = true;
+        } else if (i == nRanges) {
+            streamWrite(pReq->nSockFd, szTail, strlen(szTail), pReq->nTimeout*1000);
+            bRet = true;
+        }
+        i = nRanges;
+    }
+
+    // free
+    while (i-- > 0) {
+        if (apszPartHeads[i] != NULL) free(apszPartHeads[i]);
+    }
+    free(pszBoundary);
+
+    return bRet;
+}
+
+/*
+ * Open a temporary file to receive an upload, in the same directory as the
+ * destination. It's anonymous with O_TMPFILE where supported.
+ *
+ * @param pszTmpPath    path of the temporary file is stored, empty string
+ *                      for an anonymous one
+ * @return file descriptor, or -1 on error
+ */
+static int _openUpload(const char *pszFilePath, char *pszTmpPath, size_t nTmpPathSize, mode_t nMode)
+{
+    pszTmpPath[0] = '\0';
+
+#ifdef O_TMPFILE
+    char szDirPath[PATH_MAX];
+    qstrcpy(szDirPath, sizeof(szDirPath), pszFilePath);
+    char *pszSlash = strrchr(szDirPath, '/');
+    if (pszSlash != NULL) {
+        pszSlash[(pszSlash == szDirPath) ? 1 : 0] = '\0';
+        int nFd = open(szDirPath, O_TMPFILE | O_WRONLY, nMode);
+        if (nFd >= 0) {
+            fchmod(nFd, nMode);
+            return nFd;
+        }
+    }
+#endif
+
+    if (_getUploadTmpPath(pszTmpPath, nTmpPathSize, pszFilePath, UPLOAD_TEMP_PREFIX, ".XXXXXX") == NULL) return -1;
+    int nFd = mkstemp(pszTmpPath);
+    if (nFd < 0) {
+        pszTmpPath[0] = '\0';
+        return -1;
+    }
+    fchmod(nFd, nMode);
+
+    return nFd;
+}
+
+/*
+ * Put the received file in place of the destination.
+ */
+static bool _commitUpload(int nFd, const char *pszTmpPath, const char *pszFilePath)
+{
+    if (g_conf.bPutSync == true && fdatasync(nFd) != 0) return false;
+
+    if (pszTmpPath[0] != '\0') {
+        return (sysRename(pszTmpPath, pszFilePath) == 0) ? true : false;
+    }
+
+    // give the anonymous file a name
+    char szProcPath[64];
+    snprintf(szProcPath, sizeof(szProcPath), "/proc/self/fd/%d", nFd);
+    if (linkat(AT_FDCWD, szProcPath, AT_FDCWD, pszFilePath, AT_SYMLINK_FOLLOW) == 0) return true;
+    if (errno != EEXIST) return false;
+
+    // link can't replace, so link to a temporary name and rename it
+    char szTmpPath[PATH_MAX], szPid[32];
+    snprintf(szPid, sizeof(szPid), ".%u", (unsigned int)getpid());
+    if (_getUploadTmpPath(szTmpPath, sizeof(szTmpPath), pszFilePath, UPLOAD_TEMP_PREFIX, szPid) == NULL) return false;
+    sysUnlink(szTmpPath);
+    if (linkat(AT_FDCWD, szProcPath, AT_FDCWD, szTmpPath, AT_SYMLINK_FOLLOW) != 0) return false;
+    if (sysRename(szTmpPath, pszFilePath) != 0) {
+        sysUnlink(szTmpPath);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Hidden name next to the destination such like "/dir/<prefix>name<suffix>".
+ */
+static char *_getUploadTmpPath(char *pszBuf, size_t nBufSize, const char *pszFilePath, const char *pszPrefix, const char *pszSuffix)
+{
+    const char *pszName = strrchr(pszFilePath, '/');
+    if (pszName == NULL) return NULL;
+    pszName++;
+
+    int nLen = snprintf(pszBuf, nBufSize, "%.*s%s%s%s", (int)(pszName - pszFilePath), pszFilePath, pszPrefix, pszName, pszSuffix);
+    if (nLen < 0 || (size_t)nLen >= nBufSize) return NULL;
+
+    return pszBuf;
+}
+
+/*
+ * PUT with Content-Range, which is a part of resumable upload. Parts are
+ * appended to a staging file next to the destination, which replaces the
+ * destination when the last byte arrives. Parts must come in order, the
+ * staging file size is the offset to resume from, and a part starting at
+ * 0 restarts the upload. Abandoned staging files are removed by
+ * httpUploadReapStart().
+ *
+ * The offset is returned in Upload-Offset header, also for HEAD requests.
+ */
+static int _putRange(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszContentRange,
+                     const char *pszFilePath, const char *pszDstPath, mode_t nMode)
+{
+    // the body is not read if it's refused
+    off_t nStart, nEnd, nTotal;
+    if (_parseContentRange(pszContentRange, &nStart, &nEnd, &nTotal) == false
+        || pReq->nContentsLength != nEnd - nStart + 1) {
+        return httpResponseSetSimple(pRes, HTTP_CODE_BAD_REQUEST, false, httpResponseGetMsg(HTTP_CODE_BAD_REQUEST));
+    }
+
+    char szPartPath[PATH_MAX];
+    if (_getUploadTmpPath(szPartPath, sizeof(szPartPath), pszDstPath, UPLOAD_PART_PREFIX, "") == NULL) {
+        return httpResponseSetSimple(pRes, HTTP_CODE_FORBIDDEN, false, httpResponseGetMsg(HTTP_CODE_FORBIDDEN));
+    }
+    // only the first part creates the staging file
+    int nFd = sysOpen(szPartPath, (nStart == 0) ? (O_WRONLY | O_CREAT) : O_WRONLY, nMode);
+    if (nFd < 0 && nStart != 0 && errno == ENOENT) {
+        httpHeaderSetStr(pRes->pHeaders, "Upload-Offset", "0");
+        return httpResponseSetSimple(pRes, HTTP_CODE_CONFLICT, false, httpResponseGetMsg(HTTP_CODE_CONFLICT));
+    }
+    if (nFd < 0) {
+        return httpResponseSetSimple(pRes, HTTP_CODE_FORBIDDEN, false, httpResponseGetMsg(HTTP_CODE_FORBIDDEN));
+    }
+
+    struct stat partstat;
+    if (nStart == 0) {
+        if (ftruncate(nFd, 0) != 0) {
+            sysClose(nFd);
+            return response500(pRes);
+        }
+    } else if (sysFstat(nFd, &partstat) != 0 || partstat.st_size != nStart) {
+        // out of order, tell where to resume from
+        httpHeaderSetStrf(pRes->pHeaders, "Upload-Offset", "%jd", (intmax_t)((sysFstat(nFd, &partstat) == 0) ? partstat.st_size : 0));
+        sysClose(nFd);
+        return httpResponseSetSimple(pRes, HTTP_CODE_CONFLICT, false, httpResponseGetMsg(HTTP_CODE_CONFLICT));
+    }
+    if (lseek(nFd, nStart, SEEK_SET) != nStart) {
+        sysClose(nFd);
+        return response500(pRes);
+    }
+#ifdef FALLOC_FL_KEEP_SIZE
+    // only what this part brings. the total is just claimed by the client.
+    if (pReq->nContentsLength > 0) fallocate(nFd, FALLOC_FL_KEEP_SIZE, nStart, pReq->nContentsLength);
+#endif
+
+    // receive the part. what's received is kept even if it's broken.
+    int nResCode = httpRealPut(pReq, pRes, nFd);
+    off_t nOffset = (sysFstat(nFd, &partstat) == 0) ? partstat.st_size : 0;
+
+    if (nResCode == HTTP_CODE_CREATED) {
+        if (nTotal >= 0 && nOffset == nTotal) {
+            if ((g_conf.bPutSync == true && fdatasync(nFd) != 0) || sysRename(szPartPath, pszDstPath) != 0) {
+                LOG_WARN("Can't save uploaded file %s. (errno: %d)", pszDstPath, errno);
+                nResCode = HTTP_CODE_INTERNAL_SERVER_ERROR;
+            }
+            httpPropfindInvalidate(pszFilePath);
+        } else {
+            nResCode = HTTP_CODE_ACCEPTED;
+        }
+    }
+    if (nResCode != HTTP_CODE_CREATED) {
+        httpHeaderSetStrf(pRes->pHeaders, "Upload-Offset", "%jd", (intmax_t)nOffset);
+    }
+    sysClose(nFd);
+
+    bool bKeepAlive = (nResCode == HTTP_CODE_CREATED || nResCode == HTTP_CODE_ACCEPTED) ? true : false;
+    httpResponseSetSimple(pRes, nResCode, bKeepAlive, httpResponseGetMsg(nResCode));
+    return nResCode;
+}
+
+/*
+ * Parse Content-Range header such like "bytes 0-499/1234". The total is
+ * -1 if it's given as unknown with an asterisk.
+ */
+static bool _parseContentRange(const char *pszContentRange, off_t *pnStart, off_t *pnEnd, off_t *pnTotal)
+{
+    intmax_t nStart, nEnd, nTotal = -1;
+    int nConsumed = 0;
+    if (sscanf(pszContentRange, "bytes %jd-%jd/%n", &nStart, &nEnd, &nConsumed) != 2 || nConsumed == 0) return false;
+    if (strcmp(pszContentRange + nConsumed, "*") && sscanf(pszContentRange + nConsumed, "%jd", &nTotal) != 1) return false;
+    if (nStart < 0 || nEnd < nStart || (nTotal >= 0 && nEnd >= nTotal)) return false;
+
+    *pnStart = (off_t)nStart;
+    *pnEnd = (off_t)nEnd;
+    *pnTotal = (off_t)nTotal;
+    return true;
+}
+
+/*
+ * Remove a stale staging or temporary file of upload. Symbolic links are
+ * left alone.
+ */
+static int _reapUploadWalk(struct WalkEntry *pEntry, void *pArg)
+{
+    time_t nExpire = *(time_t *)pArg;
+
+    if (pEntry->bLink == true || S_ISREG(pEntry->st.st_mode) == false) return WALK_CONTINUE;
+    if (strncmp(pEntry->pszName, UPLOAD_PART_PREFIX, CONST_STRLEN(UPLOAD_PART_PREFIX))
+        && strncmp(pEntry->pszName, UPLOAD_TEMP_PREFIX, CONST_STRLEN(UPLOAD_TEMP_PREFIX))) {
+        return WALK_CONTINUE;
+    }
+    if (pEntry->st.st_mtime >= nExpire) return WALK_CONTINUE;
+
+    if (unlinkat(pEntry->nDirFd, pEntry->pszName, 0) == 0) {
+        LOG_INFO("Stale upload file %s is removed.", pEntry->pszPath);
+    }
+
+    return WALK_CONTINUE;
+}
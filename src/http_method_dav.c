@@ -30,19 +30,77 @@
 
 #include "qhttpd.h"
 
-static bool _addXmlResponseStart(qvector_t *obXml);
-static bool _addXmlResponseFile(qvector_t *obXml, const char *pszUriPath, struct stat *pFileStat);
-static bool _addXmlResponseFileHead(qvector_t *obXml, const char *pszUriPath, struct stat *pFileStat);
-static bool _addXmlResponseFileInfo(qvector_t *obXml, const char *pszUriPath, struct stat *pFileStat);
-static bool _addXmlResponseFileProp(qvector_t *obXml, struct stat *pFileStat);
-static bool _addXmlResponseFileTail(qvector_t *obXml);
-static bool _addXmlResponseEnd(qvector_t *obXml);
+static bool _addXmlResponseStart(struct Writer *pXml);
+static bool _addXmlResponseFile(struct Writer *pXml, const char *pszUriPath, const char *pszSysPath, struct stat *pFileStat,
+                                const struct PropEntry *pProps, int nProps);
+static bool _addXmlResponseFileHead(struct Writer *pXml, const char *pszUriPath, struct stat *pFileStat);
+static bool _addXmlResponseFileInfo(struct Writer *pXml, const char *pszUriPath, const char *pszSysPath, struct stat *pFileStat);
+static bool _addXmlResponseFileDeadProps(struct Writer *pXml, const struct PropEntry *pProps, int nProps);
+static bool _addXmlResponseFileTail(struct Writer *pXml);
+static bool _addXmlResponseEnd(struct Writer *pXml);
 static char *_getXmlEntry(char *pszXml, char *pszEntryName);
+static char *_getXmlContents(char *pszBuf, size_t nBufSize, const char *pszXml, const char *pszEntryName);
+
+struct PropfindWalk {
+    struct HttpRequest *pReq;   // request
+    struct Writer *pXml;        // xml output
+    const char *pszBasePath;    // request path without trailing slash
+    const char *pszBaseSysPath; // system path of the request path
+    struct DeadProps *apProps[WALK_MAX_DEPTH + 1];  // dead properties of
+                                                    // directories on the way
+    int nEntries;               // number of entries added
+    bool bTruncated;            // flag for entry limit reached
+    bool bFailed;               // flag for output failure
+};
+
+static bool _propfindRender(struct PropfindWalk *pWalk, const char *pszRequestPath, const char *pszFilePath, struct stat *pFileStat, int nDepth);
+static int _propfindWalk(struct WalkEntry *pEntry, void *pArg);
+static int _propfindCached(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszFilePath, struct stat *pFileStat);
+static char *_getCollectionKey(char *pszBuf, size_t nBufSize, const char *pszSysPath);
+static bool _getPropLocation(struct HttpRequest *pReq, const char *pszUriPath, char *pszDir, size_t nDirSize, char *pszMember, size_t nMemberSize);
+static const char *_getDestPath(struct HttpRequest *pReq, char *pszBuf, size_t nBufSize);
+static int _checkDestination(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszSrcPath, bool bCollection, const char *pszDestPath, char *pszDstDir, size_t nDstDirSize, char *pszDstMember, size_t nDstMemberSize);
+static int _responseTreeFailed(struct HttpResponse *pRes, const char *pszBasePath, qlist_t *pFailed);
+
+struct XmlTag {
+    const char *pszStart;       // points '<'
+    const char *pszEnd;         // next to '>'
+    const char *pszName;        // qualified name
+    size_t  nNameLen;
+    const char *pszAttrs;       // attributes
+    size_t  nAttrsLen;
+    bool    bEnd;               // flag for end tag
+    bool    bEmpty;             // flag for empty element tag
+};
+
+struct PropOp {
+    bool    bSet;               // set or remove
+    char    *pszNs;             // namespace
+    char    *pszName;           // local name
+    char    *pszXml;            // whole property element to store
+};
+
+static struct PropOp *_parsePropertyUpdate(const char *pszXml, int *pnOps);
+static void _freePropOps(struct PropOp *pOps, int nOps);
+static char *_buildPropXml(struct XmlTag *pScope, int nScope, const char *pszValue, size_t nValueLen);
+static const char *_xmlNextTag(const char *pszXml, struct XmlTag *pTag);
+static bool _xmlNextNsDecl(const char **ppszAttr, const char *pszAttrEnd, const char **ppszPrefix, size_t *pnPrefixLen, const char **ppszUri, size_t *pnUriLen);
+static char *_xmlGetNs(char *pszBuf, size_t nBufSize, struct XmlTag *pScope, int nScope);
+static const char *_xmlGetLocalName(struct XmlTag *pTag, size_t *pnLen);
+static bool _xmlTagIs(struct XmlTag *pScope, int nScope, const char *pszNs, const char *pszName);
+static bool _addXmlPropStat(struct Writer *pXml, struct PropOp *pOps, int nOps, int nResCode, bool bProtected);
+
+#define MAX_IF_TOKENS   (16)    // the maximum lock tokens taken from If header
+
+static bool _evalIfHeader(struct HttpRequest *pReq, const char *pszIf, const char **ppszTokens, int *pnTokens);
+static bool _evalIfCondition(struct HttpRequest *pReq, const char *pszCond, bool bEtag, const char *pszUriPath, const char *pszSysPath);
+static char *_getUriPath(char *pszBuf, size_t nBufSize, const char *pszUri);
+static int _getLockTimeout(const char *pszTimeout);
+static bool _addXmlLockDiscovery(struct Writer *pXml, struct LockInfo *pLocks, int *pnLevels, int nLocks, const char *pszUriPath);
 
 /*
  * WebDAV method - PROPFIND
  */
-#define FLUSH_CHUNK_IF_EXCEED_SIZE  (10 * 1024)
 int httpMethodPropfind(struct HttpRequest *pReq, struct HttpResponse *pRes)
 {
     if (g_conf.methods.bPropfind == false) return response405(pRes);
@@ -57,93 +115,84 @@ int httpMethodPropfind(struct HttpRequest *pReq, struct HttpResponse *pRes)
         return response404(pRes);
     }
 
-    // parse DEPTH header
-    int nDepth = httpHeaderGetInt(pReq->pHeaders, "DEPTH");
-    if (nDepth == 1) {
+    // parse DEPTH header, -1 for infinity
+    int nDepth = 0;
+    const char *pszDepth = httpHeaderGetStr(pReq->pHeaders, "DEPTH");
+    if (pszDepth != NULL) {
+        if (!strcasecmp(pszDepth, "infinity")) nDepth = -1;
+        else if (!strcmp(pszDepth, "0")) nDepth = 0;
+        else if (!strcmp(pszDepth, "1")) nDepth = 1;
+        else return response400(pRes);
+    }
+
+    if (nDepth != 0) {
         // if the file is not a directory file.
         if (!S_ISDIR(filestat.st_mode)) {
             return response404(pRes);
         }
-    } else if (nDepth > 1) {
-        // not supported
-        DEBUG("Depth(%d) more than 1 is not supported.", nDepth);
-        return response501(pRes);
+
+        // infinite depth is disabled
+        if (nDepth < 0 && g_conf.bAllowPropfindInfinity == false) {
+            DEBUG("Depth infinity is disabled.");
+            httpResponseSetCode(pRes, HTTP_CODE_FORBIDDEN, true);
+            const char *pszError = "<?xml version=\"1.0\" encoding=\"utf-8\"?>" CRLF
+                                   "<D:error xmlns:D=\"DAV:\"><D:propfind-finite-depth/></D:error>" CRLF;
+            httpResponseSetContent(pRes, "text/xml; charset=\"utf-8\"", pszError, strlen(pszError));
+            return HTTP_CODE_FORBIDDEN;
+        }
+    }
+
+    // collection listings are served from the cache
+    if (nDepth == 1 && g_conf.nPropfindCacheTime > 0) {
+        int nResCode = _propfindCached(pReq, pRes, szFilePath, &filestat);
+        if (nResCode != 0) return nResCode;
     }
 
     //
     // generate XML response
     //
 
+    struct PropfindWalk walk;
+    memset((void *)&walk, 0, sizeof(walk));
+    walk.pReq = pReq;
+    walk.pXml = writerCreate(writerChunkOut, (void *)pRes);
+    if (walk.pXml == NULL) return response500(pRes);
+
     // set response as chunked
     httpResponseSetCode(pRes, HTTP_CODE_MULTI_STATUS, true);
     httpResponseSetContent(pRes, "text/xml; charset=\"utf-8\"", NULL, 0);
     httpResponseSetContentChunked(pRes, true); // set transfer-encoding to chunked
     httpResponseOut(pRes);
 
-    // init xml buffer
-    qvector_t *obXml = qvector();
-    _addXmlResponseStart(obXml);
-
-    // locate requested file info at the beginning
-    _addXmlResponseFile(obXml, pReq->pszRequestPath, &filestat);
-
-    // append sub files if requested
-    if (nDepth > 0) {
-        DIR *pDir = sysOpendir(szFilePath);
-        if (pDir != NULL) {
-            struct dirent *pFile;
-            while ((pFile = sysReaddir(pDir)) != NULL) {
-                if (!strcmp(pFile->d_name, ".") || !strcmp(pFile->d_name, "..")) continue;
-
-                // flush buffer if buffered xml is large than max chunk size
-                if (obXml->list->datasize(obXml->list) >= FLUSH_CHUNK_IF_EXCEED_SIZE) {
-                    size_t nChunkSize;
-                    void *pChunk = obXml->toarray(obXml, &nChunkSize);
-                    bool bRet = httpResponseOutChunk(pRes, pChunk, nChunkSize);
-                    DEBUG("[TX-CHUNK] %s", (char *) pChunk);
-                    free(pChunk);
-                    obXml->free(obXml);
-                    obXml = qvector();
-                    if (bRet == false) break;
-                }
-
-                // generate request path
-                char szSubRequestPath[PATH_MAX];
-                snprintf(szSubRequestPath, sizeof(szSubRequestPath), "%s/%s", (strcmp(pReq->pszRequestPath, "/"))?pReq->pszRequestPath:"", pFile->d_name);
-                szSubRequestPath[sizeof(szSubRequestPath) - 1] = '\0';
-
-                // generate abs path
-                char szSubFilePath[PATH_MAX];
-                httpRequestGetSysPath(pReq, szSubFilePath, sizeof(szSubFilePath), szSubRequestPath);
-
-                // get file stat
-                struct stat filestat;
-                if (sysStat(szSubFilePath, &filestat) < 0) continue;
-
-                _addXmlResponseFile(obXml, szSubRequestPath, &filestat);
-            }
-
-            sysClosedir(pDir);
-        }
+    if (_propfindRender(&walk, pReq->pszRequestPath, szFilePath, &filestat, nDepth) == true) {
+        // end of chunk
+        httpResponseOutChunk(pRes, NULL, 0);
     }
+    writerFree(walk.pXml);
 
-    // close XML
-    _addXmlResponseEnd(obXml);
+    return HTTP_CODE_MULTI_STATUS;
+}
 
-    // flush buffer if necessary
-    if (obXml->size(obXml) > 0) {
-        size_t nChunkSize;
-        void *pChunk = obXml->toarray(obXml, &nChunkSize);
-        httpResponseOutChunk(pRes, pChunk, nChunkSize);
-        DEBUG("[TX-CHUNK] %s", (char *) pChunk);
-        free(pChunk);
-    }
-    obXml->free(obXml);
+/**
+ * Invalidate cached PROPFIND results which list the resource. Must be
+ * called after the resource is created, modified or removed.
+ *
+ * @param pszSysPath    system path of the resource
+ */
+void httpPropfindInvalidate(const char *pszSysPath)
+{
+    char szKey[PATH_MAX];
+    _getCollectionKey(szKey, sizeof(szKey), pszSysPath);
 
-    // end of chunk
-    httpResponseOutChunk(pRes, NULL, 0);
+    // listing of the resource itself if it's a collection
+    poolBumpGeneration(szKey);
 
-    return HTTP_CODE_MULTI_STATUS;
+    // and listing of the parent collection
+    char *pszSlash = strrchr(szKey, '/');
+    if (pszSlash != NULL && pszSlash != szKey) {
+        *pszSlash = '\0';
+        poolBumpGeneration(szKey);
+    }
 }
 
 /*
@@ -163,15 +212,83 @@ int httpMethodProppatch(struct HttpRequest *pReq, struct HttpResponse *pRes)
         return response404(pRes);
     }
 
+    // check preconditions
+    int nCondCode = httpConditionCheck(pReq, pRes, szFilePath);
+    if (nCondCode != 0) return nCondCode;
+
+    // check locks
+    int nLockCode = httpLockCheck(pReq, pRes, szFilePath, false, false);
+    if (nLockCode != 0) return nLockCode;
+
+    // parse request XML
+    if (pReq->pContents == NULL || pReq->nContentsLength <= 0) return response400(pRes);
+    int nOps = 0;
+    struct PropOp *pOps = _parsePropertyUpdate(pReq->pContents, &nOps);
+    if (pOps == NULL) return response400(pRes);
+
+    // DAV: properties are live properties, which can't be changed. the
+    // request is atomic, so nothing is changed then.
+    int nProtected = 0;
+    int i;
+    for (i = 0; i < nOps; i++) {
+        if (!strcmp(pOps[i].pszNs, "DAV:")) nProtected++;
+    }
+
+    int nResCode = HTTP_CODE_OK;
+    if (nProtected > 0) {
+        nResCode = HTTP_CODE_FORBIDDEN;
+    } else {
+        char szDir[PATH_MAX], szMember[PATH_MAX];
+        struct DeadProps *pProps = NULL;
+        if (_getPropLocation(pReq, pReq->pszRequestPath, szDir, sizeof(szDir), szMember, sizeof(szMember)) == true) {
+            pProps = propOpen(szDir, true);
+        }
+        if (pProps == NULL) {
+            _freePropOps(pOps, nOps);
+            return response500(pRes);
+        }
+
+        bool bSaved = true;
+        for (i = 0; i < nOps && bSaved == true; i++) {
+            if (pOps[i].bSet == true) bSaved = propSet(pProps, szMember, pOps[i].pszNs, pOps[i].pszName, pOps[i].pszXml);
+            else propRemove(pProps, szMember, pOps[i].pszNs, pOps[i].pszName);
+        }
+        if (bSaved == true) bSaved = propSave(pProps);
+        propClose(pProps);
+
+        if (bSaved == false) {
+            _freePropOps(pOps, nOps);
+            return response500(pRes);
+        }
+        httpPropfindInvalidate(szFilePath);
+    }
+
     //
     // create XML response
     //
     qvector_t *obXml = qvector();
-    _addXmlResponseStart(obXml);
-    _addXmlResponseFileHead(obXml, pReq->pszRequestPath, &filestat);
-    _addXmlResponseFileProp(obXml, &filestat);
-    _addXmlResponseFileTail(obXml);
-    _addXmlResponseEnd(obXml);
+    struct Writer *pXml = writerCreate(writerVectorOut, (void *)obXml);
+    if (pXml == NULL) {
+        obXml->free(obXml);
+        _freePropOps(pOps, nOps);
+        return response500(pRes);
+    }
+    _addXmlResponseStart(pXml);
+    writerPutLit(pXml, "  <D:response>" CRLF
+                       "    <D:href>");
+    writerPutUrl(pXml, pReq->pszRequestPath);
+    writerPutLit(pXml, "</D:href>" CRLF);
+    if (nResCode == HTTP_CODE_OK) {
+        _addXmlPropStat(pXml, pOps, nOps, HTTP_CODE_OK, false);
+    } else {
+        _addXmlPropStat(pXml, pOps, nOps, HTTP_CODE_FORBIDDEN, true);
+        if (nProtected < nOps) _addXmlPropStat(pXml, pOps, nOps, HTTP_CODE_FAILED_DEPENDENCY, false);
+    }
+    writerPutLit(pXml, "  </D:response>" CRLF);
+    _addXmlResponseEnd(pXml);
+    writerFlush(pXml);
+    writerFree(pXml);
+    _freePropOps(pOps, nOps);
 
     // set response
     size_t nXmlSize;
@@ -205,10 +322,19 @@ int httpMethodMkcol(struct HttpRequest *pReq, struct HttpResponse *pRes)
         return response403(pRes);
     }
 
+    // check preconditions
+    int nCondCode = httpConditionCheck(pReq, pRes, szFilePath);
+    if (nCondCode != 0) return nCondCode;
+
+    // check locks
+    int nLockCode = httpLockCheck(pReq, pRes, szFilePath, false, true);
+    if (nLockCode != 0) return nLockCode;
+
     // try to create directory
     if (sysMkdir(szFilePath, DEF_DIR_MODE) != 0) {
         return response500(pRes);
     }
+    httpPropfindInvalidate(szFilePath);
 
     // success
     return response201(pRes);
@@ -222,38 +348,183 @@ int httpMethodMove(struct HttpRequest *pReq, struct HttpResponse *pRes)
     if (g_conf.methods.bMove == false) return response405(pRes);
 
     // fetch destination header
-    const char *pszDestination = httpHeaderGetStr(pReq->pHeaders, "DESTINATION");
-    if (pszDestination == NULL) return response400(pRes);
-
-    // decode url encoded uri
-    char *pszTmp = strdup(pszDestination);
-    qurl_decode(pszTmp);
-    char pszDecDestination[PATH_MAX];
-    qstrcpy(pszDecDestination, sizeof(pszDecDestination), pszTmp);
-    free(pszTmp);
-
-    // parse destination header
-    char *pszDestPath;
-    if (pszDecDestination[0] == '/') {
-        pszDestPath = pszDecDestination;
-    } else if (!strncasecmp(pszDecDestination, "HTTP://", CONST_STRLEN("HTTP://"))) {
-        pszDestPath = strstr(pszDecDestination + CONST_STRLEN("HTTP://"), "/");
-        if (pszDestPath == NULL) return response400(pRes);
-    } else {
-        return response400(pRes);
-    }
+    char szDestBuf[PATH_MAX];
+    const char *pszDestPath = _getDestPath(pReq, szDestBuf, sizeof(szDestBuf));
+    if (pszDestPath == NULL) return response400(pRes);
+    if (isInternalPathname(pszDestPath) == true) return response403(pRes);
 
     // generate system path
     char szOldPath[PATH_MAX], szNewPath[PATH_MAX];
     httpRequestGetSysPath(pReq, szOldPath, sizeof(szOldPath), pReq->pszRequestPath);
     httpRequestGetSysPath(pReq, szNewPath, sizeof(szNewPath), pszDestPath);
 
+    struct stat oldstat;
+    if (sysStat(szOldPath, &oldstat) < 0) {
+        return response404(pRes);
+    }
+
+    // a collection is moved as a whole
+    const char *pszDepth = httpHeaderGetStr(pReq->pHeaders, "DEPTH");
+    if (S_ISDIR(oldstat.st_mode) && pszDepth != NULL && strcasecmp(pszDepth, "infinity")) {
+        return response400(pRes);
+    }
+
+    // Overwrite is T by default
+    bool bOverwrite = true;
+    const char *pszOverwrite = httpHeaderGetStr(pReq->pHeaders, "OVERWRITE");
+    if (pszOverwrite != NULL && !strcasecmp(pszOverwrite, "F")) bOverwrite = false;
+
+    // validate destination
+    char szNewDir[PATH_MAX], szNewMember[PATH_MAX];
+    int nResCode = _checkDestination(pReq, pRes, szOldPath, S_ISDIR(oldstat.st_mode), pszDestPath,
+                                     szNewDir, sizeof(szNewDir), szNewMember, sizeof(szNewMember));
+    if (nResCode != 0) return nResCode;
+
+    // check preconditions
+    int nCondCode = httpConditionCheck(pReq, pRes, szOldPath);
+    if (nCondCode != 0) return nCondCode;
+
+    // check locks of both sides
+    int nLockCode = httpLockCheck(pReq, pRes, szOldPath, true, true);
+    if (nLockCode == 0) nLockCode = httpLockCheck(pReq, pRes, szNewPath, true, true);
+    if (nLockCode != 0) return nLockCode;
+
     // move
-    if (sysRename(szOldPath, szNewPath) != 0) {
+    char szOldKey[PATH_MAX], szNewKey[PATH_MAX];
+    _getCollectionKey(szOldKey, sizeof(szOldKey), szOldPath);
+    _getCollectionKey(szNewKey, sizeof(szNewKey), szNewPath);
+    struct stat newstat;
+    bool bExists = (lstat(szNewKey, &newstat) == 0) ? true : false;
+
+    qlist_t *pFailed = qlist();
+    if (treeMove(szOldKey, szNewKey, bOverwrite, pFailed) == false) {
+        if (errno == EEXIST && bOverwrite == false) nResCode = response412(pRes);
+        else if (pFailed->size(pFailed) > 0) nResCode = _responseTreeFailed(pRes, pszDestPath, pFailed);
+        else nResCode = response500(pRes);
+        if (bExists == true || pFailed->size(pFailed) > 0) httpPropfindInvalidate(szNewPath);
+        pFailed->free(pFailed);
+        return nResCode;
+    }
+    lockDrop(szOldPath);
+    if (bExists == true) lockDrop(szNewPath);
+    httpPropfindInvalidate(szOldPath);
+
+    // dead properties follow the resource
+    char szOldDir[PATH_MAX], szOldMember[PATH_MAX];
+    if (_getPropLocation(pReq, pReq->pszRequestPath, szOldDir, sizeof(szOldDir), szOldMember, sizeof(szOldMember)) == true
+        && propMove(szOldDir, szOldMember, szNewDir, szNewMember) == false) {
+        LOG_WARN("Can't move properties of %s", szOldPath);
+    }
+    httpPropfindInvalidate(szNewPath);
+
+    if (pFailed->size(pFailed) > 0) {
+        nResCode = _responseTreeFailed(pRes, pszDestPath, pFailed);
+    } else if (bExists == true) {
+        nResCode = response204(pRes);
+    } else {
+        nResCode = response201(pRes);
+    }
+    pFailed->free(pFailed);
+
+    return nResCode;
+}
+
+/*
+ * WebDAV method - COPY
+ */
+int httpMethodCopy(struct HttpRequest *pReq, struct HttpResponse *pRes)
+{
+    if (g_conf.methods.bCopy == false) return response405(pRes);
+
+    char szDestBuf[PATH_MAX];
+    const char *pszDestPath = _getDestPath(pReq, szDestBuf, sizeof(szDestBuf));
+    if (pszDestPath == NULL) return response400(pRes);
+    if (isInternalPathname(pszDestPath) == true) return response403(pRes);
+
+    // generate system path
+    char szSrcPath[PATH_MAX], szDstPath[PATH_MAX];
+    httpRequestGetSysPath(pReq, szSrcPath, sizeof(szSrcPath), pReq->pszRequestPath);
+    httpRequestGetSysPath(pReq, szDstPath, sizeof(szDstPath), pszDestPath);
+
+    struct stat srcstat;
+    if (sysStat(szSrcPath, &srcstat) < 0) {
+        return response404(pRes);
+    }
+
+    // Depth is 0 or infinity
+    int nDepth = -1;
+    const char *pszDepth = httpHeaderGetStr(pReq->pHeaders, "DEPTH");
+    if (pszDepth != NULL) {
+        if (!strcmp(pszDepth, "0")) nDepth = 0;
+        else if (strcasecmp(pszDepth, "infinity")) return response400(pRes);
+    }
+
+    // Overwrite is T by default
+    bool bOverwrite = true;
+    const char *pszOverwrite = httpHeaderGetStr(pReq->pHeaders, "OVERWRITE");
+    if (pszOverwrite != NULL && !strcasecmp(pszOverwrite, "F")) bOverwrite = false;
+
+    // validate destination
+    char szDstDir[PATH_MAX], szDstMember[PATH_MAX];
+    int nResCode = _checkDestination(pReq, pRes, szSrcPath, S_ISDIR(srcstat.st_mode), pszDestPath,
+                                     szDstDir, sizeof(szDstDir), szDstMember, sizeof(szDstMember));
+    if (nResCode != 0) return nResCode;
+    char szDstKey[PATH_MAX];
+    _getCollectionKey(szDstKey, sizeof(szDstKey), szDstPath);
+
+    // check preconditions
+    int nCondCode = httpConditionCheck(pReq, pRes, szSrcPath);
+    if (nCondCode != 0) return nCondCode;
+
+    // check locks of the destination
+    int nLockCode = httpLockCheck(pReq, pRes, szDstPath, true, true);
+    if (nLockCode != 0) return nLockCode;
+
+    // the destination is replaced as a whole
+    struct stat dststat;
+    bool bExists = (lstat(szDstKey, &dststat) == 0) ? true : false;
+    if (bExists == true) {
+        if (bOverwrite == false) return response412(pRes);
+
+        qlist_t *pFailed = qlist();
+        bool bRemoved = treeRemove(szDstKey, pFailed);
+        lockDrop(szDstPath);
+        propDelete(szDstDir, szDstMember);
+        httpPropfindInvalidate(szDstPath);
+        if (bRemoved == false) {
+            nResCode = _responseTreeFailed(pRes, pszDestPath, pFailed);
+            pFailed->free(pFailed);
+            return nResCode;
+        }
+        pFailed->free(pFailed);
+    }
+
+    // copy
+    qlist_t *pFailed = qlist();
+    if (treeCopy(szSrcPath, szDstKey, nDepth, pFailed) == false) {
+        pFailed->free(pFailed);
         return response500(pRes);
     }
+    httpPropfindInvalidate(szDstPath);
+
+    // dead properties of the resource itself. the ones of members are
+    // copied with the directories.
+    char szSrcDir[PATH_MAX], szSrcMember[PATH_MAX];
+    if (_getPropLocation(pReq, pReq->pszRequestPath, szSrcDir, sizeof(szSrcDir), szSrcMember, sizeof(szSrcMember)) == true
+        && propCopy(szSrcDir, szSrcMember, szDstDir, szDstMember) == false) {
+        LOG_WARN("Can't copy properties of %s", szSrcPath);
+    }
 
-    return response201(pRes);
+    if (pFailed->size(pFailed) > 0) {
+        nResCode = _responseTreeFailed(pRes, pszDestPath, pFailed);
+    } else if (bExists == true) {
+        nResCode = response204(pRes);
+    } else {
+        nResCode = response201(pRes);
+    }
+    pFailed->free(pFailed);
+
+    return nResCode;
 }
 
 /*
@@ -273,16 +544,43 @@ int httpMethodDelete(struct HttpRequest *pReq, struct HttpResponse *pRes)
         return response404(pRes);
     }
 
+    // a collection is removed as a whole, but the document root
+    const char *pszDepth = httpHeaderGetStr(pReq->pHeaders, "DEPTH");
+    if (S_ISDIR(filestat.st_mode) && pszDepth != NULL && strcasecmp(pszDepth, "infinity")) {
+        return response400(pRes);
+    }
+    char szKey[PATH_MAX];
+    _getCollectionKey(szKey, sizeof(szKey), pReq->pszRequestPath);
+    if (!strcmp(szKey, "/")) return response403(pRes);
+
+    // check preconditions
+    int nCondCode = httpConditionCheck(pReq, pRes, szFilePath);
+    if (nCondCode != 0) return nCondCode;
+
+    // check locks
+    int nLockCode = httpLockCheck(pReq, pRes, szFilePath, S_ISDIR(filestat.st_mode), true);
+    if (nLockCode != 0) return nLockCode;
+
     // remove
-    if (S_ISDIR(filestat.st_mode)) {
-        if (sysRmdir(szFilePath) != 0) {
-            return response403(pRes);
-        }
-    } else {
-        if (sysUnlink(szFilePath) != 0) {
-            return response403(pRes);
-        }
+    _getCollectionKey(szKey, sizeof(szKey), szFilePath);
+    qlist_t *pFailed = qlist();
+    bool bRemoved = treeRemove(szKey, pFailed);
+    if (bRemoved == false) {
+        int nResCode;
+        if (pFailed->size(pFailed) > 0) nResCode = _responseTreeFailed(pRes, pReq->pszRequestPath, pFailed);
+        else nResCode = response403(pRes);
+        pFailed->free(pFailed);
+        httpPropfindInvalidate(szFilePath);
+        return nResCode;
     }
+    pFailed->free(pFailed);
+    lockDrop(szFilePath);
+
+    char szDir[PATH_MAX], szMember[PATH_MAX];
+    if (_getPropLocation(pReq, pReq->pszRequestPath, szDir, sizeof(szDir), szMember, sizeof(szMember)) == true) {
+        propDelete(szDir, szMember);
+    }
+    httpPropfindInvalidate(szFilePath);
 
     return response204(pRes); // no contents
 }
@@ -294,58 +592,100 @@ int httpMethodLock(struct HttpRequest *pReq, struct HttpResponse *pRes)
 {
     if (g_conf.methods.bLock == false) return response405(pRes);
 
-    if (pReq->nContentsLength <= 0) return response400(pRes); // bad request
+    // generate abs path
+    char szFilePath[PATH_MAX];
+    httpRequestGetSysPath(pReq, szFilePath, sizeof(szFilePath), pReq->pszRequestPath);
 
-    // parse request XML
-    char *pszLocktype = _getXmlEntry(pReq->pContents, "locktype");
-    char *pszLockscope = _getXmlEntry(pReq->pContents, "lockscope");
-    char *pszOwner = _getXmlEntry(pReq->pContents, "owner");
-    char *pszTimeout = _getXmlEntry(pReq->pContents, "timeout");
+    // check preconditions
+    int nCondCode = httpConditionCheck(pReq, pRes, szFilePath);
+    if (nCondCode != 0) return nCondCode;
+
+    struct LockInfo lock;
+    memset((void *)&lock, 0, sizeof(lock));
+    int nTimeout = _getLockTimeout(httpHeaderGetStr(pReq->pHeaders, "TIMEOUT"));
+    int nResCode = HTTP_CODE_OK;
+
+    if (pReq->nContentsLength <= 0) {
+        // refresh the lock submitted in If header
+        const char *apszTokens[MAX_IF_TOKENS];
+        int nTokens = 0;
+        const char *pszIf = httpHeaderGetStr(pReq->pHeaders, "IF");
+        if (pszIf == NULL) return response400(pRes);
+        _evalIfHeader(pReq, pszIf, apszTokens, &nTokens);
+
+        int i;
+        for (i = 0; i < nTokens; i++) {
+            if (lockRefresh(szFilePath, apszTokens[i], nTimeout, &lock) == true) break;
+        }
+        for (i = 0; i < nTokens; i++) free((char *)apszTokens[i]);
+        if (lock.szToken[0] == '\0') return response412(pRes);
+    } else {
+        // parse DEPTH header, only 0 and infinity are allowed
+        lock.bInfinity = true;
+        const char *pszDepth = httpHeaderGetStr(pReq->pHeaders, "DEPTH");
+        if (pszDepth != NULL) {
+            if (!strcmp(pszDepth, "0")) lock.bInfinity = false;
+            else if (strcasecmp(pszDepth, "infinity")) return response400(pRes);
+        }
 
-    // create unique token
-    char szToken[32+1];
-    char *pszUnique = qstrunique(NULL);
-    qstrcpy(szToken, sizeof(szToken), pszUnique);
-    free(pszUnique);
+        // parse request XML
+        char *pszLockscope = _getXmlEntry(pReq->pContents, "lockscope");
+        if (pszLockscope != NULL) {
+            if (strstr(pszLockscope, "shared") != NULL) lock.bShared = true;
+            free(pszLockscope);
+        }
+        if (_getXmlContents(lock.szOwner, sizeof(lock.szOwner), pReq->pContents, "owner") == NULL) {
+            lock.szOwner[0] = '\0';
+        }
+        lock.nTimeout = nTimeout;
+
+        // locking an unmapped url creates an empty resource, which needs
+        // tokens of locks on the way. conflicts of the lock itself are
+        // checked by lockAcquire().
+        struct stat filestat;
+        if (sysStat(szFilePath, &filestat) < 0) {
+            int nLockCode = httpLockCheck(pReq, pRes, szFilePath, false, true);
+            if (nLockCode != 0) return nLockCode;
+
+            int nFd = sysOpen(szFilePath, O_WRONLY|O_CREAT|O_EXCL, DEF_FILE_MODE);
+            if (nFd < 0) return response409(pRes);
+            sysClose(nFd);
+            httpPropfindInvalidate(szFilePath);
+            nResCode = HTTP_CODE_CREATED;
+        }
 
-    qvector_t *obXml = qvector();
-    obXml->addstr(obXml, "<?xml version=\"1.0\" encoding=\"utf-8\"?>" CRLF);
-    obXml->addstr(obXml, "<D:prop xmlns:D=\"DAV:\">" CRLF);
-    obXml->addstr(obXml, "  <D:lockdiscovery>" CRLF);
-    obXml->addstr(obXml, "    <D:activelock>" CRLF);
-
-    if (pszLocktype != NULL)
-        obXml->addstrf(obXml,"      <D:locktype><D:%s/></D:locktype>" CRLF, pszLocktype);
-    if (pszLockscope != NULL)
-        obXml->addstrf(obXml,"      <D:lockscope><D:%s/></D:lockscope>" CRLF, pszLockscope);
-    if (pszOwner != NULL)
-        obXml->addstrf(obXml,"      <D:owner>%s</D:owner>" CRLF, pszOwner);
-    if (pszTimeout != NULL)
-        obXml->addstrf(obXml,"      <D:timeout>%s</D:timeout>" CRLF, pszTimeout);
-
-    obXml->addstr(obXml, "      <D:depth>0</D:depth>" CRLF);
-    obXml->addstrf(obXml,"      <D:locktoken><D:href>opaquelocktoken:%s</D:href></D:locktoken>" CRLF, szToken);
-    obXml->addstr(obXml, "    </D:activelock>" CRLF);
-    obXml->addstr(obXml, "  </D:lockdiscovery>" CRLF);
-    obXml->addstr(obXml, "</D:prop>" CRLF);
+        int nLocked = lockAcquire(szFilePath, &lock);
+        if (nLocked == 0) {
+            return httpResponseSetSimple(pRes, HTTP_CODE_LOCKED, true, httpResponseGetMsg(HTTP_CODE_LOCKED));
+        } else if (nLocked < 0) {
+            return response503(pRes);
+        }
+        httpHeaderSetStrf(pRes->pHeaders, "Lock-Token", "<%s>", lock.szToken);
+    }
 
     // set response
+    qvector_t *obXml = qvector();
+    struct Writer *pXml = writerCreate(writerVectorOut, (void *)obXml);
+    if (pXml == NULL) {
+        obXml->free(obXml);
+        return response500(pRes);
+    }
+    writerPutLit(pXml, "<?xml version=\"1.0\" encoding=\"utf-8\"?>" CRLF
+                       "<D:prop xmlns:D=\"DAV:\">" CRLF);
+    _addXmlLockDiscovery(pXml, &lock, NULL, 1, (pReq->nContentsLength > 0) ? pReq->pszRequestPath : NULL);
+    writerPutLit(pXml, "</D:prop>" CRLF);
+    writerFlush(pXml);
+    writerFree(pXml);
+
     size_t nXmlSize;
     char *pszXmlData = (char *)obXml->toarray(obXml, &nXmlSize);
+    obXml->free(obXml);
 
-    httpResponseSetCode(pRes, HTTP_CODE_OK, true);
-    httpHeaderSetStrf(pRes->pHeaders, "Lock-Token", "<opaquelocktoken:%s>", szToken);
+    httpResponseSetCode(pRes, nResCode, true);
     httpResponseSetContent(pRes, "text/xml; charset=\"utf-8\"", pszXmlData, nXmlSize);
     free(pszXmlData);
 
-    // free
-    obXml->free(obXml);
-    if (pszLocktype != NULL) free(pszLocktype);
-    if (pszLockscope != NULL) free(pszLockscope);
-    if (pszOwner != NULL) free(pszOwner);
-    if (pszTimeout != NULL) free(pszTimeout);
-
-    return HTTP_CODE_OK;
+    return nResCode;
 }
 
 /*
@@ -355,117 +695,350 @@ int httpMethodUnlock(struct HttpRequest *pReq, struct HttpResponse *pRes)
 {
     if (g_conf.methods.bUnlock == false) return response405(pRes);
 
+    // fetch Lock-Token header in the form of <token>
+    const char *pszLockToken = httpHeaderGetStr(pReq->pHeaders, "LOCK-TOKEN");
+    if (pszLockToken == NULL) return response400(pRes);
+
+    char szToken[LOCK_TOKEN_MAX];
+    qstrcpy(szToken, sizeof(szToken), pszLockToken);
+    qstrtrim(szToken);
+    qstrunchar(szToken, '<', '>');
+
+    // generate abs path
+    char szFilePath[PATH_MAX];
+    httpRequestGetSysPath(pReq, szFilePath, sizeof(szFilePath), pReq->pszRequestPath);
+
+    if (lockRelease(szFilePath, szToken) == false) {
+        return response409(pRes);
+    }
+
     return response204(pRes);
 }
 
+/**
+ * Evaluate If header and check locks of the resource which is going to be
+ * modified. Response is set if it's not allowed.
+ *
+ * @param pszSysPath    system path of the resource
+ * @param bRecursive    true if resources below are modified too
+ * @param bMember       true if the resource is created or removed
+ * @return 0 if allowed, otherwise response code
+ */
+int httpLockCheck(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszSysPath, bool bRecursive, bool bMember)
+{
+    const char *apszTokens[MAX_IF_TOKENS];
+    int nTokens = 0;
+
+    const char *pszIf = httpHeaderGetStr(pReq->pHeaders, "IF");
+    if (pszIf != NULL && _evalIfHeader(pReq, pszIf, apszTokens, &nTokens) == false) {
+        DEBUG("If header is false. (%s)", pszIf);
+        int i;
+        for (i = 0; i < nTokens; i++) free((char *)apszTokens[i]);
+        return httpResponseSetSimple(pRes, HTTP_CODE_PRECONDITION_FAILED, false, httpResponseGetMsg(HTTP_CODE_PRECONDITION_FAILED));
+    }
+
+    bool bAllowed = lockIsAllowed(pszSysPath, bRecursive, bMember, apszTokens, nTokens);
+    int i;
+    for (i = 0; i < nTokens; i++) free((char *)apszTokens[i]);
+    if (bAllowed == false) {
+        return httpResponseSetSimple(pRes, HTTP_CODE_LOCKED, false, httpResponseGetMsg(HTTP_CODE_LOCKED));
+    }
+
+    return 0;
+}
+
 //
 // internal static functions
 //
 
-static bool _addXmlResponseStart(qvector_t *obXml)
+static bool _addXmlResponseStart(struct Writer *pXml)
 {
-    obXml->addstr(obXml, "<?xml version=\"1.0\" encoding=\"utf-8\"?>" CRLF);
-    obXml->addstr(obXml, "<D:multistatus xmlns:D=\"DAV:\">" CRLF);
+    return writerPutLit(pXml, "<?xml version=\"1.0\" encoding=\"utf-8\"?>" CRLF
+                              "<D:multistatus xmlns:D=\"DAV:\">" CRLF);
+}
 
-    return true;
+static bool _addXmlResponseFile(struct Writer *pXml, const char *pszUriPath, const char *pszSysPath, struct stat *pFileStat,
+                                const struct PropEntry *pProps, int nProps)
+{
+    _addXmlResponseFileHead(pXml, pszUriPath, pFileStat);
+    _addXmlResponseFileInfo(pXml, pszUriPath, pszSysPath, pFileStat);
+    _addXmlResponseFileDeadProps(pXml, pProps, nProps);
+    return _addXmlResponseFileTail(pXml);
 }
 
-static bool _addXmlResponseFile(qvector_t *obXml, const char *pszUriPath, struct stat *pFileStat)
+static bool _addXmlResponseFileHead(struct Writer *pXml, const char *pszUriPath, struct stat *pFileStat)
 {
-    _addXmlResponseFileHead(obXml, pszUriPath, pFileStat);
-    _addXmlResponseFileInfo(obXml, pszUriPath, pFileStat);
-    _addXmlResponseFileTail(obXml);
-    return true;
+    writerPutLit(pXml, "  <D:response xmlns:ns0=\"DAV:\" xmlns:ns1=\"urn:schemas-microsoft-com:\">" CRLF
+                       "    <D:href>");
+    writerPutUrl(pXml, pszUriPath);
+    if (S_ISDIR(pFileStat->st_mode) && strcmp(pszUriPath, "/")) writerPutLit(pXml, "/");
+    return writerPutLit(pXml, "</D:href>" CRLF
+                              "    <D:propstat>" CRLF
+                              "      <D:prop>" CRLF);
 }
 
-static bool _addXmlResponseFileHead(qvector_t *obXml, const char *pszUriPath, struct stat *pFileStat)
+static bool _addXmlResponseFileInfo(struct Writer *pXml, const char *pszUriPath, const char *pszSysPath, struct stat *pFileStat)
 {
-    char *pszEncPath = qurl_encode(pszUriPath, strlen(pszUriPath));
+    // resource type
+    bool bCollection = S_ISDIR(pFileStat->st_mode) ? true : false;
+    const char *pszContentType = (bCollection == true) ? "httpd/unix-directory" : mimeDetect(pszUriPath);
 
-    char *pszTailSlash = "";
-    if (S_ISDIR(pFileStat->st_mode) && strcmp(pszUriPath, "/")) pszTailSlash = "/";
+    // etag, unknown until the file is hashed
+    char szEtag[ETAG_MAX];
+    bool bEtag = (etagGet(szEtag, sizeof(szEtag), pszUriPath, pszSysPath, pFileStat, false) != NULL) ? true : false;
+
+    // out
+    if (bCollection == true) {
+        writerPutLit(pXml, "        <ns0:resourcetype><D:collection/></ns0:resourcetype>" CRLF);
+    } else {
+        writerPutLit(pXml, "        <ns0:resourcetype></ns0:resourcetype>" CRLF);
+    }
 
-    obXml->addstr(obXml, "  <D:response xmlns:ns0=\"DAV:\" xmlns:ns1=\"urn:schemas-microsoft-com:\">" CRLF);
-    obXml->addstrf(obXml,"    <D:href>%s%s</D:href>" CRLF, pszEncPath, pszTailSlash);
-    obXml->addstr(obXml, "    <D:propstat>" CRLF);
-    obXml->addstr(obXml, "      <D:prop>" CRLF);
+    writerPutLit(pXml, "        <ns0:getcontentlength>");
+    writerPutInt(pXml, pFileStat->st_size);
+    // the creationdate property specifies the use of the ISO 8601 date format [ISO-8601].
+    writerPutLit(pXml, "</ns0:getcontentlength>" CRLF
+                       "        <ns0:creationdate>");
+    writerPutIsoDate(pXml, pFileStat->st_mtime);
+    writerPutLit(pXml, "</ns0:creationdate>" CRLF
+                       "        <ns0:getlastmodified>");
+    writerPutHttpDate(pXml, pFileStat->st_mtime);
+    writerPutLit(pXml, "</ns0:getlastmodified>" CRLF);
+    if (bEtag == true) {
+        writerPutLit(pXml, "        <ns0:getetag>\"");
+        writerPuts(pXml, szEtag);
+        writerPutLit(pXml, "\"</ns0:getetag>" CRLF);
+    }
+    writerPutLit(pXml, "        <D:supportedlock>" CRLF
+                       "          <D:lockentry>" CRLF
+                       "            <D:lockscope><D:exclusive/></D:lockscope>" CRLF
+                       "            <D:locktype><D:write/></D:locktype>" CRLF
+                       "          </D:lockentry>" CRLF
+                       "          <D:lockentry>" CRLF
+                       "            <D:lockscope><D:shared/></D:lockscope>" CRLF
+                       "            <D:locktype><D:write/></D:locktype>" CRLF
+                       "          </D:lockentry>" CRLF
+                       "        </D:supportedlock>" CRLF);
+
+    // active locks
+    struct LockInfo aLocks[LOCK_DISCOVERY_MAX];
+    int anLevels[LOCK_DISCOVERY_MAX];
+    int nLocks = lockGetAll(pszSysPath, aLocks, anLevels, LOCK_DISCOVERY_MAX);
+    _addXmlLockDiscovery(pXml, aLocks, anLevels, nLocks, pszUriPath);
+
+    writerPutLit(pXml, "        <D:getcontenttype>");
+    writerPuts(pXml, pszContentType);
+    return writerPutLit(pXml, "</D:getcontenttype>" CRLF);
+}
 
-    free(pszEncPath);
+static bool _addXmlResponseFileDeadProps(struct Writer *pXml, const struct PropEntry *pProps, int nProps)
+{
+    int i;
+    for (i = 0; i < nProps; i++) {
+        writerPutLit(pXml, "        ");
+        writerPuts(pXml, pProps[i].pszXml);
+        writerPutLit(pXml, CRLF);
+    }
     return true;
 }
 
-static bool _addXmlResponseFileInfo(qvector_t *obXml, const char *pszUriPath, struct stat *pFileStat)
+static bool _addXmlResponseFileTail(struct Writer *pXml)
 {
-    // resource type
-    const char *pszResourceType;
-    const char *pszContentType;
-    if (S_ISDIR(pFileStat->st_mode)) {
-        pszResourceType = "<D:collection/>";
-        pszContentType = "httpd/unix-directory";
-    } else {
-        pszResourceType = "";
-        pszContentType = mimeDetect(pszUriPath);
+    return writerPutf(pXml, "      </D:prop>" CRLF
+                            "      <D:status>%s %d %s</D:status>" CRLF
+                            "    </D:propstat>" CRLF
+                            "  </D:response>" CRLF,
+                      HTTP_PROTOCOL_11, HTTP_CODE_OK, httpResponseGetMsg(HTTP_CODE_OK));
+}
+
+static bool _addXmlResponseEnd(struct Writer *pXml)
+{
+    return writerPutLit(pXml, "</D:multistatus>" CRLF);
+}
+
+/*
+ * Render multistatus of the resource and its members.
+ *
+ * @return true if everything is written, otherwise returns false
+ */
+static bool _propfindRender(struct PropfindWalk *pWalk, const char *pszRequestPath, const char *pszFilePath, struct stat *pFileStat, int nDepth)
+{
+    struct Writer *pXml = pWalk->pXml;
+    _addXmlResponseStart(pXml);
+
+    // locate requested file info at the beginning
+    char szDir[PATH_MAX], szMember[PATH_MAX];
+    struct DeadProps *pProps = NULL;
+    if (_getPropLocation(pWalk->pReq, pszRequestPath, szDir, sizeof(szDir), szMember, sizeof(szMember)) == true) {
+        pProps = propOpen(szDir, false);
     }
+    int nProps = 0;
+    const struct PropEntry *pPropEntry = (pProps != NULL) ? propGet(pProps, szMember, &nProps) : NULL;
+    _addXmlResponseFile(pXml, pszRequestPath, pszFilePath, pFileStat, pPropEntry, nProps);
+    if (pProps != NULL) propClose(pProps);
 
-    // the creationdate property specifies the use of the ISO 8601 date format [ISO-8601].
-    char szLastModified[sizeof(char) * (CONST_STRLEN("YYYY-MM-DDThh:mm:ssZ") + 1)];
-    qtime_gmt_strf(szLastModified, sizeof(szLastModified), pFileStat->st_mtime, "%Y-%m-%dT%H:%M:%SZ");
+    // append sub files if requested
+    if (nDepth != 0) {
+        char szBasePath[PATH_MAX];
+        qstrcpy(szBasePath, sizeof(szBasePath), pszRequestPath);
+        size_t nBaseLen = strlen(szBasePath);
+        if (nBaseLen > 0 && szBasePath[nBaseLen - 1] == '/') szBasePath[nBaseLen - 1] = '\0';
+
+        pWalk->pszBasePath = szBasePath;
+        pWalk->pszBaseSysPath = pszFilePath;
+        walkTree(pszFilePath, nDepth, false, _propfindWalk, (void *)pWalk);
+        pWalk->pszBasePath = NULL;
+        pWalk->pszBaseSysPath = NULL;
+
+        int i;
+        for (i = 0; i <= WALK_MAX_DEPTH; i++) {
+            if (pWalk->apProps[i] == NULL) continue;
+            propClose(pWalk->apProps[i]);
+            pWalk->apProps[i] = NULL;
+        }
 
-    // etag
-    char szEtag[ETAG_MAX];
-    getEtag(szEtag, sizeof(szEtag), pszUriPath, pFileStat);
+        // tell the client the listing is incomplete
+        if (pWalk->bTruncated == true) {
+            LOG_INFO("PROPFIND stopped at %d entries. (%s)", pWalk->nEntries, pszRequestPath);
+            writerPutLit(pXml, "  <D:response>" CRLF
+                               "    <D:href>");
+            writerPutUrl(pXml, pszRequestPath);
+            writerPutf(pXml, "</D:href>" CRLF
+                             "    <D:status>%s %d %s</D:status>" CRLF
+                             "  </D:response>" CRLF,
+                       HTTP_PROTOCOL_11, HTTP_CODE_INSUFFICIENT_STORAGE, httpResponseGetMsg(HTTP_CODE_INSUFFICIENT_STORAGE));
+        }
+    }
 
-    // out
-    obXml->addstrf(obXml,"        <ns0:resourcetype>%s</ns0:resourcetype>" CRLF, pszResourceType);
-
-    obXml->addstrf(obXml,"        <ns0:getcontentlength>%jd</ns0:getcontentlength>" CRLF, pFileStat->st_size);
-    obXml->addstrf(obXml,"        <ns0:creationdate>%s</ns0:creationdate>" CRLF, szLastModified);
-    obXml->addstrf(obXml,"        <ns0:getlastmodified>%s</ns0:getlastmodified>" CRLF, qtime_gmt_staticstr(pFileStat->st_mtime));
-    obXml->addstrf(obXml,"        <ns0:getetag>\"%s\"</ns0:getetag>" CRLF, szEtag);
-
-    obXml->addstr(obXml, "        <D:supportedlock>" CRLF);
-    obXml->addstr(obXml, "          <D:lockentry>" CRLF);
-    obXml->addstr(obXml, "            <D:lockscope><D:exclusive/></D:lockscope>" CRLF);
-    obXml->addstr(obXml, "            <D:locktype><D:write/></D:locktype>" CRLF);
-    obXml->addstr(obXml, "          </D:lockentry>" CRLF);
-    obXml->addstr(obXml, "          <D:lockentry>" CRLF);
-    obXml->addstr(obXml, "            <D:lockscope><D:shared/></D:lockscope>" CRLF);
-    obXml->addstr(obXml, "            <D:locktype><D:write/></D:locktype>" CRLF);
-    obXml->addstr(obXml, "          </D:lockentry>" CRLF);
-    obXml->addstr(obXml, "        </D:supportedlock>" CRLF);
-
-    obXml->addstr(obXml, "        <D:lockdiscovery></D:lockdiscovery>" CRLF);
-    obXml->addstrf(obXml,"        <D:getcontenttype>%s</D:getcontenttype>" CRLF, pszContentType);
+    // close XML and flush buffer
+    _addXmlResponseEnd(pXml);
+    if (writerFlush(pXml) == false) pWalk->bFailed = true;
 
-    return true;
+    return (pWalk->bFailed == true) ? false : true;
 }
 
-static bool _addXmlResponseFileProp(qvector_t *obXml, struct stat *pFileStat)
+static int _propfindWalk(struct WalkEntry *pEntry, void *pArg)
 {
-    //obXml->addstr(obXml, "      <ns1:Win32LastModifiedTime/>" CRLF);
-    //obXml->addstr(obXml, "      <ns1:Win32FileAttributes/>" CRLF);
-    obXml->addstrf(obXml,"        <ns1:Win32CreationTime>%s</ns1:Win32CreationTime>" CRLF, qtime_gmt_staticstr(pFileStat->st_mtime));
-    obXml->addstrf(obXml,"        <ns1:Win32LastAccessTime>%s</ns1:Win32LastAccessTime>" CRLF, qtime_gmt_staticstr(pFileStat->st_atime));
-    obXml->addstrf(obXml,"        <ns1:Win32LastModifiedTime>%s</ns1:Win32LastModifiedTime>" CRLF, qtime_gmt_staticstr(pFileStat->st_mtime));
-    obXml->addstr(obXml,"         <ns1:Win32FileAttributes>00000020</ns1:Win32FileAttributes>" CRLF);
+    struct PropfindWalk *pWalk = (struct PropfindWalk *)pArg;
 
-    return true;
+    // property files are not resources
+    if (isInternalFilename(pEntry->pszName) == true) return WALK_CONTINUE;
+
+    if (pWalk->nEntries >= g_conf.nPropfindMaxEntries && g_conf.nPropfindMaxEntries > 0) {
+        pWalk->bTruncated = true;
+        return WALK_STOP;
+    }
+
+    char szSubRequestPath[PATH_MAX];
+    snprintf(szSubRequestPath, sizeof(szSubRequestPath), "%s%s", pWalk->pszBasePath, pEntry->pszPath);
+
+    // dead properties are kept by the parent directory, which is read once
+    char szDir[PATH_MAX];
+    snprintf(szDir, sizeof(szDir), "%s%.*s", pWalk->pszBaseSysPath,
+             (int)(strlen(pEntry->pszPath) - strlen(pEntry->pszName) - 1), pEntry->pszPath);
+    struct DeadProps **ppProps = &pWalk->apProps[pEntry->nDepth];
+    if (*ppProps != NULL && strcmp(propGetDirPath(*ppProps), szDir)) {
+        propClose(*ppProps);
+        *ppProps = NULL;
+    }
+    if (*ppProps == NULL) *ppProps = propOpen(szDir, false);
+    int nProps = 0;
+    const struct PropEntry *pProps = (*ppProps != NULL) ? propGet(*ppProps, pEntry->pszName, &nProps) : NULL;
+
+    char szSubSysPath[PATH_MAX];
+    snprintf(szSubSysPath, sizeof(szSubSysPath), "%s%s", pWalk->pszBaseSysPath, pEntry->pszPath);
+    if (_addXmlResponseFile(pWalk->pXml, szSubRequestPath, szSubSysPath, &pEntry->st, pProps, nProps) == false) {
+        pWalk->bFailed = true;
+        return WALK_STOP;
+    }
+    pWalk->nEntries++;
+
+    return WALK_CONTINUE;
 }
 
-static bool _addXmlResponseFileTail(qvector_t *obXml)
+/*
+ * Serve Depth 1 listing from the cache. The entry is keyed by the collection,
+ * its generation bumped by our own write methods, the generation of locks
+ * for lockdiscovery, its modification time for changes made outside, and a
+ * time slot of PropfindCacheTime for changes of member files made outside.
+ *
+ * @return response code, or 0 if it can't be served from the cache
+ */
+static int _propfindCached(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszFilePath, struct stat *pFileStat)
 {
-    obXml->addstr(obXml, "      </D:prop>" CRLF);
-    obXml->addstrf(obXml,"      <D:status>%s %d %s</D:status>" CRLF, HTTP_PROTOCOL_11, HTTP_CODE_OK, httpResponseGetMsg(HTTP_CODE_OK));
-    obXml->addstr(obXml, "    </D:propstat>" CRLF);
-    obXml->addstr(obXml, "  </D:response>" CRLF);
+    char szCollection[PATH_MAX];
+    _getCollectionKey(szCollection, sizeof(szCollection), pszFilePath);
+
+    char *pszKey = qstrdupf("propfind:%s:%s:%u:%u:%jd.%09ld:%ld", pReq->pszRequestPath, szCollection,
+                            poolGetGeneration(szCollection), lockGetGeneration(),
+                            (intmax_t)pFileStat->st_mtim.tv_sec, pFileStat->st_mtim.tv_nsec,
+                            (long)(time(NULL) / g_conf.nPropfindCacheTime));
+    if (pszKey == NULL) return 0;
+
+    char szEtag[16+1];
+    snprintf(szEtag, sizeof(szEtag), "%016" PRIx64, qhashfnv1_64(pszKey, strlen(pszKey)));
+
+    // the client has the same listing
+    int nCondCode = httpHeaderCheckConditions(pReq->pHeaders, true, szEtag, pFileStat);
+    if (nCondCode != 0) {
+        free(pszKey);
+        if (nCondCode != HTTP_CODE_NOT_MODIFIED) {
+            return httpResponseSetSimple(pRes, nCondCode, true, httpResponseGetMsg(nCondCode));
+        }
+        httpHeaderSetStrf(pRes->pHeaders, "ETag", "\"%s\"", szEtag);
+        return httpResponseSetSimple(pRes, HTTP_CODE_NOT_MODIFIED, true, NULL);
+    }
 
-    return true;
+    struct stat cachestat;
+    int nFd = cacheOpen(pszKey, &cachestat);
+    if (nFd < 0) {
+        // render into the cache
+        char szTmpPath[PATH_MAX];
+        int nTmpFd = cacheCreate(szTmpPath, sizeof(szTmpPath));
+        if (nTmpFd >= 0) {
+            struct PropfindWalk walk;
+            memset((void *)&walk, 0, sizeof(walk));
+            walk.pReq = pReq;
+            walk.pXml = writerCreate(writerFileOut, (void *)&nTmpFd);
+            bool bRendered = false;
+            if (walk.pXml != NULL) {
+                bRendered = _propfindRender(&walk, pReq->pszRequestPath, pszFilePath, pFileStat, 1);
+                writerFree(walk.pXml);
+            }
+            sysClose(nTmpFd);
+
+            if (bRendered == true && walk.bTruncated == false) {
+                cacheCommit(pszKey, szTmpPath);
+                nFd = cacheOpen(pszKey, &cachestat);
+            } else {
+                cacheAbort(szTmpPath);
+            }
+        }
+    } else {
+        DEBUG("PROPFIND cache hit. (%s)", pReq->pszRequestPath);
+    }
+    free(pszKey);
+    if (nFd < 0) return 0;
+
+    httpResponseSetCode(pRes, HTTP_CODE_MULTI_STATUS, true);
+    httpResponseSetContent(pRes, "text/xml; charset=\"utf-8\"", NULL, cachestat.st_size);
+    httpHeaderSetStrf(pRes->pHeaders, "ETag", "\"%s\"", szEtag);
+    httpResponseOut(pRes);
+    streamSend(pReq->nSockFd, nFd, cachestat.st_size, pReq->nTimeout * 1000);
+    sysClose(nFd);
+
+    return HTTP_CODE_MULTI_STATUS;
 }
 
-static bool _addXmlResponseEnd(qvector_t *obXml)
+/*
+ * System path without trailing slash, which identifies the collection.
+ */
+static char *_getCollectionKey(char *pszBuf, size_t nBufSize, const char *pszSysPath)
 {
-    obXml->addstr(obXml, "</D:multistatus>" CRLF);
-    return true;
+    qstrcpy(pszBuf, nBufSize, pszSysPath);
+    size_t nLen = strlen(pszBuf);
+    while (nLen > 1 && pszBuf[nLen - 1] == '/') pszBuf[--nLen] = '\0';
+    return pszBuf;
 }
 
 static char *_getXmlEntry(char *pszXml, char *pszEntryName)
@@ -483,3 +1056,702 @@ static char *_getXmlEntry(char *pszXml, char *pszEntryName)
     free(pszEntryStart);
     return pszTmp;
 }
+
+/*
+ * Copy raw contents of the first element, such like owner of LOCK request.
+ *
+ * @return pszBuf if found and fits in the buffer, otherwise returns NULL
+ */
+static char *_getXmlContents(char *pszBuf, size_t nBufSize, const char *pszXml, const char *pszEntryName)
+{
+    char szOpen[64], szClose[64];
+    snprintf(szOpen, sizeof(szOpen), ":%s", pszEntryName);
+    snprintf(szClose, sizeof(szClose), ":%s>", pszEntryName);
+
+    // find start tag with namespace prefix
+    const char *pszStart = strstr(pszXml, szOpen);
+    while (pszStart != NULL && pszStart[strlen(szOpen)] != '>' && !isspace(pszStart[strlen(szOpen)])) {
+        pszStart = strstr(pszStart + 1, szOpen);
+    }
+    if (pszStart == NULL || (pszStart = strchr(pszStart, '>')) == NULL) return NULL;
+    if (pszStart[-1] == '/') return NULL; // empty element
+    pszStart++;
+
+    // find end tag
+    const char *pszEnd = strstr(pszStart, szClose);
+    while (pszEnd != NULL && pszEnd > pszStart && *pszEnd != '<') pszEnd--;
+    if (pszEnd == NULL || pszEnd[1] != '/') return NULL;
+
+    size_t nLen = pszEnd - pszStart;
+    if (nLen >= nBufSize) {
+        DEBUG("%s is too long, ignored.", pszEntryName);
+        return NULL;
+    }
+    memcpy(pszBuf, pszStart, nLen);
+    pszBuf[nLen] = '\0';
+    qstrtrim(pszBuf);
+
+    return pszBuf;
+}
+
+/*
+ * Evaluate If header of RFC 4918. The header is true if any of the lists
+ * is true. Untagged lists are evaluated against the request URI and tagged
+ * lists against the tagged resource.
+ *
+ * @param ppszTokens    lock tokens submitted in the header are stored.
+ *                      must be freed by the caller.
+ * @param pnTokens      the number of tokens stored
+ * @return true if the header is true, otherwise returns false
+ */
+static bool _evalIfHeader(struct HttpRequest *pReq, const char *pszIf, const char **ppszTokens, int *pnTokens)
+{
+    char szUriPath[PATH_MAX], szSysPath[PATH_MAX];
+    qstrcpy(szUriPath, sizeof(szUriPath), pReq->pszRequestPath);
+    httpRequestGetSysPath(pReq, szSysPath, sizeof(szSysPath), szUriPath);
+
+    bool bResult = false;
+    bool bValid = true;
+    const char *p = pszIf;
+    while (*p != '\0' && bValid == true) {
+        if (isspace(*p)) {
+            p++;
+        } else if (*p == '<') {
+            // resource tag
+            const char *pszEnd = strchr(p, '>');
+            if (pszEnd == NULL) break;
+            char szUri[URI_MAX];
+            snprintf(szUri, sizeof(szUri), "%.*s", (int)(pszEnd - p - 1), p + 1);
+            if (_getUriPath(szUriPath, sizeof(szUriPath), szUri) == NULL) bValid = false;
+            else httpRequestGetSysPath(pReq, szSysPath, sizeof(szSysPath), szUriPath);
+            p = pszEnd + 1;
+        } else if (*p == '(') {
+            // list of conditions
+            bool bList = true;
+            for (p++; *p != ')' && *p != '\0';) {
+                bool bNot = false;
+                while (isspace(*p)) p++;
+                if (!strncasecmp(p, "Not", CONST_STRLEN("Not"))) {
+                    bNot = true;
+                    p += CONST_STRLEN("Not");
+                    while (isspace(*p)) p++;
+                }
+
+                char cClose;
+                if (*p == '<') cClose = '>';
+                else if (*p == '[') cClose = ']';
+                else if (*p == ')') break;
+                else {
+                    bValid = false;
+                    break;
+                }
+                const char *pszEnd = strchr(p, cClose);
+                if (pszEnd == NULL) {
+                    bValid = false;
+                    break;
+                }
+
+                char szCond[URI_MAX];
+                snprintf(szCond, sizeof(szCond), "%.*s", (int)(pszEnd - p - 1), p + 1);
+                bool bEtag = (cClose == ']') ? true : false;
+                if (bEtag == false && bNot == false && *pnTokens < MAX_IF_TOKENS) {
+                    ppszTokens[(*pnTokens)++] = strdup(szCond);
+                }
+                if (_evalIfCondition(pReq, szCond, bEtag, szUriPath, szSysPath) == bNot) bList = false;
+                p = pszEnd + 1;
+            }
+            if (*p == ')') p++;
+            if (bValid == true && bList == true) bResult = true;
+        } else {
+            bValid = false;
+        }
+    }
+
+    return (bValid == true && bResult == true) ? true : false;
+}
+
+static bool _evalIfCondition(struct HttpRequest *pReq, const char *pszCond, bool bEtag, const char *pszUriPath, const char *pszSysPath)
+{
+    if (bEtag == false) return lockIsHeld(pszSysPath, pszCond);
+
+    // entity tag
+    struct stat filestat;
+    if (sysStat(pszSysPath, &filestat) < 0) return false;
+    char szEtag[ETAG_MAX];
+    etagGet(szEtag, sizeof(szEtag), pszUriPath, pszSysPath, &filestat, true);
+
+    if (!strncmp(pszCond, "W/", CONST_STRLEN("W/"))) pszCond += CONST_STRLEN("W/");
+    if (*pszCond == '"') pszCond++;
+    size_t nLen = strlen(szEtag);
+    if (strncmp(pszCond, szEtag, nLen)) return false;
+    return (pszCond[nLen] == '"' || pszCond[nLen] == '-' || pszCond[nLen] == '\0') ? true : false;
+}
+
+/*
+ * Get decoded path of absolute or relative URI.
+ */
+static char *_getUriPath(char *pszBuf, size_t nBufSize, const char *pszUri)
+{
+    const char *pszPath = pszUri;
+    if (pszUri[0] != '/') {
+        const char *pszScheme = strstr(pszUri, "://");
+        if (pszScheme == NULL) return NULL;
+        pszPath = strchr(pszScheme + CONST_STRLEN("://"), '/');
+        if (pszPath == NULL) return NULL;
+    }
+
+    qstrcpy(pszBuf, nBufSize, pszPath);
+    qurl_decode(pszBuf);
+    return pszBuf;
+}
+
+/*
+ * Parse Timeout header such like "Second-3600" or "Infinite, Second-600".
+ * The first one is taken and it's limited to LockMaxTimeout.
+ */
+static int _getLockTimeout(const char *pszTimeout)
+{
+    int nTimeout = g_conf.nLockMaxTimeout;
+    if (pszTimeout != NULL) {
+        while (isspace(*pszTimeout)) pszTimeout++;
+        if (!strncasecmp(pszTimeout, "Second-", CONST_STRLEN("Second-"))) {
+            nTimeout = atoi(pszTimeout + CONST_STRLEN("Second-"));
+        }
+    }
+
+    if (nTimeout <= 0 || nTimeout > g_conf.nLockMaxTimeout) nTimeout = g_conf.nLockMaxTimeout;
+    return nTimeout;
+}
+
+/*
+ * lockdiscovery property. The lock root is the URI path going up by the
+ * level of each lock, or the URI path itself if pnLevels is NULL. It's not
+ * given if pszUriPath is NULL.
+ */
+static bool _addXmlLockDiscovery(struct Writer *pXml, struct LockInfo *pLocks, int *pnLevels, int nLocks, const char *pszUriPath)
+{
+    writerPutLit(pXml, "  <D:lockdiscovery>" CRLF);
+
+    int i;
+    for (i = 0; i < nLocks; i++) {
+        struct LockInfo *pLock = &pLocks[i];
+        writerPutLit(pXml, "    <D:activelock>" CRLF
+                           "      <D:locktype><D:write/></D:locktype>" CRLF);
+        if (pLock->bShared == true) {
+            writerPutLit(pXml, "      <D:lockscope><D:shared/></D:lockscope>" CRLF);
+        } else {
+            writerPutLit(pXml, "      <D:lockscope><D:exclusive/></D:lockscope>" CRLF);
+        }
+        if (pLock->bInfinity == true) {
+            writerPutLit(pXml, "      <D:depth>infinity</D:depth>" CRLF);
+        } else {
+            writerPutLit(pXml, "      <D:depth>0</D:depth>" CRLF);
+        }
+        if (pLock->szOwner[0] != '\0') {
+            writerPutLit(pXml, "      <D:owner>");
+            writerPuts(pXml, pLock->szOwner);
+            writerPutLit(pXml, "</D:owner>" CRLF);
+        }
+        writerPutLit(pXml, "      <D:timeout>Second-");
+        writerPutInt(pXml, pLock->nTimeout);
+        writerPutLit(pXml, "</D:timeout>" CRLF
+                           "      <D:locktoken><D:href>");
+        writerPuts(pXml, pLock->szToken);
+        writerPutLit(pXml, "</D:href></D:locktoken>" CRLF);
+        if (pszUriPath != NULL) {
+            char szLockRoot[PATH_MAX];
+            qstrcpy(szLockRoot, sizeof(szLockRoot), pszUriPath);
+            int nLevel;
+            for (nLevel = (pnLevels != NULL) ? pnLevels[i] : 0; nLevel > 0; nLevel--) {
+                size_t nLen = strlen(szLockRoot);
+                while (nLen > 1 && szLockRoot[nLen - 1] == '/') szLockRoot[--nLen] = '\0';
+                char *pszSlash = strrchr(szLockRoot, '/');
+                if (pszSlash == NULL) break;
+                pszSlash[1] = '\0';
+            }
+            writerPutLit(pXml, "      <D:lockroot><D:href>");
+            writerPutUrl(pXml, szLockRoot);
+            writerPutLit(pXml, "</D:href></D:lockroot>" CRLF);
+        }
+        writerPutLit(pXml, "    </D:activelock>" CRLF);
+    }
+
+    return writerPutLit(pXml, "  </D:lockdiscovery>" CRLF);
+}
+
+/*
+ * Directory and member name where dead properties of the URI are kept.
+ */
+static bool _getPropLocation(struct HttpRequest *pReq, const char *pszUriPath, char *pszDir, size_t nDirSize, char *pszMember, size_t nMemberSize)
+{
+    char szPath[PATH_MAX];
+    _getCollectionKey(szPath, sizeof(szPath), pszUriPath);
+
+    char *pszSlash = strrchr(szPath, '/');
+    if (pszSlash == NULL) return false;
+    if (pszSlash[1] == '\0') {
+        // root collection
+        qstrcpy(pszMember, nMemberSize, ".");
+    } else {
+        qstrcpy(pszMember, nMemberSize, pszSlash + 1);
+        pszSlash[1] = '\0';
+    }
+
+    if (httpRequestGetSysPath(pReq, pszDir, nDirSize, szPath) == NULL) return false;
+    return true;
+}
+
+/*
+ * Parse propertyupdate of PROPPATCH request.
+ *
+ * @param pnOps the number of set and remove instructions in document order
+ * @return array of instructions, NULL if the document is malformed
+ */
+static struct PropOp *_parsePropertyUpdate(const char *pszXml, int *pnOps)
+{
+    // scope[0] propertyupdate, [1] set or remove, [2] prop, [3] property
+    struct XmlTag scope[4];
+    struct PropOp *pOps = NULL;
+    int nOps = 0;
+
+    const char *pszNext = _xmlNextTag(pszXml, &scope[0]);
+    if (pszNext == NULL || _xmlTagIs(scope, 1, "DAV:", "propertyupdate") == false) return NULL;
+
+    struct XmlTag tag;
+    int nLevel = 1;
+    while ((pszNext = _xmlNextTag(pszNext, &tag)) != NULL) {
+        if (tag.bEnd == true) {
+            if (--nLevel == 0) break;
+            continue;
+        }
+
+        scope[nLevel] = tag;
+        if (nLevel == 1) {
+            bool bSet = _xmlTagIs(scope, 2, "DAV:", "set");
+            if (bSet == false && _xmlTagIs(scope, 2, "DAV:", "remove") == false) break;
+            if (tag.bEmpty == false) nLevel++;
+        } else if (nLevel == 2) {
+            if (_xmlTagIs(scope, 3, "DAV:", "prop") == false) break;
+            if (tag.bEmpty == false) nLevel++;
+        } else {
+            // property
+            char szNs[1024];
+            size_t nNameLen;
+            const char *pszName = _xmlGetLocalName(&tag, &nNameLen);
+            if (_xmlGetNs(szNs, sizeof(szNs), scope, 4) == NULL || nNameLen == 0) break;
+
+            // find matching end tag
+            const char *pszValue = tag.pszEnd;
+            size_t nValueLen = 0;
+            if (tag.bEmpty == false) {
+                struct XmlTag sub;
+                int nSubLevel = 1;
+                while ((pszNext = _xmlNextTag(pszNext, &sub)) != NULL) {
+                    if (sub.bEnd == true) nSubLevel--;
+                    else if (sub.bEmpty == false) nSubLevel++;
+                    if (nSubLevel == 0) break;
+                }
+                if (pszNext == NULL) break;
+                nValueLen = sub.pszStart - pszValue;
+            }
+
+            struct PropOp *pNew = (struct PropOp *)realloc(pOps, sizeof(struct PropOp) * (nOps + 1));
+            if (pNew == NULL) break;
+            pOps = pNew;
+            memset((void *)&pOps[nOps], 0, sizeof(struct PropOp));
+            pOps[nOps].bSet = _xmlTagIs(scope, 2, "DAV:", "set");
+            pOps[nOps].pszNs = strdup(szNs);
+            pOps[nOps].pszName = strndup(pszName, nNameLen);
+            if (pOps[nOps].bSet == true) pOps[nOps].pszXml = _buildPropXml(scope, 4, pszValue, nValueLen);
+            nOps++;
+            if (pOps[nOps - 1].pszNs == NULL || pOps[nOps - 1].pszName == NULL
+                || (pOps[nOps - 1].bSet == true && pOps[nOps - 1].pszXml == NULL)) break;
+        }
+    }
+
+    if (pszNext == NULL || nLevel != 0 || nOps == 0) {
+        DEBUG("Malformed propertyupdate.");
+        _freePropOps(pOps, nOps);
+        return NULL;
+    }
+
+    *pnOps = nOps;
+    return pOps;
+}
+
+static void _freePropOps(struct PropOp *pOps, int nOps)
+{
+    if (pOps == NULL) return;
+
+    int i;
+    for (i = 0; i < nOps; i++) {
+        if (pOps[i].pszNs != NULL) free(pOps[i].pszNs);
+        if (pOps[i].pszName != NULL) free(pOps[i].pszName);
+        if (pOps[i].pszXml != NULL) free(pOps[i].pszXml);
+    }
+    free(pOps);
+}
+
+/*
+ * Build a self-contained property element to store. Namespace declarations
+ * in scope are copied onto the element, so it's valid wherever it's placed.
+ */
+static char *_buildPropXml(struct XmlTag *pScope, int nScope, const char *pszValue, size_t nValueLen)
+{
+    struct XmlTag *pTag = &pScope[nScope - 1];
+    qvector_t *obXml = qvector();
+
+    obXml->add(obXml, "<", 1);
+    obXml->add(obXml, pTag->pszName, pTag->nNameLen);
+    if (pTag->nAttrsLen > 0) {
+        obXml->add(obXml, " ", 1);
+        obXml->add(obXml, pTag->pszAttrs, pTag->nAttrsLen);
+    }
+
+    // declarations of ancestors which are not overridden
+    int i;
+    for (i = nScope - 2; i >= 0; i--) {
+        const char *pszAttr = pScope[i].pszAttrs;
+        const char *pszPrefix, *pszUri;
+        size_t nPrefixLen, nUriLen;
+        while (_xmlNextNsDecl(&pszAttr, pScope[i].pszAttrs + pScope[i].nAttrsLen, &pszPrefix, &nPrefixLen, &pszUri, &nUriLen) == true) {
+            bool bDeclared = false;
+            int j;
+            for (j = i + 1; j < nScope && bDeclared == false; j++) {
+                const char *pszAttr2 = pScope[j].pszAttrs;
+                const char *pszPrefix2, *pszUri2;
+                size_t nPrefixLen2, nUriLen2;
+                while (_xmlNextNsDecl(&pszAttr2, pScope[j].pszAttrs + pScope[j].nAttrsLen, &pszPrefix2, &nPrefixLen2, &pszUri2, &nUriLen2) == true) {
+                    if (nPrefixLen2 == nPrefixLen && !strncmp(pszPrefix2, pszPrefix, nPrefixLen)) {
+                        bDeclared = true;
+                        break;
+                    }
+                }
+            }
+            if (bDeclared == true) continue;
+
+            if (nPrefixLen > 0) {
+                obXml->addstrf(obXml, " xmlns:%.*s=\"%.*s\"", (int)nPrefixLen, pszPrefix, (int)nUriLen, pszUri);
+            } else {
+                obXml->addstrf(obXml, " xmlns=\"%.*s\"", (int)nUriLen, pszUri);
+            }
+        }
+    }
+
+    if (nValueLen == 0) {
+        obXml->add(obXml, "/>", 2);
+    } else {
+        obXml->add(obXml, ">", 1);
+        obXml->add(obXml, pszValue, nValueLen);
+        obXml->add(obXml, "</", 2);
+        obXml->add(obXml, pTag->pszName, pTag->nNameLen);
+        obXml->add(obXml, ">", 1);
+    }
+
+    char *pszXml = obXml->tostring(obXml);
+    obXml->free(obXml);
+    return pszXml;
+}
+
+/*
+ * Find next tag. Declarations, processing instructions, comments and CDATA
+ * sections are skipped.
+ *
+ * @return pointer next to the tag, NULL if there's no more tag
+ */
+static const char *_xmlNextTag(const char *pszXml, struct XmlTag *pTag)
+{
+    const char *p = pszXml;
+    while ((p = strchr(p, '<')) != NULL) {
+        if (!strncmp(p, "<!--", CONST_STRLEN("<!--"))) {
+            p = strstr(p, "-->");
+        } else if (!strncmp(p, "<![CDATA[", CONST_STRLEN("<![CDATA["))) {
+            p = strstr(p, "]]>");
+        } else if (p[1] == '?' || p[1] == '!') {
+            p = strchr(p, '>');
+        } else {
+            break;
+        }
+        if (p == NULL) return NULL;
+    }
+    if (p == NULL) return NULL;
+
+    memset((void *)pTag, 0, sizeof(struct XmlTag));
+    pTag->pszStart = p++;
+    if (*p == '/') {
+        pTag->bEnd = true;
+        p++;
+    }
+
+    pTag->pszName = p;
+    while (*p != '\0' && *p != '>' && *p != '/' && !isspace(*p)) p++;
+    pTag->nNameLen = p - pTag->pszName;
+    while (isspace(*p)) p++;
+
+    // attributes, '>' may be in quoted values
+    pTag->pszAttrs = p;
+    char cQuote = '\0';
+    for (; *p != '\0'; p++) {
+        if (cQuote != '\0') {
+            if (*p == cQuote) cQuote = '\0';
+        } else if (*p == '"' || *p == '\'') {
+            cQuote = *p;
+        } else if (*p == '>') {
+            break;
+        }
+    }
+    if (*p != '>' || pTag->nNameLen == 0) return NULL;
+
+    const char *pszAttrsEnd = p;
+    if (pszAttrsEnd > pTag->pszAttrs && pszAttrsEnd[-1] == '/') {
+        pTag->bEmpty = true;
+        pszAttrsEnd--;
+    }
+    while (pszAttrsEnd > pTag->pszAttrs && isspace(pszAttrsEnd[-1])) pszAttrsEnd--;
+    pTag->nAttrsLen = pszAttrsEnd - pTag->pszAttrs;
+
+    pTag->pszEnd = p + 1;
+    return pTag->pszEnd;
+}
+
+/*
+ * Iterate namespace declarations in attributes.
+ */
+static bool _xmlNextNsDecl(const char **ppszAttr, const char *pszAttrEnd, const char **ppszPrefix, size_t *pnPrefixLen, const char **ppszUri, size_t *pnUriLen)
+{
+    const char *p = *ppszAttr;
+    while (p < pszAttrEnd) {
+        while (p < pszAttrEnd && isspace(*p)) p++;
+        const char *pszName = p;
+        while (p < pszAttrEnd && *p != '=' && !isspace(*p)) p++;
+        size_t nNameLen = p - pszName;
+        while (p < pszAttrEnd && isspace(*p)) p++;
+        if (p >= pszAttrEnd || *p != '=') break;
+        p++;
+        while (p < pszAttrEnd && isspace(*p)) p++;
+        if (p >= pszAttrEnd || (*p != '"' && *p != '\'')) break;
+        char cQuote = *p++;
+        const char *pszValue = p;
+        while (p < pszAttrEnd && *p != cQuote) p++;
+        if (p >= pszAttrEnd) break;
+        size_t nValueLen = p - pszValue;
+        p++;
+
+        if (nNameLen == CONST_STRLEN("xmlns") && !strncmp(pszName, "xmlns", nNameLen)) {
+            *ppszPrefix = pszName + nNameLen;
+            *pnPrefixLen = 0;
+        } else if (nNameLen > CONST_STRLEN("xmlns:") && !strncmp(pszName, "xmlns:", CONST_STRLEN("xmlns:"))) {
+            *ppszPrefix = pszName + CONST_STRLEN("xmlns:");
+            *pnPrefixLen = nNameLen - CONST_STRLEN("xmlns:");
+        } else {
+            continue;
+        }
+        *ppszUri = pszValue;
+        *pnUriLen = nValueLen;
+        *ppszAttr = p;
+        return true;
+    }
+
+    *ppszAttr = pszAttrEnd;
+    return false;
+}
+
+/*
+ * Resolve namespace of the innermost tag in scope.
+ *
+ * @return pszBuf if resolved, NULL if the prefix is not declared
+ */
+static char *_xmlGetNs(char *pszBuf, size_t nBufSize, struct XmlTag *pScope, int nScope)
+{
+    struct XmlTag *pTag = &pScope[nScope - 1];
+    const char *pszColon = memchr(pTag->pszName, ':', pTag->nNameLen);
+    size_t nPrefixLen = (pszColon != NULL) ? (size_t)(pszColon - pTag->pszName) : 0;
+
+    int i;
+    for (i = nScope - 1; i >= 0; i--) {
+        const char *pszAttr = pScope[i].pszAttrs;
+        const char *pszPrefix, *pszUri;
+        size_t nDeclPrefixLen, nUriLen;
+        while (_xmlNextNsDecl(&pszAttr, pScope[i].pszAttrs + pScope[i].nAttrsLen, &pszPrefix, &nDeclPrefixLen, &pszUri, &nUriLen) == true) {
+            if (nDeclPrefixLen != nPrefixLen || strncmp(pszPrefix, pTag->pszName, nPrefixLen)) continue;
+            if (nUriLen >= nBufSize) return NULL;
+            memcpy(pszBuf, pszUri, nUriLen);
+            pszBuf[nUriLen] = '\0';
+            return pszBuf;
+        }
+    }
+
+    // no default namespace
+    if (nPrefixLen == 0) {
+        pszBuf[0] = '\0';
+        return pszBuf;
+    }
+    return NULL;
+}
+
+static const char *_xmlGetLocalName(struct XmlTag *pTag, size_t *pnLen)
+{
+    const char *pszColon = memchr(pTag->pszName, ':', pTag->nNameLen);
+    if (pszColon == NULL) {
+        *pnLen = pTag->nNameLen;
+        return pTag->pszName;
+    }
+    *pnLen = pTag->nNameLen - (pszColon + 1 - pTag->pszName);
+    return pszColon + 1;
+}
+
+static bool _xmlTagIs(struct XmlTag *pScope, int nScope, const char *pszNs, const char *pszName)
+{
+    char szNs[1024];
+    size_t nNameLen;
+    const char *pszLocalName = _xmlGetLocalName(&pScope[nScope - 1], &nNameLen);
+    if (nNameLen != strlen(pszName) || strncmp(pszLocalName, pszName, nNameLen)) return false;
+    if (_xmlGetNs(szNs, sizeof(szNs), pScope, nScope) == NULL || strcmp(szNs, pszNs)) return false;
+    return true;
+}
+
+/*
+ * Add propstat of PROPPATCH response, with properties of which result is
+ * the code.
+ *
+ * @param bProtected    true to list DAV: properties, otherwise the others
+ */
+static bool _addXmlPropStat(struct Writer *pXml, struct PropOp *pOps, int nOps, int nResCode, bool bProtected)
+{
+    writerPutLit(pXml, "    <D:propstat>" CRLF
+                       "      <D:prop>" CRLF);
+    int i;
+    for (i = 0; i < nOps; i++) {
+        bool bDav = (!strcmp(pOps[i].pszNs, "DAV:")) ? true : false;
+        if (nResCode != HTTP_CODE_OK && bDav != bProtected) continue;
+
+        if (bDav == true) {
+            writerPutLit(pXml, "        <D:");
+            writerPuts(pXml, pOps[i].pszName);
+            writerPutLit(pXml, "/>" CRLF);
+        } else if (pOps[i].pszNs[0] == '\0') {
+            writerPutLit(pXml, "        <");
+            writerPuts(pXml, pOps[i].pszName);
+            writerPutLit(pXml, " xmlns=\"\"/>" CRLF);
+        } else {
+            writerPutLit(pXml, "        <R:");
+            writerPuts(pXml, pOps[i].pszName);
+            writerPutLit(pXml, " xmlns:R=\"");
+            writerPuts(pXml, pOps[i].pszNs);
+            writerPutLit(pXml, "\"/>" CRLF);
+        }
+    }
+    writerPutLit(pXml, "      </D:prop>" CRLF
+                       "      <D:status>HTTP/1.1 ");
+    writerPutInt(pXml, nResCode);
+    writerPutLit(pXml, " ");
+    writerPuts(pXml, httpResponseGetMsg(nResCode));
+    return writerPutLit(pXml, "</D:status>" CRLF
+                              "    </D:propstat>" CRLF);
+}
+
+/*
+ * Get decoded path of Destination header.
+ */
+static const char *_getDestPath(struct HttpRequest *pReq, char *pszBuf, size_t nBufSize)
+{
+    const char *pszDestination = httpHeaderGetStr(pReq->pHeaders, "DESTINATION");
+    if (pszDestination == NULL) return NULL;
+
+    // decode url encoded uri
+    qstrcpy(pszBuf, nBufSize, pszDestination);
+    qurl_decode(pszBuf);
+
+    // parse destination header
+    if (pszBuf[0] == '/') {
+        return pszBuf;
+    } else if (!strncasecmp(pszBuf, "HTTP://", CONST_STRLEN("HTTP://"))) {
+        return strstr(pszBuf + CONST_STRLEN("HTTP://"), "/");
+    }
+    return NULL;
+}
+
+/*
+ * Check the destination of COPY and MOVE.
+ *
+ * @param pszDstDir     directory of the destination is stored
+ * @param pszDstMember  name of the destination in the directory is stored
+ * @return 0 if valid, otherwise the response code set
+ */
+static int _checkDestination(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszSrcPath, bool bCollection, const char *pszDestPath, char *pszDstDir, size_t nDstDirSize, char *pszDstMember, size_t nDstMemberSize)
+{
+    // the document root can't be either side
+    char szKey[PATH_MAX];
+    _getCollectionKey(szKey, sizeof(szKey), pReq->pszRequestPath);
+    if (!strcmp(szKey, "/")) return response403(pRes);
+    _getCollectionKey(szKey, sizeof(szKey), pszDestPath);
+    if (!strcmp(szKey, "/")) return response403(pRes);
+
+    // a collection can't go into itself
+    char szSrcKey[PATH_MAX], szDstKey[PATH_MAX];
+    _getCollectionKey(szSrcKey, sizeof(szSrcKey), pszSrcPath);
+    httpRequestGetSysPath(pReq, szDstKey, sizeof(szDstKey), szKey);
+    size_t nSrcKeyLen = strlen(szSrcKey);
+    if (!strcmp(szSrcKey, szDstKey)
+        || (bCollection == true && !strncmp(szDstKey, szSrcKey, nSrcKeyLen) && szDstKey[nSrcKeyLen] == '/')) {
+        return response403(pRes);
+    }
+
+    // parent of the destination must exist
+    struct stat dirstat;
+    if (_getPropLocation(pReq, pszDestPath, pszDstDir, nDstDirSize, pszDstMember, nDstMemberSize) == false
+        || sysStat(pszDstDir, &dirstat) < 0 || !S_ISDIR(dirstat.st_mode)) {
+        return response409(pRes);
+    }
+
+    return 0;
+}
+
+/*
+ * Multi-status response listing members which a tree operation failed on.
+ *
+ * @param pszBasePath   request path of the tree root
+ * @param pFailed       paths relative to the root. empty for the root itself
+ */
+static int _responseTreeFailed(struct HttpResponse *pRes, const char *pszBasePath, qlist_t *pFailed)
+{
+    char szBasePath[PATH_MAX];
+    _getCollectionKey(szBasePath, sizeof(szBasePath), pszBasePath);
+    if (!strcmp(szBasePath, "/")) szBasePath[0] = '\0';
+
+    qvector_t *obXml = qvector();
+    struct Writer *pXml = writerCreate(writerVectorOut, (void *)obXml);
+    if (pXml == NULL) {
+        obXml->free(obXml);
+        return response500(pRes);
+    }
+
+    _addXmlResponseStart(pXml);
+    qdlobj_t obj;
+    memset((void *)&obj, 0, sizeof(obj));
+    bool bRoot = (pFailed->size(pFailed) == 0) ? true : false;
+    while (bRoot == true || pFailed->getnext(pFailed, &obj, false) == true) {
+        writerPutLit(pXml, "  <D:response>" CRLF
+                           "    <D:href>");
+        writerPutUrl(pXml, szBasePath);
+        if (bRoot == false) writerPutUrl(pXml, (const char *)obj.data);
+        writerPutLit(pXml, "</D:href>" CRLF
+                           "    <D:status>HTTP/1.1 403 Forbidden</D:status>" CRLF
+                           "  </D:response>" CRLF);
+        bRoot = false;
+    }
+    _addXmlResponseEnd(pXml);
+    writerFlush(pXml);
+    writerFree(pXml);
+
+    size_t nXmlSize;
+    char *pszXmlData = (char *)obXml->toarray(obXml, &nXmlSize);
+
+    httpResponseSetCode(pRes, HTTP_CODE_MULTI_STATUS, true);
+    httpResponseSetContent(pRes, "text/xml; charset=\"utf-8\"", pszXmlData, nXmlSize);
+
+    free(pszXmlData);
+    obXml->free(obXml);
+
+    return HTTP_CODE_MULTI_STATUS;
+}
@@ -298,6 +298,17 @@ static char *_readRequest(int nSockFd, size_t *nRequestSize, int nTimeout)
     size_t nBufSize = 0;
     char *pszReqBuf = NULL;
     size_t nTotal = 0;
+
+    // persistent connection waits for the next request shorter
+    int nWaitMs = nTimeout;
+    if (g_conf.nKeepAliveTimeout > 0 && poolGetChildKeepaliveRequests() > 0) {
+        nWaitMs = g_conf.nKeepAliveTimeout * 1000;
+    }
+
+    // headers must be completed by the deadline, no matter how often bytes
+    // trickle in. it starts at the first byte.
+    time_t nDeadline = 0;
+    bool bCut = false;
     do {
         int nMaxRead = nBufSize - nTotal;
         if (nMaxRead == 0) {
@@ -311,11 +322,27 @@ static char *_readRequest(int nSockFd, size_t *nRequestSize, int nTimeout)
             //DEBUG("malloc %d %d", nBufSize, pszReqBuf);
         }
 
-        if (qio_wait_readable(nSockFd, nTimeout) <= 0) break;
+        if (nDeadline > 0) {
+            time_t nLeft = nDeadline - time(NULL);
+            if (nLeft <= 0) {
+                bCut = true;
+                break;
+            }
+            if (nLeft * 1000 < nWaitMs) nWaitMs = nLeft * 1000;
+        }
+
+        if (qio_wait_readable(nSockFd, nWaitMs) <= 0) {
+            if (nDeadline > 0 && time(NULL) >= nDeadline) bCut = true;
+            break;
+        }
         ssize_t nRead = read(nSockFd, pszReqBuf + nTotal, (nBlockRead > 0) ? nMaxRead : 1);
         //ssize_t nRead = streamRead(pszReqBuf + nTotal, nSockFd, (nBlockRead > 0) ? nMaxRead : 1, nTimeout);
 
         if (nRead <= 0) break;
+        if (nTotal == 0) {
+            nWaitMs = nTimeout;
+            if (g_conf.nHeaderReadTimeout > 0) nDeadline = time(NULL) + g_conf.nHeaderReadTimeout;
+        }
         nTotal += nRead;
 
         // turn on block read only for the requests which wait server's response after sending request.
@@ -337,6 +364,11 @@ static char *_readRequest(int nSockFd, size_t *nRequestSize, int nTimeout)
         }
     } while (bEndOfHeader == false);
 
+    if (bCut == true) {
+        LOG_INFO("Request headers are not completed in %d seconds. Connection cut. (%zu bytes received)", g_conf.nHeaderReadTimeout, nTotal);
+        poolCountSlowClient(true);
+    }
+
 #ifdef ENABLE_DEBUG
     if (pszReqBuf != NULL) {
         pszReqBuf[nTotal] = '\0';
@@ -30,6 +30,8 @@
 
 #include "qhttpd.h"
 
+static bool _outChunk(struct HttpResponse *pRes, const void *pData, size_t nSize);
+
 struct HttpResponse *httpResponseCreate(struct HttpRequest *pReq) {
     struct HttpResponse *pRes;
 
@@ -79,7 +81,7 @@ bool httpResponseSetCode(struct HttpResponse *pRes, int nResCode, bool bKeepAliv
 
     // default headers
     httpHeaderSetStr(pRes->pHeaders, "Date", qtime_gmt_staticstr(0));
-    httpHeaderSetStrf(pRes->pHeaders, "Server", "%s/%s (%s)", g_prgname, g_prgversion, g_prginfo);
+    httpHeaderSetStr(pRes->pHeaders, "Server", httpCannedGetServer());
 
     // decide to turn on/off keep-alive
     if (pReq != NULL
@@ -103,7 +105,7 @@ bool httpResponseSetCode(struct HttpResponse *pRes, int nResCode, bool bKeepAliv
     // Set keep-alive header
     if (bKeepAlive == true) {
         httpHeaderSetStr(pRes->pHeaders, "Connection", "Keep-Alive");
-        httpHeaderSetStrf(pRes->pHeaders, "Keep-Alive", "timeout=%d", pReq->nTimeout);
+        httpHeaderSetStrf(pRes->pHeaders, "Keep-Alive", "timeout=%d", (g_conf.nKeepAliveTimeout > 0) ? g_conf.nKeepAliveTimeout : pReq->nTimeout);
     } else {
         httpHeaderSetStr(pRes->pHeaders, "Connection", "close");
     }
@@ -123,7 +125,8 @@ bool httpResponseSetContent(struct HttpResponse *pRes, const char *pszContentTyp
     pRes->pszContentType = (pszContentType != NULL) ? strdup(pszContentType) : NULL;
 
     // content
-    if (pRes->pContent != NULL) free(pRes->pContent);
+    if (pRes->pContent != NULL && pRes->bContentStatic == false) free(pRes->pContent);
+    pRes->bContentStatic = false;
     if (pContent == NULL) {
         pRes->pContent = NULL;
     } else {
@@ -139,23 +142,30 @@ bool httpResponseSetContent(struct HttpResponse *pRes, const char *pszContentTyp
     return true;
 }
 
+/**
+ * Set content by reference. The content must not be released until the
+ * response is freed. This is used for serving canned contents.
+ */
+bool httpResponseSetContentStatic(struct HttpResponse *pRes, const char *pszContentType, const char *pContent, off_t nContentsLength)
+{
+    if (httpResponseSetContent(pRes, pszContentType, NULL, nContentsLength) == false) return false;
+
+    pRes->pContent = (char *)pContent;
+    pRes->bContentStatic = true;
+
+    return true;
+}
+
 bool httpResponseSetContentHtml(struct HttpResponse *pRes, const char *pszMsg)
 {
-    char *pszContent = qstrdupf(
-                           "<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">" CRLF
-                           "<html>" CRLF
-                           "<head><title>%d %s</title></head>" CRLF
-                           "<body>" CRLF
-                           "<h1>%d %s</h1>" CRLF
-                           "<p>%s</p>" CRLF
-                           "<hr>" CRLF
-                           "<address>%s %s/%s</address>" CRLF
-                           "</body></html>",
-                           pRes->nResponseCode, httpResponseGetMsg(pRes->nResponseCode),
-                           pRes->nResponseCode, httpResponseGetMsg(pRes->nResponseCode),
-                           pszMsg,
-                           g_prginfo, g_prgname, g_prgversion
-                       );
+    // use canned one if available
+    size_t nCannedSize;
+    const char *pCanned = httpCannedGetBody(pRes->nResponseCode, pszMsg, &nCannedSize);
+    if (pCanned != NULL) {
+        return httpResponseSetContentStatic(pRes, "text/html", pCanned, nCannedSize);
+    }
+
+    char *pszContent = httpCannedRenderBody(pRes->nResponseCode, pszMsg);
 
     bool bRet = false;
     if (pszContent != NULL) {
@@ -171,8 +181,9 @@ bool httpResponseSetContentChunked(struct HttpResponse *pRes, bool bChunked)
     pRes->bChunked = bChunked;
     if (bChunked == true) {
         if (pRes->pContent != NULL) {
-            free(pRes->pContent);
+            if (pRes->bContentStatic == false) free(pRes->pContent);
             pRes->pContent = NULL;
+            pRes->bContentStatic = false;
         }
 
         if (pRes->nContentsLength != 0) {
@@ -224,6 +235,9 @@ bool httpResponseOut(struct HttpResponse *pRes)
     // check header
     if (pRes->pszHttpVersion == NULL || pRes->nResponseCode == 0) return false;
 
+    // compression filter
+    httpCompressFilter(pRes);
+
     // set response information
     poolSetConnResponse(pRes);
 
@@ -260,11 +274,17 @@ bool httpResponseOut(struct HttpResponse *pRes)
     if (outBuf == NULL) return false;
 
     // first line is response code
-    outBuf->addstrf(outBuf, "%s %d %s" CRLF,
-                    pRes->pszHttpVersion,
-                    pRes->nResponseCode,
-                    httpResponseGetMsg(pRes->nResponseCode)
-                   );
+    size_t nStatusLineSize;
+    const char *pszStatusLine = httpCannedGetStatusLine(pRes->pszHttpVersion, pRes->nResponseCode, &nStatusLineSize);
+    if (pszStatusLine != NULL) {
+        outBuf->add(outBuf, pszStatusLine, nStatusLineSize);
+    } else {
+        outBuf->addstrf(outBuf, "%s %d %s" CRLF,
+                        pRes->pszHttpVersion,
+                        pRes->nResponseCode,
+                        httpResponseGetMsg(pRes->nResponseCode)
+                       );
+    }
 
     // print out headers
     qlisttbl_t *tbl = pRes->pHeaders;
@@ -279,18 +299,13 @@ bool httpResponseOut(struct HttpResponse *pRes)
     // end of headers
     outBuf->addstr(outBuf, CRLF);
 
-    // buf flush
-    streamStackOut(pReq->nSockFd, outBuf, pReq->nTimeout * 1000);
+    // buf flush with contents binary
+    size_t nBodySize = (pRes->pContent != NULL && pRes->nContentsLength > 0 && pRes->bHeadOnly == false) ? pRes->nContentsLength : 0;
+    streamStackOut(pReq->nSockFd, outBuf, pRes->pContent, nBodySize, pReq->nTimeout * 1000);
 
     // free buf
     outBuf->free(outBuf);
 
-    // print out contents binary
-    if (pRes->nContentsLength > 0 && pRes->pContent != NULL) {
-        streamWrite(pReq->nSockFd, pRes->pContent, pRes->nContentsLength, pReq->nTimeout * 1000);
-        //streamPrintf(nSockFd, "%s", CRLF);
-    }
-
     pRes->bOut = true;
     return true;
 }
@@ -302,40 +317,21 @@ bool httpResponseOut(struct HttpResponse *pRes)
  */
 bool httpResponseOutChunk(struct HttpResponse *pRes, const void *pData, size_t nSize)
 {
-    struct HttpRequest *pReq = pRes->pReq;
+    if (pRes->bHeadOnly == true) return true;
 
-    struct iovec vectors[3];
-    int nVecCnt = 0;
-    ssize_t nTotSize = 0;
+    if (pRes->pEncoder == NULL) return _outChunk(pRes, pData, nSize);
 
-    char szChunkSizeHead[16 + CONST_STRLEN(CRLF) + 1];
-    snprintf(szChunkSizeHead, sizeof(szChunkSizeHead), "%x" CRLF, (unsigned int)nSize);
-
-    // add to vector
-    vectors[nVecCnt].iov_base = szChunkSizeHead;
-    vectors[nVecCnt].iov_len = strlen(szChunkSizeHead);
-    nTotSize += vectors[nVecCnt].iov_len;
-    nVecCnt++;
+    // compression filter
+    size_t nEncSize;
+    const void *pEncData = httpEncoderUpdate(pRes->pEncoder, pData, nSize, (nSize == 0), &nEncSize);
+    if (pEncData == NULL) return false;
 
-    if (nSize > 0) {
-        // add to vector
-        vectors[nVecCnt].iov_base = (void *)pData;
-        vectors[nVecCnt].iov_len = nSize;
-        nTotSize += vectors[nVecCnt].iov_len;
-        nVecCnt++;
-    }
+    // encoder may hold data until it has enough input
+    if (nEncSize > 0 && _outChunk(pRes, pEncData, nEncSize) == false) return false;
+    if (nSize > 0) return true;
 
-    // add to vector
-    vectors[nVecCnt].iov_base = CRLF;
-    vectors[nVecCnt].iov_len = CONST_STRLEN(CRLF);
-    nTotSize += vectors[nVecCnt].iov_len;
-    nVecCnt++;
-
-    // print out
-    ssize_t nTotSent = streamWritev(pReq->nSockFd, vectors, nVecCnt, pReq->nTimeout * 1000);
-
-    if (nTotSize == nTotSent) return true;
-    return false;
+    // end of chunk
+    return _outChunk(pRes, NULL, 0);
 }
 
 bool httpResponseReset(struct HttpResponse *pRes)
@@ -350,7 +346,8 @@ bool httpResponseReset(struct HttpResponse *pRes)
     if (pRes->pszHttpVersion != NULL) free(pRes->pszHttpVersion);
     if (pRes->pHeaders) pRes->pHeaders->free(pRes->pHeaders);
     if (pRes->pszContentType != NULL) free(pRes->pszContentType);
-    if (pRes->pContent != NULL) free(pRes->pContent);
+    if (pRes->pContent != NULL && pRes->bContentStatic == false) free(pRes->pContent);
+    if (pRes->pEncoder != NULL) httpEncoderFree(pRes->pEncoder);
 
     memset((void *)pRes, 0, sizeof(struct HttpResponse));
     pRes->pHeaders = pHeaders;
@@ -365,56 +362,49 @@ void httpResponseFree(struct HttpResponse *pRes)
     if (pRes->pszHttpVersion != NULL) free(pRes->pszHttpVersion);
     if (pRes->pHeaders) pRes->pHeaders->free(pRes->pHeaders);
     if (pRes->pszContentType != NULL) free(pRes->pszContentType);
-    if (pRes->pContent != NULL) free(pRes->pContent);
+    if (pRes->pContent != NULL && pRes->bContentStatic == false) free(pRes->pContent);
+    if (pRes->pEncoder != NULL) httpEncoderFree(pRes->pEncoder);
     free(pRes);
 }
 
-const char *httpResponseGetMsg(int nResCode)
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static bool _outChunk(struct HttpResponse *pRes, const void *pData, size_t nSize)
 {
-    switch (nResCode) {
-        case HTTP_CODE_CONTINUE         :
-            return "Continue";
-        case HTTP_CODE_OK           :
-            return "OK";
-        case HTTP_CODE_CREATED          :
-            return "Created";
-        case HTTP_CODE_NO_CONTENT       :
-            return "No content";
-        case HTTP_CODE_PARTIAL_CONTENT      :
-            return "Partial Content";
-        case HTTP_CODE_MULTI_STATUS     :
-            return "Multi Status";
-        case HTTP_CODE_MOVED_TEMPORARILY    :
-            return "Moved Temporarily";
-        case HTTP_CODE_NOT_MODIFIED     :
-            return "Not Modified";
-        case HTTP_CODE_BAD_REQUEST      :
-            return "Bad Request";
-        case HTTP_CODE_UNAUTHORIZED     :
-            return "Authorization Required";
-        case HTTP_CODE_FORBIDDEN        :
-            return "Forbidden";
-        case HTTP_CODE_NOT_FOUND        :
-            return "Not Found";
-        case HTTP_CODE_METHOD_NOT_ALLOWED   :
-            return "Method Not Allowed";
-        case HTTP_CODE_REQUEST_TIME_OUT     :
-            return "Request Time Out";
-        case HTTP_CODE_GONE         :
-            return "Gone";
-        case HTTP_CODE_REQUEST_URI_TOO_LONG :
-            return "Request URI Too Long";
-        case HTTP_CODE_LOCKED           :
-            return "Locked";
-        case HTTP_CODE_INTERNAL_SERVER_ERROR    :
-            return "Internal Server Error";
-        case HTTP_CODE_NOT_IMPLEMENTED      :
-            return "Not Implemented";
-        case HTTP_CODE_SERVICE_UNAVAILABLE  :
-            return "Service Unavailable";
-        default :
-            LOG_WARN("PLEASE DEFINE THE MESSAGE FOR %d RESPONSE", nResCode);
+    struct HttpRequest *pReq = pRes->pReq;
+
+    struct iovec vectors[3];
+    int nVecCnt = 0;
+    ssize_t nTotSize = 0;
+
+    char szChunkSizeHead[16 + CONST_STRLEN(CRLF) + 1];
+    snprintf(szChunkSizeHead, sizeof(szChunkSizeHead), "%x" CRLF, (unsigned int)nSize);
+
+    // add to vector
+    vectors[nVecCnt].iov_base = szChunkSizeHead;
+    vectors[nVecCnt].iov_len = strlen(szChunkSizeHead);
+    nTotSize += vectors[nVecCnt].iov_len;
+    nVecCnt++;
+
+    if (nSize > 0) {
+        // add to vector
+        vectors[nVecCnt].iov_base = (void *)pData;
+        vectors[nVecCnt].iov_len = nSize;
+        nTotSize += vectors[nVecCnt].iov_len;
+        nVecCnt++;
     }
 
-    return "";
+    // add to vector
+    vectors[nVecCnt].iov_base = CRLF;
+    vectors[nVecCnt].iov_len = CONST_STRLEN(CRLF);
+    nTotSize += vectors[nVecCnt].iov_len;
+    nVecCnt++;
+
+    // print out
+    ssize_t nTotSent = streamWritev(pReq->nSockFd, vectors, nVecCnt, pReq->nTimeout * 1000);
+
+    if (nTotSize == nTotSent) return true;
+    return false;
 }
@@ -34,91 +34,116 @@ int httpStatusResponse(struct HttpRequest *pReq, struct HttpResponse *pRes)
 {
     if (pReq == NULL || pRes == NULL) return 0;
 
-    qvector_t *obHtml = httpGetStatusHtml();
-    if (obHtml == NULL) return response500(pRes);
+    qvector_t *obHtml = qvector();
+    struct Writer *pHtml = writerCreate(writerVectorOut, (void *)obHtml);
+    if (pHtml == NULL) {
+        obHtml->free(obHtml);
+        return response500(pRes);
+    }
+    bool bRet = (httpGetStatusHtml(pHtml) == true && writerFlush(pHtml) == true) ? true : false;
+    writerFree(pHtml);
 
-    // get size
-    size_t nHtmlSize = obHtml->list->datasize(obHtml->list);
+    // set contents, so it goes through the compression filter
+    size_t nHtmlSize;
+    char *pszHtml = (bRet == true) ? (char *)obHtml->toarray(obHtml, &nHtmlSize) : NULL;
+    obHtml->free(obHtml);
+    if (pszHtml == NULL) return response500(pRes);
 
     // set response
     httpResponseSetCode(pRes, HTTP_CODE_OK, true);
-    httpResponseSetContent(pRes, "text/html; charset=\"utf-8\"", NULL, nHtmlSize);
-
-    // print out header
-    httpResponseOut(pRes);
-
-    // print out contents
-    streamStackOut(pReq->nSockFd, obHtml, pReq->nTimeout * 1000);
-
-    // free
-    obHtml->free(obHtml);
+    httpResponseSetContent(pRes, "text/html; charset=\"utf-8\"", pszHtml, nHtmlSize);
+    free(pszHtml);
 
     return HTTP_CODE_OK;
 }
 
-qvector_t *httpGetStatusHtml(void)
+bool httpGetStatusHtml(struct Writer *pHtml)
 {
     struct SharedData *pShm = NULL;
     pShm = poolGetShm();
-    if (pShm == NULL) return NULL;
+    if (pShm == NULL) return false;
 
     char *pszVersionStr = getVersion();
 
-    qvector_t *obHtml = qvector();
-    obHtml->addstr(obHtml, "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 3.2 Final//EN\">" CRLF);
-    obHtml->addstr(obHtml, "<html>" CRLF);
-    obHtml->addstr(obHtml, "<head>" CRLF);
-    obHtml->addstrf(obHtml,"  <title>%s/%s Status</title>" CRLF, g_prgname, g_prgversion);
-    obHtml->addstr(obHtml, "  <meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />" CRLF);
-    obHtml->addstr(obHtml, "  <style type=\"text/css\">" CRLF);
-    obHtml->addstr(obHtml, "    body,td,th { font-size:14px; }" CRLF);
-    obHtml->addstr(obHtml, "  </style>" CRLF);
-    obHtml->addstr(obHtml, "</head>" CRLF);
-    obHtml->addstr(obHtml, "<body>" CRLF);
-
-    obHtml->addstrf(obHtml,"<h1>%s/%s Status</h1>" CRLF, g_prgname, g_prgversion);
-    obHtml->addstr(obHtml, "<dl>" CRLF);
-    obHtml->addstrf(obHtml,"  <dt>Server Version: %s</dt>" CRLF, pszVersionStr);
-    obHtml->addstrf(obHtml,"  <dt>Current Time: %s" CRLF, qtime_gmt_staticstr(0));
-    obHtml->addstrf(obHtml,"  , Start Time: %s</dt>" CRLF, qtime_gmt_staticstr(pShm->nStartTime));
-    obHtml->addstrf(obHtml,"  <dt>Total Connections : %d" CRLF, pShm->nTotalConnected);
-    obHtml->addstrf(obHtml,"  , Total Requests : %d</dt>" CRLF, pShm->nTotalRequests);
-    obHtml->addstrf(obHtml,"  , Total Launched: %d" CRLF, pShm->nTotalLaunched);
-    obHtml->addstrf(obHtml,"  , Running Servers: %d</dt>" CRLF, pShm->nRunningChilds);
-    obHtml->addstrf(obHtml,"  , Working Servers: %d</dt>" CRLF, pShm->nWorkingChilds);
-    obHtml->addstrf(obHtml,"  <dt>Start Servers: %d" CRLF, g_conf.nStartServers);
-    obHtml->addstrf(obHtml,"  , Min Spare Servers: %d" CRLF, g_conf.nMinSpareServers);
-    obHtml->addstrf(obHtml,"  , Max Spare Servers: %d" CRLF, g_conf.nMaxSpareServers);
-    obHtml->addstrf(obHtml,"  , Max Clients: %d</dt>" CRLF, g_conf.nMaxClients);
-    obHtml->addstr(obHtml, "</dl>" CRLF);
+    writerPutLit(pHtml, "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 3.2 Final//EN\">" CRLF
+                        "<html>" CRLF
+                        "<head>" CRLF);
+    writerPutf(pHtml, "  <title>%s/%s Status</title>" CRLF, g_prgname, g_prgversion);
+    writerPutLit(pHtml, "  <meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />" CRLF
+                        "  <style type=\"text/css\">" CRLF
+                        "    body,td,th { font-size:14px; }" CRLF
+                        "  </style>" CRLF
+                        "</head>" CRLF
+                        "<body>" CRLF);
+
+    writerPutf(pHtml, "<h1>%s/%s Status</h1>" CRLF, g_prgname, g_prgversion);
+    writerPutLit(pHtml, "<dl>" CRLF);
+    writerPutf(pHtml, "  <dt>Server Version: %s</dt>" CRLF, pszVersionStr);
+    writerPutLit(pHtml, "  <dt>Current Time: ");
+    writerPutHttpDate(pHtml, time(NULL));
+    writerPutLit(pHtml, CRLF "  , Start Time: ");
+    writerPutHttpDate(pHtml, pShm->nStartTime);
+    writerPutLit(pHtml, "</dt>" CRLF "  <dt>Total Connections : ");
+    writerPutInt(pHtml, pShm->nTotalConnected);
+    writerPutLit(pHtml, CRLF "  , Total Requests : ");
+    writerPutInt(pHtml, pShm->nTotalRequests);
+    writerPutLit(pHtml, "</dt>" CRLF "  , Total Launched: ");
+    writerPutInt(pHtml, pShm->nTotalLaunched);
+    writerPutLit(pHtml, CRLF "  , Running Servers: ");
+    writerPutInt(pHtml, pShm->nRunningChilds);
+    writerPutLit(pHtml, "</dt>" CRLF "  , Working Servers: ");
+    writerPutInt(pHtml, pShm->nWorkingChilds);
+    writerPutLit(pHtml, "</dt>" CRLF "  <dt>Shed Connections: ");
+    writerPutInt(pHtml, pShm->nShedConnections);
+    writerPutLit(pHtml, CRLF "  , Limited Connections: ");
+    writerPutInt(pHtml, pShm->nLimitedConnections);
+    writerPutLit(pHtml, CRLF "  , Limited Requests: ");
+    writerPutInt(pHtml, pShm->nLimitedRequests);
+    writerPutLit(pHtml, CRLF "  , Slow Header Cuts: ");
+    writerPutInt(pHtml, pShm->nSlowHeaderCuts);
+    writerPutLit(pHtml, CRLF "  , Slow Body Cuts: ");
+    writerPutInt(pHtml, pShm->nSlowBodyCuts);
+    writerPutLit(pHtml, "</dt>" CRLF "  <dt>Page Cache Hits: ");
+    writerPutInt(pHtml, pShm->nPageCacheHits);
+    writerPutLit(pHtml, CRLF "  , Page Cache Misses: ");
+    writerPutInt(pHtml, pShm->nPageCacheMisses);
+    writerPutLit(pHtml, "</dt>" CRLF "  <dt>Start Servers: ");
+    writerPutInt(pHtml, g_conf.nStartServers);
+    writerPutLit(pHtml, CRLF "  , Min Spare Servers: ");
+    writerPutInt(pHtml, g_conf.nMinSpareServers);
+    writerPutLit(pHtml, CRLF "  , Max Spare Servers: ");
+    writerPutInt(pHtml, g_conf.nMaxSpareServers);
+    writerPutLit(pHtml, CRLF "  , Max Clients: ");
+    writerPutInt(pHtml, g_conf.nMaxClients);
+    writerPutLit(pHtml, "</dt>" CRLF "</dl>" CRLF);
 
     free(pszVersionStr);
 
-    obHtml->addstr(obHtml, "<table width='100%%' border=1 cellpadding=1 cellspacing=0>" CRLF);
-    obHtml->addstr(obHtml, "  <tr>" CRLF);
-    obHtml->addstr(obHtml, "    <th colspan=5>Server Information</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th colspan=5>Current Connection</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th colspan=4>Request Information</th>" CRLF);
-    obHtml->addstr(obHtml, "  </tr>" CRLF);
-
-    obHtml->addstr(obHtml, "  <tr>" CRLF);
-    obHtml->addstr(obHtml, "    <th>SNO</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>PID</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>Started</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>Conns</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>Reqs</th>" CRLF);
-
-    obHtml->addstr(obHtml, "    <th>Status</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>Client IP</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>Conn Time</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>Runs</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>Reqs</th>" CRLF);
-
-    obHtml->addstr(obHtml, "    <th>Request Information</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>Res</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>Req Time</th>" CRLF);
-    obHtml->addstr(obHtml, "    <th>Runs</th>" CRLF);
-    obHtml->addstr(obHtml, "  </tr>" CRLF);
+    writerPutLit(pHtml, "<table width='100%' border=1 cellpadding=1 cellspacing=0>" CRLF
+                        "  <tr>" CRLF
+                        "    <th colspan=5>Server Information</th>" CRLF
+                        "    <th colspan=5>Current Connection</th>" CRLF
+                        "    <th colspan=4>Request Information</th>" CRLF
+                        "  </tr>" CRLF
+
+                        "  <tr>" CRLF
+                        "    <th>SNO</th>" CRLF
+                        "    <th>PID</th>" CRLF
+                        "    <th>Started</th>" CRLF
+                        "    <th>Conns</th>" CRLF
+                        "    <th>Reqs</th>" CRLF
+
+                        "    <th>Status</th>" CRLF
+                        "    <th>Client IP</th>" CRLF
+                        "    <th>Conn Time</th>" CRLF
+                        "    <th>Runs</th>" CRLF
+                        "    <th>Reqs</th>" CRLF
+
+                        "    <th>Request Information</th>" CRLF
+                        "    <th>Res</th>" CRLF
+                        "    <th>Req Time</th>" CRLF
+                        "    <th>Runs</th>" CRLF
+                        "  </tr>" CRLF);
 
     int i, j;
     for (i = j = 0; i <  g_conf.nMaxClients; i++) {
@@ -141,32 +166,44 @@ qvector_t *httpGetStatusHtml(void)
         else nReqRuns = getDiffTimeval(&pShm->child[i].conn.tvResTime, &pShm->child[i].conn.tvReqTime);
 
         char szTimeStr[sizeof(char) * (CONST_STRLEN("YYYYMMDDhhmmss")+1)];
-        obHtml->addstr(obHtml, "  <tr align=center>" CRLF);
-        obHtml->addstrf(obHtml,"    <td>%d</td>" CRLF, j);
-        obHtml->addstrf(obHtml,"    <td>%u</td>" CRLF, (unsigned int)pShm->child[i].nPid);
-        obHtml->addstrf(obHtml,"    <td>%s</td>" CRLF, qtime_gmt_strf(szTimeStr, sizeof(szTimeStr), pShm->child[i].nStartTime, "%Y%m%d%H%M%S"));
-        obHtml->addstrf(obHtml,"    <td align=right>%d</td>" CRLF, pShm->child[i].nTotalConnected);
-        obHtml->addstrf(obHtml,"    <td align=right>%d</td>" CRLF, pShm->child[i].nTotalRequests);
-
-        obHtml->addstrf(obHtml,"    <td>%s</td>" CRLF, pszStatus);
-        obHtml->addstrf(obHtml,"    <td align=left>%s:%d</td>" CRLF, pShm->child[i].conn.szAddr, pShm->child[i].conn.nPort);
-        obHtml->addstrf(obHtml,"    <td>%s</td>" CRLF, (pShm->child[i].conn.nStartTime > 0) ? qtime_gmt_strf(szTimeStr, sizeof(szTimeStr), pShm->child[i].conn.nStartTime, "%Y%m%d%H%M%S") : "&nbsp;");
-        obHtml->addstrf(obHtml,"    <td align=right>%ds</td>" CRLF, nConnRuns);
-        obHtml->addstrf(obHtml,"    <td align=right>%d</td>" CRLF, pShm->child[i].conn.nTotalRequests);
-
-        obHtml->addstrf(obHtml,"    <td align=left>%s&nbsp;</td>" CRLF, pShm->child[i].conn.szReqInfo);
-        if (pShm->child[i].conn.nResponseCode == 0) obHtml->addstr(obHtml,"    <td>&nbsp;</td>" CRLF);
-        else obHtml->addstrf(obHtml,"    <td>%d</td>" CRLF, pShm->child[i].conn.nResponseCode);
-        obHtml->addstrf(obHtml,"    <td>%s</td>" CRLF, (pShm->child[i].conn.tvReqTime.tv_sec > 0) ? qtime_gmt_strf(szTimeStr, sizeof(szTimeStr), pShm->child[i].conn.tvReqTime.tv_sec, "%Y%m%d%H%M%S") : "&nbsp;");
-        obHtml->addstrf(obHtml,"    <td align=right>%.1fms</td>" CRLF, (nReqRuns * 1000));
-        obHtml->addstr(obHtml, "  </tr>" CRLF);
+        writerPutLit(pHtml, "  <tr align=center>" CRLF "    <td>");
+        writerPutInt(pHtml, j);
+        writerPutLit(pHtml, "</td>" CRLF "    <td>");
+        writerPutInt(pHtml, (unsigned int)pShm->child[i].nPid);
+        writerPutLit(pHtml, "</td>" CRLF "    <td>");
+        writerPuts(pHtml, qtime_gmt_strf(szTimeStr, sizeof(szTimeStr), pShm->child[i].nStartTime, "%Y%m%d%H%M%S"));
+        writerPutLit(pHtml, "</td>" CRLF "    <td align=right>");
+        writerPutInt(pHtml, pShm->child[i].nTotalConnected);
+        writerPutLit(pHtml, "</td>" CRLF "    <td align=right>");
+        writerPutInt(pHtml, pShm->child[i].nTotalRequests);
+
+        writerPutLit(pHtml, "</td>" CRLF "    <td>");
+        writerPuts(pHtml, pszStatus);
+        writerPutLit(pHtml, "</td>" CRLF "    <td align=left>");
+        writerPuts(pHtml, pShm->child[i].conn.szAddr);
+        writerPutLit(pHtml, ":");
+        writerPutInt(pHtml, pShm->child[i].conn.nPort);
+        writerPutLit(pHtml, "</td>" CRLF "    <td>");
+        writerPuts(pHtml, (pShm->child[i].conn.nStartTime > 0) ? qtime_gmt_strf(szTimeStr, sizeof(szTimeStr), pShm->child[i].conn.nStartTime, "%Y%m%d%H%M%S") : "&nbsp;");
+        writerPutLit(pHtml, "</td>" CRLF "    <td align=right>");
+        writerPutInt(pHtml, nConnRuns);
+        writerPutLit(pHtml, "s</td>" CRLF "    <td align=right>");
+        writerPutInt(pHtml, pShm->child[i].conn.nTotalRequests);
+
+        writerPutLit(pHtml, "</td>" CRLF "    <td align=left>");
+        writerPuts(pHtml, pShm->child[i].conn.szReqInfo);
+        writerPutLit(pHtml, "&nbsp;</td>" CRLF "    <td>");
+        if (pShm->child[i].conn.nResponseCode == 0) writerPutLit(pHtml, "&nbsp;");
+        else writerPutInt(pHtml, pShm->child[i].conn.nResponseCode);
+        writerPutLit(pHtml, "</td>" CRLF "    <td>");
+        writerPuts(pHtml, (pShm->child[i].conn.tvReqTime.tv_sec > 0) ? qtime_gmt_strf(szTimeStr, sizeof(szTimeStr), pShm->child[i].conn.tvReqTime.tv_sec, "%Y%m%d%H%M%S") : "&nbsp;");
+        writerPutf(pHtml, "</td>" CRLF "    <td align=right>%.1fms</td>" CRLF, (nReqRuns * 1000));
+        writerPutLit(pHtml, "  </tr>" CRLF);
     }
-    obHtml->addstr(obHtml, "</table>" CRLF);
-
-    obHtml->addstr(obHtml, "<hr>" CRLF);
-    obHtml->addstrf(obHtml,"%s v%s, %s" CRLF, g_prgname, g_prgversion, g_prginfo);
-    obHtml->addstr(obHtml, "</body>" CRLF);
-    obHtml->addstr(obHtml, "</html>" CRLF);
+    writerPutLit(pHtml, "</table>" CRLF);
 
-    return obHtml;
+    writerPutLit(pHtml, "<hr>" CRLF);
+    writerPutf(pHtml, "%s v%s, %s" CRLF, g_prgname, g_prgversion, g_prginfo);
+    return writerPutLit(pHtml, "</body>" CRLF
+                               "</html>" CRLF);
 }
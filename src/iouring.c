@@ -0,0 +1,563 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: iouring.c 223 2012-05-27 09:41:18Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * io_uring I/O backend for the stream functions.
+ *
+ * Each child owns a small ring. A transfer and its linked timeout are
+ * submitted and waited for in a single io_uring_enter(2) call, which replaces
+ * the poll(2) plus read(2)/write(2) pair of the default path. File contents
+ * are spliced to the socket through a pipe registered with the ring, the
+ * file-to-pipe and pipe-to-socket steps being linked in one submission.
+ *
+ * The ring is created after fork() because it can't be shared between
+ * processes. If the kernel refuses to set it up, iouringIsReady() returns
+ * false and the stream functions keep using the default path.
+ */
+
+#ifdef ENABLE_IOURING
+
+#include "qhttpd.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define IOURING_ENTRIES     (8)     // ops in flight never exceed three
+#define IOURING_PIPE_IN     (0)     // registered file index of pipe read end
+#define IOURING_PIPE_OUT    (1)     // registered file index of pipe write end
+
+struct IoRing {
+    int nRingFd;
+
+    // submission queue
+    unsigned *pSqHead;
+    unsigned *pSqTail;
+    unsigned *pSqMask;
+    unsigned *pSqArray;
+    struct io_uring_sqe *pSqes;
+
+    // completion queue
+    unsigned *pCqHead;
+    unsigned *pCqTail;
+    unsigned *pCqMask;
+    struct io_uring_cqe *pCqes;
+
+    // mappings
+    void *pSqPtr;
+    size_t nSqSize;
+    void *pCqPtr;
+    size_t nCqSize;
+    size_t nSqesSize;
+
+    // splice pipe
+    int anPipe[2];
+    size_t nPipeSize;
+    size_t nInPipe;     // bytes left in the pipe by a short send
+};
+
+static struct IoRing m_ring;
+static bool m_bReady = false;
+
+static struct io_uring_sqe *_getSqe(void);
+static void _prepLinkTimeout(struct __kernel_timespec *pTs, int nTimeoutMs);
+static int _submitAndWait(int nSubmit, int *pnResults);
+static int _getErrno(int nRes);
+static void _unmapRing(void);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Set up the ring of the calling process. Must be called after fork().
+ *
+ * @return true if successful, otherwise returns false
+ */
+bool iouringInit(void)
+{
+    if (m_bReady == true) return true;
+
+    memset((void *)&m_ring, 0, sizeof(m_ring));
+    m_ring.nRingFd = m_ring.anPipe[0] = m_ring.anPipe[1] = -1;
+
+    struct io_uring_params params;
+    memset((void *)&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    int nRingFd = syscall(SYS_io_uring_setup, IOURING_ENTRIES, &params);
+    if (nRingFd < 0 && errno == EINVAL) {
+        // older kernels don't know about the flags
+        memset((void *)&params, 0, sizeof(params));
+        nRingFd = syscall(SYS_io_uring_setup, IOURING_ENTRIES, &params);
+    }
+    if (nRingFd < 0) {
+        DEBUG("io_uring is not available. (errno: %d)", errno);
+        return false;
+    }
+    m_ring.nRingFd = nRingFd;
+
+    if (!(params.features & IORING_FEAT_NODROP)) {
+        DEBUG("io_uring is too old.");
+        iouringFree();
+        return false;
+    }
+
+    // map rings
+    m_ring.nSqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_ring.nCqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (m_ring.nCqSize > m_ring.nSqSize) m_ring.nSqSize = m_ring.nCqSize;
+        m_ring.nCqSize = m_ring.nSqSize;
+    }
+
+    m_ring.pSqPtr = mmap(NULL, m_ring.nSqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         nRingFd, IORING_OFF_SQ_RING);
+    if (m_ring.pSqPtr == MAP_FAILED) {
+        m_ring.pSqPtr = NULL;
+        iouringFree();
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_ring.pCqPtr = m_ring.pSqPtr;
+    } else {
+        m_ring.pCqPtr = mmap(NULL, m_ring.nCqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             nRingFd, IORING_OFF_CQ_RING);
+        if (m_ring.pCqPtr == MAP_FAILED) {
+            m_ring.pCqPtr = NULL;
+            iouringFree();
+            return false;
+        }
+    }
+
+    m_ring.nSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_ring.pSqes = (struct io_uring_sqe *)mmap(NULL, m_ring.nSqesSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, nRingFd, IORING_OFF_SQES);
+    if (m_ring.pSqes == MAP_FAILED) {
+        m_ring.pSqes = NULL;
+        iouringFree();
+        return false;
+    }
+
+    char *pSq = (char *)m_ring.pSqPtr, *pCq = (char *)m_ring.pCqPtr;
+    m_ring.pSqHead = (unsigned *)(pSq + params.sq_off.head);
+    m_ring.pSqTail = (unsigned *)(pSq + params.sq_off.tail);
+    m_ring.pSqMask = (unsigned *)(pSq + params.sq_off.ring_mask);
+    m_ring.pSqArray = (unsigned *)(pSq + params.sq_off.array);
+    m_ring.pCqHead = (unsigned *)(pCq + params.cq_off.head);
+    m_ring.pCqTail = (unsigned *)(pCq + params.cq_off.tail);
+    m_ring.pCqMask = (unsigned *)(pCq + params.cq_off.ring_mask);
+    m_ring.pCqes = (struct io_uring_cqe *)(pCq + params.cq_off.cqes);
+
+    // splice pipe, registered so it's not looked up on every request
+    if (pipe2(m_ring.anPipe, O_CLOEXEC) != 0) {
+        m_ring.anPipe[0] = m_ring.anPipe[1] = -1;
+        iouringFree();
+        return false;
+    }
+    int nPipeSize = fcntl(m_ring.anPipe[1], F_SETPIPE_SZ, MAX_SENDFILE_CHUNK);
+    if (nPipeSize < 0) nPipeSize = fcntl(m_ring.anPipe[1], F_GETPIPE_SZ);
+    m_ring.nPipeSize = (nPipeSize > 0) ? nPipeSize : 65536;
+
+    if (syscall(SYS_io_uring_register, nRingFd, IORING_REGISTER_FILES, m_ring.anPipe, 2) != 0) {
+        DEBUG("Can't register files to io_uring. (errno: %d)", errno);
+        iouringFree();
+        return false;
+    }
+
+    m_bReady = true;
+    DEBUG("io_uring initialized. (entries %u, pipe %zu bytes)", params.sq_entries, m_ring.nPipeSize);
+    return true;
+}
+
+bool iouringFree(void)
+{
+    m_bReady = false;
+
+    _unmapRing();
+    if (m_ring.nRingFd >= 0) close(m_ring.nRingFd);
+    if (m_ring.anPipe[0] >= 0) close(m_ring.anPipe[0]);
+    if (m_ring.anPipe[1] >= 0) close(m_ring.anPipe[1]);
+    m_ring.nRingFd = m_ring.anPipe[0] = m_ring.anPipe[1] = -1;
+
+    return true;
+}
+
+bool iouringIsReady(void)
+{
+    return m_bReady;
+}
+
+/**
+ * Receive data. Same semantics as qio_read().
+ *
+ * @return the number of bytes read if successful, 0 on timeout, -1 for error.
+ */
+ssize_t iouringRead(int nSockFd, void *pBuffer, size_t nSize, int nTimeoutMs)
+{
+    if (nSize == 0) return 0;
+
+    ssize_t nTotal = 0;
+    errno = 0;
+    while (nTotal < nSize) {
+        ssize_t nRead = iouringRecv(nSockFd, (char *)pBuffer + nTotal, nSize - nTotal, 0, nTimeoutMs);
+        if (nRead <= 0) break;
+        nTotal += nRead;
+    }
+
+    if (nTotal > 0) return nTotal;
+    else if (errno == ETIMEDOUT) return 0;
+    return -1;
+}
+
+/**
+ * Receive a line. Same semantics as qio_gets(), but the line is peeked in one
+ * piece and consumed by the second receive instead of reading byte by byte.
+ *
+ * @return the number of bytes read including CR and LF if successful,
+ *         0 on timeout, -1 for error.
+ */
+ssize_t iouringGets(int nSockFd, char *pszStr, size_t nSize, int nTimeoutMs)
+{
+    if (nSize <= 1) return -1;
+
+    size_t nReadCnt = 0;
+    bool bEol = false;
+    errno = 0;
+    while (bEol == false && nReadCnt < nSize - 1) {
+        ssize_t nPeeked = iouringRecv(nSockFd, pszStr + nReadCnt, nSize - 1 - nReadCnt, MSG_PEEK, nTimeoutMs);
+        if (nPeeked <= 0) break;
+
+        char *pEol = memchr(pszStr + nReadCnt, '\n', nPeeked);
+        size_t nLen = (pEol != NULL) ? (size_t)(pEol - (pszStr + nReadCnt)) + 1 : (size_t)nPeeked;
+
+        // consume peeked data, it's already in the socket buffer
+        ssize_t nRead = iouringRecv(nSockFd, pszStr + nReadCnt, nLen, MSG_DONTWAIT, 0);
+        if (nRead <= 0) break;
+
+        nReadCnt += nRead;
+        if (nRead == nLen && pEol != NULL) bEol = true;
+    }
+
+    // strip CR and LF
+    size_t i, j;
+    for (i = j = 0; i < nReadCnt; i++) {
+        if (pszStr[i] == '\r' || pszStr[i] == '\n') continue;
+        pszStr[j++] = pszStr[i];
+    }
+    pszStr[j] = '\0';
+
+    if (nReadCnt > 0) return nReadCnt;
+    else if (errno == ETIMEDOUT) return 0;
+    return -1;
+}
+
+/**
+ * Single receive operation.
+ *
+ * @param nFlags    recv(2) flags
+ * @return the number of bytes received, 0 on EOF or timeout(errno is set to
+ *         ETIMEDOUT), -1 for error.
+ */
+ssize_t iouringRecv(int nSockFd, void *pBuffer, size_t nSize, int nFlags, int nTimeoutMs)
+{
+    if (nTimeoutMs == 0) nFlags |= MSG_DONTWAIT;
+
+    struct io_uring_sqe *pSqe = _getSqe();
+    pSqe->opcode = IORING_OP_RECV;
+    pSqe->fd = nSockFd;
+    pSqe->addr = (unsigned long)pBuffer;
+    pSqe->len = nSize;
+    pSqe->msg_flags = nFlags;
+    pSqe->user_data = 0;
+
+    int nSubmit = 1;
+    struct __kernel_timespec ts;
+    if (nTimeoutMs > 0) {
+        pSqe->flags |= IOSQE_IO_LINK;
+        _prepLinkTimeout(&ts, nTimeoutMs);
+        nSubmit++;
+    }
+
+    int anRes[2];
+    if (_submitAndWait(nSubmit, anRes) != 0) return -1;
+
+    if (anRes[0] >= 0) return anRes[0];
+    errno = _getErrno(anRes[0]);
+    return (errno == ETIMEDOUT) ? 0 : -1;
+}
+
+/**
+ * Send vectors. Same semantics as qio_write().
+ *
+ * @return the number of bytes written if successful, 0 on timeout,
+ *         -1 for error.
+ */
+ssize_t iouringWritev(int nSockFd, const struct iovec *pVector, int nCount, int nTimeoutMs)
+{
+    struct iovec vectors[nCount];
+    memcpy(vectors, pVector, sizeof(struct iovec) * nCount);
+
+    struct msghdr msg;
+    memset((void *)&msg, 0, sizeof(msg));
+    msg.msg_iov = vectors;
+    msg.msg_iovlen = nCount;
+
+    ssize_t nTotal = 0;
+    errno = 0;
+    while (msg.msg_iovlen > 0) {
+        // skip empty vectors
+        if (msg.msg_iov->iov_len == 0) {
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+            continue;
+        }
+
+        struct io_uring_sqe *pSqe = _getSqe();
+        pSqe->opcode = IORING_OP_SENDMSG;
+        pSqe->fd = nSockFd;
+        pSqe->addr = (unsigned long)&msg;
+        pSqe->len = 1;
+        pSqe->msg_flags = MSG_NOSIGNAL | ((nTimeoutMs == 0) ? MSG_DONTWAIT : 0);
+        pSqe->user_data = 0;
+
+        int nSubmit = 1;
+        struct __kernel_timespec ts;
+        if (nTimeoutMs > 0) {
+            pSqe->flags |= IOSQE_IO_LINK;
+            _prepLinkTimeout(&ts, nTimeoutMs);
+            nSubmit++;
+        }
+
+        int anRes[2];
+        if (_submitAndWait(nSubmit, anRes) != 0) break;
+        if (anRes[0] <= 0) {
+            if (anRes[0] < 0) errno = _getErrno(anRes[0]);
+            break;
+        }
+        nTotal += anRes[0];
+
+        // advance vectors
+        size_t nSent = anRes[0];
+        while (nSent > 0 && msg.msg_iovlen > 0) {
+            if (nSent < msg.msg_iov->iov_len) {
+                msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + nSent;
+                msg.msg_iov->iov_len -= nSent;
+                break;
+            }
+            nSent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+    }
+
+    if (nTotal > 0) return nTotal;
+    else if (errno == ETIMEDOUT) return 0;
+    return -1;
+}
+
+/**
+ * Send file contents from current file offset by splicing through the pipe.
+ *
+ * @return the number of bytes transferred if successful, 0 on timeout,
+ *         -1 for error. errno is set to EINVAL if the file can't be spliced.
+ */
+off_t iouringSend(int nSockFd, int nFd, off_t nSize, int nTimeoutMs)
+{
+    off_t nSent = 0;
+    errno = 0;
+    while (nSent < nSize) {
+        struct io_uring_sqe *pSqe;
+        int nSubmit = 0, nFill = -1, nFlush;
+
+        // fill the pipe unless the previous send left data in it
+        size_t nLen = m_ring.nInPipe;
+        if (nLen == 0) {
+            nLen = (nSize - nSent > m_ring.nPipeSize) ? m_ring.nPipeSize : (size_t)(nSize - nSent);
+
+            pSqe = _getSqe();
+            pSqe->opcode = IORING_OP_SPLICE;
+            pSqe->fd = IOURING_PIPE_OUT;
+            pSqe->off = (uint64_t) -1;
+            pSqe->splice_fd_in = nFd;
+            pSqe->splice_off_in = (uint64_t) -1;
+            pSqe->len = nLen;
+            pSqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+            pSqe->user_data = nSubmit;
+            nFill = nSubmit++;
+        }
+
+        // drain the pipe to the socket
+        pSqe = _getSqe();
+        pSqe->opcode = IORING_OP_SPLICE;
+        pSqe->fd = nSockFd;
+        pSqe->off = (uint64_t) -1;
+        pSqe->splice_fd_in = IOURING_PIPE_IN;
+        pSqe->splice_off_in = (uint64_t) -1;
+        pSqe->splice_flags = SPLICE_F_FD_IN_FIXED | SPLICE_F_MOVE;
+        pSqe->len = nLen;
+        pSqe->user_data = nSubmit;
+        nFlush = nSubmit++;
+
+        struct __kernel_timespec ts;
+        if (nTimeoutMs > 0) {
+            pSqe->flags |= IOSQE_IO_LINK;
+            _prepLinkTimeout(&ts, nTimeoutMs);
+            nSubmit++;
+        }
+
+        int anRes[3];
+        if (_submitAndWait(nSubmit, anRes) != 0) break;
+
+        if (nFill >= 0) {
+            if (anRes[nFill] < 0) {
+                errno = -anRes[nFill];
+                break;
+            } else if (anRes[nFill] == 0) { // file truncated
+                break;
+            }
+            m_ring.nInPipe = anRes[nFill];
+        }
+
+        if (anRes[nFlush] > 0) {
+            m_ring.nInPipe -= anRes[nFlush];
+            nSent += anRes[nFlush];
+        } else if (anRes[nFlush] == -ECANCELED && nFill >= 0 && anRes[nFill] < nLen) {
+            // short fill breaks the link, flush it next time
+            continue;
+        } else {
+            if (anRes[nFlush] < 0) errno = _getErrno(anRes[nFlush]);
+            break;
+        }
+    }
+
+    if (m_ring.nInPipe > 0) {
+        // stale data must not leak into the next connection
+        char szBuf[4096];
+        while (m_ring.nInPipe > 0) {
+            ssize_t nRead = read(m_ring.anPipe[0], szBuf,
+                                 (m_ring.nInPipe > sizeof(szBuf)) ? sizeof(szBuf) : m_ring.nInPipe);
+            if (nRead <= 0) break;
+            m_ring.nInPipe -= nRead;
+        }
+        m_ring.nInPipe = 0;
+    }
+
+    if (nSent > 0) return nSent;
+    else if (errno == ETIMEDOUT) return 0;
+    return -1;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static struct io_uring_sqe *_getSqe(void)
+{
+    unsigned nTail = *m_ring.pSqTail;
+    unsigned nIdx = nTail & *m_ring.pSqMask;
+    struct io_uring_sqe *pSqe = &m_ring.pSqes[nIdx];
+    memset((void *)pSqe, 0, sizeof(struct io_uring_sqe));
+
+    m_ring.pSqArray[nIdx] = nIdx;
+    __atomic_store_n(m_ring.pSqTail, nTail + 1, __ATOMIC_RELEASE);
+
+    return pSqe;
+}
+
+static void _prepLinkTimeout(struct __kernel_timespec *pTs, int nTimeoutMs)
+{
+    pTs->tv_sec = nTimeoutMs / 1000;
+    pTs->tv_nsec = (long long)(nTimeoutMs % 1000) * 1000000;
+
+    struct io_uring_sqe *pSqe = _getSqe();
+    pSqe->opcode = IORING_OP_LINK_TIMEOUT;
+    pSqe->fd = -1;
+    pSqe->addr = (unsigned long)pTs;
+    pSqe->len = 1;
+    pSqe->user_data = (uint64_t) -1;
+}
+
+/*
+ * Submit queued requests and wait for all of their completions in one call.
+ * Results are stored by user_data index. Completions of linked timeouts are
+ * reaped but not stored.
+ *
+ * @return 0 if successful, otherwise returns -1 with errno
+ */
+static int _submitAndWait(int nSubmit, int *pnResults)
+{
+    int nToSubmit = nSubmit, nWaiting = nSubmit;
+    while (nWaiting > 0) {
+        int nRet = syscall(SYS_io_uring_enter, m_ring.nRingFd, nToSubmit, nWaiting,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+        if (nRet < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+
+            // give up the ring, the stream functions fall back to poll(2)
+            LOG_WARN("io_uring_enter() failed. (errno: %d)", errno);
+            __atomic_store_n(m_ring.pSqTail, *m_ring.pSqHead, __ATOMIC_RELEASE);
+            m_bReady = false;
+            return -1;
+        }
+        nToSubmit -= nRet;
+        if (nToSubmit < 0) nToSubmit = 0;
+
+        unsigned nHead = *m_ring.pCqHead;
+        unsigned nTail = __atomic_load_n(m_ring.pCqTail, __ATOMIC_ACQUIRE);
+        for (; nHead != nTail; nHead++) {
+            struct io_uring_cqe *pCqe = &m_ring.pCqes[nHead & *m_ring.pCqMask];
+            if (pCqe->user_data < (uint64_t)nSubmit) pnResults[pCqe->user_data] = pCqe->res;
+            nWaiting--;
+        }
+        __atomic_store_n(m_ring.pCqHead, nHead, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+/*
+ * Convert negative result of cancelled or would-block operation to ETIMEDOUT.
+ */
+static int _getErrno(int nRes)
+{
+    if (nRes == -ECANCELED || nRes == -EINTR || nRes == -EAGAIN || nRes == -ETIME) return ETIMEDOUT;
+    return -nRes;
+}
+
+static void _unmapRing(void)
+{
+    if (m_ring.pSqes != NULL) munmap(m_ring.pSqes, m_ring.nSqesSize);
+    if (m_ring.pCqPtr != NULL && m_ring.pCqPtr != m_ring.pSqPtr) munmap(m_ring.pCqPtr, m_ring.nCqSize);
+    if (m_ring.pSqPtr != NULL) munmap(m_ring.pSqPtr, m_ring.nSqSize);
+    m_ring.pSqes = NULL;
+    m_ring.pCqPtr = m_ring.pSqPtr = NULL;
+}
+
+#endif
@@ -0,0 +1,193 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: limit.c 226 2012-06-02 06:41:19Z seungyoung.kim $
+ ******************************************************************************/
+
+
+/*
+ * Per-client limits.
+ *
+ * Clients are grouped by the leading ClientPrefixLength bits of the address,
+ * so a whole subnet can be limited as one client.
+ *
+ * The number of concurrent connections of a group is counted from the
+ * scoreboard, so it never drifts even when a server dies in the middle of a
+ * connection.
+ *
+ * Request rates are limited by token buckets kept in a shared memory table.
+ * The table is a small open addressing hash. When a group can't find a slot
+ * within LIMIT_PROBES, the slot which has been idle longest is taken over.
+ * Its bucket would have been refilled by then anyway.
+ */
+
+#include "qhttpd.h"
+
+#define LIMIT_SEM_ID        (2)
+#define LIMIT_SEM_MAXWAIT   (5000)
+#define LIMIT_PROBES        (8)
+
+struct LimitEntry {
+    bool    bUsed;          // flag for used slot
+    unsigned int nKey;      // masked client address
+    float   nTokens;        // remaining requests
+    struct  timeval tvLast; // last refill time
+};
+
+static struct LimitEntry *m_pTable = NULL;
+static int m_nShmId = -1;
+
+static unsigned int _getMask(void);
+static bool _takeToken(unsigned int nKey);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS - daemon
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Create the request rate table. Called by the daemon. Nothing is created
+ * if request rate is not limited.
+ *
+ * @return true if successful, otherwise returns false
+ */
+bool limitInit(void)
+{
+    if (g_conf.nClientRequestRate <= 0) return true;
+
+    int nShmId = qshm_init(g_conf.szPidFile, 'l', sizeof(struct LimitEntry) * MAX_LIMIT_ENTRIES, true);
+    if (nShmId < 0) return false;
+
+    struct LimitEntry *pTable = (struct LimitEntry *)qshm_get(nShmId);
+    if (pTable == NULL) {
+        qshm_free(nShmId);
+        return false;
+    }
+
+    memset((void *)pTable, 0, sizeof(struct LimitEntry) * MAX_LIMIT_ENTRIES);
+    m_nShmId = nShmId;
+    m_pTable = pTable;
+    return true;
+}
+
+bool limitFree(void)
+{
+    if (m_nShmId >= 0) {
+        qshm_free(m_nShmId);
+        m_nShmId = -1;
+        m_pTable = NULL;
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS - child
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Check limits of the connected client. Must be called after
+ * poolSetConnInfo().
+ *
+ * @param bConnection   true for a new connection. it also checks the number
+ *                      of concurrent connections.
+ * @return true if allowed, false if the client is over the limits
+ */
+bool limitAdmit(bool bConnection)
+{
+    unsigned int nMask = _getMask();
+    unsigned int nKey = poolGetConnNaddr() & nMask;
+
+    // the count includes this connection
+    if (bConnection == true && g_conf.nClientMaxConnections > 0
+        && poolGetConnCount(nKey, nMask) > g_conf.nClientMaxConnections) {
+        DEBUG("Too many connections from %s.", poolGetConnAddr());
+        poolCountLimited(true);
+        return false;
+    }
+
+    if (m_pTable != NULL && _takeToken(nKey) == false) {
+        DEBUG("Too many requests from %s.", poolGetConnAddr());
+        poolCountLimited(bConnection);
+        return false;
+    }
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static unsigned int _getMask(void)
+{
+    if (g_conf.nClientPrefixLength <= 0) return 0;
+    if (g_conf.nClientPrefixLength >= 32) return 0xffffffff;
+    return ~(0xffffffff >> g_conf.nClientPrefixLength);
+}
+
+static bool _takeToken(unsigned int nKey)
+{
+    struct timeval tvNow;
+    gettimeofday(&tvNow, NULL);
+
+    qsem_enter_force(g_semid, LIMIT_SEM_ID, LIMIT_SEM_MAXWAIT, NULL);
+
+    // find the slot of this client, or the one idle longest
+    struct LimitEntry *pEntry = NULL;
+    unsigned int nHash = (nKey * 2654435761U) % MAX_LIMIT_ENTRIES;
+    int i;
+    for (i = 0; i < LIMIT_PROBES; i++) {
+        struct LimitEntry *pSlot = &m_pTable[(nHash + i) % MAX_LIMIT_ENTRIES];
+        if (pSlot->bUsed == true && pSlot->nKey == nKey) {
+            pEntry = pSlot;
+            break;
+        }
+        if (pEntry == NULL || (pEntry->bUsed == true && (pSlot->bUsed == false
+            || timercmp(&pSlot->tvLast, &pEntry->tvLast, <)))) {
+            pEntry = pSlot;
+        }
+    }
+
+    if (pEntry->bUsed == false || pEntry->nKey != nKey) {
+        pEntry->bUsed = true;
+        pEntry->nKey = nKey;
+        pEntry->nTokens = g_conf.nClientRequestBurst;
+    } else {
+        pEntry->nTokens += getDiffTimeval(&tvNow, &pEntry->tvLast) * g_conf.nClientRequestRate;
+        if (pEntry->nTokens > g_conf.nClientRequestBurst) pEntry->nTokens = g_conf.nClientRequestBurst;
+    }
+    pEntry->tvLast = tvNow;
+
+    bool bAllowed = false;
+    if (pEntry->nTokens >= 1) {
+        pEntry->nTokens -= 1;
+        bAllowed = true;
+    }
+
+    qsem_leave(g_semid, LIMIT_SEM_ID);
+
+    return bAllowed;
+}
@@ -0,0 +1,287 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: linger.c 224 2012-05-29 10:15:02Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Lingering close helper.
+ *
+ * After a response is done, the connection is shut down for writing and the
+ * remaining input from the client has to be drained before close(), or the
+ * client may get RST instead of the response. Rather than keeping a server
+ * process busy with it, the socket is passed to a helper process over a unix
+ * domain socket. The helper drains every socket in one poll(2) loop and
+ * closes it on EOF or after MAX_SHUTDOWN_WAIT.
+ *
+ * The daemon owns both ends of the control socket, so handed over sockets
+ * queue up safely while the helper is being relaunched.
+ */
+
+#include "qhttpd.h"
+#include <poll.h>
+
+static int m_anCtlFd[2] = { -1, -1 };   // [0] helper side, [1] server side
+static pid_t m_nHelperPid = 0;
+
+static void _lingerMain(void);
+static int _recvSocket(int nCtlFd);
+static long long _getMsec(void);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS - daemon
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Launch the lingering close helper. Called by the daemon.
+ *
+ * @param nBindSockFd   listening socket which the helper closes.
+ *                      -1 if not opened yet.
+ * @return true if successful, otherwise returns false
+ */
+bool lingerStart(int nBindSockFd)
+{
+    if (m_anCtlFd[0] < 0) {
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, m_anCtlFd) != 0) {
+            LOG_WARN("Can't create control socket for lingering close. (errno: %d)", errno);
+            m_anCtlFd[0] = m_anCtlFd[1] = -1;
+            return false;
+        }
+
+        // children must never block on the helper
+        int nFlags = fcntl(m_anCtlFd[1], F_GETFL, 0);
+        fcntl(m_anCtlFd[1], F_SETFL, nFlags | O_NONBLOCK);
+    }
+
+    pid_t nPid = fork();
+    if (nPid < 0) {
+        LOG_WARN("Can't launch lingering close helper. (errno: %d)", errno);
+        return false;
+    } else if (nPid == 0) {
+        if (nBindSockFd >= 0) close(nBindSockFd);
+        _lingerMain();
+        exit(EXIT_SUCCESS);
+    }
+
+    m_nHelperPid = nPid;
+    DEBUG("Lingering close helper %d launched.", nPid);
+    return true;
+}
+
+/**
+ * Relaunch the helper if it's gone. Called by the daemon periodically.
+ *
+ * @return true if relaunched, otherwise returns false
+ */
+bool lingerCheck(int nBindSockFd)
+{
+    if (m_anCtlFd[0] < 0 || m_nHelperPid <= 0) return false;
+    if (kill(m_nHelperPid, 0) == 0) return false;
+
+    LOG_WARN("Lingering close helper %d is gone. Relaunching.", m_nHelperPid);
+    m_nHelperPid = 0;
+    return lingerStart(nBindSockFd);
+}
+
+bool lingerStop(void)
+{
+    if (m_nHelperPid > 0) {
+        kill(m_nHelperPid, SIGTERM);
+        m_nHelperPid = 0;
+    }
+
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (m_anCtlFd[i] >= 0) close(m_anCtlFd[i]);
+        m_anCtlFd[i] = -1;
+    }
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS - child
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Pass the socket to the helper. The caller still has to close its own
+ * descriptor.
+ *
+ * @param nSockFd   socket which is already shut down for writing
+ * @return true if the helper took it, otherwise returns false
+ */
+bool lingerHandOver(int nSockFd)
+{
+    if (m_anCtlFd[1] < 0) return false;
+
+    char cDummy = 0;
+    struct iovec vector = { &cDummy, 1 };
+
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } cmsgbuf;
+    memset((void *)&cmsgbuf, 0, sizeof(cmsgbuf));
+
+    struct msghdr msg;
+    memset((void *)&msg, 0, sizeof(msg));
+    msg.msg_iov = &vector;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf.buf;
+    msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+    struct cmsghdr *pCmsg = CMSG_FIRSTHDR(&msg);
+    pCmsg->cmsg_level = SOL_SOCKET;
+    pCmsg->cmsg_type = SCM_RIGHTS;
+    pCmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(pCmsg), &nSockFd, sizeof(int));
+
+    if (sendmsg(m_anCtlFd[1], &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != 1) {
+        DEBUG("Lingering close helper is busy. (errno: %d)", errno);
+        return false;
+    }
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static void _lingerMain(void)
+{
+    // the daemon's handlers just set flags nobody looks at here
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGUSR1, SIG_IGN);
+    signal(SIGUSR2, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    close(m_anCtlFd[1]);
+    m_anCtlFd[1] = -1;
+
+    static struct pollfd fds[1 + MAX_LINGER_SOCKETS];
+    static long long anDeadline[1 + MAX_LINGER_SOCKETS];
+    int nSockets = 0;
+
+    fds[0].fd = m_anCtlFd[0];
+    fds[0].events = POLLIN;
+
+    pid_t nParentPid = getppid();
+    while (getppid() == nParentPid) {
+        // stop taking new sockets when full, servers drain by themselves
+        fds[0].events = (nSockets < MAX_LINGER_SOCKETS) ? POLLIN : 0;
+
+        int nTimeoutMs = 1000;
+        long long nNow = _getMsec();
+        int i;
+        for (i = 1; i <= nSockets; i++) {
+            long long nLeft = anDeadline[i] - nNow;
+            if (nLeft < 0) nLeft = 0;
+            if (nLeft < nTimeoutMs) nTimeoutMs = (int)nLeft;
+        }
+
+        int nReady = poll(fds, 1 + nSockets, nTimeoutMs);
+        if (nReady < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // drain or close sockets
+        nNow = _getMsec();
+        for (i = 1; i <= nSockets; i++) {
+            bool bClose = (nNow >= anDeadline[i]) ? true : false;
+            if (bClose == false && fds[i].revents != 0) {
+                char szDummyBuf[4096];
+                ssize_t nDummyRead = recv(fds[i].fd, szDummyBuf, sizeof(szDummyBuf), MSG_DONTWAIT);
+                if (nDummyRead == 0 || (nDummyRead < 0 && errno != EAGAIN && errno != EINTR)) bClose = true;
+            }
+            if (bClose == false) continue;
+
+            // let the kernel finish sending in the background
+            struct linger li = { 0, 0 };
+            setsockopt(fds[i].fd, SOL_SOCKET, SO_LINGER, &li, sizeof(li));
+            close(fds[i].fd);
+
+            // fill the hole with the last one
+            fds[i] = fds[nSockets];
+            anDeadline[i] = anDeadline[nSockets];
+            nSockets--;
+            i--;
+        }
+
+        // take new sockets
+        if (fds[0].revents & POLLIN) {
+            while (nSockets < MAX_LINGER_SOCKETS) {
+                int nSockFd = _recvSocket(m_anCtlFd[0]);
+                if (nSockFd < 0) break;
+
+                nSockets++;
+                fds[nSockets].fd = nSockFd;
+                fds[nSockets].events = POLLIN;
+                fds[nSockets].revents = 0;
+                anDeadline[nSockets] = nNow + MAX_SHUTDOWN_WAIT;
+            }
+        }
+    }
+}
+
+static int _recvSocket(int nCtlFd)
+{
+    char cDummy;
+    struct iovec vector = { &cDummy, 1 };
+
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } cmsgbuf;
+
+    struct msghdr msg;
+    memset((void *)&msg, 0, sizeof(msg));
+    msg.msg_iov = &vector;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf.buf;
+    msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+    if (recvmsg(nCtlFd, &msg, MSG_DONTWAIT) <= 0) return -1;
+
+    struct cmsghdr *pCmsg = CMSG_FIRSTHDR(&msg);
+    if (pCmsg == NULL || pCmsg->cmsg_level != SOL_SOCKET || pCmsg->cmsg_type != SCM_RIGHTS) return -1;
+
+    int nSockFd;
+    memcpy(&nSockFd, CMSG_DATA(pCmsg), sizeof(int));
+    return nSockFd;
+}
+
+static long long _getMsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,559 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: lock.c 229 2012-06-11 14:26:53Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * WebDAV lock manager.
+ *
+ * Locks are kept in a shared memory table, so every server sees the same
+ * locks. The table is an open addressing hash keyed by the system path of
+ * the locked resource. Locks of a path always live within LOCK_PROBES slots
+ * from its hash, so checking a resource costs one short probe for the
+ * resource itself and one for each parent collection, which may hold a
+ * depth infinity lock. Only methods which change a whole collection, such
+ * like DELETE of a directory, scan the table for locks below it.
+ *
+ * Expired locks are ignored by lookups and cleared by the daemon with
+ * lockReap().
+ */
+
+#include "qhttpd.h"
+
+#define LOCK_SEM_ID         (3)
+#define LOCK_SEM_MAXWAIT    (5000)
+#define LOCK_PROBES         (8)
+
+struct LockEntry {
+    bool    bUsed;              // flag for used slot
+    unsigned int nHash;         // hash of szPath
+    char    szPath[PATH_MAX];   // locked resource without trailing slash
+    time_t  nExpire;            // expiration time
+    struct  LockInfo info;
+};
+
+struct LockTable {
+    int     nLocks;             // number of used slots
+    unsigned int nGeneration;   // bumped whenever locks change
+    struct  LockEntry entry[MAX_LOCK_ENTRIES];
+};
+
+static struct LockTable *m_pTable = NULL;
+static int m_nShmId = -1;
+
+static int _getLocks(const char *pszPath, bool bDescendants, bool bParent, struct LockEntry **ppFound, int nMaxFound);
+static bool _isUnder(const char *pszPath, const char *pszParent);
+static char *_getKey(char *pszBuf, size_t nBufSize, const char *pszPath);
+static unsigned int _getHash(const char *pszKey);
+static int _getLevel(const char *pszKey);
+static bool _isAlive(struct LockEntry *pEntry, time_t nNow);
+static void _freeEntry(struct LockEntry *pEntry);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS - daemon
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Create the lock table. Called by the daemon. Nothing is created if LOCK
+ * method is not allowed.
+ *
+ * @return true if successful, otherwise returns false
+ */
+bool lockInit(void)
+{
+    if (g_conf.methods.bLock == false) return true;
+
+    int nShmId = qshm_init(g_conf.szPidFile, 'k', sizeof(struct LockTable), true);
+    if (nShmId < 0) return false;
+
+    struct LockTable *pTable = (struct LockTable *)qshm_get(nShmId);
+    if (pTable == NULL) {
+        qshm_free(nShmId);
+        return false;
+    }
+
+    memset((void *)pTable, 0, sizeof(struct LockTable));
+    m_nShmId = nShmId;
+    m_pTable = pTable;
+    return true;
+}
+
+bool lockFree(void)
+{
+    if (m_nShmId >= 0) {
+        qshm_free(m_nShmId);
+        m_nShmId = -1;
+        m_pTable = NULL;
+    }
+    return true;
+}
+
+/**
+ * Clear expired locks. Called by the daemon periodically.
+ *
+ * @return the number of locks cleared
+ */
+int lockReap(void)
+{
+    if (m_pTable == NULL || m_pTable->nLocks == 0) return 0;
+    if (qsem_enter_nowait(g_semid, LOCK_SEM_ID) == false) return 0;
+
+    time_t nNow = time(NULL);
+    int nReaped = 0;
+    int i;
+    for (i = 0; i < MAX_LOCK_ENTRIES; i++) {
+        struct LockEntry *pEntry = &m_pTable->entry[i];
+        if (pEntry->bUsed == false || _isAlive(pEntry, nNow) == true) continue;
+
+        DEBUG("Lock expired. (%s)", pEntry->szPath);
+        _freeEntry(pEntry);
+        nReaped++;
+    }
+
+    qsem_leave(g_semid, LOCK_SEM_ID);
+
+    return nReaped;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS - child
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Lock a resource.
+ *
+ * @param pszPath   system path of the resource
+ * @param pInfo     lock to take. szToken is filled in.
+ * @return 1 if locked, 0 if it conflicts with other locks, -1 if the lock
+ *         table is full or not available
+ */
+int lockAcquire(const char *pszPath, struct LockInfo *pInfo)
+{
+    if (m_pTable == NULL) return -1;
+
+    char szKey[PATH_MAX];
+    _getKey(szKey, sizeof(szKey), pszPath);
+    unsigned int nHash = _getHash(szKey);
+
+    // opaquelocktoken is in the form of UUID
+    char *pszUnique = qstrunique(szKey);
+    if (pszUnique == NULL) return -1;
+    snprintf(pInfo->szToken, sizeof(pInfo->szToken), "opaquelocktoken:%.8s-%.4s-%.4s-%.4s-%.12s",
+             pszUnique, pszUnique + 8, pszUnique + 12, pszUnique + 16, pszUnique + 20);
+    free(pszUnique);
+
+    qsem_enter_force(g_semid, LOCK_SEM_ID, LOCK_SEM_MAXWAIT, NULL);
+
+    // an exclusive lock conflicts with any lock, a shared lock conflicts
+    // with exclusive locks only.
+    struct LockEntry *apFound[MAX_LOCK_ENTRIES];
+    int nFound = _getLocks(szKey, pInfo->bInfinity, false, apFound, MAX_LOCK_ENTRIES);
+    int i;
+    for (i = 0; i < nFound; i++) {
+        if (pInfo->bShared == false || apFound[i]->info.bShared == false) {
+            qsem_leave(g_semid, LOCK_SEM_ID);
+            DEBUG("Lock conflicts with %s", apFound[i]->info.szToken);
+            return 0;
+        }
+    }
+
+    // find a free slot
+    time_t nNow = time(NULL);
+    struct LockEntry *pEntry = NULL;
+    for (i = 0; i < LOCK_PROBES; i++) {
+        struct LockEntry *pSlot = &m_pTable->entry[(nHash + i) % MAX_LOCK_ENTRIES];
+        if (pSlot->bUsed == false || _isAlive(pSlot, nNow) == false) {
+            pEntry = pSlot;
+            break;
+        }
+    }
+
+    if (pEntry == NULL) {
+        qsem_leave(g_semid, LOCK_SEM_ID);
+        LOG_WARN("Lock table is full around %s", szKey);
+        return -1;
+    }
+
+    if (pEntry->bUsed == false) m_pTable->nLocks++;
+    pEntry->bUsed = true;
+    pEntry->nHash = nHash;
+    qstrcpy(pEntry->szPath, sizeof(pEntry->szPath), szKey);
+    pEntry->nExpire = nNow + pInfo->nTimeout;
+    pEntry->info = *pInfo;
+    m_pTable->nGeneration++;
+
+    qsem_leave(g_semid, LOCK_SEM_ID);
+
+    DEBUG("Locked %s (%s)", szKey, pInfo->szToken);
+    return 1;
+}
+
+/**
+ * Refresh timeout of a lock.
+ *
+ * @param pszPath   system path of the resource, which the lock covers
+ * @param pszToken  lock token
+ * @param nTimeout  new timeout in seconds
+ * @param pInfo     the lock is copied into, can be NULL
+ * @return true if refreshed, false if there is no such lock
+ */
+bool lockRefresh(const char *pszPath, const char *pszToken, int nTimeout, struct LockInfo *pInfo)
+{
+    if (m_pTable == NULL || m_pTable->nLocks == 0) return false;
+
+    char szKey[PATH_MAX];
+    _getKey(szKey, sizeof(szKey), pszPath);
+
+    bool bFound = false;
+    qsem_enter_force(g_semid, LOCK_SEM_ID, LOCK_SEM_MAXWAIT, NULL);
+
+    struct LockEntry *apFound[MAX_LOCK_ENTRIES];
+    int nFound = _getLocks(szKey, false, false, apFound, MAX_LOCK_ENTRIES);
+    int i;
+    for (i = 0; i < nFound; i++) {
+        if (strcmp(apFound[i]->info.szToken, pszToken)) continue;
+
+        apFound[i]->info.nTimeout = nTimeout;
+        apFound[i]->nExpire = time(NULL) + nTimeout;
+        m_pTable->nGeneration++;
+        if (pInfo != NULL) *pInfo = apFound[i]->info;
+        bFound = true;
+        break;
+    }
+
+    qsem_leave(g_semid, LOCK_SEM_ID);
+
+    return bFound;
+}
+
+/**
+ * Unlock a resource.
+ *
+ * @param pszPath   system path of the resource, which the lock covers
+ * @param pszToken  lock token
+ * @return true if unlocked, false if there is no such lock
+ */
+bool lockRelease(const char *pszPath, const char *pszToken)
+{
+    if (m_pTable == NULL || m_pTable->nLocks == 0) return false;
+
+    char szKey[PATH_MAX];
+    _getKey(szKey, sizeof(szKey), pszPath);
+
+    bool bFound = false;
+    qsem_enter_force(g_semid, LOCK_SEM_ID, LOCK_SEM_MAXWAIT, NULL);
+
+    struct LockEntry *apFound[MAX_LOCK_ENTRIES];
+    int nFound = _getLocks(szKey, false, false, apFound, MAX_LOCK_ENTRIES);
+    int i;
+    for (i = 0; i < nFound; i++) {
+        if (strcmp(apFound[i]->info.szToken, pszToken)) continue;
+
+        DEBUG("Unlocked %s (%s)", apFound[i]->szPath, pszToken);
+        _freeEntry(apFound[i]);
+        bFound = true;
+        break;
+    }
+
+    qsem_leave(g_semid, LOCK_SEM_ID);
+
+    return bFound;
+}
+
+/**
+ * Check whether the token is a lock which covers the resource.
+ *
+ * @param pszPath   system path of the resource
+ * @param pszToken  lock token
+ * @return true if the lock covers the resource, otherwise returns false
+ */
+bool lockIsHeld(const char *pszPath, const char *pszToken)
+{
+    if (m_pTable == NULL || m_pTable->nLocks == 0) return false;
+
+    char szKey[PATH_MAX];
+    _getKey(szKey, sizeof(szKey), pszPath);
+
+    bool bHeld = false;
+    qsem_enter_force(g_semid, LOCK_SEM_ID, LOCK_SEM_MAXWAIT, NULL);
+
+    struct LockEntry *apFound[MAX_LOCK_ENTRIES];
+    int nFound = _getLocks(szKey, false, false, apFound, MAX_LOCK_ENTRIES);
+    int i;
+    for (i = 0; i < nFound; i++) {
+        if (!strcmp(apFound[i]->info.szToken, pszToken)) {
+            bHeld = true;
+            break;
+        }
+    }
+
+    qsem_leave(g_semid, LOCK_SEM_ID);
+
+    return bHeld;
+}
+
+/**
+ * Get locks which cover the resource, for lockdiscovery property.
+ *
+ * @param pszPath       system path of the resource
+ * @param pInfos        locks are copied into. nTimeout is set to the
+ *                      seconds left.
+ * @param pnLevels      levels up from the resource to each locked resource,
+ *                      0 for the resource itself
+ * @param nMaxInfos     the maximum locks to get
+ * @return the number of locks
+ */
+int lockGetAll(const char *pszPath, struct LockInfo *pInfos, int *pnLevels, int nMaxInfos)
+{
+    if (m_pTable == NULL || m_pTable->nLocks == 0) return 0;
+
+    char szKey[PATH_MAX];
+    _getKey(szKey, sizeof(szKey), pszPath);
+    int nLevel = _getLevel(szKey);
+
+    qsem_enter_force(g_semid, LOCK_SEM_ID, LOCK_SEM_MAXWAIT, NULL);
+
+    struct LockEntry *apFound[MAX_LOCK_ENTRIES];
+    int nFound = _getLocks(szKey, false, false, apFound, (nMaxInfos < MAX_LOCK_ENTRIES) ? nMaxInfos : MAX_LOCK_ENTRIES);
+    time_t nNow = time(NULL);
+    int i;
+    for (i = 0; i < nFound; i++) {
+        pInfos[i] = apFound[i]->info;
+        pInfos[i].nTimeout = (int)(apFound[i]->nExpire - nNow);
+        pnLevels[i] = nLevel - _getLevel(apFound[i]->szPath);
+    }
+
+    qsem_leave(g_semid, LOCK_SEM_ID);
+
+    return nFound;
+}
+
+/**
+ * Get a number which changes whenever locks are taken, refreshed or
+ * released, so cached lockdiscovery can be told stale.
+ */
+unsigned int lockGetGeneration(void)
+{
+    if (m_pTable == NULL) return 0;
+    return m_pTable->nGeneration;
+}
+
+/**
+ * Check whether the resource can be modified with the submitted tokens.
+ *
+ * A token of each exclusive lock must be submitted. Shared locks on the
+ * same resource are satisfied by a token of any one of them.
+ *
+ * @param pszPath       system path of the resource
+ * @param bRecursive    true if resources below are modified too
+ * @param bMember       true if members of the parent collection change,
+ *                      which depth 0 locks of the parent protect too
+ * @param ppszTokens    submitted lock tokens
+ * @param nTokens       the number of tokens
+ * @return true if allowed, false if it's locked by others
+ */
+bool lockIsAllowed(const char *pszPath, bool bRecursive, bool bMember, const char **ppszTokens, int nTokens)
+{
+    if (m_pTable == NULL || m_pTable->nLocks == 0) return true;
+
+    char szKey[PATH_MAX];
+    _getKey(szKey, sizeof(szKey), pszPath);
+
+    bool bAllowed = true;
+    qsem_enter_force(g_semid, LOCK_SEM_ID, LOCK_SEM_MAXWAIT, NULL);
+
+    // mark locks which tokens are submitted
+    struct LockEntry *apFound[MAX_LOCK_ENTRIES];
+    bool abSubmitted[MAX_LOCK_ENTRIES];
+    int nFound = _getLocks(szKey, bRecursive, bMember, apFound, MAX_LOCK_ENTRIES);
+    int i, j;
+    for (i = 0; i < nFound; i++) {
+        abSubmitted[i] = false;
+        for (j = 0; j < nTokens; j++) {
+            if (!strcmp(apFound[i]->info.szToken, ppszTokens[j])) {
+                abSubmitted[i] = true;
+                break;
+            }
+        }
+    }
+
+    // every locked resource on the way must be unlocked by a token
+    for (i = 0; i < nFound && bAllowed == true; i++) {
+        if (abSubmitted[i] == true) continue;
+
+        if (apFound[i]->info.bShared == true) {
+            for (j = 0; j < nFound; j++) {
+                if (abSubmitted[j] == true && apFound[j]->info.bShared == true
+                    && !strcmp(apFound[j]->szPath, apFound[i]->szPath)) break;
+            }
+            if (j < nFound) continue;
+        }
+
+        DEBUG("%s is locked by %s", szKey, apFound[i]->info.szToken);
+        bAllowed = false;
+    }
+
+    qsem_leave(g_semid, LOCK_SEM_ID);
+
+    return bAllowed;
+}
+
+/**
+ * Remove locks of a resource and resources below. Must be called after the
+ * resource is removed.
+ *
+ * @param pszPath   system path of the resource
+ */
+void lockDrop(const char *pszPath)
+{
+    if (m_pTable == NULL || m_pTable->nLocks == 0) return;
+
+    char szKey[PATH_MAX];
+    _getKey(szKey, sizeof(szKey), pszPath);
+
+    qsem_enter_force(g_semid, LOCK_SEM_ID, LOCK_SEM_MAXWAIT, NULL);
+
+    int i;
+    for (i = 0; i < MAX_LOCK_ENTRIES; i++) {
+        struct LockEntry *pEntry = &m_pTable->entry[i];
+        if (pEntry->bUsed == false) continue;
+        if (strcmp(pEntry->szPath, szKey) && _isUnder(pEntry->szPath, szKey) == false) continue;
+
+        DEBUG("Lock dropped. (%s)", pEntry->szPath);
+        _freeEntry(pEntry);
+    }
+
+    qsem_leave(g_semid, LOCK_SEM_ID);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/*
+ * Collect live locks which cover the resource. Must be called in the
+ * semaphore.
+ *
+ * @param bDescendants  true to collect locks below the resource too
+ * @param bParent       true to collect depth 0 locks of the parent too
+ * @return the number of locks found
+ */
+static int _getLocks(const char *pszKey, bool bDescendants, bool bParent, struct LockEntry **ppFound, int nMaxFound)
+{
+    time_t nNow = time(NULL);
+    int nFound = 0;
+
+    // locks of the resource itself and ancestors which lock infinity, or
+    // the parent which locks its members
+    char szPath[PATH_MAX];
+    qstrcpy(szPath, sizeof(szPath), pszKey);
+    int nLevel = 0;
+    while (szPath[0] != '\0' && nFound < nMaxFound) {
+        unsigned int nHash = _getHash(szPath);
+        int i;
+        for (i = 0; i < LOCK_PROBES && nFound < nMaxFound; i++) {
+            struct LockEntry *pEntry = &m_pTable->entry[(nHash + i) % MAX_LOCK_ENTRIES];
+            if (pEntry->bUsed == false || pEntry->nHash != nHash) continue;
+            if (strcmp(pEntry->szPath, szPath) || _isAlive(pEntry, nNow) == false) continue;
+            if (nLevel > 0 && pEntry->info.bInfinity == false && (nLevel > 1 || bParent == false)) continue;
+            ppFound[nFound++] = pEntry;
+        }
+
+        // move up to the parent
+        char *pszSlash = strrchr(szPath, '/');
+        if (pszSlash == NULL) break;
+        if (pszSlash == szPath) {
+            if (szPath[1] == '\0') break;
+            szPath[1] = '\0';
+        } else {
+            *pszSlash = '\0';
+        }
+        nLevel++;
+    }
+
+    // locks below the resource
+    if (bDescendants == true) {
+        int i;
+        for (i = 0; i < MAX_LOCK_ENTRIES && nFound < nMaxFound; i++) {
+            struct LockEntry *pEntry = &m_pTable->entry[i];
+            if (pEntry->bUsed == false || _isAlive(pEntry, nNow) == false) continue;
+            if (_isUnder(pEntry->szPath, pszKey) == false) continue;
+            ppFound[nFound++] = pEntry;
+        }
+    }
+
+    return nFound;
+}
+
+static bool _isUnder(const char *pszPath, const char *pszParent)
+{
+    size_t nLen = strlen(pszParent);
+    if (strncmp(pszPath, pszParent, nLen)) return false;
+    if (nLen > 0 && pszParent[nLen - 1] == '/') return (pszPath[nLen] != '\0') ? true : false;
+    return (pszPath[nLen] == '/') ? true : false;
+}
+
+/*
+ * System path without trailing slash, so a collection has one key.
+ */
+static char *_getKey(char *pszBuf, size_t nBufSize, const char *pszPath)
+{
+    qstrcpy(pszBuf, nBufSize, pszPath);
+    size_t nLen = strlen(pszBuf);
+    while (nLen > 1 && pszBuf[nLen - 1] == '/') pszBuf[--nLen] = '\0';
+    return pszBuf;
+}
+
+/*
+ * Number of path components, 0 for the root.
+ */
+static int _getLevel(const char *pszKey)
+{
+    int nLevel = 0;
+    for (; *pszKey != '\0'; pszKey++) {
+        if (*pszKey == '/' && pszKey[1] != '\0') nLevel++;
+    }
+    return nLevel;
+}
+
+static unsigned int _getHash(const char *pszKey)
+{
+    return qhashfnv1_32((const void *)pszKey, strlen(pszKey)) % MAX_LOCK_ENTRIES;
+}
+
+static bool _isAlive(struct LockEntry *pEntry, time_t nNow)
+{
+    return (pEntry->nExpire > nNow) ? true : false;
+}
+
+static void _freeEntry(struct LockEntry *pEntry)
+{
+    pEntry->bUsed = false;
+    m_pTable->nLocks--;
+    m_pTable->nGeneration++;
+}
@@ -345,6 +345,43 @@ int poolGetChildKeepaliveRequests(void)
     return m_pShm->child[m_nMySlotId].conn.nTotalRequests;
 }
 
+void poolCountShedConnection(void)
+{
+    m_pShm->nShedConnections++;
+}
+
+void poolCountLimited(bool bConnection)
+{
+    if (bConnection == true) m_pShm->nLimitedConnections++;
+    else m_pShm->nLimitedRequests++;
+}
+
+void poolCountSlowClient(bool bHeader)
+{
+    if (bHeader == true) m_pShm->nSlowHeaderCuts++;
+    else m_pShm->nSlowBodyCuts++;
+}
+
+/*
+ * Generation counters. Keys share counters by hash, so a collision only
+ * invalidates more than needed.
+ */
+unsigned int poolGetGeneration(const char *pszKey)
+{
+    return m_pShm->nGeneration[qhashfnv1_32(pszKey, strlen(pszKey)) % MAX_GENERATIONS];
+}
+
+void poolBumpGeneration(const char *pszKey)
+{
+    m_pShm->nGeneration[qhashfnv1_32(pszKey, strlen(pszKey)) % MAX_GENERATIONS]++;
+}
+
+void poolCountPageCache(bool bHit)
+{
+    if (bHit == true) m_pShm->nPageCacheHits++;
+    else m_pShm->nPageCacheMisses++;
+}
+
 /////////////////////////////////////////////////////////////////////////
 // MEMBER FUNCTIONS - connection
 /////////////////////////////////////////////////////////////////////////
@@ -467,6 +504,26 @@ time_t poolGetConnReqTime(void)
     return m_pShm->child[m_nMySlotId].conn.tvReqTime.tv_sec;
 }
 
+/*
+ * Count connected clients in the same network.
+ *
+ * @param nAddr network address
+ * @param nMask network mask
+ * @return number of connections
+ */
+int poolGetConnCount(unsigned int nAddr, unsigned int nMask)
+{
+    if (m_pShm == NULL) return 0;
+
+    int i, nCnt = 0;
+    for (i = 0; i < m_nMaxChild; i++) {
+        if (m_pShm->child[i].nPid == 0 || m_pShm->child[i].conn.bConnected == false) continue;
+        if ((m_pShm->child[i].conn.nAddr & nMask) == (nAddr & nMask)) nCnt++;
+    }
+
+    return nCnt;
+}
+
 /////////////////////////////////////////////////////////////////////////
 // PRIVATE FUNCTIONS - child
 /////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,467 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: prop.c 230 2012-06-14 11:08:19Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Dead property store.
+ *
+ * Properties set by PROPPATCH are kept in a file named PROP_FILENAME in
+ * each directory, holding properties of every resource in the directory.
+ * Listing a collection therefore reads one file for all of its members.
+ * The root collection keeps its own properties under the name ".".
+ *
+ * The file has a line per property, which is the member name, namespace,
+ * local name and the property element, URL encoded and separated by a
+ * space. Lines are sorted by member name.
+ *
+ * Writers lock the directory with flock(2) and replace the file with
+ * rename(2), so readers never need a lock.
+ */
+
+#include "qhttpd.h"
+#include <sys/file.h>
+
+struct DeadProps {
+    char    szDirPath[PATH_MAX];    // directory of the store
+    int     nDirFd;             // locked directory, -1 if opened for reading
+    char    *pBuf;              // loaded file, entries point into it
+    struct  PropEntry *pEntries;
+    int     nEntries;
+    int     nAlloc;
+    bool    bModified;
+};
+
+static bool _load(struct DeadProps *pProps);
+static bool _addEntry(struct DeadProps *pProps, char *pszMember, char *pszNs, char *pszName, char *pszXml, bool bAlloc);
+static void _freeEntry(struct PropEntry *pEntry);
+static int _findFirst(struct DeadProps *pProps, const char *pszMember);
+static int _cmpEntry(const void *p1, const void *p2);
+static bool _transfer(const char *pszOldDir, const char *pszOldMember, const char *pszNewDir, const char *pszNewMember, bool bRemove);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Open property store of a directory.
+ *
+ * @param pszDirPath    system path of the directory
+ * @param bWrite        true to modify. the directory is locked until
+ *                      propClose().
+ * @return store if successful, otherwise returns NULL
+ */
+struct DeadProps *propOpen(const char *pszDirPath, bool bWrite)
+{
+    struct DeadProps *pProps = (struct DeadProps *)calloc(1, sizeof(struct DeadProps));
+    if (pProps == NULL) return NULL;
+
+    qstrcpy(pProps->szDirPath, sizeof(pProps->szDirPath), pszDirPath);
+    pProps->nDirFd = -1;
+
+    if (bWrite == true) {
+        pProps->nDirFd = open(pszDirPath, O_RDONLY | O_DIRECTORY);
+        if (pProps->nDirFd < 0 || flock(pProps->nDirFd, LOCK_EX) != 0) {
+            propClose(pProps);
+            return NULL;
+        }
+    }
+
+    if (_load(pProps) == false) {
+        propClose(pProps);
+        return NULL;
+    }
+
+    return pProps;
+}
+
+/**
+ * Close property store. Changes not saved are discarded.
+ */
+void propClose(struct DeadProps *pProps)
+{
+    if (pProps->nDirFd >= 0) close(pProps->nDirFd);
+
+    int i;
+    for (i = 0; i < pProps->nEntries; i++) _freeEntry(&pProps->pEntries[i]);
+    if (pProps->pEntries != NULL) free(pProps->pEntries);
+    if (pProps->pBuf != NULL) free(pProps->pBuf);
+    free(pProps);
+}
+
+const char *propGetDirPath(struct DeadProps *pProps)
+{
+    return pProps->szDirPath;
+}
+
+/**
+ * Get properties of a member.
+ *
+ * @param pnCount   the number of properties is stored
+ * @return the first property, or NULL if it has none
+ */
+const struct PropEntry *propGet(struct DeadProps *pProps, const char *pszMember, int *pnCount)
+{
+    *pnCount = 0;
+    int nFirst = _findFirst(pProps, pszMember);
+    if (nFirst < 0) return NULL;
+
+    int i;
+    for (i = nFirst; i < pProps->nEntries && !strcmp(pProps->pEntries[i].pszMember, pszMember); i++);
+    *pnCount = i - nFirst;
+    return &pProps->pEntries[nFirst];
+}
+
+/**
+ * Set a property of a member. Existing one of the same name is replaced.
+ *
+ * @param pszXml    whole property element
+ */
+bool propSet(struct DeadProps *pProps, const char *pszMember, const char *pszNs, const char *pszName, const char *pszXml)
+{
+    propRemove(pProps, pszMember, pszNs, pszName);
+
+    char *pszDupMember = strdup(pszMember);
+    char *pszDupNs = strdup(pszNs);
+    char *pszDupName = strdup(pszName);
+    char *pszDupXml = strdup(pszXml);
+    if (pszDupMember == NULL || pszDupNs == NULL || pszDupName == NULL || pszDupXml == NULL
+        || _addEntry(pProps, pszDupMember, pszDupNs, pszDupName, pszDupXml, true) == false) {
+        if (pszDupMember != NULL) free(pszDupMember);
+        if (pszDupNs != NULL) free(pszDupNs);
+        if (pszDupName != NULL) free(pszDupName);
+        if (pszDupXml != NULL) free(pszDupXml);
+        return false;
+    }
+
+    qsort(pProps->pEntries, pProps->nEntries, sizeof(struct PropEntry), _cmpEntry);
+    pProps->bModified = true;
+    return true;
+}
+
+/**
+ * Remove a property of a member.
+ *
+ * @param pszNs     namespace, or NULL to remove every property of the member
+ * @return the number of properties removed
+ */
+int propRemove(struct DeadProps *pProps, const char *pszMember, const char *pszNs, const char *pszName)
+{
+    int nFirst = _findFirst(pProps, pszMember);
+    if (nFirst < 0) return 0;
+
+    // entries of the member are in a row
+    int nEnd;
+    for (nEnd = nFirst; nEnd < pProps->nEntries && !strcmp(pProps->pEntries[nEnd].pszMember, pszMember); nEnd++);
+
+    int i, j;
+    for (i = j = nFirst; i < nEnd; i++) {
+        struct PropEntry *pEntry = &pProps->pEntries[i];
+        if (pszNs == NULL || (!strcmp(pEntry->pszNs, pszNs) && !strcmp(pEntry->pszName, pszName))) {
+            _freeEntry(pEntry);
+            continue;
+        }
+        pProps->pEntries[j++] = *pEntry;
+    }
+
+    int nRemoved = nEnd - j;
+    if (nRemoved > 0) {
+        memmove(&pProps->pEntries[j], &pProps->pEntries[nEnd], sizeof(struct PropEntry) * (pProps->nEntries - nEnd));
+        pProps->nEntries -= nRemoved;
+        pProps->bModified = true;
+    }
+
+    return nRemoved;
+}
+
+/**
+ * Write changes. The file is removed when no property is left.
+ *
+ * @return true if successful, otherwise returns false
+ */
+bool propSave(struct DeadProps *pProps)
+{
+    if (pProps->bModified == false) return true;
+
+    char szPath[PATH_MAX + sizeof("/" PROP_FILENAME)];
+    snprintf(szPath, sizeof(szPath), "%s/" PROP_FILENAME, pProps->szDirPath);
+
+    if (pProps->nEntries == 0) {
+        if (sysUnlink(szPath) != 0 && errno != ENOENT) return false;
+        pProps->bModified = false;
+        return true;
+    }
+
+    char szTmpPath[sizeof(szPath) + sizeof(".XXXXXX")];
+    snprintf(szTmpPath, sizeof(szTmpPath), "%s.XXXXXX", szPath);
+    int nFd = mkstemp(szTmpPath);
+    if (nFd < 0) {
+        LOG_WARN("Can't create property file in %s. (errno: %d)", pProps->szDirPath, errno);
+        return false;
+    }
+    fchmod(nFd, DEF_FILE_MODE);
+
+    bool bRet = false;
+    struct Writer *pWriter = writerCreate(writerFileOut, (void *)&nFd);
+    if (pWriter != NULL) {
+        int i;
+        for (i = 0; i < pProps->nEntries; i++) {
+            struct PropEntry *pEntry = &pProps->pEntries[i];
+            writerPutUrl(pWriter, pEntry->pszMember);
+            writerPutLit(pWriter, " ");
+            writerPutUrl(pWriter, pEntry->pszNs);
+            writerPutLit(pWriter, " ");
+            writerPutUrl(pWriter, pEntry->pszName);
+            writerPutLit(pWriter, " ");
+            writerPutUrl(pWriter, pEntry->pszXml);
+            writerPutLit(pWriter, "\n");
+        }
+        bRet = writerFlush(pWriter);
+        writerFree(pWriter);
+    }
+    sysClose(nFd);
+
+    if (bRet == false || sysRename(szTmpPath, szPath) != 0) {
+        sysUnlink(szTmpPath);
+        return false;
+    }
+
+    pProps->bModified = false;
+    return true;
+}
+
+/**
+ * Move properties of a resource, which is renamed.
+ *
+ * @return true if successful, otherwise returns false
+ */
+bool propMove(const char *pszOldDir, const char *pszOldMember, const char *pszNewDir, const char *pszNewMember)
+{
+    return _transfer(pszOldDir, pszOldMember, pszNewDir, pszNewMember, true);
+}
+
+/**
+ * Copy properties of a resource, which is copied. Properties the
+ * destination had are replaced.
+ *
+ * @return true if successful, otherwise returns false
+ */
+bool propCopy(const char *pszSrcDir, const char *pszSrcMember, const char *pszDstDir, const char *pszDstMember)
+{
+    return _transfer(pszSrcDir, pszSrcMember, pszDstDir, pszDstMember, false);
+}
+
+/**
+ * Remove properties of a resource, which is removed.
+ *
+ * @return true if successful, otherwise returns false
+ */
+bool propDelete(const char *pszDir, const char *pszMember)
+{
+    struct DeadProps *pProps = propOpen(pszDir, true);
+    if (pProps == NULL) return false;
+
+    propRemove(pProps, pszMember, NULL, NULL);
+    bool bRet = propSave(pProps);
+    propClose(pProps);
+    return bRet;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static bool _load(struct DeadProps *pProps)
+{
+    char szPath[PATH_MAX + sizeof("/" PROP_FILENAME)];
+    snprintf(szPath, sizeof(szPath), "%s/" PROP_FILENAME, pProps->szDirPath);
+
+    // no property file means no properties
+    int nFd = sysOpen(szPath, O_RDONLY, 0);
+    if (nFd < 0) return (errno == ENOENT || errno == ENOTDIR) ? true : false;
+
+    struct stat filestat;
+    if (sysFstat(nFd, &filestat) != 0) {
+        sysClose(nFd);
+        return false;
+    }
+
+    pProps->pBuf = (char *)malloc(filestat.st_size + 1);
+    if (pProps->pBuf == NULL) {
+        sysClose(nFd);
+        return false;
+    }
+
+    ssize_t nRead = 0;
+    while (nRead < filestat.st_size) {
+        ssize_t n = read(nFd, pProps->pBuf + nRead, filestat.st_size - nRead);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        nRead += n;
+    }
+    sysClose(nFd);
+    pProps->pBuf[nRead] = '\0';
+
+    // parse lines in place
+    char *pszLine = pProps->pBuf;
+    while (*pszLine != '\0') {
+        char *pszNext = strchr(pszLine, '\n');
+        if (pszNext != NULL) *pszNext++ = '\0';
+        else pszNext = pszLine + strlen(pszLine);
+
+        char *apszField[4];
+        int nFields = 0;
+        char *pszToken = pszLine;
+        while (nFields < 4 && pszToken != NULL) {
+            apszField[nFields++] = pszToken;
+            pszToken = strchr(pszToken, ' ');
+            if (pszToken != NULL) *pszToken++ = '\0';
+        }
+
+        if (nFields == 4) {
+            int i;
+            for (i = 0; i < 4; i++) qurl_decode(apszField[i]);
+            if (_addEntry(pProps, apszField[0], apszField[1], apszField[2], apszField[3], false) == false) return false;
+        } else if (*pszLine != '\0') {
+            LOG_WARN("Broken line in %s", szPath);
+        }
+
+        pszLine = pszNext;
+    }
+
+    qsort(pProps->pEntries, pProps->nEntries, sizeof(struct PropEntry), _cmpEntry);
+    return true;
+}
+
+static bool _addEntry(struct DeadProps *pProps, char *pszMember, char *pszNs, char *pszName, char *pszXml, bool bAlloc)
+{
+    if (pProps->nEntries == pProps->nAlloc) {
+        int nAlloc = (pProps->nAlloc > 0) ? pProps->nAlloc * 2 : 16;
+        struct PropEntry *pEntries = (struct PropEntry *)realloc(pProps->pEntries, sizeof(struct PropEntry) * nAlloc);
+        if (pEntries == NULL) return false;
+        pProps->pEntries = pEntries;
+        pProps->nAlloc = nAlloc;
+    }
+
+    struct PropEntry *pEntry = &pProps->pEntries[pProps->nEntries++];
+    pEntry->pszMember = pszMember;
+    pEntry->pszNs = pszNs;
+    pEntry->pszName = pszName;
+    pEntry->pszXml = pszXml;
+    pEntry->bAlloc = bAlloc;
+    return true;
+}
+
+static void _freeEntry(struct PropEntry *pEntry)
+{
+    if (pEntry->bAlloc == false) return;
+    free(pEntry->pszMember);
+    free(pEntry->pszNs);
+    free(pEntry->pszName);
+    free(pEntry->pszXml);
+}
+
+static int _findFirst(struct DeadProps *pProps, const char *pszMember)
+{
+    int nLow = 0, nHigh = pProps->nEntries;
+    while (nLow < nHigh) {
+        int nMid = (nLow + nHigh) / 2;
+        if (strcmp(pProps->pEntries[nMid].pszMember, pszMember) < 0) nLow = nMid + 1;
+        else nHigh = nMid;
+    }
+
+    if (nLow < pProps->nEntries && !strcmp(pProps->pEntries[nLow].pszMember, pszMember)) return nLow;
+    return -1;
+}
+
+static int _cmpEntry(const void *p1, const void *p2)
+{
+    const struct PropEntry *pEntry1 = (const struct PropEntry *)p1;
+    const struct PropEntry *pEntry2 = (const struct PropEntry *)p2;
+
+    int nCmp = strcmp(pEntry1->pszMember, pEntry2->pszMember);
+    if (nCmp == 0) nCmp = strcmp(pEntry1->pszNs, pEntry2->pszNs);
+    if (nCmp == 0) nCmp = strcmp(pEntry1->pszName, pEntry2->pszName);
+    return nCmp;
+}
+
+/*
+ * Copy properties of a member to another, and remove the original if asked.
+ */
+static bool _transfer(const char *pszOldDir, const char *pszOldMember, const char *pszNewDir, const char *pszNewMember, bool bRemove)
+{
+    // lock directories in the same order to avoid deadlock
+    struct DeadProps *pOld = NULL, *pNew = NULL;
+    if (!strcmp(pszOldDir, pszNewDir)) {
+        pOld = pNew = propOpen(pszOldDir, true);
+    } else if (strcmp(pszOldDir, pszNewDir) < 0) {
+        pOld = propOpen(pszOldDir, true);
+        if (pOld != NULL) pNew = propOpen(pszNewDir, true);
+    } else {
+        pNew = propOpen(pszNewDir, true);
+        if (pNew != NULL) pOld = propOpen(pszOldDir, true);
+    }
+
+    bool bRet = false;
+    struct PropEntry *pCopy = NULL;
+    int nCount = 0;
+    if (pOld != NULL && pNew != NULL) {
+        // take properties out, since setting reorders entries
+        const struct PropEntry *pEntry = propGet(pOld, pszOldMember, &nCount);
+        pCopy = (struct PropEntry *)calloc(nCount + 1, sizeof(struct PropEntry));
+        if (pCopy != NULL) {
+            int i;
+            for (i = 0; i < nCount; i++) {
+                pCopy[i].pszNs = strdup(pEntry[i].pszNs);
+                pCopy[i].pszName = strdup(pEntry[i].pszName);
+                pCopy[i].pszXml = strdup(pEntry[i].pszXml);
+            }
+
+            if (bRemove == true) propRemove(pOld, pszOldMember, NULL, NULL);
+            propRemove(pNew, pszNewMember, NULL, NULL);
+            bRet = true;
+            for (i = 0; i < nCount && bRet == true; i++) {
+                if (pCopy[i].pszNs == NULL || pCopy[i].pszName == NULL || pCopy[i].pszXml == NULL) bRet = false;
+                else bRet = propSet(pNew, pszNewMember, pCopy[i].pszNs, pCopy[i].pszName, pCopy[i].pszXml);
+            }
+            if (bRet == true) bRet = propSave(pNew);
+            if (bRet == true && pOld != pNew) bRet = propSave(pOld);
+
+            for (i = 0; i < nCount; i++) {
+                if (pCopy[i].pszNs != NULL) free(pCopy[i].pszNs);
+                if (pCopy[i].pszName != NULL) free(pCopy[i].pszName);
+                if (pCopy[i].pszXml != NULL) free(pCopy[i].pszXml);
+            }
+            free(pCopy);
+        }
+    }
+
+    if (pOld != NULL) propClose(pOld);
+    if (pNew != NULL && pNew != pOld) propClose(pNew);
+    return bRet;
+}
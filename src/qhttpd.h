@@ -44,6 +44,7 @@
 #include <libgen.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -73,28 +74,72 @@
 //
 
 #define MAX_CHILDS      (512)
-#define MAX_SEMAPHORES  (1+2)
+#define MAX_SEMAPHORES  (1+3)
 #define MAX_SEMAPHORES_LOCK_SECS (10)   // the maximum secondes which
                                         // semaphores can be locked
 #define MAX_HTTP_MEMORY_CONTENTS (1024*1024)  // if the contents size is less
                                               // than this, do not use temporary
                                               // file
+#define MAX_SENDFILE_CHUNK (1024*1024)    // the maximum bytes per sendfile()
+                                        // call, to check timeout regularly
+#define MAX_COMPRESS_FILE_SIZE (10*1024*1024)  // static files larger than
+                                              // this are not compressed
+#define SEND_PACING_SLICE (100)  // the unit is ms, data sent at once when
+                                 // sending rate is limited by timer
+#define MAX_HTTP_RANGES (16)    // the maximum number of ranges in a request.
+                                // Range header is ignored if it exceeds.
+#define RANGE_COALESCE_GAP (80) // ranges closer than this are merged into
+                                // one part
+#define IO_WILLNEED_WINDOW (4*1024*1024)  // the maximum bytes to prefetch
+                                          // at the beginning of sequential
+                                          // sending
+#define MAX_LIMIT_ENTRIES (4096)  // the maximum client groups which request
+                                  // rates are tracked in shared memory
+#define UPLOAD_PART_PREFIX ".qhttpd-part."  // staging file of resumable
+                                           // upload ".qhttpd-part.name"
+#define UPLOAD_TEMP_PREFIX ".qhttpd-temp."  // temporary file of upload
+                                           // ".qhttpd-temp.name.XXXXXX"
+#define UPLOAD_EXPIRE (24*60*60)  // staging and temporary files of upload
+                                  // untouched this long are removed
+#define WALK_MAX_DEPTH (64)     // the maximum directory depth to walk
+#define WALK_DIRENT_BUFSIZE (16*1024)  // directory entries read at once
+#define MAX_GENERATIONS (1024) // the number of generation counters of
+                                // collections, which invalidate cached
+                                // PROPFIND results
+#define MAX_LOCK_ENTRIES (1024) // the maximum WebDAV locks in shared memory
+#define LOCK_TOKEN_MAX  (64)    // lock token length including NULL
+#define LOCK_DISCOVERY_MAX (16) // the maximum locks listed in lockdiscovery
+                                // property of a resource
+#define LOCK_OWNER_MAX  (256)   // lock owner length including NULL. longer
+                                // owner information is not kept.
+#define PROP_FILENAME   ".davprops" // dead properties of resources in a
+                                    // directory, hidden from clients
+#define AUTOINDEX_MAX_ENTRIES (100000) // the maximum entries of a directory
+                                      // listing, the rest are not listed
+#define WRITER_BUFSIZE (16*1024) // output buffer size of generated contents,
+                                 // also the size of chunks sent
 #define MAX_USERCOUNTER (10)    // the amount of custom counter in shared memory
                                 // for customizing purpose
 
 #define MAX_LOGLEVEL    (4)     // the maximum log level
 
 #define URI_MAX  (1024 * 4)     // the maximum request uri length
-#define ETAG_MAX (8+1+8+1+8+1)  // the maximum etag string length including
-// NULL termination
+#define SHA256_DIGEST_SIZE (32)  // SHA-256 digest size in bytes
+#define ETAG_XATTR_NAME "user.qhttpd.sha256" // extended attribute keeping
+                                             // content hash of a file
+#define ETAG_CACHE_SIZE (1024)  // content hashes each server remembers
+#define ETAG_HASH_MAX_SIZE (256*1024*1024) // larger files are not hashed on
+                                           // GET, only when uploaded
+#define ETAG_MAX (SHA256_DIGEST_SIZE*2+1+7+1)  // the maximum etag string length
+// including encoding suffix and NULL termination
 
 // TCP options
-#define MAX_LISTEN_BACKLOG      (5)     // the maximum length the queue of
-                                        // pending connections may grow up to.
-#define SET_TCP_LINGER_TIMEOUT  (15)    // 0 for disable
+#define SET_TCP_LINGER_TIMEOUT  (0)     // 0 for disable
 #define SET_TCP_NODELAY         (1)     // 0 for disable
 #define MAX_SHUTDOWN_WAIT       (5000)  // the maximum ms for waiting input
                                         // stream after socket shutdown
+#define MAX_LINGER_SOCKETS      (1024)  // the maximum sockets the lingering
+                                        // close helper drains at once
 
 // default file creation mode
 #define CRLF           "\r\n"   // CR+LF
@@ -104,10 +149,15 @@
 // prefork management
 #define MAX_PREFORK_AT_ONCE   (5)     // the maximum prefork servers at once
 #define PERIODIC_JOB_INTERVAL (2)     // periodic job interval
+#define CACHE_CLEANUP_INTERVAL (60)   // cache cleanup interval
+#define UPLOAD_REAP_INTERVAL  (60*60) // stale upload files reaping interval
 #define KILL_IDLE_INTERVAL    (1000)  // the unit is ms, if idle servers are
                                       // more than max idle server, it will be
                                       // terminated by one in every interval.
                                       // This must be bigger than 1000.
+#define OVERLOAD_SHED_INTERVAL (100)  // the unit is ms, base interval between
+                                      // shedding connections while overloaded.
+#define LIMIT_RETRY_AFTER     (1)     // Retry-After seconds of 429 response
 
 //
 // HTTP PROTOCOL CODES
@@ -123,6 +173,7 @@
 #define HTTP_CODE_CONTINUE              (100)
 #define HTTP_CODE_OK                    (200)
 #define HTTP_CODE_CREATED               (201)
+#define HTTP_CODE_ACCEPTED              (202)
 #define HTTP_CODE_NO_CONTENT            (204)
 #define HTTP_CODE_PARTIAL_CONTENT       (206)
 #define HTTP_CODE_MULTI_STATUS          (207)
@@ -134,12 +185,28 @@
 #define HTTP_CODE_NOT_FOUND             (404)
 #define HTTP_CODE_METHOD_NOT_ALLOWED    (405)
 #define HTTP_CODE_REQUEST_TIME_OUT      (408)
+#define HTTP_CODE_CONFLICT              (409)
 #define HTTP_CODE_GONE                  (410)
+#define HTTP_CODE_PRECONDITION_FAILED   (412)
 #define HTTP_CODE_REQUEST_URI_TOO_LONG  (414)
+#define HTTP_CODE_REQUESTED_RANGE_NOT_SATISFIABLE (416)
 #define HTTP_CODE_LOCKED                (423)
+#define HTTP_CODE_FAILED_DEPENDENCY     (424)
+#define HTTP_CODE_TOO_MANY_REQUESTS     (429)
 #define HTTP_CODE_INTERNAL_SERVER_ERROR (500)
 #define HTTP_CODE_NOT_IMPLEMENTED       (501)
 #define HTTP_CODE_SERVICE_UNAVAILABLE   (503)
+#define HTTP_CODE_INSUFFICIENT_STORAGE  (507)
+
+#define HTTP_CODE_MAX                   (600)   // response codes are less than this
+
+// HTTP CONTENT ENCODINGS
+#define HTTP_ENCODING_IDENTITY          (0)
+#define HTTP_ENCODING_GZIP              (1 << 0)
+#define HTTP_ENCODING_BR                (1 << 1)
+#define HTTP_ENCODING_ZSTD              (1 << 2)
+#define HTTP_ENCODING_DEFLATE           (1 << 3)
+#define HTTP_ENCODING_ALL               (HTTP_ENCODING_GZIP | HTTP_ENCODING_BR | HTTP_ENCODING_ZSTD | HTTP_ENCODING_DEFLATE)
 
 //
 // TYPE DEFINES
@@ -149,6 +216,49 @@ enum HttpAuthT {
     HTTP_AUTH_DIGEST
 };
 
+#define WALK_CONTINUE   (0)
+#define WALK_SKIP       (1)     // do not descend into the directory
+#define WALK_STOP       (-1)
+
+struct WalkEntry {
+    int     nDirFd;             // descriptor of the parent directory
+    const char *pszName;        // entry name
+    const char *pszPath;        // path from the walk root such like /a/b
+    int     nDepth;             // 1 for entries of the root
+    struct  stat st;            // stat, symbolic links are followed
+    bool    bLink;              // flag for symbolic link
+    bool    bPost;              // flag for revisit after directory entries
+    bool    bTruncated;         // flag for directory too deep to descend
+};
+typedef int (*walkcb_t)(struct WalkEntry *pEntry, void *pArg);
+
+struct LockInfo {
+    char    szToken[LOCK_TOKEN_MAX];    // opaquelocktoken:...
+    char    szOwner[LOCK_OWNER_MAX];    // contents of owner element
+    bool    bShared;            // shared or exclusive
+    bool    bInfinity;          // depth infinity or 0
+    int     nTimeout;           // seconds
+};
+
+struct PropEntry {
+    char    *pszMember;         // resource name in the directory
+    char    *pszNs;             // namespace
+    char    *pszName;           // local name
+    char    *pszXml;            // whole property element
+    bool    bAlloc;             // flag for allocated strings
+};
+struct DeadProps;
+
+struct Sha256 {
+    uint32_t anState[8];
+    uint64_t nLength;           // bytes hashed
+    unsigned char szBuf[64];    // pending block
+    size_t  nBufLen;
+};
+
+struct Writer;
+typedef bool (*writerout_t)(void *pArg, const void *pData, size_t nSize);
+
 //
 // CONFIGURATION STRUCTURES
 //
@@ -171,7 +281,17 @@ struct ServerConfig {
     int nMaxKeepAliveRequests;
 
     int nConnectionTimeout;
+    int nKeepAliveTimeout;
+    int nHeaderReadTimeout;
+    int nMinBodyRate;
     bool    bIgnoreOverConnection;
+    int nListenBacklog;
+    int nOverloadShedDelay;
+    int nOverloadRetryAfter;
+    int nClientPrefixLength;
+    int nClientMaxConnections;
+    int nClientRequestRate;
+    int nClientRequestBurst;
     int nResponseExpires;
 
     char    szDocumentRoot[PATH_MAX];
@@ -190,6 +310,7 @@ struct ServerConfig {
         bool bProppatch;
         bool bMkcol;
         bool bMove;
+        bool bCopy;
         bool bDelete;
         bool bLock;
         bool bUnlock;
@@ -199,12 +320,48 @@ struct ServerConfig {
 
     char    szDirectoryIndex[NAME_MAX];
 
+    bool    bEnableAutoindex;
+    int nAutoindexPageSize;
+    int nAutoindexCacheTime;
+
     bool    bEnableLua;
     char    szLuaScript[PATH_MAX];
 
     bool    bEnableStatus;
     char    szStatusUrl[URI_MAX];
 
+    char    szErrorPageDir[PATH_MAX];
+
+    bool    bEnablePrecompressed;
+
+    bool    bEnableCompression;
+    int nCompressLevel;
+    int nCompressMinSize;
+    char    szCompressTypes[1024];
+
+    char    szCacheDir[PATH_MAX];
+    int nCacheMaxSize;
+
+    int nIoHintMinSize;
+    int nIoDropCacheMinSize;
+
+    int nSendRateLimit;
+    char    szSendRateLocations[1024];
+    int nSendRateFreeSize;
+
+    bool    bAllowPropfindInfinity;
+    int nPropfindMaxEntries;
+    int nPropfindCacheTime;
+
+    int nLockMaxTimeout;
+
+    bool    bPutSync;
+    char    szContentStore[PATH_MAX];
+
+    bool    bEnableStrongEtag;
+
+    bool    bEnableIoUring;
+
     char    szErrorLog[PATH_MAX];
     char    szAccessLog[PATH_MAX];
     int nLogRotate;
@@ -225,6 +382,16 @@ struct SharedData {
     int nTotalConnected;        // total connection counter
     int nTotalRequests;         // total processed requests counter
 
+    int nShedConnections;       // connections shed by admission control
+    int nLimitedConnections;    // connections rejected by client limits
+    int nLimitedRequests;       // requests rejected by client limits
+
+    int nSlowHeaderCuts;        // connections cut by header read deadline
+    int nSlowBodyCuts;          // connections cut by minimum body rate
+
+    int nPageCacheHits;         // file windows found in the page cache
+    int nPageCacheMisses;       // file windows read ahead before sending
+
     // child info
     struct child {
         pid_t   nPid;           // pid, 0 means empty slot
@@ -252,6 +419,9 @@ struct SharedData {
         } conn;
     } child[MAX_CHILDS];
 
+    // generation counters of collections
+    unsigned int nGeneration[MAX_GENERATIONS];
+
     // extra info
     int nUserCounter[MAX_USERCOUNTER];
 };
@@ -306,7 +476,16 @@ struct HttpResponse {
     char  *pszContentType;      // contents mime type
     off_t nContentsLength;      // contents length
     char  *pContent;            // contents data
+    bool  bContentStatic;       // flag for contents data which must not be freed
     bool  bChunked;             // flag for chunked data out
+    bool  bHeadOnly;            // flag for HEAD, contents are not sent
+
+    struct HttpEncoder *pEncoder; // compression filter for chunked data out
+};
+
+struct HttpRange {
+    off_t nOffset1;             // first byte position
+    off_t nOffset2;             // last byte position, inclusive
 };
 
 struct HttpUser {
@@ -354,6 +533,12 @@ extern bool poolSetExitRequest(void);
 
 extern int poolGetChildTotalRequests(void);
 extern int poolGetChildKeepaliveRequests(void);
+extern void poolCountPageCache(bool bHit);
+extern void poolCountShedConnection(void);
+extern void poolCountLimited(bool bConnection);
+extern void poolCountSlowClient(bool bHeader);
+extern unsigned int poolGetGeneration(const char *pszKey);
+extern void poolBumpGeneration(const char *pszKey);
 
 extern bool poolSetConnInfo(int nSockFd);
 extern bool poolSetConnRequest(struct HttpRequest *pReq);
@@ -363,6 +548,7 @@ extern char *poolGetConnAddr(void);
 extern unsigned int poolGetConnNaddr(void);
 extern int poolGetConnPort(void);
 extern time_t poolGetConnReqTime(void);
+extern int poolGetConnCount(unsigned int nAddr, unsigned int nMask);
 
 // child.c
 extern void childStart(int nSockFd);
@@ -382,6 +568,7 @@ extern struct HttpResponse *httpResponseCreate(struct HttpRequest *pReq);
 extern int httpResponseSetSimple(struct HttpResponse *pRes, int nResCode, bool nKeepAlive, const char *pszText);
 extern bool httpResponseSetCode(struct HttpResponse *pRes, int nResCode, bool bKeepAlive);
 extern bool httpResponseSetContent(struct HttpResponse *pRes, const char *pszContentType, const char *pContent, off_t nContentsLength);
+extern bool httpResponseSetContentStatic(struct HttpResponse *pRes, const char *pszContentType, const char *pContent, off_t nContentsLength);
 extern bool httpResponseSetContentHtml(struct HttpResponse *pRes, const char *pszMsg);
 extern bool httpResponseSetContentChunked(struct HttpResponse *pRes, bool bChunked);
 extern bool httpResponseSetAuthRequired(struct HttpResponse *pRes, enum HttpAuthT nAuthType, const char *pszRealm);
@@ -389,7 +576,6 @@ extern bool httpResponseOut(struct HttpResponse *pRes);
 extern bool httpResponseOutChunk(struct HttpResponse *pRes, const void *pData, size_t nSize);
 extern bool httpResponseReset(struct HttpResponse *pRes);
 extern void httpResponseFree(struct HttpResponse *pRes);
-extern const char *httpResponseGetMsg(int nResCode);
 
 #define response200(pRes)   httpResponseSetSimple(pRes, HTTP_CODE_OK, true, httpResponseGetMsg(HTTP_CODE_OK));
 #define response201(pRes)   httpResponseSetSimple(pRes, HTTP_CODE_CREATED, true, httpResponseGetMsg(HTTP_CODE_CREATED));
@@ -400,11 +586,39 @@ extern const char *httpResponseGetMsg(int nResCode);
 #define response404(pRes)   httpResponseSetSimple(pRes, HTTP_CODE_NOT_FOUND, true, httpResponseGetMsg(HTTP_CODE_NOT_FOUND))
 #define response404nc(pRes) httpResponseSetSimple(pRes, HTTP_CODE_NOT_FOUND, true, NULL)
 #define response405(pRes)   httpResponseSetSimple(pRes, HTTP_CODE_METHOD_NOT_ALLOWED, false, httpResponseGetMsg(HTTP_CODE_METHOD_NOT_ALLOWED))
+#define response409(pRes)   httpResponseSetSimple(pRes, HTTP_CODE_CONFLICT, true, httpResponseGetMsg(HTTP_CODE_CONFLICT))
+#define response412(pRes)   httpResponseSetSimple(pRes, HTTP_CODE_PRECONDITION_FAILED, true, httpResponseGetMsg(HTTP_CODE_PRECONDITION_FAILED))
 #define response414(pRes)   httpResponseSetSimple(pRes, HTTP_CODE_REQUEST_URI_TOO_LONG, false, httpResponseGetMsg(HTTP_CODE_REQUEST_URI_TOO_LONG))
 #define response500(pRes)   httpResponseSetSimple(pRes, HTTP_CODE_INTERNAL_SERVER_ERROR, false, httpResponseGetMsg(HTTP_CODE_INTERNAL_SERVER_ERROR))
 #define response501(pRes)   httpResponseSetSimple(pRes, HTTP_CODE_NOT_IMPLEMENTED, false, httpResponseGetMsg(HTTP_CODE_NOT_IMPLEMENTED))
 #define response503(pRes)   httpResponseSetSimple(pRes, HTTP_CODE_SERVICE_UNAVAILABLE, false, httpResponseGetMsg(HTTP_CODE_SERVICE_UNAVAILABLE))
 
+// http_canned.c
+extern bool httpCannedInit(const char *pszErrorPageDir);
+extern bool httpCannedFree(void);
+extern const char *httpCannedGetBody(int nResCode, const char *pszMsg, size_t *pnSize);
+extern const char *httpCannedGetStatusLine(const char *pszHttpVer, int nResCode, size_t *pnSize);
+extern bool httpCannedSend(int nSockFd, int nResCode);
+extern const char *httpCannedGetServer(void);
+extern char *httpCannedRenderBody(int nResCode, const char *pszMsg);
+extern const char *httpResponseGetMsg(int nResCode);
+
+// http_encoding.c
+extern int httpEncodingParse(const char *pszAcceptEncoding);
+extern const char *httpEncodingGetName(int nEncoding);
+extern int httpEncodingSelectFile(struct HttpRequest *pReq, char *pszFilePath, size_t nBufSize, struct stat *pStat);
+extern bool httpEncodingSetHeaders(struct HttpResponse *pRes, int nEncoding, const char *pszContentType, off_t nContentsLength);
+extern char *httpEncodingAppendEtag(char *pszEtag, size_t nBufSize, struct HttpResponse *pRes);
+
+// http_compress.c
+extern int httpCompressSelect(struct HttpRequest *pReq, const char *pszContentType, off_t nContentsLength);
+extern bool httpCompressIsEligible(const char *pszContentType, off_t nContentsLength);
+extern bool httpCompressFilter(struct HttpResponse *pRes);
+extern int httpCompressOpenFile(struct HttpRequest *pReq, const char *pszFilePath, struct stat *pStat, const char *pszContentType, int *pnEncoding);
+extern struct HttpEncoder *httpEncoderCreate(int nEncoding, int nLevel);
+extern const void *httpEncoderUpdate(struct HttpEncoder *pEnc, const void *pIn, size_t nInSize, bool bFinish, size_t *pnOutSize);
+extern void httpEncoderFree(struct HttpEncoder *pEnc);
+
 // http_header.c
 extern const char *httpHeaderGetStr(qlisttbl_t *entries, const char *pszName);
 extern int httpHeaderGetInt(qlisttbl_t *entries, const char *pszName);
@@ -412,7 +626,9 @@ extern bool httpHeaderSetStr(qlisttbl_t *entries, const char *pszName, const cha
 extern bool httpHeaderSetStrf(qlisttbl_t *entries, const char *pszName, const char *pszformat, ...);
 extern bool httpHeaderRemove(qlisttbl_t *entries, const char *pszName);
 extern bool httpHeaderHasCasestr(qlisttbl_t *entries, const char *pszName, const char *pszValue);
-extern bool httpHeaderParseRange(const char *pszRangeHeader, off_t nFilesize, off_t *pnRangeOffset1, off_t *pnRangeOffset2, off_t *pnRangeSize);
+extern int httpHeaderParseRanges(const char *pszRangeHeader, off_t nFilesize, struct HttpRange *pRanges, int nMaxRanges);
+extern bool httpHeaderCheckIfRange(qlisttbl_t *entries, const char *pszEtag, time_t nMtime);
+extern int httpHeaderCheckConditions(qlisttbl_t *entries, bool bSafe, const char *pszEtag, struct stat *pStat);
 extern bool httpHeaderSetExpire(qlisttbl_t *entries, int nExpire);
 
 // http_auth.c
@@ -422,33 +638,100 @@ extern struct HttpUser *httpAuthParse(struct HttpRequest *pReq);
 extern int httpMethodOptions(struct HttpRequest *pReq, struct HttpResponse *pRes);
 extern int httpMethodHead(struct HttpRequest *pReq, struct HttpResponse *pRes);
 extern int httpMethodGet(struct HttpRequest *pReq, struct HttpResponse *pRes);
-extern int httpRealGet(struct HttpRequest *pReq, struct HttpResponse *pRes, int nFd, struct stat *pStat, const char *pszContentType);
+extern int httpRealGet(struct HttpRequest *pReq, struct HttpResponse *pRes, int nFd, struct stat *pStat, const char *pszContentType,
+                       const char *pszEtag);
 extern int httpMethodPut(struct HttpRequest *pReq, struct HttpResponse *pRes);
 extern int httpRealPut(struct HttpRequest *pReq, struct HttpResponse *pRes, int nFd);
 extern int httpMethodDelete(struct HttpRequest *pReq, struct HttpResponse *pRes);
 extern int httpMethodNotImplemented(struct HttpRequest *pReq, struct HttpResponse *pRes);
+extern int httpConditionCheck(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszSysPath);
+extern bool httpUploadReapStart(int nBindSockFd);
 
 // http_method_dav.c
 extern int httpMethodPropfind(struct HttpRequest *pReq, struct HttpResponse *pRes);
 extern int httpMethodProppatch(struct HttpRequest *pReq, struct HttpResponse *pRes);
 extern int httpMethodMkcol(struct HttpRequest *pReq, struct HttpResponse *pRes);
 extern int httpMethodMove(struct HttpRequest *pReq, struct HttpResponse *pRes);
+extern int httpMethodCopy(struct HttpRequest *pReq, struct HttpResponse *pRes);
 extern int httpMethodDelete(struct HttpRequest *pReq, struct HttpResponse *pRes);
 extern int httpMethodLock(struct HttpRequest *pReq, struct HttpResponse *pRes);
 extern int httpMethodUnlock(struct HttpRequest *pReq, struct HttpResponse *pRes);
+extern void httpPropfindInvalidate(const char *pszSysPath);
+extern int httpLockCheck(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszSysPath, bool bRecursive, bool bMember);
+
+// http_autoindex.c
+extern int httpAutoindex(struct HttpRequest *pReq, struct HttpResponse *pRes, const char *pszSysPath, struct stat *pStat);
 
 // http_status.c
 extern int httpStatusResponse(struct HttpRequest *pReq, struct HttpResponse *pRes);
-extern qvector_t *httpGetStatusHtml(void);
+extern bool httpGetStatusHtml(struct Writer *pHtml);
 
 // http_accesslog.c
 extern bool httpAccessLog(struct HttpRequest *pReq, struct HttpResponse *pRes);
 
+// admit.c
+extern bool admitControl(int nBindSockFd, bool bSaturated);
+
+// limit.c
+extern bool limitInit(void);
+extern bool limitFree(void);
+extern bool limitAdmit(bool bConnection);
+
+// lock.c
+extern bool lockInit(void);
+extern bool lockFree(void);
+extern int lockReap(void);
+extern int lockAcquire(const char *pszPath, struct LockInfo *pInfo);
+extern bool lockRefresh(const char *pszPath, const char *pszToken, int nTimeout, struct LockInfo *pInfo);
+extern bool lockRelease(const char *pszPath, const char *pszToken);
+extern bool lockIsHeld(const char *pszPath, const char *pszToken);
+extern int lockGetAll(const char *pszPath, struct LockInfo *pInfos, int *pnLevels, int nMaxInfos);
+extern unsigned int lockGetGeneration(void);
+extern bool lockIsAllowed(const char *pszPath, bool bRecursive, bool bMember, const char **ppszTokens, int nTokens);
+extern void lockDrop(const char *pszPath);
+
+// prop.c
+extern struct DeadProps *propOpen(const char *pszDirPath, bool bWrite);
+extern void propClose(struct DeadProps *pProps);
+extern const char *propGetDirPath(struct DeadProps *pProps);
+extern const struct PropEntry *propGet(struct DeadProps *pProps, const char *pszMember, int *pnCount);
+extern bool propSet(struct DeadProps *pProps, const char *pszMember, const char *pszNs, const char *pszName, const char *pszXml);
+extern int propRemove(struct DeadProps *pProps, const char *pszMember, const char *pszNs, const char *pszName);
+extern bool propSave(struct DeadProps *pProps);
+extern bool propMove(const char *pszOldDir, const char *pszOldMember, const char *pszNewDir, const char *pszNewMember);
+extern bool propCopy(const char *pszSrcDir, const char *pszSrcMember, const char *pszDstDir, const char *pszDstMember);
+extern bool propDelete(const char *pszDir, const char *pszMember);
+
+// linger.c
+extern bool lingerStart(int nBindSockFd);
+extern bool lingerCheck(int nBindSockFd);
+extern bool lingerStop(void);
+extern bool lingerHandOver(int nSockFd);
+
 // mime.c
 extern bool mimeInit(const char *pszFilepath);
 extern bool mimeFree(void);
 extern const char *mimeDetect(const char *pszFilename);
 
+// cache.c
+extern bool cacheInit(void);
+extern int cacheOpen(const char *pszKey, struct stat *pStat);
+extern int cacheCreate(char *pszTmpPath, size_t nBufSize);
+extern bool cacheCommit(const char *pszKey, const char *pszTmpPath);
+extern bool cacheAbort(const char *pszTmpPath);
+extern bool cacheCleanupStart(int nBindSockFd, off_t nMaxSize);
+extern int cacheCleanup(off_t nMaxSize);
+
+// store.c
+extern bool storeInit(void);
+extern bool storeCommit(int nFd, const unsigned char *pDigest, const char *pszFilePath);
+
+// etag.c
+extern char *etagGet(char *pszBuf, size_t nBufSize, const char *pszPath, const char *pszSysPath, struct stat *pStat,
+                     bool bCompute);
+extern bool etagSetHash(int nFd, const unsigned char *pDigest);
+extern bool etagCheckHash(const char *pszSysPath, struct stat *pStat, const char *pszHash);
+
 // stream.c
 extern int streamWaitReadable(int nSockFd, int nTimeoutMs);
 extern ssize_t streamRead(int nSockFd, void *pszBuffer, size_t nSize, int nTimeoutMs);
@@ -457,18 +740,33 @@ extern ssize_t streamGetb(int nSockFd, char *pszBuffer, size_t nSize, int nTimeo
 extern off_t streamSave(int nFd, int nSockFd, off_t nSize, int nTimeoutMs);
 extern ssize_t streamPrintf(int nSockFd, const char *format, ...);
 extern ssize_t streamPuts(int nSockFd, const char *pszStr);
-extern ssize_t streamStackOut(int nSockFd, qvector_t *vector, int nTimeoutMs);
+extern ssize_t streamStackOut(int nSockFd, qvector_t *vector, const void *pBody, size_t nBodySize, int nTimeoutMs);
 extern ssize_t streamWrite(int nSockFd, const void *pszBuffer, size_t nSize, int nTimeoutMs);
 extern ssize_t streamWritev(int nSockFd,  const struct iovec *pVector, int nCount, int nTimeoutMs);
+extern void streamSetSendRate(int nSockFd, int nRate, off_t nFreeSize);
+extern void streamSetSaveHash(struct Sha256 *pHash);
 extern off_t streamSend(int nSockFd, int nFd, off_t nSize, int nTimeoutMs);
 
+// iouring.c
+#ifdef ENABLE_IOURING
+extern bool iouringInit(void);
+extern bool iouringFree(void);
+extern bool iouringIsReady(void);
+extern ssize_t iouringRead(int nSockFd, void *pBuffer, size_t nSize, int nTimeoutMs);
+extern ssize_t iouringGets(int nSockFd, char *pszStr, size_t nSize, int nTimeoutMs);
+extern ssize_t iouringRecv(int nSockFd, void *pBuffer, size_t nSize, int nFlags, int nTimeoutMs);
+extern ssize_t iouringWritev(int nSockFd, const struct iovec *pVector, int nCount, int nTimeoutMs);
+extern off_t iouringSend(int nSockFd, int nFd, off_t nSize, int nTimeoutMs);
+#endif
+
 // util.c
 extern int closeSocket(int nSockFd);
-extern char *getEtag(char *pszBuf, size_t nBufSize, const char *pszPath, struct stat *pStat);
 extern unsigned int getIp2Uint(const char *szIp);
 extern float getDiffTimeval(struct timeval *t1, struct timeval *t0);
 extern bool isValidPathname(const char *pszPath);
 extern void correctPathname(char *pszPath);
+extern bool isInternalFilename(const char *pszName);
+extern bool isInternalPathname(const char *pszPath);
 
 // syscall.c
 #include <dirent.h>
@@ -483,6 +781,39 @@ extern int sysRmdir(const char *pszPath);
 extern DIR *sysOpendir(const char *pszPath);
 extern struct dirent *sysReaddir(DIR *pDir);
 extern int sysClosedir(DIR *pDir);
+extern int sysFadvise(int nFd, off_t nOffset, off_t nLen, int nAdvice);
+extern int sysIsCached(int nFd, off_t nOffset);
+
+// sha256.c
+extern void sha256Init(struct Sha256 *pCtx);
+extern void sha256Update(struct Sha256 *pCtx, const void *pData, size_t nSize);
+extern void sha256Final(struct Sha256 *pCtx, unsigned char *pDigest);
+
+// tree.c
+extern bool treeCopy(const char *pszSrcPath, const char *pszDstPath, int nMaxDepth, qlist_t *pFailed);
+extern bool treeMove(const char *pszSrcPath, const char *pszDstPath, bool bOverwrite, qlist_t *pFailed);
+extern bool treeRemove(const char *pszPath, qlist_t *pFailed);
+extern off_t treeCopyData(int nInFd, int nOutFd, off_t nSize);
+
+// walk.c
+extern int walkTree(const char *pszRoot, int nMaxDepth, bool bPostOrder, walkcb_t pCallback, void *pArg);
+
+// writer.c
+extern struct Writer *writerCreate(writerout_t pOut, void *pArg);
+extern bool writerFlush(struct Writer *pWriter);
+extern void writerFree(struct Writer *pWriter);
+extern bool writerPut(struct Writer *pWriter, const void *pData, size_t nSize);
+extern bool writerPuts(struct Writer *pWriter, const char *pszStr);
+extern bool writerPutf(struct Writer *pWriter, const char *pszFormat, ...);
+extern bool writerPutInt(struct Writer *pWriter, intmax_t nNum);
+extern bool writerPutHttpDate(struct Writer *pWriter, time_t nTime);
+extern bool writerPutIsoDate(struct Writer *pWriter, time_t nTime);
+extern bool writerPutUrl(struct Writer *pWriter, const char *pszStr);
+extern bool writerPutHtml(struct Writer *pWriter, const char *pszStr);
+extern bool writerPutJson(struct Writer *pWriter, const char *pszStr);
+extern bool writerChunkOut(void *pArg, const void *pData, size_t nSize);
+extern bool writerFileOut(void *pArg, const void *pData, size_t nSize);
+extern bool writerVectorOut(void *pArg, const void *pData, size_t nSize);
 
 // luascript.c
 #ifdef ENABLE_LUA
@@ -530,6 +861,7 @@ extern int g_loglevel;
 // DEFINITION FUNCTIONS
 //
 #define CONST_STRLEN(x)     (sizeof(x) - 1)
+#define writerPutLit(w, s)  writerPut(w, s, CONST_STRLEN(s))
 #define IS_EMPTY_STRING(x)  ( (x == NULL || x[0] == '\0') ? true : false )
 
 #define DYNAMIC_VSPRINTF(s, f)                                          \
@@ -0,0 +1,165 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: sha256.c 232 2012-06-20 10:21:44Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * SHA-256 of FIPS 180-4, for hashing uploaded contents as they arrive.
+ */
+
+#include "qhttpd.h"
+
+#define ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t m_anK[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void _transform(struct Sha256 *pCtx, const unsigned char *pBlock);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+void sha256Init(struct Sha256 *pCtx)
+{
+    static const uint32_t anInit[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(pCtx->anState, anInit, sizeof(anInit));
+    pCtx->nLength = 0;
+    pCtx->nBufLen = 0;
+}
+
+void sha256Update(struct Sha256 *pCtx, const void *pData, size_t nSize)
+{
+    const unsigned char *p = (const unsigned char *)pData;
+    pCtx->nLength += nSize;
+
+    // fill up the pending block
+    if (pCtx->nBufLen > 0) {
+        size_t nFill = sizeof(pCtx->szBuf) - pCtx->nBufLen;
+        if (nFill > nSize) nFill = nSize;
+        memcpy(pCtx->szBuf + pCtx->nBufLen, p, nFill);
+        pCtx->nBufLen += nFill;
+        p += nFill;
+        nSize -= nFill;
+        if (pCtx->nBufLen < sizeof(pCtx->szBuf)) return;
+        _transform(pCtx, pCtx->szBuf);
+        pCtx->nBufLen = 0;
+    }
+
+    // whole blocks straight from the input
+    for (; nSize >= sizeof(pCtx->szBuf); p += sizeof(pCtx->szBuf), nSize -= sizeof(pCtx->szBuf)) {
+        _transform(pCtx, p);
+    }
+
+    memcpy(pCtx->szBuf, p, nSize);
+    pCtx->nBufLen = nSize;
+}
+
+/**
+ * Finish hashing.
+ *
+ * @param pDigest   SHA256_DIGEST_SIZE bytes of digest are stored
+ */
+void sha256Final(struct Sha256 *pCtx, unsigned char *pDigest)
+{
+    uint64_t nBits = pCtx->nLength * 8;
+
+    // padding and length in bits
+    pCtx->szBuf[pCtx->nBufLen++] = 0x80;
+    if (pCtx->nBufLen > sizeof(pCtx->szBuf) - 8) {
+        memset(pCtx->szBuf + pCtx->nBufLen, 0, sizeof(pCtx->szBuf) - pCtx->nBufLen);
+        _transform(pCtx, pCtx->szBuf);
+        pCtx->nBufLen = 0;
+    }
+    memset(pCtx->szBuf + pCtx->nBufLen, 0, sizeof(pCtx->szBuf) - 8 - pCtx->nBufLen);
+    int i;
+    for (i = 0; i < 8; i++) {
+        pCtx->szBuf[sizeof(pCtx->szBuf) - 1 - i] = (unsigned char)(nBits >> (i * 8));
+    }
+    _transform(pCtx, pCtx->szBuf);
+
+    for (i = 0; i < 8; i++) {
+        pDigest[i * 4] = (unsigned char)(pCtx->anState[i] >> 24);
+        pDigest[i * 4 + 1] = (unsigned char)(pCtx->anState[i] >> 16);
+        pDigest[i * 4 + 2] = (unsigned char)(pCtx->anState[i] >> 8);
+        pDigest[i * 4 + 3] = (unsigned char)(pCtx->anState[i]);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static void _transform(struct Sha256 *pCtx, const unsigned char *pBlock)
+{
+    uint32_t w[64];
+    int i;
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)pBlock[i * 4] << 24) | ((uint32_t)pBlock[i * 4 + 1] << 16)
+               | ((uint32_t)pBlock[i * 4 + 2] << 8) | (uint32_t)pBlock[i * 4 + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = pCtx->anState[0], b = pCtx->anState[1], c = pCtx->anState[2], d = pCtx->anState[3];
+    uint32_t e = pCtx->anState[4], f = pCtx->anState[5], g = pCtx->anState[6], h = pCtx->anState[7];
+    for (i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + m_anK[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    pCtx->anState[0] += a;
+    pCtx->anState[1] += b;
+    pCtx->anState[2] += c;
+    pCtx->anState[3] += d;
+    pCtx->anState[4] += e;
+    pCtx->anState[5] += f;
+    pCtx->anState[6] += g;
+    pCtx->anState[7] += h;
+}
@@ -0,0 +1,211 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: store.c 233 2012-06-20 10:21:44Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Content addressed store for uploaded files.
+ *
+ * Uploaded contents are hashed while they are received and kept once in
+ * ContentStore as blobs named by SHA-256 such like "ab/abcdef...". Files in
+ * the document root are hard links to the blobs, so uploading the same
+ * contents again to any path only makes another link and the received
+ * copy is thrown away. Blobs carry their hash in an extended attribute,
+ * which gives the files a content based ETag. See etag.c.
+ *
+ * The server never modifies files in place, every PUT replaces the link.
+ * Files sharing a blob share its inode, so the mode and the modification
+ * time are those of the first upload, and Last-Modified tells when the
+ * contents were stored. An upload asking for another mode is not linked.
+ * A blob modified in place outside the server no longer matches the hash
+ * kept in it, and it's replaced by the next upload of the contents.
+ * Blobs nobody links to any more have link count 1 and can be removed
+ * with "find ContentStore -type f -links 1 -delete".
+ */
+
+#include "qhttpd.h"
+
+static char *_getBlobPath(char *pszBuf, size_t nBufSize, const char *pszHex);
+static bool _linkBlob(const char *pszBlobPath, const char *pszFilePath);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Prepare content store directory.
+ *
+ * @return true if content store is available, otherwise returns false
+ */
+bool storeInit(void)
+{
+    if (IS_EMPTY_STRING(g_conf.szContentStore) == true) return false;
+
+    struct stat dirstat, rootstat;
+    if (sysStat(g_conf.szContentStore, &dirstat) != 0 || !S_ISDIR(dirstat.st_mode)) {
+        if (qfile_mkdir(g_conf.szContentStore, DEF_DIR_MODE, true) == false
+            || sysStat(g_conf.szContentStore, &dirstat) != 0) {
+            LOG_WARN("Can't create content store %s. Content store is disabled.", g_conf.szContentStore);
+            g_conf.szContentStore[0] = '\0';
+            return false;
+        }
+    }
+
+    // hard links can't cross file systems
+    if (sysStat(g_conf.szDocumentRoot, &rootstat) == 0 && rootstat.st_dev != dirstat.st_dev) {
+        LOG_WARN("Content store %s is not on the file system of %s. Content store is disabled.",
+                 g_conf.szContentStore, g_conf.szDocumentRoot);
+        g_conf.szContentStore[0] = '\0';
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Put a received file in place of the destination through the store. If
+ * the same contents are stored already, the destination becomes a link to
+ * that blob and the received file is left to the caller to discard.
+ *
+ * @param nFd           received file, hashed with pDigest
+ * @param pDigest       SHA-256 digest of the received contents
+ * @param pszFilePath   destination path
+ * @return true if successful, otherwise returns false. the caller falls
+ *         back to save the file by itself.
+ */
+bool storeCommit(int nFd, const unsigned char *pDigest, const char *pszFilePath)
+{
+    if (IS_EMPTY_STRING(g_conf.szContentStore) == true) return false;
+
+    char *pszHex = qhex_encode(pDigest, SHA256_DIGEST_SIZE);
+    if (pszHex == NULL) return false;
+
+    char szBlobPath[PATH_MAX];
+    if (_getBlobPath(szBlobPath, sizeof(szBlobPath), pszHex) == NULL) {
+        free(pszHex);
+        return false;
+    }
+
+    struct stat blobstat, filestat;
+    if (sysFstat(nFd, &filestat) != 0) {
+        free(pszHex);
+        return false;
+    }
+
+    bool bStored = false, bModified = false;
+    if (sysStat(szBlobPath, &blobstat) == 0) {
+        if (etagCheckHash(szBlobPath, &blobstat, pszHex) == false) {
+            LOG_WARN("Stored contents %s are modified. Replaced by %s.", szBlobPath, pszFilePath);
+            bModified = true;
+        } else if ((blobstat.st_mode & 07777) != (filestat.st_mode & 07777)) {
+            DEBUG("Contents of %s are stored with another mode.", pszFilePath);
+            free(pszHex);
+            return false;
+        } else {
+            DEBUG("Contents of %s are stored already.", pszFilePath);
+            bStored = true;
+        }
+    }
+    free(pszHex);
+
+    if (bStored == false) {
+        // a new blob, or one replacing modified contents
+        if (g_conf.bPutSync == true && fdatasync(nFd) != 0) return false;
+        etagSetHash(nFd, pDigest);
+
+        char szDirPath[PATH_MAX];
+        qstrcpy(szDirPath, sizeof(szDirPath), szBlobPath);
+        *strrchr(szDirPath, '/') = '\0';
+        sysMkdir(szDirPath, DEF_DIR_MODE);
+
+        char szProcPath[64], szTmpPath[PATH_MAX];
+        snprintf(szProcPath, sizeof(szProcPath), "/proc/self/fd/%d", nFd);
+        const char *pszLinkPath = szBlobPath;
+        if (bModified == true) {
+            int nLen = snprintf(szTmpPath, sizeof(szTmpPath), "%s.%u", szBlobPath, (unsigned int)getpid());
+            if (nLen < 0 || (size_t)nLen >= sizeof(szTmpPath)) return false;
+            sysUnlink(szTmpPath);
+            pszLinkPath = szTmpPath;
+        }
+
+        if (linkat(AT_FDCWD, szProcPath, AT_FDCWD, pszLinkPath, AT_SYMLINK_FOLLOW) != 0 && (errno != EEXIST || bModified == true)) {
+            if (errno != EXDEV) LOG_WARN("Can't store contents of %s. (errno: %d)", pszFilePath, errno);
+            return false;
+        }
+        if (bModified == true && sysRename(szTmpPath, szBlobPath) != 0) {
+            sysUnlink(szTmpPath);
+            return false;
+        }
+    }
+
+    return _linkBlob(szBlobPath, pszFilePath);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static char *_getBlobPath(char *pszBuf, size_t nBufSize, const char *pszHex)
+{
+    int nLen = snprintf(pszBuf, nBufSize, "%s/%.2s/%s", g_conf.szContentStore, pszHex, pszHex);
+    if (nLen < 0 || (size_t)nLen >= nBufSize) return NULL;
+    return pszBuf;
+}
+
+/*
+ * Replace the destination with a link to the blob.
+ */
+static bool _linkBlob(const char *pszBlobPath, const char *pszFilePath)
+{
+    // same contents are uploaded again to the same path
+    struct stat blobstat, filestat;
+    if (sysStat(pszBlobPath, &blobstat) != 0) return false;
+    if (sysStat(pszFilePath, &filestat) == 0
+        && filestat.st_dev == blobstat.st_dev && filestat.st_ino == blobstat.st_ino) {
+        return true;
+    }
+
+    // link can't replace, so link to a temporary name and rename it
+    const char *pszName = strrchr(pszFilePath, '/');
+    if (pszName == NULL) return false;
+    pszName++;
+
+    char szTmpPath[PATH_MAX];
+    int nLen = snprintf(szTmpPath, sizeof(szTmpPath), "%.*s" UPLOAD_TEMP_PREFIX "%s.%u", (int)(pszName - pszFilePath), pszFilePath,
+                        pszName, (unsigned int)getpid());
+    if (nLen < 0 || (size_t)nLen >= sizeof(szTmpPath)) return false;
+
+    sysUnlink(szTmpPath);
+    if (link(pszBlobPath, szTmpPath) != 0) return false;
+    if (sysRename(szTmpPath, pszFilePath) != 0) {
+        sysUnlink(szTmpPath);
+        return false;
+    }
+
+    return true;
+}
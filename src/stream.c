@@ -29,10 +29,36 @@
  ******************************************************************************/
 
 #include "qhttpd.h"
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+static ssize_t _read(int nSockFd, void *pBuffer, size_t nSize, int nTimeoutMs);
+static ssize_t _recv(int nSockFd, void *pBuffer, size_t nSize, int nTimeoutMs);
+static off_t _readBody(int nSockFd, int nFd, char *pBuffer, off_t nSize, int nTimeoutMs);
+static ssize_t _write(int nSockFd, const void *pBuffer, size_t nSize, int nTimeoutMs);
+static off_t _send(int nSockFd, int nFd, off_t nSize, int nTimeoutMs);
+static void _waitPacing(void);
+
+// egress shaping of the current response body
+static struct {
+    int     nRate;          // bytes per second, 0 for unlimited
+    off_t   nFreeLeft;      // bytes left to send at full speed
+    bool    bKernel;        // paced by SO_MAX_PACING_RATE
+    bool    bTimer;         // paced by sleeping between chunks
+    struct  timeval tvStart;    // timer pacing start time
+    off_t   nPaced;         // bytes sent since tvStart
+} m_shape;
+
+static struct Sha256 *m_pSaveHash = NULL;  // hash of saved request body
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
 
 ssize_t streamRead(int nSockFd, void *pszBuffer, size_t nSize, int nTimeoutMs)
 {
-    ssize_t nReaded = qio_read(nSockFd, pszBuffer, nSize, nTimeoutMs);
+    ssize_t nReaded = _read(nSockFd, pszBuffer, nSize, nTimeoutMs);
 #ifdef ENABLE_DEBUG
     if (nReaded > 0) DEBUG("[RX] (binary, readed %zd bytes)", nReaded);
 #endif
@@ -41,7 +67,12 @@ ssize_t streamRead(int nSockFd, void *pszBuffer, size_t nSize, int nTimeoutMs)
 
 ssize_t streamGets(int nSockFd, char *pszStr, size_t nSize, int nTimeoutMs)
 {
+#ifdef ENABLE_IOURING
+    ssize_t nReaded = (iouringIsReady() == true) ? iouringGets(nSockFd, pszStr, nSize, nTimeoutMs)
+                      : qio_gets(nSockFd, pszStr, nSize, nTimeoutMs);
+#else
     ssize_t nReaded = qio_gets(nSockFd, pszStr, nSize, nTimeoutMs);
+#endif
 #ifdef ENABLE_DEBUG
     if (nReaded > 0) DEBUG("[RX] %s", pszStr);
 #endif
@@ -50,14 +81,14 @@ ssize_t streamGets(int nSockFd, char *pszStr, size_t nSize, int nTimeoutMs)
 
 ssize_t streamGetb(int nSockFd, char *pszBuffer, size_t nSize, int nTimeoutMs)
 {
-    ssize_t nReaded = qio_read(nSockFd, pszBuffer, nSize, nTimeoutMs);
+    ssize_t nReaded = _readBody(nSockFd, -1, pszBuffer, nSize, nTimeoutMs);
     DEBUG("[RX] (binary, readed/request=%zd/%zu bytes)", nReaded, nSize);
     return nReaded;
 }
 
 off_t streamSave(int nFd, int nSockFd, off_t nSize, int nTimeoutMs)
 {
-    off_t nSaved = qio_send(nFd, nSockFd, nSize, nTimeoutMs);
+    off_t nSaved = _readBody(nSockFd, nFd, NULL, nSize, nTimeoutMs);
     DEBUG("[RX] (save %jd/%jd bytes)", nSaved, nSize);
     return nSaved;
 }
@@ -68,7 +99,7 @@ ssize_t streamPrintf(int nSockFd, const char *format, ...)
     DYNAMIC_VSPRINTF(pszBuf, format);
     if (pszBuf == NULL) return -1;
 
-    ssize_t nSent = qio_write(nSockFd, pszBuf, strlen(pszBuf), 0);
+    ssize_t nSent = _write(nSockFd, pszBuf, strlen(pszBuf), 0);
 
 #ifdef ENABLE_DEBUG
     if (nSent > 0) DEBUG("[TX] %s", pszBuf);
@@ -91,14 +122,30 @@ ssize_t streamPuts(int nSockFd, const char *pszStr)
     return nSent;
 }
 
-ssize_t streamStackOut(int nSockFd, qvector_t *vector, int nTimeoutMs)
+/*
+ * Send stacked data followed by optional body in one go.
+ */
+ssize_t streamStackOut(int nSockFd, qvector_t *vector, const void *pBody, size_t nBodySize, int nTimeoutMs)
 {
     size_t nSize;
     char *pData = (char *)vector->toarray(vector, &nSize);
 
     ssize_t nWritten = 0;
     if (pData != NULL) {
-        nWritten = qio_write(nSockFd, pData, nSize, nTimeoutMs);
+        struct iovec vectors[2];
+        int nVecCnt = 0;
+
+        vectors[nVecCnt].iov_base = pData;
+        vectors[nVecCnt].iov_len = nSize;
+        nVecCnt++;
+
+        if (pBody != NULL && nBodySize > 0) {
+            vectors[nVecCnt].iov_base = (void *)pBody;
+            vectors[nVecCnt].iov_len = nBodySize;
+            nVecCnt++;
+        }
+
+        nWritten = streamWritev(nSockFd, vectors, nVecCnt, nTimeoutMs);
 
 #ifdef ENABLE_DEBUG
         if (g_debug) {
@@ -116,7 +163,7 @@ ssize_t streamStackOut(int nSockFd, qvector_t *vector, int nTimeoutMs)
 
 ssize_t streamWrite(int nSockFd, const void *pszBuffer, size_t nSize, int nTimeoutMs)
 {
-    ssize_t nWritten = qio_write(nSockFd, pszBuffer, nSize, nTimeoutMs);
+    ssize_t nWritten = _write(nSockFd, pszBuffer, nSize, nTimeoutMs);
     DEBUG("[TX] (binary, written/request=%zd/%zu bytes)", nWritten, nSize);
 
     return nWritten;
@@ -124,27 +171,296 @@ ssize_t streamWrite(int nSockFd, const void *pszBuffer, size_t nSize, int nTimeo
 
 ssize_t streamWritev(int nSockFd,  const struct iovec *pVector, int nCount, int nTimeoutMs)
 {
+#ifdef ENABLE_IOURING
+    if (iouringIsReady() == true) {
+        ssize_t nWritten = iouringWritev(nSockFd, pVector, nCount, nTimeoutMs);
+        DEBUG("[TX] (binary, written=%zd bytes, %d vectors)", nWritten, nCount);
+        return nWritten;
+    }
+#endif
+
+    struct iovec vectors[nCount];
+    memcpy(vectors, pVector, sizeof(struct iovec) * nCount);
+    struct iovec *pVec = vectors;
+    int nLeft = nCount;
+
     ssize_t nWritten = 0;
-    int i;
-    for (i = 0; i < nCount; i++) {
-        ssize_t nSent = streamWrite(nSockFd, pVector[i].iov_base, pVector[i].iov_len, nTimeoutMs);
-        if (nSent <= 0) break;
+    errno = 0;
+    while (nLeft > 0) {
+        if (pVec->iov_len == 0) {
+            pVec++;
+            nLeft--;
+            continue;
+        }
+
+        if (nTimeoutMs >= 0 && qio_wait_writable(nSockFd, nTimeoutMs) <= 0) break;
+        ssize_t nSent = writev(nSockFd, pVec, (nLeft > IOV_MAX) ? IOV_MAX : nLeft);
+        if (nSent <= 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            break;
+        }
         nWritten += nSent;
-    }
 
-    /*
-    ssize_t nWritten = writev(nSockFd, pVector, nCount);
-    */
+        // advance vectors
+        while (nSent > 0 && nLeft > 0) {
+            if (nSent < pVec->iov_len) {
+                pVec->iov_base = (char *)pVec->iov_base + nSent;
+                pVec->iov_len -= nSent;
+                break;
+            }
+            nSent -= pVec->iov_len;
+            pVec++;
+            nLeft--;
+        }
+    }
 
     DEBUG("[TX] (binary, written=%zd bytes, %d vectors)", nWritten, nCount);
 
+    if (nWritten == 0 && errno != ETIMEDOUT) return -1;
     return nWritten;
 }
 
+/**
+ * Limit the sending rate of following streamSend() calls until the next
+ * call. The first nFreeSize bytes go out at full speed.
+ *
+ * The kernel pacing rate is not lifted when the response is done, or the
+ * data still queued in the socket would be flushed at full speed. The
+ * request loop calls this with 0 for every request, which also clears the
+ * state left by the last connection.
+ *
+ * @param nRate     bytes per second. 0 for unlimited.
+ * @param nFreeSize bytes to send before limiting
+ */
+void streamSetSendRate(int nSockFd, int nRate, off_t nFreeSize)
+{
+#ifdef SO_MAX_PACING_RATE
+    if (m_shape.bKernel == true) {
+        unsigned int nUnlimited = ~0U;
+        setsockopt(nSockFd, SOL_SOCKET, SO_MAX_PACING_RATE, &nUnlimited, sizeof(nUnlimited));
+    }
+#endif
+    memset((void *)&m_shape, 0, sizeof(m_shape));
+    if (nRate <= 0) return;
+
+    m_shape.nRate = nRate;
+    m_shape.nFreeLeft = nFreeSize;
+}
+
+/**
+ * Hash request body while it's saved by streamSave().
+ *
+ * @param pHash     initialized hash context, NULL to stop hashing
+ */
+void streamSetSaveHash(struct Sha256 *pHash)
+{
+    m_pSaveHash = pHash;
+}
+
+/*
+ * Send file contents from current file offset using sendfile(2), so the data
+ * never crosses user space. Falls back to read/write copy if the file system
+ * does not support it.
+ *
+ * @return the number of bytes transferred if successful, 0 on timeout,
+ *         -1 for error.
+ */
 off_t streamSend(int nSockFd, int nFd, off_t nSize, int nTimeoutMs)
 {
+    if (m_shape.nRate <= 0) return _send(nSockFd, nFd, nSize, nTimeoutMs);
+
+    off_t nSent = 0;
+    while (nSent < nSize) {
+        off_t nChunk = nSize - nSent;
+        if (m_shape.nFreeLeft > 0) {
+            if (nChunk > m_shape.nFreeLeft) nChunk = m_shape.nFreeLeft;
+        } else {
+            if (m_shape.bKernel == false && m_shape.bTimer == false) {
+#ifdef SO_MAX_PACING_RATE
+                // the kernel paces packets, so the server just blocks on
+                // a full socket buffer
+                unsigned int nRate = m_shape.nRate;
+                if (setsockopt(nSockFd, SOL_SOCKET, SO_MAX_PACING_RATE, &nRate, sizeof(nRate)) == 0) {
+                    m_shape.bKernel = true;
+                }
+#endif
+                if (m_shape.bKernel == false) {
+                    m_shape.bTimer = true;
+                    gettimeofday(&m_shape.tvStart, NULL);
+                    m_shape.nPaced = 0;
+                }
+                DEBUG("Send rate limited to %d bytes/s. (%s)", m_shape.nRate, (m_shape.bKernel == true) ? "kernel" : "timer");
+            }
+
+            if (m_shape.bTimer == true) {
+                off_t nSlice = (off_t)m_shape.nRate * SEND_PACING_SLICE / 1000;
+                if (nSlice < 1) nSlice = 1;
+                if (nChunk > nSlice) nChunk = nSlice;
+                _waitPacing();
+            }
+        }
+
+        off_t nRet = _send(nSockFd, nFd, nChunk, nTimeoutMs);
+        if (nRet <= 0) {
+            if (nSent == 0) nSent = nRet;
+            break;
+        }
+        nSent += nRet;
+
+        if (m_shape.nFreeLeft > 0) m_shape.nFreeLeft -= nRet;
+        else m_shape.nPaced += nRet;
+
+        if (nRet != nChunk) break;
+    }
+
+    return nSent;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static ssize_t _read(int nSockFd, void *pBuffer, size_t nSize, int nTimeoutMs)
+{
+#ifdef ENABLE_IOURING
+    if (iouringIsReady() == true) return iouringRead(nSockFd, pBuffer, nSize, nTimeoutMs);
+#endif
+    return qio_read(nSockFd, pBuffer, nSize, nTimeoutMs);
+}
+
+static ssize_t _write(int nSockFd, const void *pBuffer, size_t nSize, int nTimeoutMs)
+{
+#ifdef ENABLE_IOURING
+    if (iouringIsReady() == true) {
+        struct iovec vector = { (void *)pBuffer, nSize };
+        return iouringWritev(nSockFd, &vector, 1, nTimeoutMs);
+    }
+#endif
+    return qio_write(nSockFd, pBuffer, nSize, nTimeoutMs);
+}
+
+static off_t _send(int nSockFd, int nFd, off_t nSize, int nTimeoutMs)
+{
+#ifdef ENABLE_IOURING
+    if (iouringIsReady() == true) {
+        off_t nSent = iouringSend(nSockFd, nFd, nSize, nTimeoutMs);
+        if (nSent != -1 || errno != EINVAL) {
+            DEBUG("[TX] (splice %jd/%jd bytes)", nSent, nSize);
+            return nSent;
+        }
+        // the file can't be spliced, use sendfile
+    }
+#endif
+
+#ifdef __linux__
+    off_t nSent = 0;
+    while (nSent < nSize) {
+        if (nTimeoutMs >= 0 && qio_wait_writable(nSockFd, nTimeoutMs) <= 0) break;
+
+        size_t nChunk = (nSize - nSent > MAX_SENDFILE_CHUNK) ? MAX_SENDFILE_CHUNK : (size_t)(nSize - nSent);
+        ssize_t nRet = sendfile(nSockFd, nFd, NULL, nChunk);
+        if (nRet < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            if (nSent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                nSent = qio_send(nSockFd, nFd, nSize, nTimeoutMs);
+            } else if (nSent == 0) {
+                nSent = -1;
+            }
+            break;
+        } else if (nRet == 0) { // file truncated
+            break;
+        }
+        nSent += nRet;
+    }
+#else
     off_t nSent = qio_send(nSockFd, nFd, nSize, nTimeoutMs);
+#endif
     DEBUG("[TX] (send %jd/%jd bytes)", nSent, nSize);
 
     return nSent;
 }
+
+/*
+ * Sleep until the bytes sent so far are due at the limited rate.
+ */
+static void _waitPacing(void)
+{
+    struct timeval tvNow;
+    gettimeofday(&tvNow, NULL);
+
+    float nDue = (float)m_shape.nPaced / m_shape.nRate;
+    float nWait = nDue - getDiffTimeval(&tvNow, &m_shape.tvStart);
+    if (nWait <= 0) return;
+
+    struct timespec ts;
+    ts.tv_sec = (time_t)nWait;
+    ts.tv_nsec = (long)((nWait - ts.tv_sec) * 1000000000);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+static ssize_t _recv(int nSockFd, void *pBuffer, size_t nSize, int nTimeoutMs)
+{
+#ifdef ENABLE_IOURING
+    if (iouringIsReady() == true) return iouringRecv(nSockFd, pBuffer, nSize, 0, nTimeoutMs);
+#endif
+    int nStatus = qio_wait_readable(nSockFd, nTimeoutMs);
+    if (nStatus <= 0) return nStatus;
+    return read(nSockFd, pBuffer, nSize);
+}
+
+/*
+ * Receive request body into the file or the buffer. A client gets nTimeoutMs
+ * of grace, then every MinBodyRate bytes extend the deadline by a second, so
+ * trickling bytes slower than that gets the connection cut.
+ *
+ * @param nFd       file to save into. ignored if pBuffer is given.
+ * @param pBuffer   buffer to read into. NULL to save into nFd.
+ * @return the number of bytes received if successful, 0 on timeout,
+ *         -1 for error.
+ */
+static off_t _readBody(int nSockFd, int nFd, char *pBuffer, off_t nSize, int nTimeoutMs)
+{
+    struct timeval tvStart, tvNow;
+    gettimeofday(&tvStart, NULL);
+
+    char szBuf[16 * 1024];
+    off_t nTotal = 0;
+    bool bCut = false;
+    errno = 0;
+    while (nTotal < nSize) {
+        int nWaitMs = nTimeoutMs;
+        if (g_conf.nMinBodyRate > 0 && nTimeoutMs > 0) {
+            gettimeofday(&tvNow, NULL);
+            long long nElapsedMs = (long long)(tvNow.tv_sec - tvStart.tv_sec) * 1000 + (tvNow.tv_usec - tvStart.tv_usec) / 1000;
+            long long nLeftMs = nTimeoutMs + (long long)nTotal * 1000 / g_conf.nMinBodyRate - nElapsedMs;
+            if (nLeftMs <= 0) {
+                bCut = true;
+                break;
+            }
+            if (nLeftMs < nWaitMs) nWaitMs = (int)nLeftMs;
+        }
+
+        size_t nWant = (pBuffer != NULL || nSize - nTotal < sizeof(szBuf)) ? (size_t)(nSize - nTotal) : sizeof(szBuf);
+        ssize_t nRead = _recv(nSockFd, (pBuffer != NULL) ? pBuffer + nTotal : szBuf, nWant, nWaitMs);
+        if (nRead <= 0) {
+            if (nRead == 0 && errno == ETIMEDOUT && nWaitMs < nTimeoutMs) bCut = true;
+            else if (nRead == 0 && errno != ETIMEDOUT) errno = 0;  // closed by peer
+            break;
+        }
+        if (pBuffer == NULL) {
+            if (qio_write(nFd, szBuf, nRead, -1) != nRead) break;
+            if (m_pSaveHash != NULL) sha256Update(m_pSaveHash, szBuf, nRead);
+        }
+        nTotal += nRead;
+    }
+
+    if (bCut == true) {
+        LOG_INFO("Request body is slower than %d bytes/sec. Connection cut. (%jd/%jd bytes received)", g_conf.nMinBodyRate, nTotal, nSize);
+        poolCountSlowClient(false);
+        errno = ETIMEDOUT;
+    }
+
+    if (nTotal > 0) return nTotal;
+    else if (errno == ETIMEDOUT) return 0;
+    return -1;
+}
@@ -83,3 +83,29 @@ int sysClosedir(DIR *pDir)
 {
     return closedir(pDir);
 }
+
+int sysFadvise(int nFd, off_t nOffset, off_t nLen, int nAdvice)
+{
+#ifdef POSIX_FADV_NORMAL
+    return posix_fadvise(nFd, nOffset, nLen, nAdvice);
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Tell whether the page at the offset is in the page cache, without blocking
+ * on the disk.
+ *
+ * @return 1 if cached, 0 if not, -1 if it can't be told
+ */
+int sysIsCached(int nFd, off_t nOffset)
+{
+#ifdef RWF_NOWAIT
+    char cBuf;
+    struct iovec vector = { &cBuf, 1 };
+    if (preadv2(nFd, &vector, 1, nOffset, RWF_NOWAIT) >= 0) return 1;
+    if (errno == EAGAIN) return 0;
+#endif
+    return -1;
+}
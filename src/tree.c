@@ -0,0 +1,454 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: tree.c 231 2012-06-18 16:40:12Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Tree operations for COPY, MOVE and DELETE.
+ *
+ * Collections are walked with walkTree() and every entry is created or
+ * removed relative to the descriptor of its directory, so memory use depends
+ * on the depth only and paths are never resolved from the root again.
+ *
+ * MOVE is a rename(2). renameat2(2) refuses to replace the destination
+ * unless overwriting is allowed, and a collection replacing another is
+ * swapped in with RENAME_EXCHANGE before the old one is removed, so the
+ * destination never disappears in between. Across filesystems the tree is
+ * copied and the source removed.
+ *
+ * File data is copied inside the kernel. A reflink with FICLONE is tried
+ * first, which shares the extents on filesystems like btrfs and XFS, then
+ * copy_file_range(2), then splice(2) through a pipe, and read/write at last.
+ */
+
+#include "qhttpd.h"
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE    (1 << 0)
+#endif
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE     (1 << 1)
+#endif
+
+struct TreeCopy {
+    int     anDstFd[WALK_MAX_DEPTH + 1];    // destination directories
+    qlist_t *pFailed;           // paths of members failed
+};
+
+struct TreeRemove {
+    qlist_t *pFailed;           // paths of members failed
+};
+
+static int _copyWalk(struct WalkEntry *pEntry, void *pArg);
+static int _removeWalk(struct WalkEntry *pEntry, void *pArg);
+static bool _copyFileAt(int nSrcDirFd, const char *pszSrcName, int nDstDirFd, const char *pszDstName, struct stat *pSrcStat);
+static off_t _copyRange(int nInFd, int nOutFd, off_t nSize);
+static off_t _copySplice(int nInFd, int nOutFd, off_t nSize);
+static off_t _copyRw(int nInFd, int nOutFd, off_t nSize);
+static void _addFailed(qlist_t *pFailed, const char *pszPath);
+static int _rename(const char *pszOldPath, const char *pszNewPath, unsigned int nFlags);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Copy a file or a collection. The destination must not exist.
+ *
+ * @param pszSrcPath    system path of the source
+ * @param pszDstPath    system path of the destination
+ * @param nMaxDepth     0 to copy a collection without members, -1 for all
+ * @param pFailed       relative paths of members failed to copy are added.
+ *                      can be NULL.
+ * @return true if the resource itself is copied, otherwise returns false
+ */
+bool treeCopy(const char *pszSrcPath, const char *pszDstPath, int nMaxDepth, qlist_t *pFailed)
+{
+    struct stat srcstat;
+    if (sysStat(pszSrcPath, &srcstat) != 0) return false;
+
+    if (S_ISDIR(srcstat.st_mode) == false) {
+        return _copyFileAt(AT_FDCWD, pszSrcPath, AT_FDCWD, pszDstPath, &srcstat);
+    }
+
+    if (mkdir(pszDstPath, srcstat.st_mode & 07777) != 0) return false;
+    if (nMaxDepth == 0) return true;
+
+    struct TreeCopy copy;
+    memset((void *)&copy, 0, sizeof(copy));
+    copy.pFailed = pFailed;
+    copy.anDstFd[0] = open(pszDstPath, O_RDONLY | O_DIRECTORY);
+    if (copy.anDstFd[0] < 0) return false;
+
+    walkTree(pszSrcPath, nMaxDepth, true, _copyWalk, (void *)&copy);
+    close(copy.anDstFd[0]);
+
+    return true;
+}
+
+/**
+ * Remove a file or a collection with all of its members.
+ *
+ * @param pszPath   system path to remove
+ * @param pFailed   relative paths of members failed to remove are added.
+ *                  can be NULL.
+ * @return true if the resource itself is removed, otherwise returns false
+ */
+bool treeRemove(const char *pszPath, qlist_t *pFailed)
+{
+    struct stat filestat;
+    if (lstat(pszPath, &filestat) != 0) return false;
+
+    if (S_ISDIR(filestat.st_mode) == false) {
+        return (sysUnlink(pszPath) == 0) ? true : false;
+    }
+
+    struct TreeRemove remove;
+    remove.pFailed = pFailed;
+    walkTree(pszPath, -1, true, _removeWalk, (void *)&remove);
+
+    return (sysRmdir(pszPath) == 0) ? true : false;
+}
+
+/**
+ * Move a file or a collection.
+ *
+ * @param pszSrcPath    system path of the source
+ * @param pszDstPath    system path of the destination
+ * @param bOverwrite    true to replace the destination if it exists
+ * @param pFailed       relative paths of members failed to move are added.
+ *                      can be NULL.
+ * @return true if the resource itself is moved, otherwise returns false
+ *         with errno EEXIST if the destination exists and bOverwrite is
+ *         false. across filesystems, the source is kept if any member is
+ *         not copied, and false is returned with errno EIO.
+ */
+bool treeMove(const char *pszSrcPath, const char *pszDstPath, bool bOverwrite, qlist_t *pFailed)
+{
+    if (_rename(pszSrcPath, pszDstPath, RENAME_NOREPLACE) == 0) return true;
+
+    if (errno == EEXIST) {
+        if (bOverwrite == false) return false;
+
+        // files and empty collections are replaced atomically
+        if (rename(pszSrcPath, pszDstPath) == 0) return true;
+        if (errno != ENOTEMPTY && errno != EEXIST && errno != EISDIR && errno != ENOTDIR) return false;
+
+        // swap and remove the old one, which is at the source now
+        if (_rename(pszSrcPath, pszDstPath, RENAME_EXCHANGE) == 0) {
+            if (treeRemove(pszSrcPath, NULL) == false) {
+                LOG_WARN("Can't remove replaced resource %s", pszSrcPath);
+            }
+            return true;
+        }
+
+        if (treeRemove(pszDstPath, pFailed) == false) return false;
+        return (sysRename(pszSrcPath, pszDstPath) == 0) ? true : false;
+    }
+
+    if (errno != EXDEV) return false;
+
+    // across filesystems, copy and remove
+    struct stat dststat;
+    if (lstat(pszDstPath, &dststat) == 0) {
+        if (bOverwrite == false) {
+            errno = EEXIST;
+            return false;
+        }
+        if (treeRemove(pszDstPath, pFailed) == false) return false;
+    }
+
+    qlist_t *pCopyFailed = qlist();
+    if (pCopyFailed == NULL) return false;
+    bool bCopied = treeCopy(pszSrcPath, pszDstPath, -1, pCopyFailed);
+
+    // the source is kept unless everything is copied
+    size_t nCopyFailed = pCopyFailed->size(pCopyFailed);
+    if (pFailed != NULL) {
+        qdlobj_t obj;
+        memset((void *)&obj, 0, sizeof(obj));
+        while (pCopyFailed->getnext(pCopyFailed, &obj, false) == true) {
+            pFailed->addlast(pFailed, obj.data, obj.size);
+        }
+    }
+    pCopyFailed->free(pCopyFailed);
+    if (bCopied == false) return false;
+    if (nCopyFailed > 0) {
+        LOG_WARN("Kept the source of partly copied resource %s", pszSrcPath);
+        errno = EIO;
+        return false;
+    }
+
+    if (treeRemove(pszSrcPath, pFailed) == false) {
+        LOG_WARN("Can't remove moved resource %s", pszSrcPath);
+    }
+
+    return true;
+}
+
+/**
+ * Copy file data in the kernel.
+ *
+ * @param nInFd     source positioned at the beginning
+ * @param nOutFd    empty destination
+ * @param nSize     bytes to copy
+ * @return the number of bytes copied, or -1 on error
+ */
+off_t treeCopyData(int nInFd, int nOutFd, off_t nSize)
+{
+#ifdef FICLONE
+    if (nSize > 0 && ioctl(nOutFd, FICLONE, nInFd) == 0) {
+        DEBUG("Reflinked %jd bytes.", (intmax_t)nSize);
+        return nSize;
+    }
+#endif
+
+    off_t nCopied = _copyRange(nInFd, nOutFd, nSize);
+    if (nCopied == 0 && nSize > 0) nCopied = _copySplice(nInFd, nOutFd, nSize);
+    if (nCopied == 0 && nSize > 0) nCopied = _copyRw(nInFd, nOutFd, nSize);
+
+    return nCopied;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+static int _copyWalk(struct WalkEntry *pEntry, void *pArg)
+{
+    struct TreeCopy *pCopy = (struct TreeCopy *)pArg;
+    int nDstDirFd = pCopy->anDstFd[pEntry->nDepth - 1];
+
+    // directory is done
+    if (pEntry->bPost == true) {
+        if (pCopy->anDstFd[pEntry->nDepth] >= 0) close(pCopy->anDstFd[pEntry->nDepth]);
+        pCopy->anDstFd[pEntry->nDepth] = -1;
+        return WALK_CONTINUE;
+    }
+
+    // temporary files of the property store
+    if (!strncmp(pEntry->pszName, PROP_FILENAME ".", CONST_STRLEN(PROP_FILENAME "."))) return WALK_CONTINUE;
+
+    if (pEntry->bLink == true) {
+        char szTarget[PATH_MAX];
+        ssize_t nLen = readlinkat(pEntry->nDirFd, pEntry->pszName, szTarget, sizeof(szTarget) - 1);
+        if (nLen >= 0) {
+            szTarget[nLen] = '\0';
+            if (symlinkat(szTarget, nDstDirFd, pEntry->pszName) == 0) return WALK_CONTINUE;
+        }
+    } else if (S_ISDIR(pEntry->st.st_mode)) {
+        // members would be lost
+        if (pEntry->bTruncated == true) {
+            _addFailed(pCopy->pFailed, pEntry->pszPath);
+            return WALK_SKIP;
+        }
+
+        if (mkdirat(nDstDirFd, pEntry->pszName, pEntry->st.st_mode & 07777) == 0) {
+            pCopy->anDstFd[pEntry->nDepth] = openat(nDstDirFd, pEntry->pszName, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if (pCopy->anDstFd[pEntry->nDepth] >= 0) return WALK_CONTINUE;
+        }
+        _addFailed(pCopy->pFailed, pEntry->pszPath);
+        return WALK_SKIP;
+    } else if (S_ISREG(pEntry->st.st_mode)) {
+        if (_copyFileAt(pEntry->nDirFd, pEntry->pszName, nDstDirFd, pEntry->pszName, &pEntry->st) == true) return WALK_CONTINUE;
+    }
+
+    _addFailed(pCopy->pFailed, pEntry->pszPath);
+    return WALK_CONTINUE;
+}
+
+static int _removeWalk(struct WalkEntry *pEntry, void *pArg)
+{
+    struct TreeRemove *pRemove = (struct TreeRemove *)pArg;
+
+    // directories are removed after their members
+    bool bDir = (pEntry->bLink == false && S_ISDIR(pEntry->st.st_mode)) ? true : false;
+    if (bDir == true && pEntry->bPost == false) {
+        // members can't be reached
+        if (pEntry->bTruncated == true) {
+            _addFailed(pRemove->pFailed, pEntry->pszPath);
+            return WALK_SKIP;
+        }
+        return WALK_CONTINUE;
+    }
+
+    if (unlinkat(pEntry->nDirFd, pEntry->pszName, (bDir == true) ? AT_REMOVEDIR : 0) != 0) {
+        // not empty because of members failed, which are reported already
+        if (bDir == true && errno == ENOTEMPTY && pRemove->pFailed != NULL && pRemove->pFailed->size(pRemove->pFailed) > 0) {
+            return WALK_CONTINUE;
+        }
+        _addFailed(pRemove->pFailed, pEntry->pszPath);
+    }
+
+    return WALK_CONTINUE;
+}
+
+static bool _copyFileAt(int nSrcDirFd, const char *pszSrcName, int nDstDirFd, const char *pszDstName, struct stat *pSrcStat)
+{
+    int nInFd = openat(nSrcDirFd, pszSrcName, O_RDONLY);
+    if (nInFd < 0) return false;
+
+    int nOutFd = openat(nDstDirFd, pszDstName, O_WRONLY | O_CREAT | O_EXCL, pSrcStat->st_mode & 07777);
+    if (nOutFd < 0) {
+        close(nInFd);
+        return false;
+    }
+
+    off_t nCopied = treeCopyData(nInFd, nOutFd, pSrcStat->st_size);
+    close(nInFd);
+    if (close(nOutFd) != 0 || nCopied != pSrcStat->st_size) {
+        DEBUG("Copy failed. (%s, %jd/%jd bytes)", pszSrcName, (intmax_t)nCopied, (intmax_t)pSrcStat->st_size);
+        unlinkat(nDstDirFd, pszDstName, 0);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Copy with copy_file_range(2).
+ *
+ * @return bytes copied, 0 if not supported between the files
+ */
+static off_t _copyRange(int nInFd, int nOutFd, off_t nSize)
+{
+#if defined(__linux__) && defined(SYS_copy_file_range)
+    off_t nCopied = 0;
+    while (nCopied < nSize) {
+        size_t nChunk = (nSize - nCopied > MAX_SENDFILE_CHUNK) ? MAX_SENDFILE_CHUNK : (size_t)(nSize - nCopied);
+        ssize_t nRet = syscall(SYS_copy_file_range, nInFd, NULL, nOutFd, NULL, nChunk, 0);
+        if (nRet < 0) {
+            if (errno == EINTR) continue;
+            if (nCopied == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) return 0;
+            return -1;
+        } else if (nRet == 0) { // file truncated
+            break;
+        }
+        nCopied += nRet;
+    }
+    return nCopied;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Copy with splice(2) through a pipe.
+ *
+ * @return bytes copied, 0 if not supported between the files
+ */
+static off_t _copySplice(int nInFd, int nOutFd, off_t nSize)
+{
+#ifdef __linux__
+    int anPipe[2];
+    if (pipe(anPipe) != 0) return 0;
+
+    off_t nCopied = 0;
+    while (nCopied < nSize) {
+        size_t nChunk = (nSize - nCopied > MAX_SENDFILE_CHUNK) ? MAX_SENDFILE_CHUNK : (size_t)(nSize - nCopied);
+        ssize_t nIn = splice(nInFd, NULL, anPipe[1], NULL, nChunk, SPLICE_F_MOVE);
+        if (nIn < 0) {
+            if (errno == EINTR) continue;
+            if (nCopied > 0 || errno != EINVAL) nCopied = -1;
+            break;
+        } else if (nIn == 0) { // file truncated
+            break;
+        }
+
+        // drain the pipe
+        while (nIn > 0) {
+            ssize_t nOut = splice(anPipe[0], NULL, nOutFd, NULL, nIn, SPLICE_F_MOVE);
+            if (nOut < 0 && errno == EINTR) continue;
+            if (nOut <= 0) break;
+            nIn -= nOut;
+            nCopied += nOut;
+        }
+        if (nIn > 0) {
+            nCopied = -1;
+            break;
+        }
+    }
+
+    close(anPipe[0]);
+    close(anPipe[1]);
+    return nCopied;
+#else
+    return 0;
+#endif
+}
+
+static off_t _copyRw(int nInFd, int nOutFd, off_t nSize)
+{
+    char szBuf[64 * 1024];
+    off_t nCopied = 0;
+    while (nCopied < nSize) {
+        size_t nChunk = (nSize - nCopied > sizeof(szBuf)) ? sizeof(szBuf) : (size_t)(nSize - nCopied);
+        ssize_t nRead = read(nInFd, szBuf, nChunk);
+        if (nRead < 0 && errno == EINTR) continue;
+        if (nRead < 0) return -1;
+        if (nRead == 0) break;
+        if (qio_write(nOutFd, szBuf, nRead, -1) != nRead) return -1;
+        nCopied += nRead;
+    }
+    return nCopied;
+}
+
+static void _addFailed(qlist_t *pFailed, const char *pszPath)
+{
+    DEBUG("Tree operation failed. (%s, errno: %d)", pszPath, errno);
+    if (pFailed != NULL) pFailed->addlast(pFailed, pszPath, strlen(pszPath) + 1);
+}
+
+/*
+ * renameat2(2) with flags, emulated where it's not supported.
+ */
+static int _rename(const char *pszOldPath, const char *pszNewPath, unsigned int nFlags)
+{
+#if defined(__linux__) && defined(SYS_renameat2)
+    int nRet = syscall(SYS_renameat2, AT_FDCWD, pszOldPath, AT_FDCWD, pszNewPath, nFlags);
+    if (nRet == 0 || (errno != ENOSYS && errno != EINVAL)) return nRet;
+#endif
+
+    // can't exchange without it
+    if (nFlags & RENAME_EXCHANGE) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    struct stat filestat;
+    if ((nFlags & RENAME_NOREPLACE) && lstat(pszNewPath, &filestat) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return rename(pszOldPath, pszNewPath);
+}
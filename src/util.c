@@ -34,8 +34,12 @@ int closeSocket(int nSockFd)
 {
     // close connection
     if (shutdown(nSockFd, SHUT_WR) == 0) {
+        // let the helper drain input, so we can go back to work right away
+        if (lingerHandOver(nSockFd) == true) return close(nSockFd);
+
+        time_t nDeadline = time(NULL) + (MAX_SHUTDOWN_WAIT / 1000);
         char szDummyBuf[1024];
-        while (true) {
+        while (time(NULL) < nDeadline) {
             ssize_t nDummyRead = streamRead(nSockFd, szDummyBuf, sizeof(szDummyBuf), MAX_SHUTDOWN_WAIT);
             if (nDummyRead <= 0) break;
             DEBUG("Throw %zu bytes from dummy input stream.", nDummyRead);
@@ -44,14 +48,6 @@ int closeSocket(int nSockFd)
     return close(nSockFd);
 }
 
-char *getEtag(char *pszBuf, size_t nBufSize, const char *pszPath, struct stat *pStat)
-{
-    unsigned int nFilepathHash = qhashfnv1_32((const void *)pszPath, strlen(pszPath));
-    snprintf(pszBuf, nBufSize, "%08x-%08x-%08x", nFilepathHash, (unsigned int)pStat->st_size, (unsigned int)pStat->st_mtime);
-    pszBuf[nBufSize - 1] = '\0';
-    return pszBuf;
-}
-
 unsigned int getIp2Uint(const char *szIp)
 {
     char szBuf[15+1];
@@ -128,6 +124,57 @@ bool isValidPathname(const char *pszPath)
     return true;
 }
 
+/**
+ * Check whether a file name belongs to the server's own bookkeeping
+ *
+ * @param pszName	single path component
+ *
+ * @return	true if the name is the dead property store or one of its
+ *		temporary files, or a staging or temporary file of upload
+ */
+bool isInternalFilename(const char *pszName)
+{
+    if (pszName == NULL) return false;
+
+    if (!strcmp(pszName, PROP_FILENAME)) return true;
+    if (!strncmp(pszName, PROP_FILENAME ".", CONST_STRLEN(PROP_FILENAME "."))) return true;
+
+    // ".qhttpd-part.name" and ".qhttpd-temp.name.XXXXXX"
+    if (!strncmp(pszName, UPLOAD_PART_PREFIX, CONST_STRLEN(UPLOAD_PART_PREFIX))
+        && pszName[CONST_STRLEN(UPLOAD_PART_PREFIX)] != '\0') return true;
+    if (!strncmp(pszName, UPLOAD_TEMP_PREFIX, CONST_STRLEN(UPLOAD_TEMP_PREFIX))
+        && pszName[CONST_STRLEN(UPLOAD_TEMP_PREFIX)] != '\0') return true;
+
+    return false;
+}
+
+/**
+ * Check whether any component of a path is an internal file name
+ *
+ * @see isInternalFilename()
+ */
+bool isInternalPathname(const char *pszPath)
+{
+    if (pszPath == NULL) return false;
+
+    char szName[FILENAME_MAX + 1];
+    const char *pszBegin = pszPath;
+    while (*pszBegin != '\0') {
+        while (*pszBegin == '/') pszBegin++;
+        size_t nLen = strcspn(pszBegin, "/");
+        if (nLen == 0) break;
+
+        if (nLen < sizeof(szName)) {
+            memcpy(szName, pszBegin, nLen);
+            szName[nLen] = '\0';
+            if (isInternalFilename(szName) == true) return true;
+        }
+        pszBegin += nLen;
+    }
+
+    return false;
+}
+
 /**
  * Correting path
  *
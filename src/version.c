@@ -74,6 +74,22 @@ char *getVersion(void)
     ver->addstr(ver, " --enable-hook");
 #endif
 
+#ifdef ENABLE_ZLIB
+    ver->addstr(ver, " --enable-zlib");
+#endif
+
+#ifdef ENABLE_BROTLI
+    ver->addstr(ver, " --enable-brotli");
+#endif
+
+#ifdef ENABLE_ZSTD
+    ver->addstr(ver, " --enable-zstd");
+#endif
+
+#ifdef ENABLE_IOURING
+    ver->addstr(ver, " --enable-iouring");
+#endif
+
     ver->addstr(ver, ")");
 
     char *final = ver->tostring(ver);
@@ -0,0 +1,262 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: walk.c 227 2012-06-05 13:02:36Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Directory tree walker.
+ *
+ * The tree is walked iteratively with a stack of open directories, so memory
+ * use depends on the depth only, never on the number of entries. Entries are
+ * read in batches with getdents64(2) where available and every entry is
+ * stat'ed relative to its directory descriptor, so paths are never resolved
+ * from the root again.
+ */
+
+#include "qhttpd.h"
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define WALK_GETDENTS
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+struct WalkLevel {
+    int     nFd;            // directory descriptor
+    size_t  nPathLen;       // path length of this directory
+#ifdef WALK_GETDENTS
+    char    *pBuf;          // directory entries read at once
+    int     nBufPos;
+    int     nBufLen;
+#else
+    DIR     *pDir;
+#endif
+};
+
+static bool _openLevel(struct WalkLevel *pLevel, int nFd);
+static void _closeLevel(struct WalkLevel *pLevel);
+static const char *_readLevel(struct WalkLevel *pLevel);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Walk the directory tree. The root itself is not visited.
+ *
+ * @param pszRoot       root directory
+ * @param nMaxDepth     the maximum depth to visit, 1 for entries of the root
+ *                      only. -1 for no limit but WALK_MAX_DEPTH.
+ * @param bPostOrder    visit directories once more after their entries.
+ *                      pEntry->bPost is set for the second visit. skipped
+ *                      directories are not visited again.
+ *                      pEntry->bTruncated is set for directories which
+ *                      entries are not visited because of WALK_MAX_DEPTH.
+ * @param pCallback     called for every entry. returns WALK_CONTINUE,
+ *                      WALK_SKIP not to descend into the directory, or
+ *                      WALK_STOP to stop walking.
+ * @param pArg          user data passed to the callback
+ * @return number of visited entries, or -1 if the root can't be opened
+ */
+int walkTree(const char *pszRoot, int nMaxDepth, bool bPostOrder, walkcb_t pCallback, void *pArg)
+{
+    bool bLimited = (nMaxDepth < 0 || nMaxDepth >= WALK_MAX_DEPTH) ? true : false;
+    if (bLimited == true) nMaxDepth = WALK_MAX_DEPTH;
+
+    int nRootFd = open(pszRoot, O_RDONLY | O_DIRECTORY);
+    if (nRootFd < 0) return -1;
+
+    struct WalkLevel aLevels[WALK_MAX_DEPTH];
+    if (_openLevel(&aLevels[0], nRootFd) == false) {
+        close(nRootFd);
+        return -1;
+    }
+
+    char szPath[PATH_MAX] = "";
+    aLevels[0].nPathLen = 0;
+
+    int nDepth = 1, nVisited = 0;
+    bool bStop = false;
+    while (nDepth > 0 && bStop == false) {
+        struct WalkLevel *pLevel = &aLevels[nDepth - 1];
+
+        const char *pszName = _readLevel(pLevel);
+        if (pszName == NULL) {
+            // done with this directory, revisit it from its parent
+            size_t nDirPathLen = pLevel->nPathLen;
+            _closeLevel(pLevel);
+            nDepth--;
+            szPath[nDirPathLen] = '\0';
+
+            if (nDepth > 0 && bPostOrder == true) {
+                struct WalkEntry entry;
+                memset((void *)&entry, 0, sizeof(entry));
+                entry.nDirFd = aLevels[nDepth - 1].nFd;
+                entry.pszName = strrchr(szPath, '/') + 1;
+                entry.pszPath = szPath;
+                entry.nDepth = nDepth;
+                entry.bPost = true;
+                fstatat(entry.nDirFd, entry.pszName, &entry.st, AT_SYMLINK_NOFOLLOW);
+                if (pCallback(&entry, pArg) == WALK_STOP) bStop = true;
+            }
+            continue;
+        }
+
+        // build path
+        size_t nNameLen = strlen(pszName);
+        if (pLevel->nPathLen + 1 + nNameLen >= sizeof(szPath)) continue;
+        szPath[pLevel->nPathLen] = '/';
+        memcpy(szPath + pLevel->nPathLen + 1, pszName, nNameLen + 1);
+
+        struct WalkEntry entry;
+        memset((void *)&entry, 0, sizeof(entry));
+        entry.nDirFd = pLevel->nFd;
+        entry.pszName = szPath + pLevel->nPathLen + 1;
+        entry.pszPath = szPath;
+        entry.nDepth = nDepth;
+
+        // symbolic links are followed for the information, never for walking
+        if (fstatat(pLevel->nFd, pszName, &entry.st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        bool bDir = S_ISDIR(entry.st.st_mode) ? true : false;
+        if (S_ISLNK(entry.st.st_mode)) {
+            entry.bLink = true;
+            struct stat linkstat;
+            if (fstatat(pLevel->nFd, pszName, &linkstat, 0) == 0) entry.st = linkstat;
+        }
+
+        if (bDir == true && nDepth >= nMaxDepth && bLimited == true) entry.bTruncated = true;
+
+        nVisited++;
+        int nRet = pCallback(&entry, pArg);
+        if (nRet == WALK_STOP) {
+            bStop = true;
+            break;
+        }
+        if (bDir == false || nRet == WALK_SKIP) continue;
+
+        if (nDepth >= nMaxDepth) {
+            if (entry.bTruncated == true) DEBUG("Too deep to walk. (%s)", szPath);
+            if (bPostOrder == true) {
+                entry.bPost = true;
+                if (pCallback(&entry, pArg) == WALK_STOP) bStop = true;
+            }
+            continue;
+        }
+
+        // descend
+        int nFd = openat(pLevel->nFd, pszName, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if (nFd < 0 || _openLevel(&aLevels[nDepth], nFd) == false) {
+            if (nFd >= 0) close(nFd);
+            if (bPostOrder == true) {
+                entry.bPost = true;
+                if (pCallback(&entry, pArg) == WALK_STOP) bStop = true;
+            }
+            continue;
+        }
+        aLevels[nDepth].nPathLen = pLevel->nPathLen + 1 + nNameLen;
+        nDepth++;
+    }
+
+    // stopped in the middle
+    while (nDepth > 0) {
+        _closeLevel(&aLevels[nDepth - 1]);
+        nDepth--;
+    }
+
+    return nVisited;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+#ifdef WALK_GETDENTS
+static bool _openLevel(struct WalkLevel *pLevel, int nFd)
+{
+    pLevel->pBuf = (char *)malloc(WALK_DIRENT_BUFSIZE);
+    if (pLevel->pBuf == NULL) return false;
+    pLevel->nFd = nFd;
+    pLevel->nBufPos = pLevel->nBufLen = 0;
+    return true;
+}
+
+static void _closeLevel(struct WalkLevel *pLevel)
+{
+    free(pLevel->pBuf);
+    close(pLevel->nFd);
+}
+
+static const char *_readLevel(struct WalkLevel *pLevel)
+{
+    while (true) {
+        if (pLevel->nBufPos >= pLevel->nBufLen) {
+            int nRead = syscall(SYS_getdents64, pLevel->nFd, pLevel->pBuf, WALK_DIRENT_BUFSIZE);
+            if (nRead <= 0) return NULL;
+            pLevel->nBufPos = 0;
+            pLevel->nBufLen = nRead;
+        }
+
+        struct linux_dirent64 *pEnt = (struct linux_dirent64 *)(pLevel->pBuf + pLevel->nBufPos);
+        pLevel->nBufPos += pEnt->d_reclen;
+
+        if (!strcmp(pEnt->d_name, ".") || !strcmp(pEnt->d_name, "..")) continue;
+        return pEnt->d_name;
+    }
+}
+#else
+static bool _openLevel(struct WalkLevel *pLevel, int nFd)
+{
+    pLevel->pDir = fdopendir(nFd);
+    if (pLevel->pDir == NULL) return false;
+    pLevel->nFd = nFd;
+    return true;
+}
+
+static void _closeLevel(struct WalkLevel *pLevel)
+{
+    closedir(pLevel->pDir);
+}
+
+static const char *_readLevel(struct WalkLevel *pLevel)
+{
+    struct dirent *pEnt;
+    while ((pEnt = readdir(pLevel->pDir)) != NULL) {
+        if (!strcmp(pEnt->d_name, ".") || !strcmp(pEnt->d_name, "..")) continue;
+        return pEnt->d_name;
+    }
+    return NULL;
+}
+#endif
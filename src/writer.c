@@ -0,0 +1,372 @@
+/******************************************************************************
+ * qHttpd - http://www.qdecoder.org
+ *
+ * Copyright (c) 2008-2012 Seungyoung Kim.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************
+ * $Id: writer.c 228 2012-06-08 09:47:15Z seungyoung.kim $
+ ******************************************************************************/
+
+/*
+ * Buffered text writer for generated contents.
+ *
+ * Output is formatted straight into a fixed buffer which is handed to the
+ * output function whenever it fills up, so generating a large document
+ * costs neither a memory allocation per field nor a copy of the whole
+ * document. Static parts of a template are written with writerPutLit(),
+ * which takes the length at compile time, and numbers and dates have their
+ * own formatters which don't go through printf.
+ *
+ * Once the output function fails, following writes are ignored and
+ * return false.
+ */
+
+#include "qhttpd.h"
+
+struct Writer {
+    char    szBuf[WRITER_BUFSIZE];
+    size_t  nLen;           // bytes in buffer
+    writerout_t pOut;       // output function
+    void    *pArg;          // argument for output function
+    bool    bFailed;        // flag for output failure
+};
+
+static const char *m_aszDays[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char *m_aszMonths[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                       "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+static struct tm *_getGmtime(time_t nTime);
+static char *_putDigits(char *pszBuf, int nNum, int nDigits);
+
+/////////////////////////////////////////////////////////////////////////
+// PUBLIC FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/**
+ * Create a writer.
+ *
+ * @param pOut  output function, such like writerChunkOut()
+ * @param pArg  argument passed to the output function
+ * @return writer if successful, otherwise returns NULL
+ */
+struct Writer *writerCreate(writerout_t pOut, void *pArg)
+{
+    struct Writer *pWriter = (struct Writer *)malloc(sizeof(struct Writer));
+    if (pWriter == NULL) return NULL;
+
+    pWriter->nLen = 0;
+    pWriter->pOut = pOut;
+    pWriter->pArg = pArg;
+    pWriter->bFailed = false;
+    return pWriter;
+}
+
+/**
+ * Flush buffered output.
+ *
+ * @return true if successful, otherwise returns false
+ */
+bool writerFlush(struct Writer *pWriter)
+{
+    if (pWriter->bFailed == true) return false;
+    if (pWriter->nLen == 0) return true;
+
+    if (pWriter->pOut(pWriter->pArg, pWriter->szBuf, pWriter->nLen) == false) {
+        pWriter->bFailed = true;
+    }
+    pWriter->nLen = 0;
+
+    return (pWriter->bFailed == true) ? false : true;
+}
+
+/**
+ * Free the writer. Buffered output is not flushed.
+ */
+void writerFree(struct Writer *pWriter)
+{
+    free(pWriter);
+}
+
+bool writerPut(struct Writer *pWriter, const void *pData, size_t nSize)
+{
+    if (pWriter->bFailed == true) return false;
+
+    while (nSize > 0) {
+        if (pWriter->nLen == sizeof(pWriter->szBuf) && writerFlush(pWriter) == false) return false;
+
+        size_t nCopy = sizeof(pWriter->szBuf) - pWriter->nLen;
+        if (nCopy > nSize) nCopy = nSize;
+        memcpy(pWriter->szBuf + pWriter->nLen, pData, nCopy);
+        pWriter->nLen += nCopy;
+        pData = (const char *)pData + nCopy;
+        nSize -= nCopy;
+    }
+
+    return true;
+}
+
+bool writerPuts(struct Writer *pWriter, const char *pszStr)
+{
+    return writerPut(pWriter, pszStr, strlen(pszStr));
+}
+
+bool writerPutf(struct Writer *pWriter, const char *pszFormat, ...)
+{
+    if (pWriter->bFailed == true) return false;
+
+    va_list arglist;
+    va_start(arglist, pszFormat);
+    int nLen = vsnprintf(pWriter->szBuf + pWriter->nLen, sizeof(pWriter->szBuf) - pWriter->nLen, pszFormat, arglist);
+    va_end(arglist);
+    if (nLen < 0) return false;
+
+    // fits in the buffer
+    if (pWriter->nLen + nLen < sizeof(pWriter->szBuf)) {
+        pWriter->nLen += nLen;
+        return true;
+    }
+
+    // doesn't fit, format again into a separate buffer
+    char *pszStr = (char *)malloc(nLen + 1);
+    if (pszStr == NULL) return false;
+    va_start(arglist, pszFormat);
+    vsnprintf(pszStr, nLen + 1, pszFormat, arglist);
+    va_end(arglist);
+
+    bool bRet = writerPut(pWriter, pszStr, nLen);
+    free(pszStr);
+    return bRet;
+}
+
+bool writerPutInt(struct Writer *pWriter, intmax_t nNum)
+{
+    char szBuf[24];
+    char *p = szBuf + sizeof(szBuf);
+
+    uintmax_t nAbs = (nNum < 0) ? -(uintmax_t)nNum : (uintmax_t)nNum;
+    do {
+        *--p = '0' + (nAbs % 10);
+        nAbs /= 10;
+    } while (nAbs > 0);
+    if (nNum < 0) *--p = '-';
+
+    return writerPut(pWriter, p, szBuf + sizeof(szBuf) - p);
+}
+
+/**
+ * Write date in RFC 1123 format such like "Sun, 06 Nov 1994 08:49:37 GMT".
+ */
+bool writerPutHttpDate(struct Writer *pWriter, time_t nTime)
+{
+    struct tm *pTm = _getGmtime(nTime);
+    if (pTm == NULL) return false;
+
+    char szBuf[CONST_STRLEN("Sun, 06 Nov 1994 08:49:37 GMT")];
+    char *p = szBuf;
+    memcpy(p, m_aszDays[pTm->tm_wday], 3); p += 3;
+    *p++ = ','; *p++ = ' ';
+    p = _putDigits(p, pTm->tm_mday, 2); *p++ = ' ';
+    memcpy(p, m_aszMonths[pTm->tm_mon], 3); p += 3;
+    *p++ = ' ';
+    p = _putDigits(p, pTm->tm_year + 1900, 4); *p++ = ' ';
+    p = _putDigits(p, pTm->tm_hour, 2); *p++ = ':';
+    p = _putDigits(p, pTm->tm_min, 2); *p++ = ':';
+    p = _putDigits(p, pTm->tm_sec, 2);
+    memcpy(p, " GMT", 4); p += 4;
+
+    return writerPut(pWriter, szBuf, p - szBuf);
+}
+
+/**
+ * Write date in ISO 8601 format such like "1994-11-06T08:49:37Z".
+ */
+bool writerPutIsoDate(struct Writer *pWriter, time_t nTime)
+{
+    struct tm *pTm = _getGmtime(nTime);
+    if (pTm == NULL) return false;
+
+    char szBuf[CONST_STRLEN("1994-11-06T08:49:37Z")];
+    char *p = szBuf;
+    p = _putDigits(p, pTm->tm_year + 1900, 4); *p++ = '-';
+    p = _putDigits(p, pTm->tm_mon + 1, 2); *p++ = '-';
+    p = _putDigits(p, pTm->tm_mday, 2); *p++ = 'T';
+    p = _putDigits(p, pTm->tm_hour, 2); *p++ = ':';
+    p = _putDigits(p, pTm->tm_min, 2); *p++ = ':';
+    p = _putDigits(p, pTm->tm_sec, 2); *p++ = 'Z';
+
+    return writerPut(pWriter, szBuf, p - szBuf);
+}
+
+/**
+ * Write URL encoded string in the same way as qurl_encode().
+ */
+bool writerPutUrl(struct Writer *pWriter, const char *pszStr)
+{
+    static const char szHex[] = "0123456789abcdef";
+
+    const char *pszStart = pszStr;
+    for (; *pszStr != '\0'; pszStr++) {
+        unsigned char c = *pszStr;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+            || strchr("-./:@\\_", c) != NULL) continue;
+
+        // flush plain characters so far
+        if (pszStr > pszStart && writerPut(pWriter, pszStart, pszStr - pszStart) == false) return false;
+
+        char szEnc[3] = { '%', szHex[c >> 4], szHex[c & 0x0F] };
+        if (writerPut(pWriter, szEnc, sizeof(szEnc)) == false) return false;
+        pszStart = pszStr + 1;
+    }
+
+    if (pszStr > pszStart) return writerPut(pWriter, pszStart, pszStr - pszStart);
+    return true;
+}
+
+/**
+ * Write string escaped for HTML text and attribute values.
+ */
+bool writerPutHtml(struct Writer *pWriter, const char *pszStr)
+{
+    const char *pszStart = pszStr;
+    for (; *pszStr != '\0'; pszStr++) {
+        const char *pszEnt;
+        switch (*pszStr) {
+            case '&'  : pszEnt = "&amp;"; break;
+            case '<'  : pszEnt = "&lt;"; break;
+            case '>'  : pszEnt = "&gt;"; break;
+            case '"'  : pszEnt = "&quot;"; break;
+            case '\'' : pszEnt = "&#39;"; break;
+            default   : continue;
+        }
+
+        if (pszStr > pszStart && writerPut(pWriter, pszStart, pszStr - pszStart) == false) return false;
+        if (writerPuts(pWriter, pszEnt) == false) return false;
+        pszStart = pszStr + 1;
+    }
+
+    if (pszStr > pszStart) return writerPut(pWriter, pszStart, pszStr - pszStart);
+    return true;
+}
+
+/**
+ * Write string escaped for JSON string, without quotes.
+ */
+bool writerPutJson(struct Writer *pWriter, const char *pszStr)
+{
+    static const char szHex[] = "0123456789abcdef";
+
+    const char *pszStart = pszStr;
+    for (; *pszStr != '\0'; pszStr++) {
+        unsigned char c = *pszStr;
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        if (pszStr > pszStart && writerPut(pWriter, pszStart, pszStr - pszStart) == false) return false;
+        if (c == '"' || c == '\\') {
+            char szEsc[2] = { '\\', c };
+            if (writerPut(pWriter, szEsc, sizeof(szEsc)) == false) return false;
+        } else {
+            char szEsc[6] = { '\\', 'u', '0', '0', szHex[c >> 4], szHex[c & 0x0F] };
+            if (writerPut(pWriter, szEsc, sizeof(szEsc)) == false) return false;
+        }
+        pszStart = pszStr + 1;
+    }
+
+    if (pszStr > pszStart) return writerPut(pWriter, pszStart, pszStr - pszStart);
+    return true;
+}
+
+/**
+ * Output function which sends data as a chunk of the response.
+ *
+ * @param pArg  struct HttpResponse
+ */
+bool writerChunkOut(void *pArg, const void *pData, size_t nSize)
+{
+    DEBUG("[TX-CHUNK] %.*s", (int)nSize, (const char *)pData);
+    return httpResponseOutChunk((struct HttpResponse *)pArg, pData, nSize);
+}
+
+/**
+ * Output function which writes data into a file.
+ *
+ * @param pArg  pointer to the file descriptor
+ */
+bool writerFileOut(void *pArg, const void *pData, size_t nSize)
+{
+    int nFd = *(int *)pArg;
+    while (nSize > 0) {
+        ssize_t nWritten = write(nFd, pData, nSize);
+        if (nWritten < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        pData = (const char *)pData + nWritten;
+        nSize -= nWritten;
+    }
+    return true;
+}
+
+/**
+ * Output function which appends data to a vector.
+ *
+ * @param pArg  qvector_t
+ */
+bool writerVectorOut(void *pArg, const void *pData, size_t nSize)
+{
+    qvector_t *vector = (qvector_t *)pArg;
+    return vector->add(vector, pData, nSize);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTIONS
+/////////////////////////////////////////////////////////////////////////
+
+/*
+ * gmtime() of the last time is kept, since generated documents tend to
+ * print the same time over and over.
+ */
+static struct tm *_getGmtime(time_t nTime)
+{
+    static time_t nLastTime = -1;
+    static struct tm lastTm;
+
+    if (nTime != nLastTime) {
+        if (gmtime_r(&nTime, &lastTm) == NULL) {
+            nLastTime = -1;
+            return NULL;
+        }
+        nLastTime = nTime;
+    }
+    return &lastTm;
+}
+
+static char *_putDigits(char *pszBuf, int nNum, int nDigits)
+{
+    int i;
+    for (i = nDigits - 1; i >= 0; i--) {
+        pszBuf[i] = '0' + (nNum % 10);
+        nNum /= 10;
+    }
+    return pszBuf + nDigits;
+}